@@ -2706,8 +2706,11 @@ true. If the end of the buffer is reached, false is returned.
 */
 inline bool json::parser::next()
 {
+    // at the end, clear current_ so that it cannot be taken for the start of
+    // another value (an unterminated "[[" would otherwise recurse forever)
     if (pos_ == buffer_.size())
     {
+        current_ = '\0';
         return false;
     }
 
@@ -2718,6 +2721,7 @@ inline bool json::parser::next()
     {
         if (pos_ == buffer_.size())
         {
+            current_ = '\0';
             return false;
         }
 
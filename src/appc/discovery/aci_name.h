@@ -17,7 +17,11 @@
 
 #pragma once
 
+#include <vector>
+
+#include "appc/discovery/types.h"
 #include "appc/util/namespace.h"
+#include "appc/util/status.h"
 #include "appc/util/try.h"
 
 
@@ -25,15 +29,72 @@ namespace appc {
 namespace discovery {
 
 
+// As render_aci_name, appending to out (so that a batch can render into one buffer).
+inline Status append_aci_name(std::string& out, const Name& name, const Labels& labels) {
+  const auto not_found = labels.end();
+  const auto version = labels.find("version");
+  if (version == not_found) return Error("version label required");
+  const auto os = labels.find("os");
+  if (os == not_found) return Error("os label required");
+  const auto arch = labels.find("arch");
+  if (arch == not_found) return Error("arch label required");
+  out.reserve(out.length() + name.length() + version->second.length() + os->second.length() +
+              arch->second.length() + 3 + aci_ext.length());
+  out.append(name).append(1, '-').append(version->second).append(1, '-').append(os->second)
+     .append(1, '-').append(arch->second).append(aci_ext);
+  return Success();
+}
+
+
 // Given a name and labels, returns the canonical "common" name for an image.
 // Experimental.
 inline Try<std::string> render_aci_name(const Name& name, const Labels& labels) {
-  auto not_found = labels.end();
-  if (labels.find("version") == not_found) return Failure<std::string>("version label required");
-  if (labels.find("os") == not_found) return Failure<std::string>("os label required");
-  if (labels.find("arch") == not_found) return Failure<std::string>("arch label required");
-  return Result(ns::join("-", name, labels.at("version"), labels.at("os"), labels.at("arch"))
-                + aci_ext);
+  std::string aci_name{};
+  const auto rendered = append_aci_name(aci_name, name, labels);
+  if (!rendered) return Failure<std::string>(rendered.message);
+  return Result(aci_name);
+}
+
+
+// prefix + the rendered name of each reference, results in input order.
+inline std::vector<Try<URI>> render_aci_uris(const URI& prefix,
+                                             const std::vector<ImageReference>& references) {
+  std::vector<Try<URI>> uris{};
+  uris.reserve(references.size());
+  URI uri{prefix};
+  for (const auto& reference : references) {
+    uri.resize(prefix.length());
+    const auto rendered = append_aci_name(uri, reference.name, reference.labels);
+    uris.push_back(rendered ? Result(uri) : Failure<URI>(rendered.message));
+  }
+  return uris;
+}
+
+
+struct ACIName {
+  Name name;
+  Labels labels;
+};
+
+
+// The inverse of render_aci_name. os and arch may not contain dashes, and neither may the version
+// (the name may).
+inline Try<ACIName> parse_aci_name(const std::string& aci_name) {
+  if (aci_name.length() <= aci_ext.length() ||
+      aci_name.compare(aci_name.length() - aci_ext.length(), aci_ext.length(), aci_ext) != 0) {
+    return Failure<ACIName>(aci_name + " does not end in " + aci_ext);
+  }
+  std::string rest = aci_name.substr(0, aci_name.length() - aci_ext.length());
+  std::string parts[3];
+  for (int i = 2; i >= 0; i--) {
+    const auto dash = rest.rfind('-');
+    if (dash == std::string::npos || dash == 0 || dash + 1 == rest.length()) {
+      return Failure<ACIName>(aci_name + " is not <name>-<version>-<os>-<arch>" + aci_ext);
+    }
+    parts[i] = rest.substr(dash + 1);
+    rest = rest.substr(0, dash);
+  }
+  return Result(ACIName{rest, Labels{{"version", parts[0]}, {"os", parts[1]}, {"arch", parts[2]}}});
 }
 
 
@@ -0,0 +1,110 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+
+#pragma once
+
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <curl/curl.h>
+
+#include "appc/discovery/types.h"
+#include "appc/util/log.h"
+#include "appc/util/try.h"
+
+
+// The libcurl setup under https.h, for code that drives curl itself. Linked against libappc, only
+// this header brings in curl.
+
+
+namespace appc {
+namespace discovery {
+namespace https {
+
+
+using CurlHandle = std::unique_ptr<CURL, decltype(&curl_easy_cleanup)>;
+
+
+// Once per process, however many translation units include this: an inline function's static is
+// shared by all of them. curl_global_cleanup(), when?
+inline void global_init() {
+  static std::once_flag initialized{};
+  std::call_once(initialized, []() {
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+  });
+}
+
+
+// -1 when unknown.
+inline int64_t content_length(CURL* curl) {
+#if LIBCURL_VERSION_NUM >= 0x073700
+  curl_off_t length = -1;
+  if (curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length) != CURLE_OK) return -1;
+  return length;
+#else
+  double length = -1;
+  if (curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &length) != CURLE_OK) return -1;
+  return static_cast<int64_t>(length);
+#endif
+}
+
+
+inline size_t string_writer(void* buffer, size_t size, size_t nmemb, void* stream) {
+  static_cast<std::string*>(stream)->append(static_cast<char*>(buffer), size * nmemb);
+  return size * nmemb;
+}
+
+
+inline Try<CurlHandle> new_handle(const URI& remote_uri, char* error_buffer) {
+  global_init();
+
+  CurlHandle curl{curl_easy_init(), curl_easy_cleanup};
+
+  if (!curl) return Failure<CurlHandle>("Could not initialize curl.");
+
+  // FIXME Temporary
+  //curl_easy_setopt(curl.get(), CURLOPT_VERBOSE, 1L);
+  curl_easy_setopt(curl.get(), CURLOPT_URL, remote_uri.c_str());
+  curl_easy_setopt(curl.get(), CURLOPT_FAILONERROR, 1L);
+
+  error_buffer[0] = '\0';
+  curl_easy_setopt(curl.get(), CURLOPT_ERRORBUFFER, error_buffer);
+
+// FIXME plumb this through, cleanup.
+#ifndef __APPLE__
+  const char* pinned_pub_key = getenv("APPC_PINNED_KEY");
+  if (pinned_pub_key != NULL) {
+    APPC_LOG(debug, "https", std::string("Pinning certificate to ") + pinned_pub_key);
+    if (curl_easy_setopt(curl.get(), CURLOPT_PINNEDPUBLICKEY, pinned_pub_key) != CURLE_OK) {
+      return Failure<CurlHandle>("Could not pin certificate to APPC_PINNED_KEY");
+    }
+    curl_easy_setopt(curl.get(), CURLOPT_SSL_VERIFYPEER, 0L);
+  }
+#endif
+  // Trust the certificates in this PEM file instead of the system's.
+  const char* ca_file = getenv("APPC_CA_FILE");
+  if (ca_file != NULL) curl_easy_setopt(curl.get(), CURLOPT_CAINFO, ca_file);
+
+  return Try<CurlHandle>(std::make_shared<CurlHandle>(std::move(curl)), "");
+}
+
+
+} // namespace https
+} // namespace discovery
+} // namespace appc
@@ -0,0 +1,584 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/mman.h>
+
+#include "appc/discovery/types.h"
+#include "appc/discovery/verify.h"
+#include "appc/os/staged_file.h"
+#include "appc/util/status.h"
+#include "appc/util/try.h"
+
+
+namespace appc {
+namespace discovery {
+namespace delta {
+
+
+// Binary deltas between two versions of an ACI. A delta rebuilds the new image's tar from the
+// previous image's tar as a sequence of copies out of the old tar and literal inserts:
+//
+//   "ACIDELTA" version(2)
+//   varint base size, varint target size (uncompressed)
+//   varint length + base image ID, varint length + target image ID
+//   ops: 0x01 varint offset varint length (copy from base)
+//        0x02 varint length bytes         (insert)
+//        0x00                             (end)
+//
+// Deltas are taken between the uncompressed tars, which is what an ImageID covers, so a new
+// version that shares most of its files with the last one shares most of its delta input whatever
+// the images are compressed with. The rebuilt image is stored as an uncompressed tar, verified
+// against the target image ID as it is written.
+//
+// Matching is rsync-style: the base is indexed by a rolling checksum of each aligned block and the
+// target is scanned a byte at a time, extending each match in both directions. The target is
+// streamed through the matcher; only the base needs random access.
+
+
+const std::string magic{"ACIDELTA"};
+const uint8_t format_version = 2;
+const size_t default_block_size = 4096;
+// The largest image a delta may build when the expectation does not bound it more tightly.
+const uint64_t default_max_target_size = 16ull << 30;
+
+enum Op : uint8_t { op_end = 0x00, op_copy = 0x01, op_insert = 0x02 };
+
+
+inline void put_varint(std::string& out, uint64_t value) {
+  while (value >= 0x80) {
+    out += static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  out += static_cast<char>(value);
+}
+
+
+struct Header {
+  uint64_t base_size;
+  uint64_t target_size;
+  ImageID base_id;
+  ImageID target_id;
+};
+
+
+// An image's tar, decompressed, and its image ID.
+struct Tar {
+  std::string bytes;
+  ImageID id;
+};
+
+
+// Decompresses an image held in memory (gzip, bzip2, xz or none).
+inline Try<Tar> untar_image(const std::string& image) {
+  std::string bytes{};
+  ImageVerifier verifier{};
+  verifier.set_output([&bytes](const unsigned char* data, const size_t size) {
+    bytes.append(reinterpret_cast<const char*>(data), size);
+    return Success();
+  });
+  const auto fed = verifier.update(image.data(), image.length());
+  if (!fed) return Failure<Tar>(fed.message);
+  const auto id = verifier.image_id();
+  if (!id) return Failure<Tar>(id.failure_reason());
+  return Result(Tar{bytes, *id});
+}
+
+
+// Rolling checksum of a window, as in rsync: a is the byte sum, b the sum of the running a's.
+class RollingChecksum {
+private:
+  uint32_t a{0};
+  uint32_t b{0};
+  size_t length{0};
+
+public:
+  void reset(const unsigned char* data, const size_t window) {
+    a = b = 0;
+    length = window;
+    for (size_t i = 0; i < window; i++) {
+      a += data[i];
+      b += (window - i) * data[i];
+    }
+  }
+
+  void roll(const unsigned char out, const unsigned char in) {
+    a += in - out;
+    b += a - length * out;
+  }
+
+  uint32_t value() const {
+    return (a & 0xffff) | (b << 16);
+  }
+};
+
+
+// Read-only private mapping of a file, for random access to one too large to hold in memory.
+class Mapping {
+private:
+  void* address;
+  const size_t length;
+
+public:
+  Mapping(const int fd, const size_t length)
+  : address(length == 0 ? nullptr : mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0)),
+    length(length) {}
+
+  Mapping(const Mapping&) = delete;
+  Mapping& operator=(const Mapping&) = delete;
+
+  ~Mapping() {
+    if (address != nullptr && address != MAP_FAILED) munmap(address, length);
+  }
+
+  explicit operator bool() const {
+    return address != MAP_FAILED;
+  }
+
+  const unsigned char* data() const {
+    return static_cast<const unsigned char*>(address);
+  }
+
+  size_t size() const {
+    return length;
+  }
+};
+
+
+inline std::string header_bytes(const uint64_t base_size,
+                                const uint64_t target_size,
+                                const ImageID& base_id,
+                                const ImageID& target_id) {
+  std::string header{magic};
+  header += static_cast<char>(format_version);
+  put_varint(header, base_size);
+  put_varint(header, target_size);
+  put_varint(header, base_id.value.length());
+  header += base_id.value;
+  put_varint(header, target_id.value.length());
+  header += target_id.value;
+  return header;
+}
+
+
+// Encodes the ops rebuilding a target, fed in pieces, from a base held in memory (or mapped). Only
+// a window of the target is kept: the literal not yet written out, bounded by max_literal, and the
+// bytes not yet scanned. Ops are handed to the sink in batches of about max_output bytes.
+class Encoder {
+public:
+  using Sink = std::function<Status(const std::string& ops)>;
+
+private:
+  static const size_t max_literal = 1 << 20;
+  static const size_t max_output = 1 << 20;
+
+  const unsigned char* const base;
+  const size_t base_length;
+  const size_t block_size;
+  const Sink sink;
+  std::unordered_map<uint32_t, std::vector<size_t>> index{};
+  RollingChecksum checksum{};
+  bool rolling{false};
+
+  // pending[literal, pos) can no longer start a match; pending[pos, end) is yet to be scanned.
+  std::string pending{};
+  size_t literal{0};
+  size_t pos{0};
+
+  // A match still being extended as the target arrives.
+  bool matching{false};
+  size_t match_base{0};
+  size_t match_length{0};
+
+  std::string out{};
+
+  void insert(const size_t end) {
+    if (end <= literal) return;
+    out += static_cast<char>(op_insert);
+    put_varint(out, end - literal);
+    out.append(pending, literal, end - literal);
+    literal = end;
+  }
+
+  void copy() {
+    out += static_cast<char>(op_copy);
+    put_varint(out, match_base);
+    put_varint(out, match_length);
+  }
+
+  // Encodes what can be without seeing further into the target: all of it when final.
+  void encode(const bool final) {
+    for (;;) {
+      if (matching) {
+        while (literal < pending.length() && match_base + match_length < base_length &&
+               base[match_base + match_length] == static_cast<unsigned char>(pending[literal])) {
+          match_length++;
+          literal++;
+        }
+        if (!final && literal == pending.length() && match_base + match_length < base_length) {
+          break;
+        }
+        copy();
+        matching = false;
+        rolling = false;
+        pos = literal;
+        continue;
+      }
+      if (index.empty() || pos + block_size > pending.length()) break;
+      const unsigned char* bytes = reinterpret_cast<const unsigned char*>(pending.data());
+      if (!rolling) {
+        checksum.reset(bytes + pos, block_size);
+        rolling = true;
+      }
+      const auto candidates = index.find(checksum.value());
+      if (candidates != index.end()) {
+        for (const size_t offset : candidates->second) {
+          if (std::memcmp(base + offset, bytes + pos, block_size) != 0) continue;
+          size_t start = pos;
+          match_base = offset;
+          while (start > literal && match_base > 0 && base[match_base - 1] == bytes[start - 1]) {
+            match_base--;
+            start--;
+          }
+          insert(start);
+          match_length = pos + block_size - start;
+          literal = pos + block_size;
+          matching = true;
+          break;
+        }
+        if (matching) continue;
+      }
+      if (pos + block_size >= pending.length()) break;
+      checksum.roll(bytes[pos], bytes[pos + block_size]);
+      pos++;
+    }
+    if (final) {
+      insert(pending.length());
+    } else if (!matching && pos - literal > max_literal) {
+      insert(pos);
+    }
+    // Dropped once it is at least half the window, so each byte is moved a bounded number of times.
+    if (literal > 0 && literal * 2 >= pending.length()) {
+      pending.erase(0, literal);
+      pos -= literal;
+      literal = 0;
+    }
+  }
+
+  Status drain(const bool final) {
+    if (out.empty() || (!final && out.length() < max_output)) return Success();
+    const auto sunk = sink(out);
+    out.clear();
+    return sunk;
+  }
+
+public:
+  Encoder(const unsigned char* base,
+          const size_t base_length,
+          const size_t block_size,
+          const Sink& sink)
+  : base(base),
+    base_length(base_length),
+    block_size(block_size),
+    sink(sink) {
+    RollingChecksum block{};
+    for (size_t offset = 0; offset + block_size <= base_length; offset += block_size) {
+      block.reset(base + offset, block_size);
+      auto& offsets = index[block.value()];
+      // Long runs of identical blocks (zero padding) need not all be remembered.
+      if (offsets.size() < 8) offsets.push_back(offset);
+    }
+  }
+
+  Status update(const void* data, const size_t size) {
+    pending.append(static_cast<const char*>(data), size);
+    encode(false);
+    return drain(false);
+  }
+
+  Status finish() {
+    encode(true);
+    out += static_cast<char>(op_end);
+    return drain(true);
+  }
+};
+
+
+// The delta from the base tar to the target tar.
+inline std::string create_from_tars(const Tar& base_tar,
+                                    const Tar& target_tar,
+                                    const size_t block_size = default_block_size) {
+  const std::string& base = base_tar.bytes;
+  const std::string& target = target_tar.bytes;
+  std::string patch = header_bytes(base.length(), target.length(), base_tar.id, target_tar.id);
+  Encoder encoder{reinterpret_cast<const unsigned char*>(base.data()),
+                  base.length(),
+                  block_size,
+                  [&patch](const std::string& ops) {
+                    patch += ops;
+                    return Success();
+                  }};
+  encoder.update(target.data(), target.length());
+  encoder.finish();
+  return patch;
+}
+
+
+// The delta from one image to another, both as stored (compressed or not).
+inline Try<std::string> create(const std::string& base,
+                               const std::string& target,
+                               const size_t block_size = default_block_size) {
+  const auto base_tar = untar_image(base);
+  if (!base_tar) return Failure<std::string>("Base image: " + base_tar.failure_reason());
+  const auto target_tar = untar_image(target);
+  if (!target_tar) return Failure<std::string>("Target image: " + target_tar.failure_reason());
+  return Result(create_from_tars(*base_tar, *target_tar, block_size));
+}
+
+
+// Writes the delta from base_path to target_path (both as stored) to delta_path, without holding
+// either image in memory: the base is decompressed to an anonymous scratch file and mapped, and
+// the target is read twice, once for the ID and size that head the delta and once to encode it.
+inline Status create_file(const Path& base_path,
+                          const Path& target_path,
+                          const Path& delta_path,
+                          const size_t block_size = default_block_size) {
+  uint64_t target_size = 0;
+  ImageVerifier target_scan{};
+  target_scan.set_output([&target_size](const unsigned char*, const size_t size) {
+    target_size += size;
+    return Success();
+  });
+  const auto target_scanned = feed_file(target_path, target_scan);
+  if (!target_scanned) return Error("Target image: " + target_scanned.message);
+  const auto target_id = target_scan.image_id();
+  if (!target_id) return Error("Target image: " + target_id.failure_reason());
+
+  // Never committed, so it leaves nothing behind.
+  os::StagedFile base{delta_path + ".base"};
+  const auto base_opened = base.open();
+  if (!base_opened) return base_opened;
+  ImageVerifier base_verifier{};
+  base_verifier.set_output([&base](const unsigned char* data, const size_t size) {
+    return base.write(data, size);
+  });
+  const auto base_fed = feed_file(base_path, base_verifier);
+  if (!base_fed) return Error("Base image: " + base_fed.message);
+  const auto base_id = base_verifier.image_id();
+  if (!base_id) return Error("Base image: " + base_id.failure_reason());
+  const int base_fd = base.descriptor();
+  if (base_fd < 0) return Error("Could not write decompressed base image for " + delta_path);
+  const Mapping mapped{base_fd, static_cast<size_t>(base.size())};
+  if (!mapped) {
+    return Error("Could not map decompressed base image: " + std::string(strerror(errno)));
+  }
+
+  os::StagedFile out{delta_path};
+  const auto opened = out.open();
+  if (!opened) return opened;
+  const std::string header = header_bytes(mapped.size(), target_size, *base_id, *target_id);
+  const auto headed = out.write(header.data(), header.length());
+  if (!headed) return headed;
+
+  Encoder encoder{mapped.data(), mapped.size(), block_size, [&out](const std::string& ops) {
+                    return out.write(ops.data(), ops.length());
+                  }};
+  // Held to the first pass, in case the target changed in between.
+  ImageVerifier target_verifier{Expectation(*target_id, target_size)};
+  target_verifier.set_output([&encoder](const unsigned char* data, const size_t size) {
+    return encoder.update(data, size);
+  });
+  const auto target_fed = feed_file(target_path, target_verifier);
+  const auto target_verified = target_fed ? target_verifier.finish() : target_fed;
+  if (!target_verified) return Error("Target image: " + target_verified.message);
+  const auto encoded = encoder.finish();
+  if (!encoded) return encoded;
+  return out.commit();
+}
+
+
+// Buffered sequential reader over a delta file.
+class Reader {
+private:
+  std::unique_ptr<FILE, decltype(&fclose)> file;
+
+public:
+  explicit Reader(const Path& path)
+  : file(fopen(path.c_str(), "rb"), fclose) {}
+
+  operator bool() const {
+    return static_cast<bool>(file);
+  }
+
+  bool read(void* out, const size_t length) {
+    return fread(out, 1, length, file.get()) == length;
+  }
+
+  bool varint(uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      const int c = fgetc(file.get());
+      if (c == EOF) return false;
+      value |= static_cast<uint64_t>(c & 0x7f) << shift;
+      if (!(c & 0x80)) return true;
+    }
+    return false;
+  }
+
+  bool image_id(std::string& id) {
+    uint64_t length;
+    if (!varint(length) || length > 1024) return false;
+    id.assign(length, '\0');
+    return read(&id[0], length);
+  }
+
+  Try<Header> header() {
+    std::string read_magic(magic.length(), '\0');
+    uint8_t version = 0;
+    if (!read(&read_magic[0], magic.length()) || read_magic != magic) {
+      return Failure<Header>("Not an ACI delta");
+    }
+    if (!read(&version, 1) || version != format_version) {
+      return Failure<Header>("Unsupported ACI delta version " + std::to_string(version));
+    }
+    uint64_t base_size, target_size;
+    std::string base_id, target_id;
+    if (!varint(base_size) || !varint(target_size) || !image_id(base_id) || !image_id(target_id)) {
+      return Failure<Header>("Truncated ACI delta header");
+    }
+    return Result(Header{base_size, target_size, ImageID(base_id), ImageID(target_id)});
+  }
+};
+
+
+// Rebuilds target_path, as an uncompressed tar, from base_path (compressed or not) and the delta.
+// The base is decompressed to an anonymous scratch file and must be the image the delta was made
+// from. The rebuilt image is verified against the expected image ID if given, otherwise against
+// the ID recorded in the delta. A delta recorded for a different image, or for one larger than
+// max_target_size or the expected max_size, is rejected before anything is written.
+inline Status apply(const Path& base_path,
+                    const Path& delta_path,
+                    const Path& target_path,
+                    const Option<Expectation>& expected = None<Expectation>(),
+                    const uint64_t max_target_size = default_max_target_size) {
+  Reader reader{delta_path};
+  if (!reader) return Error("Could not open delta " + delta_path);
+  const auto header = reader.header();
+  if (!header) return Error(header.failure_reason());
+
+  const Expectation expectation = expected ? *expected : Expectation(header->target_id);
+  if (expected) {
+    const std::string& want = expected->image_id.value;
+    const std::string& have = header->target_id.value;
+    const size_t common = std::min(want.length(), have.length());
+    if (want.compare(0, common, have, 0, common) != 0) {
+      return Error("Delta builds " + have + ", expected " + want);
+    }
+  }
+  // The size comes from the delta, and is preallocated below.
+  const uint64_t max_size = expected && expected->max_size > 0
+                                ? std::min(expected->max_size, max_target_size)
+                                : max_target_size;
+  if (header->target_size > max_size) {
+    return Error("Delta builds " + std::to_string(header->target_size) + " bytes, more than the " +
+                 std::to_string(max_size) + " allowed");
+  }
+  ImageVerifier verifier{expectation};
+  const auto supported = verifier.supported();
+  if (!supported) return supported;
+
+  // Never committed, so it leaves nothing behind.
+  os::StagedFile base{target_path + ".base"};
+  const auto base_opened = base.open();
+  if (!base_opened) return base_opened;
+  ImageVerifier base_verifier{Expectation(header->base_id, header->base_size)};
+  base_verifier.set_output([&base](const unsigned char* data, const size_t size) {
+    return base.write(data, size);
+  });
+  const auto base_fed = feed_file(base_path, base_verifier);
+  const auto base_verified = base_fed ? base_verifier.finish() : base_fed;
+  if (!base_verified || base.size() != header->base_size) {
+    return Error("Base image " + base_path + " is not the one this delta was made from" +
+                 (base_verified ? "" : ": " + base_verified.message));
+  }
+
+  os::StagedFile out{target_path};
+  const auto opened = out.open();
+  if (!opened) return opened;
+  const auto preallocated = out.preallocate(header->target_size);
+  if (!preallocated) return preallocated;
+
+  const size_t buffer_size = 1 << 20;
+  std::unique_ptr<char[]> buffer{new char[buffer_size]};
+  const auto emit = [&](const char* data, const size_t length) -> Status {
+    const auto verified = verifier.update(data, length);
+    if (!verified) return verified;
+    return out.write(data, length);
+  };
+
+  uint64_t written = 0;
+  for (;;) {
+    uint8_t op;
+    if (!reader.read(&op, 1)) return Error("Truncated ACI delta");
+    if (op == op_end) break;
+    uint64_t offset = 0, length = 0;
+    if (op == op_copy) {
+      if (!reader.varint(offset) || !reader.varint(length)) return Error("Truncated ACI delta");
+      if (offset > header->base_size || length > header->base_size - offset) {
+        return Error("ACI delta copies past end of base");
+      }
+    } else if (op == op_insert) {
+      if (!reader.varint(length)) return Error("Truncated ACI delta");
+    } else {
+      return Error("Unknown ACI delta operation " + std::to_string(op));
+    }
+    if (length > header->target_size - written) return Error("ACI delta exceeds target size");
+    while (length > 0) {
+      const size_t chunk = std::min<uint64_t>(length, buffer_size);
+      if (op == op_copy) {
+        if (base.read_at(buffer.get(), chunk, offset) != static_cast<ssize_t>(chunk)) {
+          return Error("Could not read decompressed base image " + base_path);
+        }
+        offset += chunk;
+      } else if (!reader.read(buffer.get(), chunk)) {
+        return Error("Truncated ACI delta");
+      }
+      const auto emitted = emit(buffer.get(), chunk);
+      if (!emitted) return emitted;
+      length -= chunk;
+      written += chunk;
+    }
+  }
+  if (written != header->target_size) return Error("ACI delta ended before target was complete");
+  const auto verified = verifier.finish();
+  if (!verified) return verified;
+  return out.commit();
+}
+
+
+} // namespace delta
+} // namespace discovery
+} // namespace appc
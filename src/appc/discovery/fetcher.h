@@ -17,8 +17,12 @@
 
 #pragma once
 
+#include <vector>
+
 #include "appc/discovery/types.h"
+#include "appc/discovery/verify.h"
 #include "appc/util/namespace.h"
+#include "appc/util/option.h"
 #include "appc/util/try.h"
 
 
@@ -28,22 +32,46 @@ namespace discovery {
 
 // A Fetcher takes a possibly remote URI (generally produced from a resolver), performs some action
 // to retrieve it and store it, and returns a URI to the local location of the image (on disk).
-class AbstractFetcher {
+//
+// Given an Expectation, a fetcher must also check that what it stored is the expected image. The
+// default checks the stored file afterward; fetchers that transfer the image should override it to
+// verify while the bytes are streaming in.
+//
+// As with Resolver, one instance serves every thread using a provider and all of its methods must
+// be safe to call concurrently. Concurrent fetches of the same URI are not coalesced (that is what
+// mirror::MirrorCache is for), each stores a complete image.
+class Fetcher {
 public:
-  virtual ~AbstractFetcher() {}
+  virtual ~Fetcher() {}
   virtual Try<URI> fetch(const URI& uri) = 0;
-};
 
+  virtual Try<URI> fetch(const URI& uri, const Expectation& expected) {
+    auto fetched = fetch(uri);
+    if (!fetched) return fetched;
+    const auto verified = verify_file(uri_file_path(from_result(fetched)), expected);
+    if (!verified) return Failure<URI>(verified.message);
+    return fetched;
+  }
 
-class Fetcher : public AbstractFetcher {
-private:
-  const std::shared_ptr<AbstractFetcher> impl;
-public:
-  Fetcher(AbstractFetcher* impl)
-  : impl(impl) {}
-  virtual ~Fetcher() {}
-  virtual Try<URI> fetch(const URI& uri) {
-    return impl->fetch(uri);
+  // Fetches each URI, results in input order. Fetchers that can share work across a batch should
+  // override this.
+  virtual std::vector<Try<URI>> fetch_all(const std::vector<URI>& uris) {
+    std::vector<Try<URI>> fetched{};
+    fetched.reserve(uris.size());
+    for (const auto& uri : uris) fetched.push_back(fetch(uri));
+    return fetched;
+  }
+
+  // The first of uris (alternatives, in order of preference) that can be fetched, verified against
+  // expected if given. The default tries them one at a time and stops at the first success.
+  virtual Try<URI> fetch_first(const std::vector<URI>& uris, const Option<Expectation>& expected) {
+    std::string reasons{};
+    for (const auto& uri : uris) {
+      auto fetched = expected ? fetch(uri, *expected) : fetch(uri);
+      if (fetched) return fetched;
+      reasons += (reasons.empty() ? "" : "; ") + fetched.failure_reason();
+    }
+    return Failure<URI>(uris.empty() ? "Nothing to fetch" : reasons);
   }
 };
 
@@ -15,17 +15,21 @@
 // A (possibly updated) copy of of this software is available at
 // https://github.com/cdaylward/libappc
 
+
 #pragma once
 
-#include <fstream>
-#include <mutex>
-#include <cstdio>
-#include <curl/curl.h>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
 
-#include "3rdparty/cdaylward/pathname.h"
 #include "appc/discovery/types.h"
-#include "appc/os/mkdir.h"
+#include "appc/discovery/verify.h"
+#include "appc/os/staged_file.h"
+#include "appc/util/linkage.h"
 #include "appc/util/status.h"
+#include "appc/util/try.h"
 
 
 namespace appc {
@@ -33,75 +37,77 @@ namespace discovery {
 namespace https {
 
 
-static std::once_flag curl_initialized;
+// Where a failed get() went wrong.
+enum class Fault {
+  none,
+  // The connection, TLS, or an HTTP error status: the remote's failure.
+  transfer,
+  // A check rejected the bytes that arrived.
+  content,
+  // This host: the image's directory, or staging and publishing the file.
+  local
+};
+
+
+// Each check sees the bytes as they are written. The image is only published at write_filename
+// once the transfer and every check have succeeded; otherwise nothing is left behind. A caller
+// that passes fault learns where a failure came from.
+Status get(const URI& remote_uri,
+           const Path& write_filename,
+           const std::vector<StreamCheck*>& checks = {},
+           const appc::os::StagedFile::Options& options = appc::os::StagedFile::Options(),
+           Fault* fault = nullptr);
 
 
-struct WriteHandle {
-  const char* filename;
-  FILE* fileptr;
+struct Download {
+  URI uri;
+  Path write_filename;
+  std::vector<StreamCheck*> checks;
 };
 
 
-static size_t writer(void* buffer, size_t size, size_t nmemb, void* stream) {
-  WriteHandle* handle = static_cast<WriteHandle*>(stream);
-  if (handle && !handle->fileptr) {
-    handle->fileptr = fopen(handle->filename, "wb");
-  }
-  if (!handle->fileptr) return -1;
-  return fwrite(buffer, size, nmemb, handle->fileptr);
-}
-
-
-inline Status get(const URI& remote_uri, const Path& write_filename) {
-  const auto made_image_dir = appc::os::mkdir(pathname::dir(write_filename), 0755, true);
-  if (!made_image_dir) {
-    return Error(std::string{"Could not create directory for image: "} + made_image_dir.message);
-  }
-
-  std::call_once(curl_initialized, []() {
-    curl_global_init(CURL_GLOBAL_DEFAULT);
-  });
-  // curl_global_cleanup(), when?
-
-  std::unique_ptr<CURL, decltype(&curl_easy_cleanup)> curl{curl_easy_init(), curl_easy_cleanup};
-
-  if (!curl) return Error("Could not initialize curl.");
-
-  // FIXME Temporary
-  //curl_easy_setopt(curl.get(), CURLOPT_VERBOSE, 1L);
-  curl_easy_setopt(curl.get(), CURLOPT_URL, remote_uri.c_str());
-  curl_easy_setopt(curl.get(), CURLOPT_FAILONERROR, 1L);
-
-  char error_buffer[CURL_ERROR_SIZE];
-  curl_easy_setopt(curl.get(), CURLOPT_ERRORBUFFER, &error_buffer);
-
-// FIXME plumb this through, cleanup.
-#ifndef __APPLE__
-  const char* pinned_pub_key = getenv("APPC_PINNED_KEY");
-  if (pinned_pub_key != NULL) {
-    std::cerr << "Pinning certificate to " << pinned_pub_key << std::endl;
-    if (curl_easy_setopt(curl.get(), CURLOPT_PINNEDPUBLICKEY, pinned_pub_key) != CURLE_OK) {
-      return Error("Could not pin certificate to APPC_PINNED_KEY");
-    }
-    curl_easy_setopt(curl.get(), CURLOPT_SSL_VERIFYPEER, 0L);
-  }
-#endif
+// As get() for each download, performed concurrently (at most max_parallel at a time) from one
+// connection pool, so that a batch from the same host reuses its connections, and shares one
+// connection where both ends support HTTP/2 multiplexing. Results are in input order.
+std::vector<Status> get_all(const std::vector<Download>& downloads,
+                            const size_t max_parallel = 8,
+                            const appc::os::StagedFile::Options& options =
+                                appc::os::StagedFile::Options());
+
 
-  WriteHandle handle{write_filename.c_str(), NULL};
+// Transfer without storing: the checks are the only consumers of the bytes (e.g. a check that
+// writes them somewhere of its own choosing).
+Status stream(const URI& remote_uri, const std::vector<StreamCheck*>& checks);
 
-  curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION, writer);
-  curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, &handle);
 
-  CURLcode result = curl_easy_perform(curl.get());
+// Retrieve a small resource (e.g. a signature) into memory, failing if it is over max_size bytes.
+Try<std::string> get_string(const URI& remote_uri,
+                            const uint64_t max_size = std::numeric_limits<uint64_t>::max());
 
-  if (handle.fileptr) fclose(handle.fileptr);
 
-  if(result != CURLE_OK) return Error(error_buffer);
+// Reads byte ranges of one resource, keeping the connection open from one range to the next.
+class RangeReader {
+private:
+  struct Handle;
+  std::unique_ptr<Handle> handle;
 
-  return Success();
-}
+public:
+  explicit RangeReader(const URI& remote_uri);
+  ~RangeReader();
+
+  RangeReader(const RangeReader&) = delete;
+  RangeReader& operator=(const RangeReader&) = delete;
+
+  // Replaces data with the length bytes at offset.
+  Status read(const uint64_t offset, const uint64_t length, std::string& data);
+};
 
 
 } // namespace https
 } // namespace discovery
-} // namespace simple
+} // namespace appc
+
+
+#ifndef APPC_COMPILED
+#include "appc/discovery/https_impl.h"
+#endif
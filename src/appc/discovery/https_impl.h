@@ -0,0 +1,388 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include <curl/curl.h>
+
+#include "3rdparty/cdaylward/pathname.h"
+#include "appc/discovery/curl.h"
+#include "appc/discovery/https.h"
+#include "appc/os/mkdir.h"
+#include "appc/util/trace.h"
+
+
+namespace appc {
+namespace discovery {
+namespace https {
+
+
+struct WriteHandle {
+  CURL* curl;
+  appc::os::StagedFile& file;
+  bool started;
+  std::vector<StreamCheck*> checks;
+  std::string error;
+  Fault fault;
+};
+
+
+static size_t writer(void* buffer, size_t size, size_t nmemb, void* stream) {
+  WriteHandle* handle = static_cast<WriteHandle*>(stream);
+  if (!handle->started) {
+    handle->started = true;
+    const int64_t content_length = https::content_length(handle->curl);
+    if (content_length > 0) {
+      const auto preallocated = handle->file.preallocate(content_length);
+      if (!preallocated) {
+        handle->error = preallocated.message;
+        handle->fault = Fault::local;
+        return 0;
+      }
+    }
+  }
+  // Returning short aborts the transfer as soon as the image can no longer match.
+  for (auto check : handle->checks) {
+    const auto checked = check->update(buffer, size * nmemb);
+    if (!checked) {
+      handle->error = checked.message;
+      handle->fault = Fault::content;
+      return 0;
+    }
+  }
+  const auto written = handle->file.write(buffer, size * nmemb);
+  if (!written) {
+    handle->error = written.message;
+    handle->fault = Fault::local;
+    return 0;
+  }
+  return size * nmemb;
+}
+
+
+// Sets a handle up to write through handle.
+inline void set_writer(CURL* curl, WriteHandle& handle) {
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writer);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &handle);
+  // Fewer, larger callbacks; the file coalesces further.
+  curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, 512L * 1024);
+}
+
+
+// Once the transfer is over: the checks have the final say, then the file is published.
+inline Status finish_transfer(const CURLcode result,
+                              WriteHandle& handle,
+                              const char* error_buffer) {
+  if (!handle.error.empty()) return Error(handle.error);
+
+  if(result != CURLE_OK) {
+    handle.fault = Fault::transfer;
+    return Error(error_buffer);
+  }
+
+  for (auto check : handle.checks) {
+    const auto checked = check->finish();
+    if (!checked) {
+      handle.fault = Fault::content;
+      return checked;
+    }
+  }
+
+  const auto committed = handle.file.commit();
+  if (!committed) handle.fault = Fault::local;
+  return committed;
+}
+
+
+inline Status make_image_dir(const Path& write_filename) {
+  const auto made_image_dir = appc::os::mkdir(pathname::dir(write_filename), 0755, true);
+  if (!made_image_dir) {
+    return Error(std::string{"Could not create directory for image: "} + made_image_dir.message);
+  }
+  return Success();
+}
+
+
+APPC_INLINE Status get(const URI& remote_uri,
+                       const Path& write_filename,
+                       const std::vector<StreamCheck*>& checks,
+                       const appc::os::StagedFile::Options& options,
+                       Fault* fault) {
+  Fault ignored{};
+  Fault& reported = fault ? *fault : ignored;
+  reported = Fault::local;
+  const auto made_image_dir = make_image_dir(write_filename);
+  if (!made_image_dir) return made_image_dir;
+
+  char error_buffer[CURL_ERROR_SIZE];
+  const auto curl = new_handle(remote_uri, error_buffer);
+  if (!curl) return Error(curl.failure_reason());
+
+  appc::os::StagedFile file{write_filename, options};
+  const auto opened = file.open();
+  if (!opened) return opened;
+
+  WriteHandle handle{curl->get(), file, false, checks, "", Fault::none};
+  set_writer(curl->get(), handle);
+
+  APPC_TRACE_SPAN_DETAIL("https.transfer", remote_uri);
+  CURLcode result = curl_easy_perform(curl->get());
+
+  const auto finished = finish_transfer(result, handle, error_buffer);
+  reported = handle.fault;
+  return finished;
+}
+
+
+// One of get_all's transfers in flight.
+struct Transfer {
+  const size_t index;
+  const Path write_filename;
+  char error_buffer[CURL_ERROR_SIZE];
+  const Try<CurlHandle> curl;
+  appc::os::StagedFile file;
+  WriteHandle handle;
+  APPC_IF_TRACING(const std::string traced; uint64_t traced_at{0};)
+
+  Transfer(const size_t index, const Download& download, const appc::os::StagedFile::Options& options)
+  : index(index),
+    write_filename(download.write_filename),
+    curl(new_handle(download.uri, error_buffer)),
+    file(download.write_filename, options),
+    handle{curl ? curl->get() : nullptr, file, false, download.checks, "", Fault::none}
+    APPC_IF_TRACING(, traced(download.uri)) {}
+
+  Status start() {
+    const auto made_image_dir = make_image_dir(write_filename);
+    if (!made_image_dir) return made_image_dir;
+    if (!curl) return Error(curl.failure_reason());
+    const auto opened = file.open();
+    if (!opened) return opened;
+    set_writer(curl->get(), handle);
+#ifdef CURLPIPE_MULTIPLEX
+    // Rather wait to share a connection than open another.
+    curl_easy_setopt(curl->get(), CURLOPT_PIPEWAIT, 1L);
+#endif
+    APPC_IF_TRACING(traced_at = util::trace_clock();)
+    return Success();
+  }
+};
+
+
+APPC_INLINE std::vector<Status> get_all(const std::vector<Download>& downloads,
+                                        const size_t max_parallel,
+                                        const appc::os::StagedFile::Options& options) {
+  global_init();
+  std::vector<std::string> errors(downloads.size());
+  std::vector<bool> finished(downloads.size(), false);
+  std::unique_ptr<CURLM, decltype(&curl_multi_cleanup)> multi{curl_multi_init(), curl_multi_cleanup};
+  if (!multi) {
+    return std::vector<Status>(downloads.size(), Error("Could not initialize curl."));
+  }
+#ifdef CURLPIPE_MULTIPLEX
+  curl_multi_setopt(multi.get(), CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+  std::map<CURL*, std::unique_ptr<Transfer>> active{};
+  size_t next = 0;
+
+  const auto fill = [&]() {
+    while (active.size() < std::max<size_t>(max_parallel, 1) && next < downloads.size()) {
+      std::unique_ptr<Transfer> transfer{new Transfer(next, downloads[next], options)};
+      next++;
+      const auto started = transfer->start();
+      if (!started) {
+        errors[transfer->index] = started.message;
+        finished[transfer->index] = true;
+        continue;
+      }
+      CURL* curl = transfer->handle.curl;
+      curl_multi_add_handle(multi.get(), curl);
+      active[curl] = std::move(transfer);
+    }
+  };
+
+  fill();
+  while (!active.empty()) {
+    int running = 0;
+    curl_multi_perform(multi.get(), &running);
+    int queued = 0;
+    while (CURLMsg* message = curl_multi_info_read(multi.get(), &queued)) {
+      if (message->msg != CURLMSG_DONE) continue;
+      const auto done = active.find(message->easy_handle);
+      if (done == active.end()) continue;
+      Transfer& transfer = *done->second;
+      APPC_IF_TRACING(util::trace_phase("https.transfer", transfer.traced.c_str(), transfer.traced_at);)
+      const auto result = finish_transfer(message->data.result, transfer.handle, transfer.error_buffer);
+      errors[transfer.index] = result ? "" : result.message;
+      finished[transfer.index] = true;
+      curl_multi_remove_handle(multi.get(), message->easy_handle);
+      active.erase(done);
+    }
+    fill();
+    if (!active.empty()) curl_multi_wait(multi.get(), nullptr, 0, 100, nullptr);
+  }
+
+  std::vector<Status> statuses{};
+  statuses.reserve(downloads.size());
+  for (size_t i = 0; i < downloads.size(); i++) {
+    statuses.push_back(finished[i] && errors[i].empty() ? Success() : Error(errors[i]));
+  }
+  return statuses;
+}
+
+
+struct StreamHandle {
+  std::vector<StreamCheck*> checks;
+  std::string check_error;
+};
+
+
+static size_t stream_writer(void* buffer, size_t size, size_t nmemb, void* stream) {
+  StreamHandle* handle = static_cast<StreamHandle*>(stream);
+  for (auto check : handle->checks) {
+    const auto checked = check->update(buffer, size * nmemb);
+    if (!checked) {
+      handle->check_error = checked.message;
+      return 0;
+    }
+  }
+  return size * nmemb;
+}
+
+
+APPC_INLINE Status stream(const URI& remote_uri, const std::vector<StreamCheck*>& checks) {
+  char error_buffer[CURL_ERROR_SIZE];
+  const auto curl = new_handle(remote_uri, error_buffer);
+  if (!curl) return Error(curl.failure_reason());
+
+  StreamHandle handle{checks, ""};
+  curl_easy_setopt(curl->get(), CURLOPT_WRITEFUNCTION, stream_writer);
+  curl_easy_setopt(curl->get(), CURLOPT_WRITEDATA, &handle);
+
+  APPC_IF_TRACING(const uint64_t traced_at = util::trace_clock();)
+  const CURLcode result = curl_easy_perform(curl->get());
+  APPC_IF_TRACING(util::trace_phase("https.transfer", remote_uri.c_str(), traced_at);)
+  if (!handle.check_error.empty()) return Error(handle.check_error);
+  if (result != CURLE_OK) return Error(error_buffer);
+
+  for (auto check : checks) {
+    const auto checked = check->finish();
+    if (!checked) return checked;
+  }
+  return Success();
+}
+
+
+// Collects a response of at most limit bytes, aborting the transfer once it would be longer.
+struct BoundedBody {
+  CURL* curl;
+  std::string& data;
+  const uint64_t limit;
+  // 0 accepts any successful response.
+  const long expected_code;
+  bool started;
+  std::string error;
+};
+
+
+static size_t bounded_writer(void* buffer, size_t size, size_t nmemb, void* stream) {
+  BoundedBody* body = static_cast<BoundedBody*>(stream);
+  if (!body->started) {
+    body->started = true;
+    long code = 0;
+    curl_easy_getinfo(body->curl, CURLINFO_RESPONSE_CODE, &code);
+    if (body->expected_code != 0 && code != body->expected_code) {
+      body->error = "Expected HTTP " + std::to_string(body->expected_code) + ", got " +
+                    std::to_string(code);
+      return 0;
+    }
+  }
+  if (size * nmemb > body->limit - body->data.size()) {
+    body->error = "Response exceeds " + std::to_string(body->limit) + " bytes";
+    return 0;
+  }
+  body->data.append(static_cast<char*>(buffer), size * nmemb);
+  return size * nmemb;
+}
+
+
+APPC_INLINE Try<std::string> get_string(const URI& remote_uri, const uint64_t max_size) {
+  char error_buffer[CURL_ERROR_SIZE];
+  const auto curl = new_handle(remote_uri, error_buffer);
+  if (!curl) return Failure<std::string>(curl.failure_reason());
+
+  std::string data{};
+  BoundedBody body{curl->get(), data, max_size, 0, false, ""};
+  curl_easy_setopt(curl->get(), CURLOPT_WRITEFUNCTION, bounded_writer);
+  curl_easy_setopt(curl->get(), CURLOPT_WRITEDATA, &body);
+
+  APPC_TRACE_SPAN_DETAIL("https.transfer", remote_uri);
+  const CURLcode result = curl_easy_perform(curl->get());
+  if (!body.error.empty()) return Failure<std::string>(body.error);
+  if (result != CURLE_OK) return Failure<std::string>(error_buffer);
+
+  return Result(data);
+}
+
+
+struct RangeReader::Handle {
+  char error_buffer[CURL_ERROR_SIZE];
+  const Try<CurlHandle> curl;
+
+  explicit Handle(const URI& remote_uri)
+  : curl(new_handle(remote_uri, error_buffer)) {}
+};
+
+
+APPC_INLINE RangeReader::RangeReader(const URI& remote_uri)
+: handle(new Handle(remote_uri)) {}
+
+
+APPC_INLINE RangeReader::~RangeReader() = default;
+
+
+APPC_INLINE Status RangeReader::read(const uint64_t offset,
+                                     const uint64_t length,
+                                     std::string& data) {
+  if (!handle->curl) return Error(handle->curl.failure_reason());
+  CURL* curl = handle->curl->get();
+  const std::string range = std::to_string(offset) + "-" + std::to_string(offset + length - 1);
+  curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+  data.clear();
+  data.reserve(length);
+  // A server ignoring the range answers 200 with the whole resource, from the wrong offset.
+  BoundedBody body{curl, data, length, 206, false, ""};
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, bounded_writer);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+  const CURLcode result = curl_easy_perform(curl);
+  if (!body.error.empty()) return Error(body.error);
+  if (result != CURLE_OK) return Error(handle->error_buffer);
+  if (data.size() != length) {
+    return Error("Received " + std::to_string(data.size()) + " of " + std::to_string(length) +
+                 " bytes");
+  }
+  return Success();
+}
+
+
+} // namespace https
+} // namespace discovery
+} // namespace appc
@@ -0,0 +1,115 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "appc/discovery/types.h"
+
+
+namespace appc {
+namespace discovery {
+
+
+// Spellings of a label value that name the same thing (amd64 and x86_64), so that an image
+// published under either is found. The table is expanded when built: each value maps to the
+// ordered list of spellings to try for it, the requested spelling first, then the rest of its
+// group in the order given. Values are matched as given and then lower-cased, so AMD64 is amd64.
+class LabelAliases {
+private:
+  using Spellings = std::map<std::string, std::vector<std::string>>;
+
+  std::map<std::string, Spellings> table{};
+
+  static std::string lower(std::string value) {
+    std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+    return value;
+  }
+
+  const std::vector<std::string>* spellings(const std::string& label, const std::string& value) const {
+    const auto values = table.find(label);
+    if (values == table.end()) return nullptr;
+    auto found = values->second.find(value);
+    if (found == values->second.end()) found = values->second.find(lower(value));
+    if (found == values->second.end()) return nullptr;
+    return &found->second;
+  }
+
+public:
+  // Adds a group of equivalent values for label. A value already in a group gains the new
+  // spellings after its existing ones.
+  LabelAliases with(const std::string& label, const std::vector<std::string>& group) const {
+    LabelAliases aliases{*this};
+    auto& values = aliases.table[label];
+    for (const auto& value : group) {
+      auto& ordered = values[value];
+      if (ordered.empty()) ordered.push_back(value);
+      for (const auto& alias : group) {
+        if (std::find(ordered.begin(), ordered.end(), alias) == ordered.end()) {
+          ordered.push_back(alias);
+        }
+      }
+    }
+    return aliases;
+  }
+
+  // The usual alternative spellings of the arch values in the appc spec.
+  static LabelAliases defaults() {
+    return LabelAliases().with("arch", {"amd64", "x86_64"})
+                         .with("arch", {"i386", "i686", "x86"})
+                         .with("arch", {"aarch64", "arm64"})
+                         .with("arch", {"armv7l", "armhf", "armv7"})
+                         .with("arch", {"ppc64le", "powerpc64le"});
+  }
+
+  bool empty() const {
+    return table.empty();
+  }
+
+  // The labels to try, in order: the labels as given (aliased values normalized), then every
+  // combination of alternative spellings, earlier labels (by name) varying slowest.
+  std::vector<Labels> candidates(const Labels& labels) const {
+    std::vector<Labels> expanded{Labels{}};
+    for (const auto& label : labels) {
+      const auto alternatives = spellings(label.first, label.second);
+      if (alternatives == nullptr) {
+        for (auto& candidate : expanded) candidate[label.first] = label.second;
+        continue;
+      }
+      std::vector<Labels> next{};
+      next.reserve(expanded.size() * alternatives->size());
+      for (const auto& candidate : expanded) {
+        for (const auto& value : *alternatives) {
+          next.push_back(candidate);
+          next.back()[label.first] = value;
+        }
+      }
+      expanded.swap(next);
+    }
+    return expanded;
+  }
+};
+
+
+} // namespace discovery
+} // namespace appc
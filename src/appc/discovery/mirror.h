@@ -0,0 +1,442 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include "3rdparty/cdaylward/pathname.h"
+#include "appc/discovery/aci_name.h"
+#include "appc/discovery/https.h"
+#include "appc/discovery/provider.h"
+#include "appc/discovery/strategy/simple.h"
+#include "appc/net/http_server.h"
+#include "appc/os/mkdir.h"
+#include "appc/util/log.h"
+#include "appc/util/option.h"
+#include "appc/util/status.h"
+#include "appc/util/try.h"
+
+
+namespace appc {
+namespace discovery {
+namespace mirror {
+
+
+// A caching mirror: images are served from a local cache directory laid out like the simple
+// strategy's URLs (<cache>/example.com/worker-1.0.0-linux-amd64.aci). Misses are fetched upstream
+// through an ImageProvider, at most once per image no matter how many clients ask for it, and every
+// waiting client is fed from the partially written cache file as it fills.
+
+
+// Where a client's bytes go.
+class Sink {
+public:
+  virtual ~Sink() {}
+  // Called once, before any data. The length is known when the image is already cached.
+  virtual Status begin(const Option<uint64_t>& length) = 0;
+  virtual Status write(const char* data, const size_t size) = 0;
+  // Called once after the last byte of a transfer that completed.
+  virtual Status end() { return Success(); }
+
+  virtual Status send_file(const int fd, off_t offset, size_t count) {
+    char buffer[64 * 1024];
+    while (count > 0) {
+      const ssize_t got = pread(fd, buffer, std::min(sizeof(buffer), count), offset);
+      if (got <= 0) return Error("Could not read cached image");
+      const auto wrote = write(buffer, got);
+      if (!wrote) return wrote;
+      offset += got;
+      count -= got;
+    }
+    return Success();
+  }
+};
+
+
+// An in-progress upstream fetch.
+struct Fill {
+  const Path final_path;
+  const Path staging_path;
+  std::mutex mutex{};
+  std::condition_variable progressed{};
+  bool started{false};
+  uint64_t written{0};
+  bool done{false};
+  bool failed{false};
+  std::string error{};
+
+  explicit Fill(const Path& final_path)
+  : final_path(final_path),
+    staging_path(final_path + ".partial") {}
+
+  void fail(const std::string& reason) {
+    std::lock_guard<std::mutex> lock{mutex};
+    if (done || failed) return;
+    failed = true;
+    error = reason;
+    progressed.notify_all();
+  }
+};
+
+
+class Fills {
+private:
+  std::mutex mutex{};
+  std::map<Path, std::shared_ptr<Fill>> fills{};
+public:
+  // Returns the fill for the key and whether the caller created it (and so must run it).
+  std::pair<std::shared_ptr<Fill>, bool> join(const Path& key, const Path& final_path) {
+    std::lock_guard<std::mutex> lock{mutex};
+    auto& fill = fills[key];
+    if (fill) return std::make_pair(fill, false);
+    fill = std::make_shared<Fill>(final_path);
+    return std::make_pair(fill, true);
+  }
+
+  std::shared_ptr<Fill> find(const Path& key) {
+    std::lock_guard<std::mutex> lock{mutex};
+    const auto fill = fills.find(key);
+    return fill == fills.end() ? nullptr : fill->second;
+  }
+
+  // Unregisters the fill, unless the key has since been taken by a newer one.
+  void remove(const Path& key, const std::shared_ptr<Fill>& fill) {
+    std::lock_guard<std::mutex> lock{mutex};
+    const auto registered = fills.find(key);
+    if (registered != fills.end() && registered->second == fill) fills.erase(registered);
+  }
+
+  // Unregisters and fails the fill in one step, so a client that joins afterwards starts a new fill
+  // rather than sharing this one's error.
+  void fail(const Path& key, const std::shared_ptr<Fill>& fill, const std::string& reason) {
+    std::lock_guard<std::mutex> lock{mutex};
+    const auto registered = fills.find(key);
+    if (registered != fills.end() && registered->second == fill) fills.erase(registered);
+    fill->fail(reason);
+  }
+};
+
+
+// Writes the upstream bytes to the staging file and wakes the waiting clients. On completion the
+// staging file is renamed into the cache.
+class FillWriter : public StreamCheck {
+private:
+  Fill& fill;
+  const int fd;
+public:
+  FillWriter(Fill& fill, const int fd)
+  : fill(fill),
+    fd(fd) {}
+
+  virtual Status update(const void* data, const size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    size_t wrote = 0;
+    while (wrote < size) {
+      const ssize_t n = ::write(fd, bytes + wrote, size - wrote);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return Error(std::string{"Could not write to cache: "} + strerror(errno));
+      wrote += n;
+    }
+    std::lock_guard<std::mutex> lock{fill.mutex};
+    // Clients commit to a response on the first byte, an upstream error before then is theirs too.
+    fill.started = true;
+    fill.written += size;
+    fill.progressed.notify_all();
+    return Success();
+  }
+
+  virtual Status finish() {
+    std::lock_guard<std::mutex> lock{fill.mutex};
+    if (rename(fill.staging_path.c_str(), fill.final_path.c_str()) != 0) {
+      return Error(std::string{"Could not move image into cache: "} + strerror(errno));
+    }
+    fill.started = true;
+    fill.done = true;
+    fill.progressed.notify_all();
+    return Success();
+  }
+};
+
+
+// The upstream fetcher: streams into the Fill registered for the image's cache path.
+class FillFetcher final : public appc::discovery::Fetcher {
+private:
+  const URI upstream_prefix;
+  const std::shared_ptr<Fills> fills;
+public:
+  FillFetcher(const URI& upstream_prefix,
+              const std::shared_ptr<Fills>& fills)
+  : upstream_prefix(upstream_prefix),
+    fills(fills) {}
+
+  using appc::discovery::Fetcher::fetch;
+
+  virtual Try<URI> fetch(const URI& uri) {
+    if (!valid_prefix(upstream_prefix, uri)) {
+      return Failure<URI>("URI does not begin with " + upstream_prefix + ", will not fetch " + uri);
+    }
+    const Path key = uri.substr(upstream_prefix.length());
+    const auto fill = fills->find(key);
+    if (!fill) return Failure<URI>("No cache fill registered for " + uri);
+
+    const auto made_dir = appc::os::mkdir(pathname::dir(fill->final_path), 0755, true);
+    if (!made_dir) return Failure<URI>(made_dir.message);
+    const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    int fd = open(fill->staging_path.c_str(), flags, 0644);
+    if (fd < 0 && errno == ENOENT) {
+      const auto made_again = appc::os::mkdir_again(pathname::dir(fill->final_path), 0755);
+      if (!made_again) return Failure<URI>(made_again.message);
+      fd = open(fill->staging_path.c_str(), flags, 0644);
+    }
+    if (fd < 0) {
+      return Failure<URI>("Could not create " + fill->staging_path + ": " + strerror(errno));
+    }
+
+    FillWriter writer{*fill, fd};
+    const Status streamed = https::stream(uri, {&writer});
+    close(fd);
+    if (!streamed) {
+      unlink(fill->staging_path.c_str());
+      fills->fail(key, fill, streamed.message);
+      return Failure<URI>(streamed.message);
+    }
+    return Result(file_prefix + fill->final_path);
+  }
+};
+
+
+class MirrorCache {
+private:
+  const Path cache_dir;
+  const std::shared_ptr<Fills> fills;
+  ImageProvider provider;
+
+  std::mutex mutex{};
+  std::condition_variable idle{};
+  size_t running{0};
+
+  static Status send_cached(const int fd, Sink& sink) {
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) return Error("Could not stat cached image");
+    const auto begun = sink.begin(Some(static_cast<uint64_t>(file_stat.st_size)));
+    if (!begun) return begun;
+    return sink.send_file(fd, 0, file_stat.st_size);
+  }
+
+  void run(const Path& key, const ACIName aci_name, const std::shared_ptr<Fill> fill) {
+    const auto fetched = provider.get(aci_name.name, aci_name.labels);
+    if (fetched) {
+      fills->remove(key, fill);
+    } else {
+      fills->fail(key, fill, fetched.failure_reason());
+    }
+    std::lock_guard<std::mutex> lock{mutex};
+    if (--running == 0) idle.notify_all();
+  }
+
+  // Follows the staging file as it grows until the fill is done.
+  static Status tail(Fill& fill, Sink& sink) {
+    int fd = -1;
+    {
+      std::unique_lock<std::mutex> lock{fill.mutex};
+      fill.progressed.wait(lock, [&fill]() { return fill.started || fill.done || fill.failed; });
+      if (fill.failed) return Error(fill.error);
+      const Path& path = fill.done ? fill.final_path : fill.staging_path;
+      fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) return Error("Could not open " + path + ": " + strerror(errno));
+    }
+    const auto begun = sink.begin(None<uint64_t>());
+    if (!begun) {
+      close(fd);
+      return begun;
+    }
+    std::unique_ptr<char[]> buffer{new char[256 * 1024]};
+    uint64_t offset = 0;
+    for (;;) {
+      const ssize_t got = pread(fd, buffer.get(), 256 * 1024, offset);
+      if (got > 0) {
+        const auto wrote = sink.write(buffer.get(), got);
+        if (!wrote) {
+          close(fd);
+          return wrote;
+        }
+        offset += got;
+        continue;
+      }
+      std::unique_lock<std::mutex> lock{fill.mutex};
+      fill.progressed.wait(lock, [&fill, offset]() {
+        return fill.written > offset || fill.done || fill.failed;
+      });
+      if (fill.failed) {
+        close(fd);
+        return Error(fill.error);
+      }
+      if (fill.done && fill.written <= offset) break;
+    }
+    close(fd);
+    return sink.end();
+  }
+
+public:
+  MirrorCache(const Path& cache_dir,
+              const URI& upstream_prefix = https_prefix)
+  : cache_dir(cache_dir),
+    fills(std::make_shared<Fills>()),
+    provider({Strategy(new strategy::simple::Resolver(upstream_prefix),
+                       new FillFetcher(upstream_prefix, fills),
+                       "mirror_fill")}) {}
+
+  MirrorCache(const MirrorCache&) = delete;
+  MirrorCache& operator=(const MirrorCache&) = delete;
+
+  ~MirrorCache() {
+    std::unique_lock<std::mutex> lock{mutex};
+    idle.wait(lock, [this]() { return running == 0; });
+  }
+
+  // Maps a request path to its image name, failing for anything that is not an image path.
+  static Try<ACIName> image_for_path(const Path& path) {
+    const Path relative = pathname::trim_leading_slash(path);
+    if (relative.empty() || pathname::has_dot_dot(relative)) {
+      return Failure<ACIName>("Not an image path: " + path);
+    }
+    return parse_aci_name(relative);
+  }
+
+  Status stream(const Path& path, Sink& sink) {
+    const auto aci_name = image_for_path(path);
+    if (!aci_name) return Error(aci_name.failure_reason());
+    const Path key = pathname::trim_leading_slash(path);
+    const Path final_path = pathname::join(cache_dir, key);
+
+    const int cached = open(final_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (cached >= 0) {
+      const auto sent = send_cached(cached, sink);
+      close(cached);
+      return sent;
+    }
+
+    const auto joined = fills->join(key, final_path);
+    const auto fill = joined.first;
+    if (joined.second) {
+      // Raced with a fill that completed between the open above and joining.
+      const int completed = open(final_path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (completed >= 0) {
+        fills->remove(key, fill);
+        const auto sent = send_cached(completed, sink);
+        close(completed);
+        return sent;
+      }
+      {
+        std::lock_guard<std::mutex> lock{mutex};
+        running++;
+      }
+      std::thread(&MirrorCache::run, this, key, from_result(aci_name), fill).detach();
+    }
+    return tail(*fill, sink);
+  }
+};
+
+
+// Adapts a mirror client to an HTTP response. Responses for images still being fetched upstream
+// are chunked, so a client can tell a complete image (the last chunk arrives) from a fill that
+// failed part way (the connection is reset before it does).
+class ResponseSink : public Sink {
+private:
+  net::http::Connection& connection;
+  bool chunked{false};
+public:
+  bool begun{false};
+
+  explicit ResponseSink(net::http::Connection& connection)
+  : connection(connection) {}
+
+  virtual Status begin(const Option<uint64_t>& length) {
+    begun = true;
+    net::http::Headers headers{{"Content-Type", "application/octet-stream"}};
+    if (length) {
+      headers["Content-Length"] = std::to_string(*length);
+    } else {
+      headers["Transfer-Encoding"] = "chunked";
+      chunked = true;
+    }
+    return connection.send_head(200, headers);
+  }
+
+  virtual Status write(const char* data, const size_t size) {
+    if (!chunked) return connection.write(data, size);
+    // An empty chunk would end the body.
+    if (size == 0) return Success();
+    char size_line[32];
+    snprintf(size_line, sizeof(size_line), "%zx\r\n", size);
+    const auto wrote_size = connection.write(size_line);
+    if (!wrote_size) return wrote_size;
+    const auto wrote = connection.write(data, size);
+    if (!wrote) return wrote;
+    return connection.write("\r\n");
+  }
+
+  virtual Status send_file(const int fd, off_t offset, size_t count) {
+    if (chunked) return Sink::send_file(fd, offset, count);
+    return connection.send_file(fd, offset, count);
+  }
+
+  virtual Status end() {
+    return chunked ? connection.write("0\r\n\r\n") : Success();
+  }
+
+  void abort() {
+    connection.abort();
+  }
+};
+
+
+// GET /<aci name> for a net::http::Server.
+inline net::http::Handler handler(MirrorCache& cache) {
+  return [&cache](const net::http::Request& request, net::http::Connection& connection) {
+    if (request.method != "GET") {
+      connection.send_response(405);
+      return;
+    }
+    const Path path = request.target.substr(0, request.target.find('?'));
+    if (!MirrorCache::image_for_path(path)) {
+      connection.send_response(404);
+      return;
+    }
+    ResponseSink sink{connection};
+    const auto streamed = cache.stream(path, sink);
+    if (!streamed && !sink.begun) {
+      connection.send_response(502, streamed.message + "\n");
+    } else if (!streamed) {
+      APPC_LOG(warning, "mirror", "Transfer of " + path + " failed: " + streamed.message);
+      sink.abort();
+    }
+  };
+}
+
+
+} // namespace mirror
+} // namespace discovery
+} // namespace appc
@@ -0,0 +1,172 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <vector>
+
+#include "appc/discovery/strategy.h"
+#include "appc/discovery/types.h"
+
+
+namespace appc {
+namespace discovery {
+
+
+// A Plan decides the order an ImageProvider tries its strategies in for each name, and is told how
+// each attempt went. Without one, strategies are tried in the order given.
+class Plan {
+public:
+  virtual ~Plan() {}
+
+  // Indexes into strategies, in the order they are to be tried for name.
+  virtual std::vector<size_t> order(const Name& name,
+                                    const std::vector<Strategy>& strategies) const = 0;
+
+  // Seconds, on the clock attempts are timed by.
+  virtual double now() const = 0;
+
+  virtual void record(const Name& name,
+                      const Strategy& strategy,
+                      const bool provided,
+                      const double seconds) = 0;
+};
+
+
+// An AdaptivePlan learns, per name prefix (by default the name's domain), how often each strategy
+// provides an image and how long an attempt takes, and orders the strategies by expected cost: an
+// attempt's mean duration over its probability of success (with one imaginary hit and one
+// imaginary miss, so an untried strategy starts at 1/2). Sequential attempts in ascending
+// duration/probability minimize the expected time to the first success.
+//
+// Strategies are told apart by name, so they need distinct ones (as the builders give them), and
+// what has been learned carries over when the provider is configured with a changed list.
+//
+// With Order::fixed the strategies are always tried in the given order, and statistics are still
+// kept. Ties, and prefixes with no history, keep the given order, so the adaptive order is a
+// deterministic function of the outcomes and durations observed.
+class AdaptivePlan : public Plan {
+public:
+  enum class Order { fixed, adaptive };
+
+  struct StrategyStats {
+    uint64_t attempts;
+    uint64_t hits;
+    // Seconds, moving average over all attempts, hits and misses alike.
+    double mean_seconds;
+
+    double hit_rate() const {
+      return (hits + 1.0) / (attempts + 2.0);
+    }
+
+    double expected_cost() const {
+      return mean_seconds / hit_rate();
+    }
+  };
+
+  // Per prefix, by strategy name.
+  using Stats = std::map<std::string, std::map<std::string, StrategyStats>>;
+  using Clock = std::function<double()>;
+  using PrefixOf = std::function<std::string(const Name&)>;
+
+  static double steady_seconds() {
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  static std::string domain_of(const Name& name) {
+    return name.substr(0, name.find('/'));
+  }
+
+private:
+  const Order order_by;
+  const double alpha;
+  const Clock clock;
+  const PrefixOf prefix_of;
+
+  mutable std::mutex mutex{};
+  Stats stats_by_prefix{};
+
+public:
+  explicit AdaptivePlan(const Order order_by = Order::adaptive,
+                        const double alpha = 0.2,
+                        const Clock& clock = steady_seconds,
+                        const PrefixOf& prefix_of = domain_of)
+  : order_by(order_by),
+    alpha(alpha),
+    clock(clock),
+    prefix_of(prefix_of) {}
+
+  virtual std::vector<size_t> order(const Name& name,
+                                    const std::vector<Strategy>& strategies) const {
+    std::vector<size_t> indexes(strategies.size());
+    std::iota(indexes.begin(), indexes.end(), 0);
+    if (order_by == Order::fixed) return indexes;
+    std::vector<double> costs(strategies.size(), std::numeric_limits<double>::infinity());
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      const auto found = stats_by_prefix.find(prefix_of(name));
+      if (found == stats_by_prefix.end()) return indexes;
+      // A strategy never tried for a prefix that has history has only ever been preceded by hits;
+      // it stays behind the strategies that provided them.
+      for (size_t i = 0; i < strategies.size(); i++) {
+        const auto stats = found->second.find(strategies[i].get_name());
+        if (stats != found->second.end()) costs[i] = stats->second.expected_cost();
+      }
+    }
+    std::stable_sort(indexes.begin(), indexes.end(),
+                     [&costs](const size_t left, const size_t right) {
+                       return costs[left] < costs[right];
+                     });
+    return indexes;
+  }
+
+  virtual double now() const {
+    return clock();
+  }
+
+  virtual void record(const Name& name,
+                      const Strategy& strategy,
+                      const bool provided,
+                      const double seconds) {
+    const std::string prefix = prefix_of(name);
+    std::lock_guard<std::mutex> lock{mutex};
+    auto& stats = stats_by_prefix[prefix][strategy.get_name()];
+    stats.mean_seconds = stats.attempts == 0
+                             ? seconds
+                             : stats.mean_seconds + alpha * (seconds - stats.mean_seconds);
+    stats.attempts++;
+    if (provided) stats.hits++;
+  }
+
+  // A snapshot of what has been learned.
+  Stats stats() const {
+    std::lock_guard<std::mutex> lock{mutex};
+    return stats_by_prefix;
+  }
+};
+
+
+} // namespace discovery
+} // namespace appc
@@ -17,10 +17,20 @@
 
 #pragma once
 
+#include <algorithm>
+#include <memory>
 #include <vector>
 
+#include "appc/discovery/label_aliases.h"
+#include "appc/discovery/plan.h"
 #include "appc/discovery/strategy.h"
+#include "appc/util/log.h"
+#include "appc/util/metrics.h"
 #include "appc/util/namespace.h"
+#include "appc/util/option.h"
+#include "appc/util/profile.h"
+#include "appc/util/snapshot.h"
+#include "appc/util/trace.h"
 #include "appc/util/try.h"
 
 
@@ -28,37 +38,280 @@ namespace appc {
 namespace discovery {
 
 
+// One strategy's attempt: resolve, then fetch (verifying against expected if given).
+inline Try<URI> get_with(const Strategy& strategy,
+                         const Name& name,
+                         const Labels& labels,
+                         const Option<Expectation>& expected) {
+  APPC_IF_METRICS(const auto& metrics = strategy.get_metrics(); util::Stopwatch stopwatch{};)
+  APPC_IF_TRACING(const std::string traced_detail = strategy.get_name() + " " + name;
+                  const char* traced = traced_detail.c_str();
+                  uint64_t traced_at = util::trace_clock();)
+  auto uri = strategy.get_resolver()->resolve(name, labels);
+  APPC_IF_METRICS(metrics.resolve_seconds.observe(stopwatch.lap());)
+  APPC_IF_TRACING(traced_at = util::trace_phase("resolve", traced, traced_at);)
+  if (!uri) {
+    APPC_IF_METRICS(metrics.unresolved.add();)
+    APPC_LOG(info, "discovery", uri.failure_reason());
+    return Failure<URI>(uri.failure_reason());
+  }
+  APPC_LOG(info, "discovery", "Resolved: " + name + " -> " + from_result(uri));
+  auto fetched = expected ? strategy.get_fetcher()->fetch(from_result(uri), *expected)
+                          : strategy.get_fetcher()->fetch(from_result(uri));
+  APPC_IF_TRACING(util::trace_phase("fetch", traced, traced_at);)
+  APPC_IF_METRICS(metrics.fetch_seconds.observe(stopwatch.lap());
+                  (fetched ? metrics.provided : metrics.fetch_failures).add();)
+  if (!fetched) {
+    APPC_LOG(warning, "discovery", "Fetch failed: " + fetched.failure_reason());
+    return fetched;
+  }
+  APPC_LOG(info, "discovery", "Fetched: " + from_result(uri));
+  APPC_LOG(info, "discovery", "Location: " + from_result(fetched));
+  return fetched;
+}
+
+
+// One strategy's attempt at any of several candidate labels (alternative spellings, in order of
+// preference): every candidate is resolved, then the fetcher provides the first it can.
+inline Try<URI> get_first_with(const Strategy& strategy,
+                               const Name& name,
+                               const std::vector<Labels>& candidates,
+                               const Option<Expectation>& expected) {
+  std::vector<ImageReference> references{};
+  references.reserve(candidates.size());
+  for (const auto& labels : candidates) references.push_back(ImageReference{name, labels});
+  APPC_IF_METRICS(const auto& metrics = strategy.get_metrics(); util::Stopwatch stopwatch{};)
+  APPC_IF_TRACING(const std::string traced_detail = strategy.get_name() + " " + name;
+                  const char* traced = traced_detail.c_str();
+                  uint64_t traced_at = util::trace_clock();)
+  const auto resolved = strategy.get_resolver()->resolve_all(references);
+  APPC_IF_METRICS(metrics.resolve_seconds.observe(stopwatch.lap());)
+  APPC_IF_TRACING(traced_at = util::trace_phase("resolve", traced, traced_at);)
+  std::vector<URI> uris{};
+  for (const auto& uri : resolved) {
+    if (!uri) {
+      APPC_LOG(info, "discovery", uri.failure_reason());
+      continue;
+    }
+    APPC_LOG(info, "discovery", "Resolved: " + name + " -> " + from_result(uri));
+    uris.push_back(from_result(uri));
+  }
+  if (uris.empty()) {
+    APPC_IF_METRICS(metrics.unresolved.add();)
+    return Failure<URI>("Could not resolve " + name);
+  }
+  auto fetched = strategy.get_fetcher()->fetch_first(uris, expected);
+  APPC_IF_TRACING(util::trace_phase("fetch", traced, traced_at);)
+  APPC_IF_METRICS(metrics.fetch_seconds.observe(stopwatch.lap());
+                  (fetched ? metrics.provided : metrics.fetch_failures).add();)
+  if (!fetched) {
+    APPC_LOG(warning, "discovery", "Fetch failed: " + fetched.failure_reason());
+    return fetched;
+  }
+  APPC_LOG(info, "discovery", "Location: " + from_result(fetched));
+  return fetched;
+}
+
+
 // An ImageProvider uses a list of strategies, in order, to attempt to resolve and fetch an image.
 // An ImageProvider returns the on-disk URI for the image provided by the first strategy that won.
+//
+// With LabelAliases, an image is also looked for under the alternative spellings of its label
+// values (arch x86_64 for amd64, say). Each strategy is tried with every candidate before the
+// next strategy is, so a local store is searched for all of them (in one pass, if indexed) before
+// anything is requested remotely.
+//
+// With a Plan, the strategies are tried in the order it gives for each name (AdaptivePlan learns
+// one per domain), rather than as listed.
+//
+// An ImageProvider may be shared by any number of threads. Its strategies and aliases may be
+// replaced while it is in use (configure(), to rotate credentials or add a store, say): each call
+// takes the configuration current when it starts and keeps it to the end, so a call never sees
+// half of a change. Taking it is lock-free (see util::Snapshot for what it does cost), and
+// replacing it never waits on calls.
 class ImageProvider {
+public:
+  struct Configuration {
+    const std::vector<Strategy> strategies;
+    const LabelAliases aliases;
+    const std::shared_ptr<Plan> plan;
+  };
+
 private:
-  std::vector<Strategy> strategies{};
+  util::Snapshot<Configuration> configuration;
+
+  static std::shared_ptr<const Configuration> make(const std::vector<Strategy>& strategies,
+                                                   const LabelAliases& aliases,
+                                                   const std::shared_ptr<Plan>& plan) {
+    return std::make_shared<const Configuration>(Configuration{strategies, aliases, plan});
+  }
+
+  // One strategy's batch: the references in group (indexes into references) not yet provided,
+  // one candidate rank at a time.
+  static void provide_batch(const Strategy& strategy,
+                            const std::vector<ImageReference>& references,
+                            const std::vector<std::vector<Labels>>& candidates,
+                            std::vector<size_t> group,
+                            std::vector<URI>& provided,
+                            Plan* plan) {
+    APPC_IF_METRICS(const auto& metrics = strategy.get_metrics();)
+    APPC_IF_TRACING(const std::string traced_detail = strategy.get_name() + " batch";
+                    const char* traced = traced_detail.c_str();)
+    const std::vector<size_t> attempted = group;
+    const double started = plan != nullptr ? plan->now() : 0;
+    for (size_t rank = 0; !group.empty(); rank++) {
+      std::vector<ImageReference> batch{};
+      std::vector<size_t> batch_index{};
+      for (const auto i : group) {
+        if (rank >= candidates[i].size()) continue;
+        batch.push_back(ImageReference{references[i].name, candidates[i][rank]});
+        batch_index.push_back(i);
+      }
+      if (batch.empty()) break;
+      APPC_IF_METRICS(util::Stopwatch stopwatch{};)
+      APPC_IF_TRACING(uint64_t traced_at = util::trace_clock();)
+      const auto resolved = strategy.get_resolver()->resolve_all(batch);
+      APPC_IF_METRICS(metrics.resolve_seconds.observe(stopwatch.lap());)
+      APPC_IF_TRACING(traced_at = util::trace_phase("resolve", traced, traced_at);)
+
+      std::vector<URI> uris{};
+      std::vector<size_t> resolved_index{};
+      for (size_t b = 0; b < batch.size(); b++) {
+        if (!resolved[b]) {
+          APPC_IF_METRICS(metrics.unresolved.add();)
+          APPC_LOG(info, "discovery", resolved[b].failure_reason());
+          continue;
+        }
+        uris.push_back(from_result(resolved[b]));
+        resolved_index.push_back(batch_index[b]);
+      }
+      const auto fetched = strategy.get_fetcher()->fetch_all(uris);
+      APPC_IF_TRACING(util::trace_phase("fetch", traced, traced_at);)
+      APPC_IF_METRICS(metrics.fetch_seconds.observe(stopwatch.lap());)
+      for (size_t u = 0; u < uris.size(); u++) {
+        APPC_IF_METRICS((fetched[u] ? metrics.provided : metrics.fetch_failures).add();)
+        if (fetched[u]) {
+          provided[resolved_index[u]] = from_result(fetched[u]);
+        } else {
+          APPC_LOG(warning, "discovery", "Fetch failed: " + fetched[u].failure_reason());
+        }
+      }
+      group.erase(std::remove_if(group.begin(), group.end(), [&provided](const size_t i) {
+                    return !provided[i].empty();
+                  }),
+                  group.end());
+    }
+    if (plan == nullptr) return;
+    // The batch's time is shared evenly among its references.
+    const double seconds = (plan->now() - started) / attempted.size();
+    for (const auto i : attempted) {
+      plan->record(references[i].name, strategy, !provided[i].empty(), seconds);
+    }
+  }
+
 public:
-  ImageProvider(const std::vector<Strategy>& strategies)
-  : strategies(strategies) {}
+  ImageProvider(const std::vector<Strategy>& strategies,
+                const LabelAliases& aliases = LabelAliases(),
+                const std::shared_ptr<Plan>& plan = nullptr)
+  : configuration(make(strategies, aliases, plan)) {}
+
+  std::shared_ptr<const Configuration> get_configuration() const {
+    return configuration.load();
+  }
 
-  Try<URI> get(const Name& name, const Labels& labels) {
+  // Calls already under way finish with the configuration they started with.
+  void configure(const std::vector<Strategy>& strategies,
+                 const LabelAliases& aliases = LabelAliases(),
+                 const std::shared_ptr<Plan>& plan = nullptr) {
+    configuration.publish(make(strategies, aliases, plan));
+  }
+
+  Try<URI> get(const Name& name, const Labels& labels) const {
+    return get(name, labels, None<Expectation>());
+  }
+
+  // As above, but only accept an image that matches expected (e.g. the imageID of an AppRef or
+  // Dependency). A strategy whose image does not match is treated like any other failed fetch.
+  Try<URI> get(const Name& name, const Labels& labels, const Expectation& expected) const {
+    return get(name, labels, Some(expected));
+  }
+
+  Try<URI> get(const Name& name, const Labels& labels, const Option<Expectation>& expected) const {
+    APPC_PROFILE_SCOPE("ImageProvider::get");
     // TODO validate name
     // validate labels
-    for (auto& strategy : strategies) {
-      auto uri = strategy.get_resolver()->resolve(name, labels);
-      if (!uri) {
-        std::cerr << uri.failure_reason() << std::endl;
-        continue;
-      }
-      // TODO logging, ;)
-      std::cerr << "Resolved: " << name << " -> " << from_result(uri) << std::endl;
-      auto fetched = strategy.get_fetcher()->fetch(from_result(uri));
-      if (!fetched) {
-        std::cerr << "Fetch failed: " << fetched.failure_reason() << std::endl;
-        continue;
+    const auto current = configuration.load();
+    const auto& strategies = current->strategies;
+    const auto& aliases = current->aliases;
+    Plan* plan = current->plan.get();
+    const auto candidates = aliases.empty() ? std::vector<Labels>{labels}
+                                            : aliases.candidates(labels);
+    const auto order = plan != nullptr ? plan->order(name, strategies) : std::vector<size_t>{};
+    for (size_t i = 0; i < strategies.size(); i++) {
+      const auto& strategy = strategies[plan != nullptr ? order[i] : i];
+      const double started = plan != nullptr ? plan->now() : 0;
+      auto fetched = candidates.size() == 1 ? get_with(strategy, name, candidates.front(), expected)
+                                            : get_first_with(strategy, name, candidates, expected);
+      if (plan != nullptr) {
+        plan->record(name, strategy, static_cast<bool>(fetched), plan->now() - started);
       }
-      std::cerr << "Fetched: " << from_result(uri) << std::endl;
-      std::cerr << "Location: " << from_result(fetched) << std::endl;
-      return fetched;
+      if (fetched) return fetched;
     }
     return Failure<URI>("Could not retrieve " + name);
   }
+
+  // get() for each reference, results in input order. Each strategy sees, as one batch, the
+  // references no earlier strategy provided (so a local store answers everything it has before
+  // anything is requested remotely). With aliases, a strategy is given a batch per candidate
+  // rank: every reference's first candidate, then the second candidate of those not yet found,
+  // and so on, so that no more than one candidate per reference is fetched at a time. With a Plan,
+  // the references are tried in rounds: in each, every strategy is given one batch of the pending
+  // references the plan puts it at that place for.
+  std::vector<Try<URI>> get_all(const std::vector<ImageReference>& references) const {
+    APPC_PROFILE_SCOPE("ImageProvider::get_all");
+    const auto current = configuration.load();
+    const auto& strategies = current->strategies;
+    const auto& aliases = current->aliases;
+    Plan* plan = current->plan.get();
+    std::vector<std::vector<Labels>> candidates{};
+    std::vector<std::vector<size_t>> orders{};
+    candidates.reserve(references.size());
+    for (const auto& reference : references) {
+      candidates.push_back(aliases.empty() ? std::vector<Labels>{reference.labels}
+                                           : aliases.candidates(reference.labels));
+      if (plan != nullptr) orders.push_back(plan->order(reference.name, strategies));
+    }
+    std::vector<URI> provided(references.size());
+    std::vector<size_t> pending(references.size());
+    for (size_t i = 0; i < pending.size(); i++) pending[i] = i;
+
+    for (size_t round = 0; round < strategies.size() && !pending.empty(); round++) {
+      if (plan == nullptr) {
+        provide_batch(strategies[round], references, candidates, pending, provided, plan);
+      } else {
+        for (size_t s = 0; s < strategies.size(); s++) {
+          std::vector<size_t> group{};
+          for (const auto i : pending) {
+            if (orders[i][round] == s) group.push_back(i);
+          }
+          if (group.empty()) continue;
+          provide_batch(strategies[s], references, candidates, group, provided, plan);
+        }
+      }
+      pending.erase(std::remove_if(pending.begin(), pending.end(), [&provided](const size_t i) {
+                      return !provided[i].empty();
+                    }),
+                    pending.end());
+    }
+
+    std::vector<Try<URI>> results{};
+    results.reserve(references.size());
+    for (size_t i = 0; i < references.size(); i++) {
+      results.push_back(provided[i].empty() ? Failure<URI>("Could not retrieve " + references[i].name)
+                                            : Result(provided[i]));
+    }
+    return results;
+  }
 };
 
 
@@ -17,6 +17,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include "appc/discovery/types.h"
 #include "appc/util/namespace.h"
 #include "appc/util/try.h"
@@ -29,23 +31,23 @@ namespace discovery {
 // A Resolver takes a name and labels and renders a URI for the image.  The resolver may or may not
 // use network services to determine the URI (as is the case with meta discovery). The returned URI
 // may be local or remote.
-class AbstractResolver {
+//
+// Resolvers are shared by every thread using a provider: resolve() and resolve_all() must be safe
+// to call concurrently on one instance, so implementations synchronize any state they keep.
+class Resolver {
 public:
-  virtual ~AbstractResolver() {}
+  virtual ~Resolver() {}
   virtual Try<URI> resolve(const Name& name, const Labels& labels) = 0;
-};
 
-
-class Resolver : public AbstractResolver {
-private:
-  const std::shared_ptr<AbstractResolver> impl;
-public:
-  Resolver(AbstractResolver* impl)
-  : impl(impl) {}
-
-  virtual ~Resolver() {}
-  virtual Try<URI> resolve(const Name& name, const Labels& labels) {
-    return impl->resolve(name, labels);
+  // Resolves each reference, results in input order. Resolvers that can share work across a batch
+  // (one pass over an index, one connection for many requests) should override this.
+  virtual std::vector<Try<URI>> resolve_all(const std::vector<ImageReference>& references) {
+    std::vector<Try<URI>> uris{};
+    uris.reserve(references.size());
+    for (const auto& reference : references) {
+      uris.push_back(resolve(reference.name, reference.labels));
+    }
+    return uris;
   }
 };
 
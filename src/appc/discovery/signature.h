@@ -0,0 +1,570 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <future>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/param_build.h>
+#include <openssl/rsa.h>
+
+#include "3rdparty/cdaylward/pathname.h"
+#include "appc/discovery/https.h"
+#include "appc/discovery/types.h"
+#include "appc/discovery/verify.h"
+#include "appc/os/dir.h"
+#include "appc/util/status.h"
+#include "appc/util/try.h"
+
+
+namespace appc {
+namespace discovery {
+namespace signature {
+
+
+// Detached OpenPGP signatures (.aci.sig) over the ACI as transferred. Verification is native rather
+// than shelling out to gpg so that the data digest can be computed while the ACI streams in and the
+// check completes along with the download.
+//
+// Scope is what ACI signing uses in practice: v4 binary-document signatures made with RSA keys,
+// binary or ASCII-armored. The keyring is trusted as given (no web of trust, no expiry or
+// revocation checks).
+
+
+using Bytes = std::string;
+using KeyID = std::string;
+
+
+namespace openpgp {
+
+
+const int tag_signature = 2;
+const int tag_public_key = 6;
+const int tag_public_subkey = 14;
+
+const int sig_binary_document = 0x00;
+
+const int subpacket_issuer = 16;
+const int subpacket_issuer_fingerprint = 33;
+
+
+struct Packet {
+  int tag;
+  Bytes body;
+};
+
+
+inline uint32_t read_be(const Bytes& bytes, const size_t offset, const size_t length) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < length; i++) {
+    value = (value << 8) | static_cast<unsigned char>(bytes[offset + i]);
+  }
+  return value;
+}
+
+
+inline Try<std::vector<Packet>> parse_packets(const Bytes& data) {
+  std::vector<Packet> packets{};
+  size_t pos = 0;
+  while (pos < data.length()) {
+    const unsigned char header = data[pos++];
+    if (!(header & 0x80)) return Failure<std::vector<Packet>>("Invalid OpenPGP packet header");
+    int tag;
+    size_t length;
+    if (header & 0x40) {
+      tag = header & 0x3f;
+      if (pos >= data.length()) return Failure<std::vector<Packet>>("Truncated OpenPGP packet");
+      const unsigned char first = data[pos++];
+      if (first < 192) {
+        length = first;
+      } else if (first < 224) {
+        if (pos >= data.length()) return Failure<std::vector<Packet>>("Truncated OpenPGP packet");
+        length = ((first - 192) << 8) + static_cast<unsigned char>(data[pos++]) + 192;
+      } else if (first == 255) {
+        if (pos + 4 > data.length()) return Failure<std::vector<Packet>>("Truncated OpenPGP packet");
+        length = read_be(data, pos, 4);
+        pos += 4;
+      } else {
+        return Failure<std::vector<Packet>>("Partial length OpenPGP packets not supported");
+      }
+    } else {
+      tag = (header >> 2) & 0x0f;
+      const int length_type = header & 0x03;
+      if (length_type == 3) {
+        length = data.length() - pos;
+      } else {
+        const size_t octets = length_type == 0 ? 1 : length_type == 1 ? 2 : 4;
+        if (pos + octets > data.length()) {
+          return Failure<std::vector<Packet>>("Truncated OpenPGP packet");
+        }
+        length = read_be(data, pos, octets);
+        pos += octets;
+      }
+    }
+    if (pos + length > data.length()) return Failure<std::vector<Packet>>("Truncated OpenPGP packet");
+    packets.push_back(Packet{tag, data.substr(pos, length)});
+    pos += length;
+  }
+  return Result(packets);
+}
+
+
+// Reads an MPI at offset, advancing offset past it. Returns the magnitude bytes.
+inline Try<Bytes> read_mpi(const Bytes& body, size_t& offset) {
+  if (offset + 2 > body.length()) return Failure<Bytes>("Truncated MPI");
+  const size_t bits = read_be(body, offset, 2);
+  const size_t length = (bits + 7) / 8;
+  offset += 2;
+  if (offset + length > body.length()) return Failure<Bytes>("Truncated MPI");
+  const Bytes value = body.substr(offset, length);
+  offset += length;
+  return Result(value);
+}
+
+
+inline Try<Bytes> base64_decode(const std::string& text) {
+  static const std::string alphabet{
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"};
+  Bytes out{};
+  uint32_t accumulator = 0;
+  int bits = 0;
+  for (const char c : text) {
+    if (c == '=') break;
+    if (c == '\n' || c == '\r' || c == ' ' || c == '\t') continue;
+    const auto index = alphabet.find(c);
+    if (index == std::string::npos) return Failure<Bytes>("Invalid base64 in armored data");
+    accumulator = (accumulator << 6) | index;
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      out += static_cast<char>((accumulator >> bits) & 0xff);
+    }
+  }
+  return Result(out);
+}
+
+
+// Strips ASCII armor if present, otherwise returns data unchanged.
+inline Try<Bytes> dearmor(const Bytes& data) {
+  const std::string begin_marker{"-----BEGIN PGP "};
+  const auto begin = data.find(begin_marker);
+  if (begin == std::string::npos) return Result(data);
+  // Armor headers end with the first empty line.
+  auto body = data.find("\n\n", begin);
+  const auto crlf_body = data.find("\r\n\r\n", begin);
+  if (crlf_body != std::string::npos && (body == std::string::npos || crlf_body < body)) {
+    body = crlf_body + 2;
+  }
+  if (body == std::string::npos) return Failure<Bytes>("Malformed armor, no header terminator");
+  body += 2;
+  auto end = data.find("\n=", body - 1);
+  const auto end_marker = data.find("-----END PGP ", body);
+  if (end_marker == std::string::npos) return Failure<Bytes>("Malformed armor, no end marker");
+  if (end == std::string::npos || end > end_marker) end = end_marker;
+  return base64_decode(data.substr(body, end - body));
+}
+
+
+inline Bytes digest(const EVP_MD* md, const Bytes& data) {
+  unsigned char out[EVP_MAX_MD_SIZE];
+  unsigned int length = 0;
+  EVP_Digest(data.data(), data.length(), out, &length, md, nullptr);
+  return Bytes(reinterpret_cast<char*>(out), length);
+}
+
+
+inline const EVP_MD* hash_algorithm(const int id) {
+  switch (id) {
+    case 2: return EVP_sha1();
+    case 8: return EVP_sha256();
+    case 9: return EVP_sha384();
+    case 10: return EVP_sha512();
+    case 11: return EVP_sha224();
+    default: return nullptr;
+  }
+}
+
+
+} // namespace openpgp
+
+
+struct PublicKey {
+  KeyID key_id;
+  Bytes fingerprint;
+  std::shared_ptr<EVP_PKEY> key;
+};
+
+
+inline Try<PublicKey> public_key_from_packet(const Bytes& body) {
+  if (body.length() < 6 || body[0] != 4) return Failure<PublicKey>("Only v4 public keys supported");
+  const int algorithm = static_cast<unsigned char>(body[5]);
+  if (algorithm != 1 && algorithm != 3) {
+    return Failure<PublicKey>("Only RSA public keys supported, algorithm " + std::to_string(algorithm));
+  }
+  size_t offset = 6;
+  const auto n = openpgp::read_mpi(body, offset);
+  if (!n) return Failure<PublicKey>(n.failure_reason());
+  const auto e = openpgp::read_mpi(body, offset);
+  if (!e) return Failure<PublicKey>(e.failure_reason());
+
+  // v4 fingerprint: sha1 over 0x99, two-octet length, packet body. Key ID is its low 64 bits.
+  Bytes framed{"\x99"};
+  framed += static_cast<char>((body.length() >> 8) & 0xff);
+  framed += static_cast<char>(body.length() & 0xff);
+  framed += body;
+  const Bytes fingerprint = openpgp::digest(EVP_sha1(), framed);
+
+  std::unique_ptr<BIGNUM, decltype(&BN_free)> bn_n{
+      BN_bin2bn(reinterpret_cast<const unsigned char*>(n->data()), n->length(), nullptr), BN_free};
+  std::unique_ptr<BIGNUM, decltype(&BN_free)> bn_e{
+      BN_bin2bn(reinterpret_cast<const unsigned char*>(e->data()), e->length(), nullptr), BN_free};
+  std::unique_ptr<OSSL_PARAM_BLD, decltype(&OSSL_PARAM_BLD_free)> builder{
+      OSSL_PARAM_BLD_new(), OSSL_PARAM_BLD_free};
+  if (!bn_n || !bn_e || !builder ||
+      !OSSL_PARAM_BLD_push_BN(builder.get(), OSSL_PKEY_PARAM_RSA_N, bn_n.get()) ||
+      !OSSL_PARAM_BLD_push_BN(builder.get(), OSSL_PKEY_PARAM_RSA_E, bn_e.get())) {
+    return Failure<PublicKey>("Could not build RSA key parameters");
+  }
+  std::unique_ptr<OSSL_PARAM, decltype(&OSSL_PARAM_free)> params{
+      OSSL_PARAM_BLD_to_param(builder.get()), OSSL_PARAM_free};
+  std::unique_ptr<EVP_PKEY_CTX, decltype(&EVP_PKEY_CTX_free)> ctx{
+      EVP_PKEY_CTX_new_from_name(nullptr, "RSA", nullptr), EVP_PKEY_CTX_free};
+  EVP_PKEY* pkey = nullptr;
+  if (!params || !ctx ||
+      EVP_PKEY_fromdata_init(ctx.get()) != 1 ||
+      EVP_PKEY_fromdata(ctx.get(), &pkey, EVP_PKEY_PUBLIC_KEY, params.get()) != 1) {
+    return Failure<PublicKey>("Could not load RSA public key");
+  }
+
+  return Result(PublicKey{fingerprint.substr(fingerprint.length() - 8),
+                          fingerprint,
+                          std::shared_ptr<EVP_PKEY>(pkey, EVP_PKEY_free)});
+}
+
+
+// A set of trusted public keys, indexed by key ID. Primary keys and subkeys are both usable.
+class Keyring {
+private:
+  std::map<KeyID, PublicKey> keys{};
+
+public:
+  Status add(const Bytes& data) {
+    const auto binary = openpgp::dearmor(data);
+    if (!binary) return Error(binary.failure_reason());
+    const auto packets = openpgp::parse_packets(*binary);
+    if (!packets) return Error(packets.failure_reason());
+    for (const auto& packet : *packets) {
+      if (packet.tag != openpgp::tag_public_key && packet.tag != openpgp::tag_public_subkey) {
+        continue;
+      }
+      // Keys with algorithms we can't use are skipped rather than failing the whole keyring.
+      const auto key = public_key_from_packet(packet.body);
+      if (key) keys[key->key_id] = *key;
+    }
+    return Success();
+  }
+
+  Status add_file(const Path& path) {
+    std::ifstream file{path, std::ios::binary};
+    if (!file) return Error("Could not open keyring " + path);
+    std::stringstream contents{};
+    contents << file.rdbuf();
+    const auto added = add(contents.str());
+    if (!added) return Error(path + ": " + added.message);
+    return Success();
+  }
+
+  // Loads a single keyring file, or every file in a directory.
+  static Try<Keyring> from_path(const Path& path) {
+    Keyring keyring{};
+    const auto dir = os::open_dir(path);
+    if (!dir) {
+      const auto added = keyring.add_file(path);
+      if (!added) return Failure<Keyring>(added.message);
+      return Result(keyring);
+    }
+    for (struct dirent* entry = readdir(dir.get()); entry; entry = readdir(dir.get())) {
+      const std::string filename{entry->d_name};
+      if (filename == "." || filename == "..") continue;
+      const auto added = keyring.add_file(pathname::join(path, filename));
+      if (!added) return Failure<Keyring>(added.message);
+    }
+    return Result(keyring);
+  }
+
+  size_t size() const {
+    return keys.size();
+  }
+
+  const PublicKey* find(const KeyID& key_id) const {
+    const auto key = keys.find(key_id);
+    return key == keys.end() ? nullptr : &key->second;
+  }
+};
+
+
+struct Signature {
+  int hash_algorithm;
+  int public_key_algorithm;
+  KeyID issuer;
+  Bytes hashed_trailer;
+  Bytes hash_prefix;
+  Bytes value;
+};
+
+
+inline Try<Signature> parse_signature(const Bytes& data) {
+  const auto binary = openpgp::dearmor(data);
+  if (!binary) return Failure<Signature>(binary.failure_reason());
+  const auto packets = openpgp::parse_packets(*binary);
+  if (!packets) return Failure<Signature>(packets.failure_reason());
+  const Bytes* body = nullptr;
+  for (const auto& packet : *packets) {
+    if (packet.tag == openpgp::tag_signature) {
+      body = &packet.body;
+      break;
+    }
+  }
+  if (!body) return Failure<Signature>("No signature packet found");
+  if (body->length() < 6 || (*body)[0] != 4) return Failure<Signature>("Only v4 signatures supported");
+
+  Signature signature{};
+  const int type = static_cast<unsigned char>((*body)[1]);
+  if (type != openpgp::sig_binary_document) {
+    return Failure<Signature>("Only binary document signatures supported");
+  }
+  signature.public_key_algorithm = static_cast<unsigned char>((*body)[2]);
+  signature.hash_algorithm = static_cast<unsigned char>((*body)[3]);
+
+  const size_t hashed_length = openpgp::read_be(*body, 4, 2);
+  size_t offset = 6 + hashed_length;
+  if (offset + 2 > body->length()) return Failure<Signature>("Truncated signature");
+  const size_t unhashed_length = openpgp::read_be(*body, offset, 2);
+
+  // The v4 trailer: the hashed portion of the packet, then 0x04 0xff and its length.
+  signature.hashed_trailer = body->substr(0, offset);
+  signature.hashed_trailer += "\x04\xff";
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    signature.hashed_trailer += static_cast<char>((offset >> shift) & 0xff);
+  }
+
+  // Issuer can be in either subpacket area.
+  const auto find_issuer = [&signature](const Bytes& area) {
+    size_t pos = 0;
+    while (pos < area.length()) {
+      size_t length = static_cast<unsigned char>(area[pos++]);
+      if (length >= 192 && length < 255 && pos < area.length()) {
+        length = ((length - 192) << 8) + static_cast<unsigned char>(area[pos++]) + 192;
+      } else if (length == 255 && pos + 4 <= area.length()) {
+        length = openpgp::read_be(area, pos, 4);
+        pos += 4;
+      }
+      if (length == 0 || pos + length > area.length()) return;
+      const int type = area[pos] & 0x7f;
+      if (type == openpgp::subpacket_issuer && length == 9) {
+        signature.issuer = area.substr(pos + 1, 8);
+      } else if (type == openpgp::subpacket_issuer_fingerprint && length == 22) {
+        signature.issuer = area.substr(pos + 2 + 12, 8);
+      }
+      pos += length;
+    }
+  };
+  find_issuer(body->substr(6, hashed_length));
+  offset += 2;
+  if (offset + unhashed_length + 2 > body->length()) return Failure<Signature>("Truncated signature");
+  if (signature.issuer.empty()) find_issuer(body->substr(offset, unhashed_length));
+  offset += unhashed_length;
+  if (signature.issuer.empty()) return Failure<Signature>("Signature does not name its issuer");
+
+  signature.hash_prefix = body->substr(offset, 2);
+  offset += 2;
+  const auto value = openpgp::read_mpi(*body, offset);
+  if (!value) return Failure<Signature>(value.failure_reason());
+  signature.value = *value;
+  return Result(signature);
+}
+
+
+// A SignatureVerifier hashes the signed data as it streams in, with the hash algorithm the
+// detached signature names. The signature is small and requested first, so it is normally known
+// by the time the data starts. Until it has arrived, every hash algorithm a signature could name
+// is computed; from then on only its algorithm is carried forward. Updates never wait for it, so
+// a slow signature never stalls the transfer.
+class SignatureVerifier : public StreamCheck {
+private:
+  using DigestContext = std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)>;
+
+  const Keyring& keyring;
+  std::shared_future<Try<Bytes>> pending_signature;
+  std::shared_ptr<Signature> signature{};
+  std::map<int, DigestContext> digests{};
+  bool started{false};
+
+  void add_digest(const int algorithm) {
+    DigestContext context{EVP_MD_CTX_new(), EVP_MD_CTX_free};
+    EVP_DigestInit_ex(context.get(), openpgp::hash_algorithm(algorithm), nullptr);
+    digests.emplace(algorithm, std::move(context));
+  }
+
+  bool signature_arrived() const {
+    return pending_signature.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+  }
+
+  // Before the first byte: starts every digest the signature could need, or only its own when it
+  // has already arrived.
+  Status start() {
+    started = true;
+    if (signature_arrived()) {
+      const auto resolved = resolve_signature();
+      if (!resolved) return resolved;
+      add_digest(signature->hash_algorithm);
+      return Success();
+    }
+    for (const int algorithm : {8, 10, 9, 11, 2}) add_digest(algorithm);
+    return Success();
+  }
+
+  Status resolve_signature() {
+    const auto fetched = pending_signature.get();
+    if (!fetched) return Error("Could not retrieve signature: " + fetched.failure_reason());
+    const auto parsed = parse_signature(*fetched);
+    if (!parsed) return Error(parsed.failure_reason());
+    signature = parsed;
+    if (!openpgp::hash_algorithm(signature->hash_algorithm)) {
+      return Error("Unsupported signature hash algorithm " +
+                   std::to_string(signature->hash_algorithm));
+    }
+    // Drop the digests that turned out not to be needed.
+    for (auto it = digests.begin(); it != digests.end(); ) {
+      it = it->first == signature->hash_algorithm ? std::next(it) : digests.erase(it);
+    }
+    return Success();
+  }
+
+public:
+  SignatureVerifier(const Keyring& keyring,
+                    const std::shared_future<Try<Bytes>>& pending_signature)
+  : keyring(keyring),
+    pending_signature(pending_signature) {}
+
+  // The number of hash algorithms the data is being hashed with: 1 once the signature is known.
+  size_t hashing() const {
+    return digests.size();
+  }
+
+  virtual Status update(const void* data, const size_t size) {
+    if (!started) {
+      const auto begun = start();
+      if (!begun) return begun;
+    } else if (!signature && signature_arrived()) {
+      const auto resolved = resolve_signature();
+      if (!resolved) return resolved;
+    }
+    for (auto& digest : digests) {
+      if (EVP_DigestUpdate(digest.second.get(), data, size) != 1) {
+        return Error("Could not update signature digest");
+      }
+    }
+    return Success();
+  }
+
+  virtual Status finish() {
+    if (!started) {
+      const auto begun = start();
+      if (!begun) return begun;
+    }
+    if (!signature) {
+      const auto resolved = resolve_signature();
+      if (!resolved) return resolved;
+    }
+    const PublicKey* key = keyring.find(signature->issuer);
+    if (!key) return Error("Signature made by a key that is not in the keyring");
+
+    auto& context = digests.at(signature->hash_algorithm);
+    EVP_DigestUpdate(context.get(), signature->hashed_trailer.data(),
+                     signature->hashed_trailer.length());
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int md_length = 0;
+    EVP_DigestFinal_ex(context.get(), md, &md_length);
+    if (signature->hash_prefix.compare(0, 2, reinterpret_cast<char*>(md), 2) != 0) {
+      return Error("Bad signature, digest does not match");
+    }
+
+    std::unique_ptr<EVP_PKEY_CTX, decltype(&EVP_PKEY_CTX_free)> verify{
+        EVP_PKEY_CTX_new(key->key.get(), nullptr), EVP_PKEY_CTX_free};
+    // A stripped leading zero in the MPI still needs to be padded back to the modulus size.
+    Bytes value = signature->value;
+    const size_t modulus_length = EVP_PKEY_get_size(key->key.get());
+    if (value.length() < modulus_length) value.insert(0, modulus_length - value.length(), '\0');
+    if (!verify ||
+        EVP_PKEY_verify_init(verify.get()) != 1 ||
+        EVP_PKEY_CTX_set_rsa_padding(verify.get(), RSA_PKCS1_PADDING) != 1 ||
+        EVP_PKEY_CTX_set_signature_md(verify.get(),
+                                      openpgp::hash_algorithm(signature->hash_algorithm)) != 1 ||
+        EVP_PKEY_verify(verify.get(),
+                        reinterpret_cast<const unsigned char*>(value.data()), value.length(),
+                        md, md_length) != 1) {
+      return Error("Bad signature");
+    }
+    return Success();
+  }
+};
+
+
+// Detached signatures are a few hundred bytes; anything much larger is not one.
+const uint64_t max_signature_size = 16 * 1024;
+
+
+inline URI signature_uri(const URI& aci_uri) {
+  if (aci_uri.length() > aci_ext.length() &&
+      aci_uri.compare(aci_uri.length() - aci_ext.length(), aci_ext.length(), aci_ext) == 0) {
+    return aci_uri.substr(0, aci_uri.length() - aci_ext.length()) + sig_ext;
+  }
+  return aci_uri + sig_ext.substr(aci_ext.length());
+}
+
+
+// Retrieves an ACI and its detached signature concurrently, checking the signature (and any other
+// checks given) as the ACI is written. The signature is requested first so that, normally, the ACI
+// is hashed with its algorithm alone. On failure the ACI is removed; a bad or missing signature is
+// reported as a content fault.
+inline Status get_signed(const URI& uri,
+                         const Path& write_filename,
+                         const Keyring& keyring,
+                         std::vector<StreamCheck*> checks = {},
+                         https::Fault* fault = nullptr) {
+  const URI sig_uri = signature_uri(uri);
+  std::shared_future<Try<Bytes>> pending_signature = std::async(std::launch::async, [sig_uri]() {
+    return https::get_string(sig_uri, max_signature_size);
+  }).share();
+
+  SignatureVerifier verifier{keyring, pending_signature};
+  checks.push_back(&verifier);
+  return https::get(uri, write_filename, checks, appc::os::StagedFile::Options(), fault);
+}
+
+
+} // namespace signature
+} // namespace discovery
+} // namespace appc
@@ -19,6 +19,7 @@
 
 #include "appc/discovery/fetcher.h"
 #include "appc/discovery/resolver.h"
+#include "appc/util/metrics.h"
 #include "appc/util/namespace.h"
 #include "appc/util/try.h"
 
@@ -27,32 +28,82 @@ namespace appc {
 namespace discovery {
 
 
-// A Strategy provides a resolver and a fetcher to be used together.  A Strategy may or may not be a
-// factory for resolvers and fetchers.
-class AbstractStrategy {
-public:
-  virtual ~AbstractStrategy() {}
-  virtual std::shared_ptr<Resolver> get_resolver() = 0;
-  virtual std::shared_ptr<Fetcher> get_fetcher() = 0;
+#ifdef APPC_METRICS
+// A strategy's share of the discovery metrics, looked up once when the strategy is made.
+struct StrategyMetrics {
+  util::Histogram& resolve_seconds;
+  util::Histogram& fetch_seconds;
+  util::Counter& unresolved;
+  util::Counter& fetch_failures;
+  util::Counter& provided;
+
+  explicit StrategyMetrics(const std::string& name)
+  : resolve_seconds(util::metrics().histogram("appc_discovery_resolve_seconds",
+                                              "Time spent resolving, per strategy.",
+                                              {{"strategy", name}})),
+    fetch_seconds(util::metrics().histogram("appc_discovery_fetch_seconds",
+                                            "Time spent fetching, per strategy.",
+                                            {{"strategy", name}})),
+    unresolved(util::metrics().counter("appc_discovery_attempts_total",
+                                       "Images asked of each strategy, by outcome.",
+                                       {{"strategy", name}, {"outcome", "unresolved"}})),
+    fetch_failures(util::metrics().counter("appc_discovery_attempts_total",
+                                           "Images asked of each strategy, by outcome.",
+                                           {{"strategy", name}, {"outcome", "fetch_failed"}})),
+    provided(util::metrics().counter("appc_discovery_attempts_total",
+                                     "Images asked of each strategy, by outcome.",
+                                     {{"strategy", name}, {"outcome", "provided"}})) {}
 };
+#endif
 
 
-class Strategy : AbstractStrategy {
+// A Strategy provides a resolver and a fetcher to be used together. It owns them; copies share
+// them. The implementations are held directly, so a call is one virtual call with no reference
+// counting: get_resolver() and get_fetcher() return references to the held pointers.
+//
+// The name identifies the strategy in metrics; the builders name theirs after the strategy
+// ("local", "simple", ...).
+//
+// A Strategy is safe to use from any number of threads at once (see Resolver and Fetcher).
+class Strategy {
 private:
   std::shared_ptr<Resolver> resolver;
   std::shared_ptr<Fetcher> fetcher;
+  std::string name;
+  APPC_IF_METRICS(std::shared_ptr<const StrategyMetrics> metrics;)
 public:
-  Strategy(Resolver* resolver, Fetcher* fetcher)
+  Strategy(Resolver* resolver, Fetcher* fetcher, const std::string& name = "unnamed")
+  : resolver(resolver),
+    fetcher(fetcher),
+    name(name)
+    APPC_IF_METRICS(, metrics(std::make_shared<StrategyMetrics>(name))) {}
+
+  // For resolvers and fetchers that wrap another strategy's.
+  Strategy(const std::shared_ptr<Resolver>& resolver,
+           const std::shared_ptr<Fetcher>& fetcher,
+           const std::string& name = "unnamed")
   : resolver(resolver),
-    fetcher(fetcher) {}
-  virtual ~Strategy() {}
+    fetcher(fetcher),
+    name(name)
+    APPC_IF_METRICS(, metrics(std::make_shared<StrategyMetrics>(name))) {}
 
-  virtual std::shared_ptr<Resolver> get_resolver() {
+  const std::shared_ptr<Resolver>& get_resolver() const {
     return resolver;
   }
-  virtual std::shared_ptr<Fetcher> get_fetcher() {
+
+  const std::shared_ptr<Fetcher>& get_fetcher() const {
     return fetcher;
   }
+
+  const std::string& get_name() const {
+    return name;
+  }
+
+#ifdef APPC_METRICS
+  const StrategyMetrics& get_metrics() const {
+    return *metrics;
+  }
+#endif
 };
 
 
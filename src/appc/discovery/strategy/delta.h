@@ -0,0 +1,251 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "3rdparty/cdaylward/pathname.h"
+
+#include "appc/discovery/aci_name.h"
+#include "appc/discovery/delta.h"
+#include "appc/discovery/https.h"
+#include "appc/discovery/strategy.h"
+#include "appc/os/dir.h"
+#include "appc/util/namespace.h"
+#include "appc/util/status.h"
+#include "appc/util/try.h"
+
+
+namespace appc {
+namespace discovery {
+namespace strategy {
+namespace delta {
+
+
+// Delta Discovery - rebuild a new version of an image from the previous version already in the
+// local store, transferring only a binary delta (see appc/discovery/delta.h).
+//
+// If the store holds example.com/worker-1.0.0-linux-amd64.aci and 1.1.0 is wanted, fetch:
+//
+// https://example.com/worker-1.1.0-linux-amd64.aci.from-1.0.0.delta
+//
+// If there is no earlier version, or the delta cannot be fetched or does not rebuild the expected
+// image, the strategy fails and the next strategy (generally simple) fetches the full image.
+// Place this strategy after local and before simple, with the same storage location.
+
+
+const std::string delta_ext{".delta"};
+
+
+// Orders versions by dot-separated components, numerically where both components are numbers.
+inline int compare_versions(const std::string& left, const std::string& right) {
+  size_t l = 0, r = 0;
+  while (l < left.length() || r < right.length()) {
+    const size_t l_end = std::min(left.find('.', l), left.length());
+    const size_t r_end = std::min(right.find('.', r), right.length());
+    const std::string l_part = l < left.length() ? left.substr(l, l_end - l) : "";
+    const std::string r_part = r < right.length() ? right.substr(r, r_end - r) : "";
+    const bool numeric = !l_part.empty() && !r_part.empty() &&
+                         l_part.find_first_not_of("0123456789") == std::string::npos &&
+                         r_part.find_first_not_of("0123456789") == std::string::npos;
+    if (numeric && l_part.length() != r_part.length()) {
+      return l_part.length() < r_part.length() ? -1 : 1;
+    }
+    const int compared = l_part.compare(r_part);
+    if (compared != 0) return compared < 0 ? -1 : 1;
+    l = l_end + 1;
+    r = r_end + 1;
+  }
+  return 0;
+}
+
+
+// The stored image a delta URI (<image>.from-<previous version>.delta) is to be applied to: the
+// image with the previous version in place of the target's, in the target's directory. The name
+// and the version may both contain dashes, so the split between them is the one for which the
+// previous version is stored.
+inline Try<Path> base_image_path(const Path& target_path, const std::string& previous) {
+  const std::string filename = pathname::base(target_path);
+  // <name>-<version> and -<os>-<arch>.aci; os and arch have no dashes.
+  size_t suffix_start = filename.rfind('-');
+  if (suffix_start != std::string::npos && suffix_start > 0) {
+    suffix_start = filename.rfind('-', suffix_start - 1);
+  }
+  if (suffix_start == std::string::npos || suffix_start == 0) {
+    return Failure<Path>("Not an image file name: " + filename);
+  }
+  const std::string suffix = filename.substr(suffix_start);
+  for (size_t dash = filename.rfind('-', suffix_start - 1);
+       dash != std::string::npos && dash > 0;
+       dash = filename.rfind('-', dash - 1)) {
+    const Path candidate = pathname::join(pathname::dir(target_path),
+                                          filename.substr(0, dash + 1) + previous + suffix);
+    struct stat candidate_stat;
+    if (stat(candidate.c_str(), &candidate_stat) == 0 && S_ISREG(candidate_stat.st_mode)) {
+      return Result(candidate);
+    }
+  }
+  return Failure<Path>("No local " + previous + " of " + filename + " to apply a delta to");
+}
+
+
+class Resolver final : public appc::discovery::Resolver {
+private:
+  const Path base_path;
+  const URI remote_prefix;
+public:
+  Resolver(const Path& base_path,
+           const URI& remote_prefix)
+  : base_path(base_path),
+    remote_prefix(remote_prefix) {}
+
+  virtual Try<URI> resolve(const Name& name, const Labels& labels) {
+    const auto aci_name = render_aci_name(name, labels);
+    if (!aci_name) return Failure<URI>(aci_name.failure_reason());
+
+    const Path target_path = pathname::join(base_path, from_result(aci_name));
+    const Path store_dir = pathname::dir(target_path);
+    const std::string& version = labels.at("version");
+    const std::string prefix = pathname::base(name) + "-";
+    const std::string suffix = "-" + ns::join("-", labels.at("os"), labels.at("arch")) + aci_ext;
+
+    std::string previous{};
+    const auto dir = os::open_dir(store_dir);
+    if (!dir) return Failure<URI>("No local images of " + name + " to apply a delta to");
+    for (struct dirent* entry = readdir(dir.get()); entry; entry = readdir(dir.get())) {
+      const std::string filename{entry->d_name};
+      if (filename.length() <= prefix.length() + suffix.length() ||
+          filename.compare(0, prefix.length(), prefix) != 0 ||
+          filename.compare(filename.length() - suffix.length(), suffix.length(), suffix) != 0) {
+        continue;
+      }
+      const std::string candidate = filename.substr(
+          prefix.length(), filename.length() - prefix.length() - suffix.length());
+      if (compare_versions(candidate, version) < 0 &&
+          (previous.empty() || compare_versions(candidate, previous) > 0)) {
+        previous = candidate;
+      }
+    }
+    if (previous.empty()) return Failure<URI>("No earlier version of " + name + " stored locally");
+
+    return Result(remote_prefix + from_result(aci_name) + ".from-" + previous + delta_ext);
+  }
+};
+
+
+// fetch(delta uri) -> local uri of the rebuilt image. Everything needed is in the URI: the image
+// it rebuilds, and the version it is rebuilt from.
+class Fetcher final : public appc::discovery::Fetcher {
+private:
+  const Path base_path;
+  const URI remote_prefix;
+
+  Try<URI> fetch(const URI& uri, const Option<Expectation>& expected) {
+    if (!valid_prefix(remote_prefix, uri)) {
+      return Failure<URI>("URI does not begin with " + remote_prefix + ", will not fetch " + uri);
+    }
+    const std::string from{".from-"};
+    const size_t from_start = uri.rfind(from);
+    if (uri.length() <= delta_ext.length() ||
+        uri.compare(uri.length() - delta_ext.length(), delta_ext.length(), delta_ext) != 0 ||
+        from_start == std::string::npos || from_start < remote_prefix.length()) {
+      return Failure<URI>("Not a delta URI: " + uri);
+    }
+    const Path aci_name = uri.substr(remote_prefix.length(), from_start - remote_prefix.length());
+    const std::string previous = uri.substr(
+        from_start + from.length(), uri.length() - delta_ext.length() - from_start - from.length());
+    const Path target_path = pathname::join(base_path, aci_name);
+    if (previous.empty() || previous.find('/') != std::string::npos ||
+        !pathname::is_absolute(target_path) || pathname::has_dot_dot(target_path)) {
+      return Failure<URI>("Will not store image at " + target_path);
+    }
+    const auto base_image = base_image_path(target_path, previous);
+    if (!base_image) return Failure<URI>(base_image.failure_reason());
+
+    // Named for this fetch, so that concurrent fetches of the same image do not share it.
+    static std::atomic<uint64_t> fetches{0};
+    const Path delta_path = target_path + ".from-" + previous + delta_ext + "." +
+                            std::to_string(getpid()) + "." + std::to_string(fetches++);
+    const Status fetched = https::get(uri, delta_path);
+    if (!fetched) return Failure<URI>(fetched.message);
+
+    const Status applied = appc::discovery::delta::apply(*base_image,
+                                                        delta_path,
+                                                        target_path,
+                                                        expected);
+    unlink(delta_path.c_str());
+    if (!applied) return Failure<URI>(applied.message);
+
+    return Result(file_prefix + target_path);
+  }
+public:
+  Fetcher(const Path& base_path,
+          const URI& remote_prefix)
+  : base_path(base_path),
+    remote_prefix(remote_prefix) {}
+
+  virtual Try<URI> fetch(const URI& uri) {
+    return fetch(uri, None<Expectation>());
+  }
+
+  // The rebuilt image is verified as it is written, no need to read it back.
+  virtual Try<URI> fetch(const URI& uri, const Expectation& expected) {
+    return fetch(uri, Some(expected));
+  }
+};
+
+
+class StrategyBuilder {
+private:
+  const URI base_uri;
+  const URI remote_prefix;
+public:
+  StrategyBuilder(const URI& base_uri = "",
+                  const URI& remote_prefix = https_prefix)
+  : base_uri(base_uri),
+    remote_prefix(remote_prefix) {}
+
+  StrategyBuilder with_storage_base_uri(const URI& base_uri) {
+    return StrategyBuilder(base_uri, remote_prefix);
+  }
+
+  // Where deltas are served from, https:// by default (deltas sit next to the images).
+  StrategyBuilder with_remote_prefix(const URI& remote_prefix) {
+    return StrategyBuilder(base_uri, remote_prefix);
+  }
+
+  Try<Strategy> build() {
+    if (!valid_prefix(file_prefix, base_uri)) {
+      return Failure<Strategy>(
+        "storage_base_uri must begin with " + file_prefix + ", is " + base_uri);
+    }
+    const Path path = base_uri.substr(file_prefix.length());
+    return Result(Strategy(new Resolver(path, remote_prefix),
+                           new Fetcher(path, remote_prefix),
+                           "delta"));
+  }
+};
+
+
+} // namespace delta
+} // namespace strategy
+} // namespace discovery
+} // namespace appc
@@ -19,12 +19,14 @@
 
 #include <cerrno>
 #include <cstring>
+#include <memory>
 #include <sys/stat.h>
 
 #include "3rdparty/cdaylward/pathname.h"
 
 #include "appc/discovery/aci_name.h"
 #include "appc/discovery/strategy.h"
+#include "appc/os/file_index.h"
 #include "appc/util/namespace.h"
 #include "appc/util/option.h"
 #include "appc/util/status.h"
@@ -42,64 +44,145 @@ namespace local {
 
 // Given a name and labels, render a local location for the common
 // (simple) ACI name: <storage base path>/{name}-{version}-{os}-{arch}.aci
-class Resolver : public appc::discovery::Resolver {
+class Resolver final : public appc::discovery::Resolver {
 private:
-  class Impl : public appc::discovery::AbstractResolver {
-  private:
-    const URI base_uri;
-  public:
-    Impl(const URI& base_uri)
-    : base_uri(base_uri) {}
-
-    virtual Try<URI> resolve(const Name& name, const Labels& labels) {
-      const auto aci_name = render_aci_name(name, labels);
-      if (!aci_name) return Failure<URI>(aci_name.failure_reason());
-      return Result(ns::join("/", base_uri, from_result(aci_name)));
-    }
-  };
+  const URI base_uri;
 public:
   Resolver(const URI& base_uri)
-  : appc::discovery::Resolver(new Impl(base_uri)) {}
+  : base_uri(base_uri) {}
+
+  virtual Try<URI> resolve(const Name& name, const Labels& labels) {
+    URI uri = base_uri + "/";
+    const auto rendered = append_aci_name(uri, name, labels);
+    if (!rendered) return Failure<URI>(rendered.message);
+    return Result(uri);
+  }
+
+  virtual std::vector<Try<URI>> resolve_all(const std::vector<ImageReference>& references) {
+    return render_aci_uris(base_uri + "/", references);
+  }
 };
 
 
 // A Fetcher generally turns a remote uri into a local uri
 // (Retrieve an image and return its on-disk location)
 // Here we check if it exists.
-class Fetcher : public appc::discovery::Fetcher {
+class Fetcher final : public appc::discovery::Fetcher {
+public:
+  using appc::discovery::Fetcher::fetch;
+
+  virtual Try<URI> fetch(const URI& uri) {
+    if (!valid_prefix(file_prefix, uri)) {
+      return Failure<URI>("URI must begin with " + file_prefix + ", cannot fetch " + uri);
+    }
+    Path path = uri.substr(file_prefix.length());
+    if (!pathname::is_absolute(path)) {
+      return Failure<URI>("URI did not contain absolute path, will not fetch " + path);
+    }
+    struct stat path_stat;
+    if (stat(path.c_str(), &path_stat) != 0) {
+      return Failure<URI>(uri + " " + strerror(errno));
+    }
+    return Result(uri);
+  }
+};
+
+
+// As Fetcher, but answers from an inotify-maintained index of the storage directory instead of
+// calling stat for each request (see appc::os::FileIndex), falling back to stat for paths outside
+// the storage directory and whenever the index cannot answer.
+class IndexedFetcher final : public appc::discovery::Fetcher {
 private:
-  class Impl : public appc::discovery::AbstractFetcher {
-  public:
-    virtual Try<URI> fetch(const URI& uri) {
-      if (!valid_prefix(file_prefix, uri)) {
-        return Failure<URI>("URI must begin with " + file_prefix + ", cannot fetch " + uri);
-      }
-      Path path = uri.substr(file_prefix.length());
-      if (!pathname::is_absolute(path)) {
-        return Failure<URI>("URI did not contain absolute path, will not fetch " + path);
-      }
-      struct stat path_stat;
-      if (stat(path.c_str(), &path_stat) != 0) {
-        return Failure<URI>(uri + " " + strerror(errno));
+  std::unique_ptr<os::FileIndex> index;
+public:
+  using appc::discovery::Fetcher::fetch;
+
+  IndexedFetcher(const Path& root)
+  : index(new os::FileIndex(root)) {
+    // Failure leaves the index answering unknown, i.e. plain stat.
+    index->open();
+  }
+
+  virtual Try<URI> fetch(const URI& uri) {
+    if (!valid_prefix(file_prefix, uri)) {
+      return Failure<URI>("URI must begin with " + file_prefix + ", cannot fetch " + uri);
+    }
+    Path path = uri.substr(file_prefix.length());
+    if (!pathname::is_absolute(path)) {
+      return Failure<URI>("URI did not contain absolute path, will not fetch " + path);
+    }
+    return answer(uri, path, index->contains(path));
+  }
+
+  // One pass over the index for the whole batch.
+  virtual std::vector<Try<URI>> fetch_all(const std::vector<URI>& uris) {
+    std::vector<Path> paths{};
+    paths.reserve(uris.size());
+    for (const auto& uri : uris) {
+      const Path path = valid_prefix(file_prefix, uri) ? uri.substr(file_prefix.length()) : "";
+      paths.push_back(pathname::is_absolute(path) ? path : "");
+    }
+    const auto presence = index->contains_all(paths);
+    std::vector<Try<URI>> fetched{};
+    fetched.reserve(uris.size());
+    for (size_t i = 0; i < uris.size(); i++) {
+      fetched.push_back(paths[i].empty() ? fetch(uris[i]) : answer(uris[i], paths[i], presence[i]));
+    }
+    return fetched;
+  }
+
+  // One pass over the index finds the candidates that are present.
+  virtual Try<URI> fetch_first(const std::vector<URI>& uris, const Option<Expectation>& expected) {
+    const auto fetched = fetch_all(uris);
+    std::string reasons{};
+    for (size_t i = 0; i < uris.size(); i++) {
+      if (fetched[i] && !expected) return fetched[i];
+      if (fetched[i]) {
+        const auto verified = verify_file(uri_file_path(from_result(fetched[i])), *expected);
+        if (verified) return fetched[i];
+        reasons += (reasons.empty() ? "" : "; ") + verified.message;
+      } else {
+        reasons += (reasons.empty() ? "" : "; ") + fetched[i].failure_reason();
       }
-      return Result(uri);
     }
-  };
-public:
-  Fetcher()
-  : appc::discovery::Fetcher(new Impl()) {}
+    return Failure<URI>(uris.empty() ? "Nothing to fetch" : reasons);
+  }
+
+private:
+  Try<URI> answer(const URI& uri, const Path& path, const os::FileIndex::Presence presence) {
+    switch (presence) {
+      case os::FileIndex::Presence::present:
+        return Result(uri);
+      case os::FileIndex::Presence::absent:
+        return Failure<URI>(uri + " " + strerror(ENOENT));
+      case os::FileIndex::Presence::unknown:
+        break;
+    }
+    struct stat path_stat;
+    if (stat(path.c_str(), &path_stat) != 0) {
+      return Failure<URI>(uri + " " + strerror(errno));
+    }
+    return Result(uri);
+  }
 };
 
 
 class StrategyBuilder {
 private:
   const URI base_uri;
+  const bool indexed;
 public:
-  StrategyBuilder(const URI& base_uri = "")
-  : base_uri(base_uri) {}
+  StrategyBuilder(const URI& base_uri = "", const bool indexed = false)
+  : base_uri(base_uri),
+    indexed(indexed) {}
 
   StrategyBuilder with_storage_base_uri(const URI& base_uri) {
-    return StrategyBuilder(base_uri);
+    return StrategyBuilder(base_uri, indexed);
+  }
+
+  // Check for images with an IndexedFetcher rather than a stat per request.
+  StrategyBuilder with_index(const bool indexed = true) {
+    return StrategyBuilder(base_uri, indexed);
   }
 
   Try<appc::discovery::Strategy> build() {
@@ -107,8 +190,14 @@ public:
       return Failure<appc::discovery::Strategy>(
         "storage_base_uri must begin with " + file_prefix + ", is " + base_uri);
     }
+    if (indexed) {
+      return Result(appc::discovery::Strategy(
+          new Resolver(base_uri),
+          new IndexedFetcher(base_uri.substr(file_prefix.length()))));
+    }
     return Result(appc::discovery::Strategy(new Resolver(base_uri),
-                                            new Fetcher()));
+                                            new Fetcher(),
+                                            "local"));
   }
 };
 
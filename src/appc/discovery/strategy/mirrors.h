@@ -0,0 +1,517 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include "3rdparty/cdaylward/pathname.h"
+
+#include "appc/discovery/aci_name.h"
+#include "appc/discovery/https.h"
+#include "appc/discovery/signature.h"
+#include "appc/discovery/strategy.h"
+#include "appc/os/staged_file.h"
+#include "appc/util/log.h"
+#include "appc/util/option.h"
+#include "appc/util/snapshot.h"
+#include "appc/util/status.h"
+#include "appc/util/try.h"
+
+
+namespace appc {
+namespace discovery {
+namespace strategy {
+namespace mirrors {
+
+
+// Mirror Discovery - simple discovery against a list of mirrors, fastest healthy mirror first.
+//
+// Given mirrors https://a.example.com/ and https://b.example.com/, example.com/worker 1.0.0 is
+// fetched from whichever of
+//
+// https://a.example.com/example.com/worker-1.0.0-linux-amd64.aci
+// https://b.example.com/example.com/worker-1.0.0-linux-amd64.aci
+//
+// is expected to finish first, by EWMA estimates of each mirror's time to first byte and throughput
+// from completed fetches. A failed fetch falls back to the next mirror and demotes the failed one.
+// Every probe interval one fetch goes to the mirror with the stalest estimate, so a recovered or
+// faster mirror is noticed. Images are stored as the simple strategy stores them, so local
+// discovery against the same storage works as a cache.
+
+
+struct Estimate {
+  uint64_t samples{0};
+  // Seconds to first byte.
+  double latency{0};
+  // Bytes per second after the first byte.
+  double throughput{0};
+  // Consecutive failures, reset by a success.
+  uint32_t failures{0};
+  // Seconds since the epoch of the last fetch, successful or not.
+  int64_t last_used{0};
+};
+
+
+// Estimates for a list of mirrors. Thread-safe. The list may be replaced while in use
+// (set_mirrors()): fetches under way keep the list they started with, later ones see the new one.
+// With a state path, recorded estimates are written at most every save_interval seconds, and any
+// not yet written are written by save() and on destruction.
+class Ranking {
+public:
+  using Clock = std::function<int64_t()>;
+  using Mirrors = std::shared_ptr<const std::vector<URI>>;
+
+  static int64_t system_clock() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+  }
+
+private:
+  util::Snapshot<std::vector<URI>> mirrors;
+  const Path state_path;
+  const double alpha;
+  const int64_t probe_interval;
+  const Clock now;
+  const int64_t save_interval;
+  int64_t last_probe;
+
+  std::mutex mutex{};
+  std::map<URI, Estimate> estimates{};
+  // Typical image size, to weigh latency against throughput.
+  double typical_size{16 << 20};
+  // Whether estimates changed since they were last written, and when that was.
+  bool unsaved{false};
+  int64_t last_save{std::numeric_limits<int64_t>::min()};
+  // Orders writers, so that an older snapshot never replaces a newer one.
+  std::mutex save_mutex{};
+
+  double expected_seconds(const Estimate& estimate) const {
+    return estimate.latency + (estimate.throughput > 0 ? typical_size / estimate.throughput : 0);
+  }
+
+  // Requires mutex. Marks the estimates changed, and whether it is time to write them.
+  bool save_due() {
+    unsaved = true;
+    if (state_path.empty()) return false;
+    const int64_t current = now();
+    if (last_save != std::numeric_limits<int64_t>::min() && current - last_save < save_interval) {
+      return false;
+    }
+    last_save = current;
+    return true;
+  }
+
+public:
+  Ranking(const std::vector<URI>& mirrors,
+          const Path& state_path = "",
+          const double alpha = 0.3,
+          const int64_t probe_interval = 600,
+          const Clock& now = system_clock,
+          const int64_t save_interval = 10)
+  : mirrors(std::make_shared<const std::vector<URI>>(mirrors)),
+    state_path(state_path),
+    alpha(alpha),
+    probe_interval(probe_interval),
+    now(now),
+    save_interval(save_interval),
+    last_probe(now()) {}
+
+  ~Ranking() {
+    const auto saved = save();
+    if (!saved) APPC_LOG(warning, "mirrors", saved.message);
+  }
+
+  // Writes the estimates if they changed since they were last written. The file is written
+  // outside the lock, from a copy, so fetches are never held up by the disk.
+  Status save() {
+    if (state_path.empty()) return Success();
+    std::lock_guard<std::mutex> writing{save_mutex};
+    std::vector<std::pair<URI, Estimate>> listed{};
+    double size = 0;
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      if (!unsaved) return Success();
+      unsaved = false;
+      size = typical_size;
+      for (const auto& mirror : *mirrors.load()) listed.emplace_back(mirror, estimates[mirror]);
+    }
+    std::ostringstream out{};
+    out.precision(17);
+    out << "appc-mirrors 1\n";
+    out << "size " << size << "\n";
+    for (const auto& entry : listed) {
+      const Estimate& estimate = entry.second;
+      out << "mirror " << entry.first << " " << estimate.samples << " " << estimate.latency << " "
+          << estimate.throughput << " " << estimate.failures << " " << estimate.last_used << "\n";
+    }
+    // Not worth a sync per write, a crash costs at most the latest samples.
+    const auto published = appc::os::publish_file(state_path, out.str(), false);
+    if (!published) {
+      std::lock_guard<std::mutex> lock{mutex};
+      unsaved = true;
+    }
+    return published;
+  }
+
+  Mirrors get_mirrors() const {
+    return mirrors.load();
+  }
+
+  // Estimates of mirrors still listed are kept, and a mirror listed again later starts over.
+  Status set_mirrors(const std::vector<URI>& replacement) {
+    if (replacement.empty()) return Error("No mirrors configured");
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      mirrors.publish(std::make_shared<const std::vector<URI>>(replacement));
+      for (auto estimate = estimates.begin(); estimate != estimates.end();) {
+        if (std::find(replacement.begin(), replacement.end(), estimate->first) == replacement.end()) {
+          estimate = estimates.erase(estimate);
+        } else {
+          ++estimate;
+        }
+      }
+      unsaved = true;
+    }
+    return save();
+  }
+
+  // Estimates for mirrors no longer listed are dropped. A missing state file is not an error.
+  Status load() {
+    if (state_path.empty()) return Success();
+    std::ifstream in{state_path};
+    if (!in) return Success();
+    std::string line;
+    if (!std::getline(in, line) || line != "appc-mirrors 1") {
+      return Error(state_path + " is not a mirror estimates file");
+    }
+    std::lock_guard<std::mutex> lock{mutex};
+    const auto listed = mirrors.load();
+    while (std::getline(in, line)) {
+      std::istringstream fields{line};
+      std::string kind;
+      fields >> kind;
+      if (kind == "size") {
+        fields >> typical_size;
+      } else if (kind == "mirror") {
+        URI mirror;
+        Estimate estimate{};
+        fields >> mirror >> estimate.samples >> estimate.latency >> estimate.throughput
+               >> estimate.failures >> estimate.last_used;
+        if (!fields) return Error("Malformed mirror estimate in " + state_path + ": " + line);
+        if (std::find(listed->begin(), listed->end(), mirror) != listed->end()) {
+          estimates[mirror] = estimate;
+        }
+      }
+    }
+    return Success();
+  }
+
+  Estimate estimate(const URI& mirror) {
+    std::lock_guard<std::mutex> lock{mutex};
+    return estimates[mirror];
+  }
+
+  // The mirrors in the order they should be tried. Healthy mirrors come first, fastest first,
+  // then mirrors without estimates in list order, then mirrors that last failed. When a probe is
+  // due, the mirror used least recently goes first instead.
+  std::vector<URI> ranked() {
+    return ranked(mirrors.load());
+  }
+
+  // As above, of the given list (one from get_mirrors()).
+  std::vector<URI> ranked(const Mirrors& listed) {
+    std::lock_guard<std::mutex> lock{mutex};
+    std::vector<URI> order{*listed};
+    const auto rank = [this](const URI& mirror) {
+      const Estimate& estimate = estimates[mirror];
+      return std::make_tuple(estimate.failures > 0 ? 2 : estimate.samples == 0 ? 1 : 0,
+                             estimate.failures,
+                             expected_seconds(estimate));
+    };
+    std::stable_sort(order.begin(), order.end(), [&rank](const URI& left, const URI& right) {
+      return rank(left) < rank(right);
+    });
+
+    const int64_t current = now();
+    if (order.size() > 1 && current - last_probe >= probe_interval) {
+      const auto stalest = std::min_element(
+          order.begin() + 1, order.end(), [this](const URI& left, const URI& right) {
+            return estimates[left].last_used < estimates[right].last_used;
+          });
+      if (estimates[*stalest].last_used + probe_interval <= current) {
+        std::rotate(order.begin(), stalest, stalest + 1);
+        last_probe = current;
+      }
+    }
+    return order;
+  }
+
+  Status record_success(const URI& mirror,
+                        const double latency,
+                        const uint64_t bytes,
+                        const double transfer_seconds) {
+    std::unique_lock<std::mutex> lock{mutex};
+    Estimate& estimate = estimates[mirror];
+    const double throughput = transfer_seconds > 0 ? bytes / transfer_seconds : 0;
+    if (estimate.samples == 0) {
+      estimate.latency = latency;
+      estimate.throughput = throughput;
+    } else {
+      estimate.latency += alpha * (latency - estimate.latency);
+      if (throughput > 0) estimate.throughput += alpha * (throughput - estimate.throughput);
+    }
+    estimate.samples++;
+    estimate.failures = 0;
+    estimate.last_used = now();
+    typical_size += alpha * (bytes - typical_size);
+    const bool due = save_due();
+    lock.unlock();
+    return due ? save() : Success();
+  }
+
+  Status record_failure(const URI& mirror) {
+    std::unique_lock<std::mutex> lock{mutex};
+    Estimate& estimate = estimates[mirror];
+    estimate.failures++;
+    estimate.last_used = now();
+    const bool due = save_due();
+    lock.unlock();
+    return due ? save() : Success();
+  }
+};
+
+
+// Times a transfer: first byte and total bytes.
+class Timing : public StreamCheck {
+private:
+  using clock = std::chrono::steady_clock;
+  const clock::time_point started{clock::now()};
+  clock::time_point first_byte{};
+  clock::time_point finished{};
+  uint64_t bytes{0};
+
+  static double seconds(const clock::duration& duration) {
+    return std::chrono::duration<double>(duration).count();
+  }
+
+public:
+  virtual Status update(const void*, const size_t size) {
+    if (bytes == 0) first_byte = clock::now();
+    bytes += size;
+    return Success();
+  }
+
+  virtual Status finish() {
+    finished = clock::now();
+    if (bytes == 0) first_byte = finished;
+    return Success();
+  }
+
+  double latency() const {
+    return seconds(first_byte - started);
+  }
+
+  double transfer_seconds() const {
+    return seconds(finished - first_byte);
+  }
+
+  uint64_t size() const {
+    return bytes;
+  }
+};
+
+
+class Resolver final : public appc::discovery::Resolver {
+private:
+  const std::shared_ptr<Ranking> ranking;
+public:
+  Resolver(const std::shared_ptr<Ranking>& ranking)
+  : ranking(ranking) {}
+
+  virtual Try<URI> resolve(const Name& name, const Labels& labels) {
+    const auto aci_name = render_aci_name(name, labels);
+    if (!aci_name) return Failure<URI>(aci_name.failure_reason());
+    return Result(ranking->ranked().front() + from_result(aci_name));
+  }
+};
+
+
+// fetch(mirror uri) -> local uri, trying the other mirrors if the resolved one fails.
+class Fetcher final : public appc::discovery::Fetcher {
+private:
+  const Path base_path;
+  const std::shared_ptr<Ranking> ranking;
+  const std::shared_ptr<signature::Keyring> keyring;
+
+  Status attempt(const URI& mirror,
+                 const Path& aci_name,
+                 const Path& full_path,
+                 const Option<Expectation>& expected) {
+    const URI uri = mirror + aci_name;
+    Timing timing{};
+    std::vector<StreamCheck*> checks{&timing};
+    // Verifiers are stateful, each attempt gets its own.
+    std::unique_ptr<ImageVerifier> verifier{};
+    if (expected) {
+      verifier.reset(new ImageVerifier(*expected));
+      const auto supported = verifier->supported();
+      if (!supported) return supported;
+      checks.push_back(verifier.get());
+    }
+    https::Fault fault{};
+    const Status fetched =
+        keyring ? signature::get_signed(uri, full_path, *keyring, checks, &fault)
+                : https::get(uri, full_path, checks, appc::os::StagedFile::Options(), &fault);
+    // Only the mirror's own failures demote it: a full disk here, or an image that does not match
+    // what was asked for, says nothing about how well it serves.
+    if (!fetched && fault != https::Fault::transfer) return fetched;
+    const Status recorded = fetched
+        ? ranking->record_success(mirror, timing.latency(), timing.size(), timing.transfer_seconds())
+        : ranking->record_failure(mirror);
+    if (!recorded) APPC_LOG(warning, "mirrors", recorded.message);
+    return fetched;
+  }
+
+  Try<URI> fetch(const URI& uri, const Option<Expectation>& expected) {
+    // The whole fetch uses this list, even if the mirrors are replaced meanwhile.
+    const auto mirrors = ranking->get_mirrors();
+    const auto resolved = std::find_if(mirrors->begin(), mirrors->end(), [&uri](const URI& mirror) {
+      return valid_prefix(mirror, uri);
+    });
+    if (resolved == mirrors->end()) {
+      return Failure<URI>("URI is not on a configured mirror, will not fetch " + uri);
+    }
+    const Path aci_name = uri.substr(resolved->length());
+    const Path full_path = pathname::join(base_path, aci_name);
+    if (!pathname::is_absolute(full_path) || pathname::has_dot_dot(full_path)) {
+      return Failure<URI>("URI did not contain absolute path, will not store " + full_path);
+    }
+
+    std::vector<URI> order = ranking->ranked(mirrors);
+    order.erase(std::find(order.begin(), order.end(), *resolved));
+    order.insert(order.begin(), *resolved);
+
+    std::string failures{};
+    for (const auto& mirror : order) {
+      const Status fetched = attempt(mirror, aci_name, full_path, expected);
+      if (fetched) return Result(file_prefix + full_path);
+      failures += "\n  " + mirror + ": " + fetched.message;
+    }
+    return Failure<URI>("All mirrors failed for " + aci_name + ":" + failures);
+  }
+
+public:
+  Fetcher(const Path& base_path,
+          const std::shared_ptr<Ranking>& ranking,
+          const std::shared_ptr<signature::Keyring>& keyring = nullptr)
+  : base_path(base_path),
+    ranking(ranking),
+    keyring(keyring) {}
+
+  virtual Try<URI> fetch(const URI& uri) {
+    return fetch(uri, None<Expectation>());
+  }
+
+  virtual Try<URI> fetch(const URI& uri, const Expectation& expected) {
+    return fetch(uri, Some(expected));
+  }
+};
+
+
+class StrategyBuilder {
+private:
+  const URI base_uri;
+  const std::vector<URI> mirrors;
+  const Path state_path;
+  const Path keyring_path;
+  const std::shared_ptr<Ranking> ranking;
+public:
+  StrategyBuilder(const URI& base_uri = "",
+                  const std::vector<URI>& mirrors = {},
+                  const Path& state_path = "",
+                  const Path& keyring_path = "",
+                  const std::shared_ptr<Ranking>& ranking = nullptr)
+  : base_uri(base_uri),
+    mirrors(mirrors),
+    state_path(state_path),
+    keyring_path(keyring_path),
+    ranking(ranking) {}
+
+  StrategyBuilder with_storage_base_uri(const URI& base_uri) {
+    return StrategyBuilder(base_uri, mirrors, state_path, keyring_path, ranking);
+  }
+
+  // Prefixes the ACI name is appended to, e.g. https://mirror.example.com/
+  StrategyBuilder with_mirrors(const std::vector<URI>& mirrors) {
+    return StrategyBuilder(base_uri, mirrors, state_path, keyring_path, ranking);
+  }
+
+  // Where estimates are kept across restarts. Without one they are kept in memory only.
+  StrategyBuilder with_state_path(const Path& state_path) {
+    return StrategyBuilder(base_uri, mirrors, state_path, keyring_path, ranking);
+  }
+
+  StrategyBuilder with_keyring(const Path& keyring_path) {
+    return StrategyBuilder(base_uri, mirrors, state_path, keyring_path, ranking);
+  }
+
+  // Use ranking, its mirrors and its state, instead of the mirrors and state path given. The
+  // caller keeps it to change the mirrors later (set_mirrors()) without rebuilding the strategy.
+  StrategyBuilder with_ranking(const std::shared_ptr<Ranking>& ranking) {
+    return StrategyBuilder(base_uri, mirrors, state_path, keyring_path, ranking);
+  }
+
+  Try<Strategy> build() {
+    if (!valid_prefix(file_prefix, base_uri)) {
+      return Failure<Strategy>(
+        "storage_base_uri must begin with " + file_prefix + ", is " + base_uri);
+    }
+    if (!ranking && mirrors.empty()) return Failure<Strategy>("No mirrors configured");
+    const Path path = base_uri.substr(file_prefix.length());
+    std::shared_ptr<signature::Keyring> keyring{};
+    if (!keyring_path.empty()) {
+      const auto loaded = signature::Keyring::from_path(keyring_path);
+      if (!loaded) return Failure<Strategy>(loaded.failure_reason());
+      if (loaded->size() == 0) return Failure<Strategy>("No usable keys in " + keyring_path);
+      keyring = loaded;
+    }
+    auto used = ranking;
+    if (!used) {
+      used = std::make_shared<Ranking>(mirrors, state_path);
+      const auto loaded = used->load();
+      if (!loaded) return Failure<Strategy>(loaded.message);
+    }
+    return Result(Strategy(new Resolver(used),
+                           new Fetcher(path, used, keyring),
+                           "mirrors"));
+  }
+};
+
+
+} // namespace mirrors
+} // namespace strategy
+} // namespace discovery
+} // namespace appc
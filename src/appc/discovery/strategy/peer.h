@@ -0,0 +1,666 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+
+#include "3rdparty/cdaylward/pathname.h"
+#include "appc/discovery/aci_name.h"
+#include "appc/discovery/https.h"
+#include "appc/discovery/strategy.h"
+#include "appc/discovery/strategy/simple.h"
+#include "appc/discovery/verify.h"
+#include "appc/net/http_server.h"
+#include "appc/os/dir.h"
+#include "appc/os/fs.h"
+#include "appc/os/mkdir.h"
+#include "appc/os/staged_file.h"
+#include "appc/util/namespace.h"
+#include "appc/util/status.h"
+#include "appc/util/try.h"
+
+
+namespace appc {
+namespace discovery {
+namespace strategy {
+namespace peer {
+
+
+// Peer Discovery - pulling images from the stores of other nodes on the local network
+//
+// A node shares its image store by serving it with a Store and handler() below:
+//
+//   GET /images               one "<image id> <size> <aci name>" line per image held
+//   GET /hashes/<aci name>    the image's HashList
+//   GET /images/<aci name>    the image, honouring single byte ranges
+//
+// The peer Fetcher asks each of its peers for the hash list of an image and pulls chunks in
+// parallel from every peer holding an identical copy, a few connections per peer, so faster peers
+// serve more of the image. Each chunk is checked against the hash list as it arrives and a peer
+// that sends a bad chunk is dropped, on all of its connections, for the rest of the transfer. Hash
+// lists come from the peers themselves, so peers are trusted not to lie about them unless there is
+// an Expectation: then only peers advertising the expected ImageID are used and the assembled image
+// is verified before it is published. Either way the sizes in a hash list are bounded before
+// anything is allocated for them.
+//
+// Images resolve to peer://{name}-{version}-{os}-{arch}.aci and are stored as the simple
+// strategy stores them, so a node's store can in turn be shared with its peers.
+
+
+const URI peer_prefix{"peer://"};
+
+// What the Fetcher accepts from a peer's hash list unless configured otherwise.
+const uint64_t default_max_image_size{uint64_t{16} << 30};
+const uint64_t min_chunk_size{4 * 1024};
+const uint64_t max_chunk_size{64 * 1024 * 1024};
+
+
+// The chunk digests (sha256) of an image, and its ImageID, as computed by the peer serving it.
+struct HashList {
+  std::string image_id;
+  uint64_t size;
+  uint64_t chunk_size;
+  std::vector<std::string> chunks;
+
+  uint64_t chunk_offset(const size_t chunk) const {
+    return chunk * chunk_size;
+  }
+
+  uint64_t chunk_length(const size_t chunk) const {
+    return std::min(chunk_size, size - chunk_offset(chunk));
+  }
+
+  bool operator==(const HashList& other) const {
+    return image_id == other.image_id && size == other.size && chunk_size == other.chunk_size &&
+           chunks == other.chunks;
+  }
+
+  std::string render() const {
+    std::ostringstream out{};
+    out << "appc-peer-hashes 1\n";
+    out << "id " << image_id << "\n";
+    out << "size " << size << "\n";
+    out << "chunk-size " << chunk_size << "\n";
+    for (const auto& chunk : chunks) out << "chunk " << chunk << "\n";
+    return out.str();
+  }
+
+  // Hash lists claiming more than max_size bytes, or chunks outside [min_chunk_size,
+  // max_chunk_size], are rejected.
+  static Try<HashList> parse(const std::string& text,
+                             const uint64_t max_size = default_max_image_size) {
+    std::istringstream in{text};
+    std::string magic{};
+    int version = 0;
+    HashList hashes{"", 0, 0, {}};
+    std::string key{};
+    if (!(in >> magic >> version) || magic != "appc-peer-hashes" || version != 1) {
+      return Failure<HashList>("Not a peer hash list");
+    }
+    if (!(in >> key >> hashes.image_id) || key != "id" ||
+        !(in >> key >> hashes.size) || key != "size" ||
+        !(in >> key >> hashes.chunk_size) || key != "chunk-size") {
+      return Failure<HashList>("Malformed peer hash list");
+    }
+    if (hashes.size > max_size) {
+      return Failure<HashList>("Peer hash list claims " + std::to_string(hashes.size) +
+                               " bytes, more than the limit of " + std::to_string(max_size));
+    }
+    if (hashes.chunk_size < min_chunk_size || hashes.chunk_size > max_chunk_size) {
+      return Failure<HashList>("Peer hash list has unsupported chunk size " +
+                               std::to_string(hashes.chunk_size));
+    }
+    const uint64_t expected_chunks = hashes.size / hashes.chunk_size +
+                                     (hashes.size % hashes.chunk_size != 0 ? 1 : 0);
+    std::string digest{};
+    while (in >> key >> digest) {
+      if (key != "chunk" || hashes.chunks.size() == expected_chunks) {
+        return Failure<HashList>("Malformed peer hash list");
+      }
+      hashes.chunks.push_back(digest);
+    }
+    if (hashes.chunks.size() != expected_chunks) {
+      return Failure<HashList>("Peer hash list has " + std::to_string(hashes.chunks.size()) +
+                               " chunks for " + std::to_string(hashes.size) + " bytes");
+    }
+    return Result(hashes);
+  }
+};
+
+
+inline std::string chunk_digest(const void* data, const size_t size) {
+  unsigned char md[EVP_MAX_MD_SIZE];
+  unsigned int md_length = 0;
+  if (EVP_Digest(data, size, md, &md_length, EVP_sha256(), nullptr) != 1) return "";
+  return ImageVerifier::to_hex(md, md_length);
+}
+
+
+// An image store shared with peers. Hash lists are computed on first request and kept until the
+// image changes.
+class Store {
+private:
+  struct Entry {
+    uint64_t size;
+    int64_t modified;
+    std::shared_ptr<const HashList> hashes;
+  };
+
+  const Path root;
+  const uint64_t chunk_size;
+  std::mutex mutex{};
+  std::map<Path, Entry> entries{};
+
+  static int64_t modified_ns(const struct stat& file_stat) {
+    return static_cast<int64_t>(file_stat.st_mtim.tv_sec) * 1000000000 + file_stat.st_mtim.tv_nsec;
+  }
+
+  Try<HashList> compute(const Path& path, const int fd, const uint64_t size) {
+    HashList hashes{"", size, chunk_size, {}};
+    ImageVerifier verifier{};
+    std::unique_ptr<char[]> buffer{new char[chunk_size]};
+    for (uint64_t offset = 0; offset < size; offset += chunk_size) {
+      const size_t length = std::min(chunk_size, size - offset);
+      size_t got = 0;
+      while (got < length) {
+        const ssize_t n = pread(fd, buffer.get() + got, length - got, offset + got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return Failure<HashList>("Could not read " + path);
+        got += n;
+      }
+      hashes.chunks.push_back(chunk_digest(buffer.get(), length));
+      const auto updated = verifier.update(buffer.get(), length);
+      if (!updated) return Failure<HashList>(path + ": " + updated.message);
+    }
+    const auto image_id = verifier.image_id();
+    if (!image_id) return Failure<HashList>(path + ": " + image_id.failure_reason());
+    hashes.image_id = image_id->value;
+    return Result(hashes);
+  }
+
+  void walk(const Path& relative, std::vector<Path>& images) const {
+    const auto dir = os::open_dir(pathname::join(root, relative));
+    if (!dir) return;
+    for (struct dirent* entry = readdir(dir.get()); entry; entry = readdir(dir.get())) {
+      const std::string name{entry->d_name};
+      if (name.empty() || name[0] == '.') continue;
+      const Path child = relative.empty() ? name : pathname::join(relative, name);
+      if (os::detail::is_directory(dirfd(dir.get()), entry)) {
+        walk(child, images);
+      } else if (parse_aci_name(child)) {
+        images.push_back(child);
+      }
+    }
+  }
+
+public:
+  explicit Store(const Path& root, const uint64_t chunk_size = 1 << 20)
+  : root(root),
+    chunk_size(chunk_size) {}
+
+  Store(const Store&) = delete;
+  Store& operator=(const Store&) = delete;
+
+  // An ACI name relative to the store, e.g. example.com/worker-1.0.0-linux-amd64.aci.
+  static bool valid_name(const Path& name) {
+    return !name.empty() && name[0] != '/' && !pathname::has_dot_dot(name) && parse_aci_name(name);
+  }
+
+  Try<std::shared_ptr<const HashList>> hashes(const Path& name) {
+    using Hashes = std::shared_ptr<const HashList>;
+    if (!valid_name(name)) return Failure<Hashes>("Not an image name: " + name);
+    const Path path = pathname::join(root, name);
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return Failure<Hashes>(path + " " + strerror(errno));
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+      close(fd);
+      return Failure<Hashes>("Could not stat " + path);
+    }
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      const auto entry = entries.find(name);
+      if (entry != entries.end() && entry->second.size == static_cast<uint64_t>(file_stat.st_size) &&
+          entry->second.modified == modified_ns(file_stat)) {
+        close(fd);
+        return Result(entry->second.hashes);
+      }
+    }
+    // Computed outside the lock, a race costs a duplicate pass over one image.
+    const auto computed = compute(path, fd, file_stat.st_size);
+    close(fd);
+    if (!computed) return Failure<Hashes>(computed.failure_reason());
+    const Hashes hashes = std::make_shared<const HashList>(from_result(computed));
+    std::lock_guard<std::mutex> lock{mutex};
+    entries[name] = Entry{static_cast<uint64_t>(file_stat.st_size), modified_ns(file_stat), hashes};
+    return Result(hashes);
+  }
+
+  std::vector<Path> images() const {
+    std::vector<Path> images{};
+    walk("", images);
+    std::sort(images.begin(), images.end());
+    return images;
+  }
+
+  // The open image, or -1 with errno set.
+  int open_image(const Path& name) const {
+    if (!valid_name(name)) {
+      errno = ENOENT;
+      return -1;
+    }
+    return open(pathname::join(root, name).c_str(), O_RDONLY | O_CLOEXEC);
+  }
+};
+
+
+namespace detail {
+
+
+// "bytes=first-last" or "bytes=first-", the only forms peers send.
+// A run of decimal digits that fits in 64 bits.
+inline bool parse_offset(const std::string& digits, uint64_t& value) {
+  if (digits.empty() || digits.find_first_not_of("0123456789") != std::string::npos) return false;
+  errno = 0;
+  const unsigned long long parsed = strtoull(digits.c_str(), nullptr, 10);
+  if (errno == ERANGE) return false;
+  value = parsed;
+  return true;
+}
+
+
+inline bool parse_range(const std::string& header,
+                        const uint64_t size,
+                        uint64_t& first,
+                        uint64_t& last) {
+  const std::string unit{"bytes="};
+  if (header.compare(0, unit.length(), unit) != 0) return false;
+  const std::string spec = header.substr(unit.length());
+  const auto dash = spec.find('-');
+  if (dash == std::string::npos || dash == 0) return false;
+  const std::string to = spec.substr(dash + 1);
+  if (!parse_offset(spec.substr(0, dash), first)) return false;
+  if (to.empty()) {
+    last = size - 1;
+  } else if (parse_offset(to, last)) {
+    last = std::min<uint64_t>(last, size - 1);
+  } else {
+    return false;
+  }
+  return first < size && first <= last;
+}
+
+
+inline void send_image(Store& store, const Path& name, const net::http::Request& request,
+                       net::http::Connection& connection) {
+  const int fd = store.open_image(name);
+  if (fd < 0) {
+    connection.send_response(404);
+    return;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    close(fd);
+    connection.send_response(500);
+    return;
+  }
+  const uint64_t size = file_stat.st_size;
+  uint64_t first = 0;
+  uint64_t last = size - 1;
+  const auto range = request.header("range");
+  if (range && !parse_range(*range, size, first, last)) {
+    close(fd);
+    connection.send_response(416, "", {{"Content-Range", "bytes */" + std::to_string(size)}});
+    return;
+  }
+  net::http::Headers headers{{"Content-Type", "application/octet-stream"}};
+  headers["Content-Length"] = std::to_string(size == 0 ? 0 : last - first + 1);
+  if (range) {
+    headers["Content-Range"] = "bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" +
+                               std::to_string(size);
+  }
+  if (connection.send_head(range ? 206 : 200, headers) && size > 0) {
+    connection.send_file(fd, first, last - first + 1);
+  }
+  close(fd);
+}
+
+
+} // namespace detail
+
+
+// Serves a Store to peers, for a net::http::Server.
+inline net::http::Handler handler(Store& store) {
+  return [&store](const net::http::Request& request, net::http::Connection& connection) {
+    if (request.method != "GET") {
+      connection.send_response(405);
+      return;
+    }
+    const Path path = request.target.substr(0, request.target.find('?'));
+    const std::string images_path{"/images/"};
+    const std::string hashes_path{"/hashes/"};
+    if (path == "/images") {
+      std::string body{};
+      for (const auto& name : store.images()) {
+        const auto hashes = store.hashes(name);
+        // Skips images that vanished or could not be read since the listing.
+        if (!hashes) continue;
+        body += (*hashes)->image_id + " " + std::to_string((*hashes)->size) + " " + name + "\n";
+      }
+      connection.send_response(200, body, {{"Content-Type", "text/plain"}});
+    } else if (path.compare(0, hashes_path.length(), hashes_path) == 0) {
+      const auto hashes = store.hashes(path.substr(hashes_path.length()));
+      if (!hashes) {
+        connection.send_response(404);
+        return;
+      }
+      connection.send_response(200, (*hashes)->render(), {{"Content-Type", "text/plain"}});
+    } else if (path.compare(0, images_path.length(), images_path) == 0) {
+      detail::send_image(store, path.substr(images_path.length()), request, connection);
+    } else {
+      connection.send_response(404);
+    }
+  };
+}
+
+
+// One image being pulled: hands out its chunks to the workers pulling from peers and writes the
+// verified chunks into place.
+class Swarm {
+private:
+  const HashList& hashes;
+  os::StagedFile& file;
+  std::mutex mutex{};
+  std::condition_variable changed{};
+  std::deque<size_t> pending{};
+  std::set<URI> dropped{};
+  size_t in_flight{0};
+  std::string fatal{};
+  std::vector<std::string> errors{};
+  std::mutex write_mutex{};
+
+  Status write(const size_t chunk, const std::string& data) {
+    std::lock_guard<std::mutex> lock{write_mutex};
+    return file.write_at(data.data(), data.length(), hashes.chunk_offset(chunk));
+  }
+
+  // With mutex held.
+  void return_chunk(const size_t chunk, const std::string& reason) {
+    pending.push_front(chunk);
+    in_flight--;
+    errors.push_back(reason);
+    changed.notify_all();
+  }
+
+public:
+  Swarm(const HashList& hashes, os::StagedFile& file)
+  : hashes(hashes),
+    file(file) {
+    for (size_t chunk = 0; chunk < hashes.chunks.size(); chunk++) pending.push_back(chunk);
+  }
+
+  // The next chunk to pull from peer. Waits while the remaining chunks are in flight with other
+  // workers, as one of them may yet give its chunk back. False once there is nothing left to do or
+  // the peer has been dropped.
+  bool next(const URI& peer, size_t& chunk) {
+    std::unique_lock<std::mutex> lock{mutex};
+    changed.wait(lock, [this, &peer]() {
+      return !pending.empty() || in_flight == 0 || !fatal.empty() || dropped.count(peer) > 0;
+    });
+    if (pending.empty() || !fatal.empty() || dropped.count(peer) > 0) return false;
+    chunk = pending.front();
+    pending.pop_front();
+    in_flight++;
+    return true;
+  }
+
+  // Verifies and stores a pulled chunk; false (the chunk is given back and the peer dropped) if it
+  // does not match.
+  bool deliver(const size_t chunk, const std::string& data, const URI& peer) {
+    if (data.length() != hashes.chunk_length(chunk) ||
+        chunk_digest(data.data(), data.length()) != hashes.chunks[chunk]) {
+      std::lock_guard<std::mutex> lock{mutex};
+      dropped.insert(peer);
+      return_chunk(chunk, peer + " sent a corrupt chunk " + std::to_string(chunk));
+      return false;
+    }
+    const auto written = write(chunk, data);
+    std::lock_guard<std::mutex> lock{mutex};
+    if (!written && fatal.empty()) fatal = written.message;
+    in_flight--;
+    changed.notify_all();
+    return true;
+  }
+
+  void give_back(const size_t chunk, const std::string& reason) {
+    std::lock_guard<std::mutex> lock{mutex};
+    return_chunk(chunk, reason);
+  }
+
+  // Once every worker has stopped.
+  Status result() {
+    std::lock_guard<std::mutex> lock{mutex};
+    if (!fatal.empty()) return Error(fatal);
+    if (pending.empty()) return Success();
+    std::string reasons{};
+    for (const auto& error : errors) reasons += (reasons.empty() ? "" : "; ") + error;
+    return Error(std::to_string(pending.size()) + " chunks could not be pulled from any peer: " +
+                 reasons);
+  }
+};
+
+
+// Pulls chunks of the image at uri from one peer until the swarm is done or the peer fails.
+inline void pull_from(const URI& peer, const URI& uri, Swarm& swarm, const HashList& hashes) {
+  https::RangeReader reader{uri};
+  std::string data{};
+  size_t chunk = 0;
+  while (swarm.next(peer, chunk)) {
+    const auto read = reader.read(hashes.chunk_offset(chunk), hashes.chunk_length(chunk), data);
+    if (!read) {
+      swarm.give_back(chunk, peer + ": " + read.message);
+      return;
+    }
+    if (!swarm.deliver(chunk, data, peer)) return;
+  }
+}
+
+
+class Fetcher final : public appc::discovery::Fetcher {
+private:
+  const Path base_path;
+  const std::vector<URI> peers;
+  const unsigned connections_per_peer;
+  const uint64_t max_image_size;
+
+  Try<URI> pull(const URI& uri, const Expectation* expected) {
+    if (!valid_prefix(peer_prefix, uri)) {
+      return Failure<URI>("URI must begin with " + peer_prefix + ", cannot fetch " + uri);
+    }
+    const Path name = uri.substr(peer_prefix.length());
+    if (!Store::valid_name(name)) return Failure<URI>("Not an image name, will not fetch " + uri);
+
+    // The ImageID covers the uncompressed tar, the peer's size is the file's. Compressing data that
+    // does not compress adds a little framing, bzip2 the most at about half a percent.
+    uint64_t max_size = max_image_size;
+    if (expected && expected->max_size > 0) {
+      max_size = std::min(max_size, expected->max_size + expected->max_size / 64 + 64 * 1024);
+    }
+
+    std::unique_ptr<HashList> hashes{};
+    std::vector<URI> holders{};
+    std::string reasons{};
+    for (const auto& peer : peers) {
+      const auto body = https::get_string(peer + "hashes/" + name);
+      const auto listed = body ? HashList::parse(*body, max_size)
+                               : Failure<HashList>(body.failure_reason());
+      if (!listed) {
+        reasons += (reasons.empty() ? "" : "; ") + peer + ": " + listed.failure_reason();
+      } else if (expected && listed->image_id != expected->image_id.value) {
+        reasons += (reasons.empty() ? "" : "; ") + peer + " holds " + listed->image_id;
+      } else if (!hashes || *listed == *hashes) {
+        if (!hashes) hashes.reset(new HashList(from_result(listed)));
+        holders.push_back(peer);
+      }
+    }
+    if (holders.empty()) return Failure<URI>("No peer holds " + name + ": " + reasons);
+
+    const Path full_path = pathname::join(base_path, name);
+    const auto made_dir = os::mkdir(pathname::dir(full_path), 0755, true);
+    if (!made_dir) return Failure<URI>(made_dir.message);
+    os::StagedFile file{full_path};
+    const auto opened = file.open();
+    if (!opened) return Failure<URI>(opened.message);
+    const auto allocated = file.preallocate(hashes->size);
+    if (!allocated) return Failure<URI>(allocated.message);
+
+    Swarm swarm{*hashes, file};
+    std::vector<std::thread> workers{};
+    for (unsigned connection = 0; connection < connections_per_peer; connection++) {
+      for (const auto& peer : holders) {
+        if (workers.size() >= hashes->chunks.size()) break;
+        workers.emplace_back(pull_from, peer, peer + "images/" + name, std::ref(swarm),
+                             std::cref(*hashes));
+      }
+    }
+    for (auto& worker : workers) worker.join();
+    const auto pulled = swarm.result();
+    if (!pulled) return Failure<URI>(name + ": " + pulled.message);
+
+    if (expected) {
+      const auto verified = verify(file, *expected);
+      if (!verified) return Failure<URI>(verified.message);
+    }
+    const auto committed = file.commit();
+    if (!committed) return Failure<URI>(committed.message);
+    return Result(file_prefix + full_path);
+  }
+
+  // The chunks arrive out of order, so the image is read back once complete.
+  static Status verify(os::StagedFile& file, const Expectation& expected) {
+    ImageVerifier verifier{expected};
+    const auto supported = verifier.supported();
+    if (!supported) return supported;
+    std::unique_ptr<char[]> buffer{new char[256 * 1024]};
+    for (uint64_t offset = 0;;) {
+      const ssize_t got = file.read_at(buffer.get(), 256 * 1024, offset);
+      if (got < 0) return Error(std::string{"Could not read back image: "} + strerror(errno));
+      if (got == 0) break;
+      const auto updated = verifier.update(buffer.get(), got);
+      if (!updated) return updated;
+      offset += got;
+    }
+    return verifier.finish();
+  }
+
+public:
+  // Peers are base URIs of peer servers, e.g. http://10.0.0.2:7070/. Images larger than
+  // max_image_size are not pulled whatever the peers claim.
+  Fetcher(const Path& base_path,
+          const std::vector<URI>& peers,
+          const unsigned connections_per_peer = 2,
+          const uint64_t max_image_size = default_max_image_size)
+  : base_path(base_path),
+    peers(peers),
+    connections_per_peer(connections_per_peer),
+    max_image_size(max_image_size) {}
+
+  virtual Try<URI> fetch(const URI& uri) {
+    return pull(uri, nullptr);
+  }
+
+  virtual Try<URI> fetch(const URI& uri, const Expectation& expected) {
+    return pull(uri, &expected);
+  }
+};
+
+
+class StrategyBuilder {
+private:
+  const URI base_uri;
+  const std::vector<URI> peers;
+  const unsigned connections_per_peer;
+  const uint64_t max_image_size;
+public:
+  StrategyBuilder(const URI& base_uri = "",
+                  const std::vector<URI>& peers = {},
+                  const unsigned connections_per_peer = 2,
+                  const uint64_t max_image_size = default_max_image_size)
+  : base_uri(base_uri),
+    peers(peers),
+    connections_per_peer(connections_per_peer),
+    max_image_size(max_image_size) {}
+
+  StrategyBuilder with_storage_base_uri(const URI& base_uri) {
+    return StrategyBuilder(base_uri, peers, connections_per_peer, max_image_size);
+  }
+
+  // Base URIs of the peer servers to pull from.
+  StrategyBuilder with_peers(const std::vector<URI>& peers) {
+    return StrategyBuilder(base_uri, peers, connections_per_peer, max_image_size);
+  }
+
+  StrategyBuilder with_connections_per_peer(const unsigned connections_per_peer) {
+    return StrategyBuilder(base_uri, peers, connections_per_peer, max_image_size);
+  }
+
+  // The largest image file to pull, bounding what a peer's hash list can make the fetcher allocate.
+  StrategyBuilder with_max_image_size(const uint64_t max_image_size) {
+    return StrategyBuilder(base_uri, peers, connections_per_peer, max_image_size);
+  }
+
+  Try<Strategy> build() {
+    if (!valid_prefix(file_prefix, base_uri)) {
+      return Failure<Strategy>(
+        "storage_base_uri must begin with " + file_prefix + ", is " + base_uri);
+    }
+    if (peers.empty()) return Failure<Strategy>("No peers to pull from");
+    if (connections_per_peer == 0) return Failure<Strategy>("connections_per_peer must be positive");
+    std::vector<URI> normalized{};
+    for (const auto& peer : peers) {
+      normalized.push_back(peer.empty() || peer.back() == '/' ? peer : peer + "/");
+    }
+    return Result(Strategy(new simple::Resolver(peer_prefix),
+                           new Fetcher(base_uri.substr(file_prefix.length()), normalized,
+                                       connections_per_peer, max_image_size),
+                           "peer"));
+  }
+};
+
+
+} // namespace peer
+} // namespace strategy
+} // namespace discovery
+} // namespace appc
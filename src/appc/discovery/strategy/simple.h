@@ -17,10 +17,9 @@
 
 #pragma once
 
-#include <cstdlib> // REM remove when system() hack is removed.
-
 #include "appc/discovery/aci_name.h"
 #include "appc/discovery/https.h"
+#include "appc/discovery/signature.h"
 #include "appc/discovery/strategy.h"
 #include "appc/util/namespace.h"
 #include "appc/util/status.h"
@@ -48,74 +47,133 @@ namespace simple {
 // If this fails, move on to meta discovery. If this succeeds, try fetching the
 // signature using the same template but with a .sig extension:
 //
-// https://example.com/reduce-worker-1.0.0-linux-amd64.sig
+// https://example.com/reduce-worker-1.0.0-linux-amd64.aci.sig
+//
+// When configured with a keyring, the signature is fetched alongside the image and
+// checked as the image is written; an image without a valid signature is not stored.
 
 
-class Resolver : public appc::discovery::Resolver {
+// The prefix is https:// per the specification; mirrors and stand-ins may render elsewhere.
+class Resolver final : public appc::discovery::Resolver {
 private:
-  class Impl : public appc::discovery::AbstractResolver {
-  public:
-    virtual Try<URI> resolve(const Name& name, const Labels& labels) {
-      const auto aci_name = render_aci_name(name, labels);
-      if (!aci_name) return Failure<URI>(aci_name.failure_reason());
-      return Result(https_prefix + from_result(aci_name));
-    }
-  };
+  const URI prefix;
 public:
-  Resolver()
-  : appc::discovery::Resolver(new Impl()) {}
+  Resolver(const URI& prefix = https_prefix)
+  : prefix(prefix) {}
+
+  virtual Try<URI> resolve(const Name& name, const Labels& labels) {
+    URI uri{prefix};
+    const auto rendered = append_aci_name(uri, name, labels);
+    if (!rendered) return Failure<URI>(rendered.message);
+    return Result(uri);
+  }
+
+  virtual std::vector<Try<URI>> resolve_all(const std::vector<ImageReference>& references) {
+    return render_aci_uris(prefix, references);
+  }
 };
 
 
 // fetch(remote uri) -> local uri (location after fetched)
-class Fetcher : public appc::discovery::Fetcher {
+class Fetcher final : public appc::discovery::Fetcher {
 private:
-  class Impl : public appc::discovery::AbstractFetcher {
-  private:
-    const Path base_path;
-  public:
-    Impl(const Path& base_path)
-    : base_path(base_path) {}
-
-    virtual Try<URI> fetch(const URI& uri) {
-      if (!valid_prefix(https_prefix, uri)) {
-        return Failure<URI>("URI is not HTTPS, will not fetch " + uri);
-      }
-      // Create directory for app distributor (/<base_path>/example.com)
-      // TODO make recursive, make safe.
-      const Path full_path = pathname::join(base_path, uri.substr(https_prefix.length()));
-      const Path storage_dir = pathname::dir(full_path);
-      if (!pathname::is_absolute(storage_dir) || pathname::has_dot_dot(storage_dir)) {
-        return Failure<URI>("URI did not contain absolute path, will not store " + storage_dir);
-      }
-      struct stat dir_stat;
-      if (stat(storage_dir.c_str(), &dir_stat) != 0) {
-        mkdir(storage_dir.c_str(), 0755);
-      }
+  const Path base_path;
+  const std::shared_ptr<signature::Keyring> keyring;
+public:
+  Fetcher(const Path& base_path,
+          const std::shared_ptr<signature::Keyring>& keyring = nullptr)
+  : base_path(base_path),
+    keyring(keyring) {}
+
+  Try<Path> storage_path(const URI& uri) {
+    if (!valid_prefix(https_prefix, uri)) {
+      return Failure<Path>("URI is not HTTPS, will not fetch " + uri);
+    }
+    // https::get creates the directory for the app distributor (/<base_path>/example.com)
+    const Path full_path = pathname::join(base_path, uri.substr(https_prefix.length()));
+    const Path storage_dir = pathname::dir(full_path);
+    if (!pathname::is_absolute(storage_dir) || pathname::has_dot_dot(storage_dir)) {
+      return Failure<Path>("URI did not contain absolute path, will not store " + storage_dir);
+    }
+    return Result(full_path);
+  }
 
-      Status fetched = https::get(uri, full_path);
-      if (!fetched) {
-        return Failure<URI>(fetched.message);
-      }
+  Try<URI> fetch(const URI& uri, const std::vector<StreamCheck*>& checks) {
+    const auto storage = storage_path(uri);
+    if (!storage) return Failure<URI>(storage.failure_reason());
+    const Path full_path = from_result(storage);
 
-      return Result(file_prefix + full_path);
+    Status fetched = keyring ? signature::get_signed(uri, full_path, *keyring, checks)
+                             : https::get(uri, full_path, checks);
+    if (!fetched) {
+      return Failure<URI>(fetched.message);
     }
-  };
-public:
-  Fetcher(const Path& base_path)
-  : appc::discovery::Fetcher(new Impl(base_path)) {}
+
+    return Result(file_prefix + full_path);
+  }
+
+  virtual Try<URI> fetch(const URI& uri) {
+    return fetch(uri, {});
+  }
+
+  // Downloads the batch concurrently over shared connections (see https::get_all). Signed
+  // images are fetched one at a time.
+  virtual std::vector<Try<URI>> fetch_all(const std::vector<URI>& uris) {
+    if (keyring) return appc::discovery::Fetcher::fetch_all(uris);
+    std::vector<std::string> errors(uris.size());
+    std::vector<Path> paths(uris.size());
+    std::vector<https::Download> downloads{};
+    std::vector<size_t> download_index{};
+    for (size_t i = 0; i < uris.size(); i++) {
+      const auto storage = storage_path(uris[i]);
+      if (!storage) {
+        errors[i] = storage.failure_reason();
+        continue;
+      }
+      paths[i] = from_result(storage);
+      downloads.push_back(https::Download{uris[i], paths[i], {}});
+      download_index.push_back(i);
+    }
+    const auto statuses = https::get_all(downloads);
+    for (size_t d = 0; d < downloads.size(); d++) {
+      if (!statuses[d]) errors[download_index[d]] = statuses[d].message;
+    }
+    std::vector<Try<URI>> fetched{};
+    fetched.reserve(uris.size());
+    for (size_t i = 0; i < uris.size(); i++) {
+      fetched.push_back(errors[i].empty() ? Result(file_prefix + paths[i])
+                                          : Failure<URI>(errors[i]));
+    }
+    return fetched;
+  }
+
+  // Verifies while downloading rather than re-reading the image afterward.
+  virtual Try<URI> fetch(const URI& uri, const Expectation& expected) {
+    ImageVerifier verifier{expected};
+    const auto supported = verifier.supported();
+    if (!supported) return Failure<URI>(supported.message);
+    return fetch(uri, {&verifier});
+  }
 };
 
 
 class StrategyBuilder {
 private:
   const URI base_uri;
+  const Path keyring_path;
 public:
-  StrategyBuilder(const URI& base_uri = "")
-  : base_uri(base_uri) {}
+  StrategyBuilder(const URI& base_uri = "",
+                  const Path& keyring_path = "")
+  : base_uri(base_uri),
+    keyring_path(keyring_path) {}
 
   StrategyBuilder with_storage_base_uri(const URI& base_uri) {
-    return StrategyBuilder(base_uri);
+    return StrategyBuilder(base_uri, keyring_path);
+  }
+
+  // Require images to be signed by a key in the keyring (a file or a directory of key files).
+  StrategyBuilder with_keyring(const Path& keyring_path) {
+    return StrategyBuilder(base_uri, keyring_path);
   }
 
   Try<Strategy> build() {
@@ -125,8 +183,16 @@ public:
     }
     // TODO obvious cleanup
     Path path = base_uri.substr(file_prefix.length());
+    std::shared_ptr<signature::Keyring> keyring{};
+    if (!keyring_path.empty()) {
+      const auto loaded = signature::Keyring::from_path(keyring_path);
+      if (!loaded) return Failure<Strategy>(loaded.failure_reason());
+      if (loaded->size() == 0) return Failure<Strategy>("No usable keys in " + keyring_path);
+      keyring = loaded;
+    }
     return Result(Strategy(new Resolver(),
-                           new Fetcher(path)));
+                           new Fetcher(path, keyring),
+                           "simple"));
   }
 };
 
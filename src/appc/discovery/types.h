@@ -19,6 +19,7 @@
 
 #include <map>
 
+#include "appc/schema/image_id.h"
 #include "appc/util/namespace.h"
 #include "appc/util/try.h"
 
@@ -32,6 +33,14 @@ using URI = std::string;
 using Path = std::string;
 using Name = std::string;
 using Labels = std::map<std::string, std::string>;
+using ImageID = appc::schema::ImageID;
+
+
+// An image to resolve or provide, e.g. one of a batch.
+struct ImageReference {
+  Name name;
+  Labels labels;
+};
 
 // TODO still up in the air in the spec
 const std::string aci_ext = ".aci";
@@ -0,0 +1,338 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+#pragma once
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <bzlib.h>
+#include <lzma.h>
+#include <openssl/evp.h>
+#include <zlib.h>
+
+#include "appc/discovery/types.h"
+#include "appc/util/option.h"
+#include "appc/util/status.h"
+
+
+namespace appc {
+namespace discovery {
+
+
+const std::string image_id_hash_prefix{"sha512-"};
+
+
+// What a fetched image is expected to be. max_size bounds the uncompressed size in bytes (0 for no
+// bound) so a fetch can be abandoned before the whole image has been transferred.
+struct Expectation {
+  const ImageID image_id;
+  const uint64_t max_size;
+
+  explicit Expectation(const ImageID& image_id,
+                       const uint64_t max_size = 0)
+  : image_id(image_id),
+    max_size(max_size) {}
+};
+
+
+// A StreamCheck sees every chunk of an image as it is written. update() fails to abort the
+// transfer, finish() is called once the transfer has completed.
+class StreamCheck {
+public:
+  virtual ~StreamCheck() {}
+  virtual Status update(const void* data, const size_t size) = 0;
+  virtual Status finish() = 0;
+};
+
+
+// An ImageVerifier is fed the (possibly compressed) bytes of an ACI as they arrive and checks them
+// against an Expectation. An ImageID is the sha512 of the uncompressed tar, so the stream is
+// decompressed in-line (gzip, bzip2, xz or none, sniffed from the first bytes) and the output is
+// hashed in the same pass. update() fails as soon as the stream can no longer match; finish()
+// compares the digest. Constructed without an Expectation it only computes the image ID.
+class ImageVerifier : public StreamCheck {
+public:
+  // Given the uncompressed stream as it is hashed, see set_output().
+  using Output = std::function<Status(const unsigned char* data, const size_t size)>;
+
+private:
+  enum class Compression { unknown, none, gzip, bzip2, xz };
+
+  static const size_t sniff_length = 6;
+  static const size_t inflate_chunk = 64 * 1024;
+
+  const Option<Expectation> expected;
+  Output output{};
+  Compression compression{Compression::unknown};
+  std::string sniffed{};
+  uint64_t uncompressed_size{0};
+  bool stream_ended{false};
+
+  std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> digest{EVP_MD_CTX_new(), EVP_MD_CTX_free};
+  std::unique_ptr<unsigned char[]> out_buffer{};
+  z_stream gzip_stream{};
+  bz_stream bzip2_stream{};
+  lzma_stream xz_stream = LZMA_STREAM_INIT;
+
+  static Compression sniff(const std::string& head) {
+    const auto starts_with = [&head](const char* magic, const size_t length) {
+      return head.length() >= length && head.compare(0, length, magic, length) == 0;
+    };
+    if (starts_with("\x1f\x8b", 2)) return Compression::gzip;
+    if (starts_with("BZh", 3)) return Compression::bzip2;
+    if (starts_with("\xfd" "7zXZ\x00", 6)) return Compression::xz;
+    return Compression::none;
+  }
+
+  Status hash(const unsigned char* data, const size_t size) {
+    uncompressed_size += size;
+    if (expected && expected->max_size > 0 && uncompressed_size > expected->max_size) {
+      return Error("Image exceeds expected size of " + std::to_string(expected->max_size) +
+                   " bytes, cannot be " + expected->image_id.value);
+    }
+    if (size > 0 && EVP_DigestUpdate(digest.get(), data, size) != 1) {
+      return Error("Could not update image digest");
+    }
+    if (output && size > 0) return output(data, size);
+    return Success();
+  }
+
+  Status begin(const Compression detected) {
+    compression = detected;
+    if (compression == Compression::none) return Success();
+    out_buffer.reset(new unsigned char[inflate_chunk]);
+    switch (compression) {
+      case Compression::gzip:
+        if (inflateInit2(&gzip_stream, 16 + MAX_WBITS) != Z_OK) {
+          return Error("Could not initialize gzip stream");
+        }
+        break;
+      case Compression::bzip2:
+        if (BZ2_bzDecompressInit(&bzip2_stream, 0, 0) != BZ_OK) {
+          return Error("Could not initialize bzip2 stream");
+        }
+        break;
+      case Compression::xz:
+        if (lzma_stream_decoder(&xz_stream, UINT64_MAX, 0) != LZMA_OK) {
+          return Error("Could not initialize xz stream");
+        }
+        break;
+      default:
+        break;
+    }
+    return Success();
+  }
+
+  Status decompress(const unsigned char* data, const size_t size) {
+    if (size > 0 && stream_ended) return Error("Trailing data after end of compressed image");
+    switch (compression) {
+      case Compression::none:
+        return hash(data, size);
+      case Compression::gzip: {
+        gzip_stream.next_in = const_cast<unsigned char*>(data);
+        gzip_stream.avail_in = size;
+        while (gzip_stream.avail_in > 0 && !stream_ended) {
+          gzip_stream.next_out = out_buffer.get();
+          gzip_stream.avail_out = inflate_chunk;
+          const int r = inflate(&gzip_stream, Z_NO_FLUSH);
+          if (r != Z_OK && r != Z_STREAM_END) return Error("Corrupt gzip stream in image");
+          auto hashed = hash(out_buffer.get(), inflate_chunk - gzip_stream.avail_out);
+          if (!hashed) return hashed;
+          stream_ended = r == Z_STREAM_END;
+        }
+        break;
+      }
+      case Compression::bzip2: {
+        bzip2_stream.next_in = reinterpret_cast<char*>(const_cast<unsigned char*>(data));
+        bzip2_stream.avail_in = size;
+        while (bzip2_stream.avail_in > 0 && !stream_ended) {
+          bzip2_stream.next_out = reinterpret_cast<char*>(out_buffer.get());
+          bzip2_stream.avail_out = inflate_chunk;
+          const int r = BZ2_bzDecompress(&bzip2_stream);
+          if (r != BZ_OK && r != BZ_STREAM_END) return Error("Corrupt bzip2 stream in image");
+          auto hashed = hash(out_buffer.get(), inflate_chunk - bzip2_stream.avail_out);
+          if (!hashed) return hashed;
+          stream_ended = r == BZ_STREAM_END;
+        }
+        break;
+      }
+      case Compression::xz: {
+        xz_stream.next_in = data;
+        xz_stream.avail_in = size;
+        while (xz_stream.avail_in > 0 && !stream_ended) {
+          xz_stream.next_out = out_buffer.get();
+          xz_stream.avail_out = inflate_chunk;
+          const lzma_ret r = lzma_code(&xz_stream, LZMA_RUN);
+          if (r != LZMA_OK && r != LZMA_STREAM_END) return Error("Corrupt xz stream in image");
+          auto hashed = hash(out_buffer.get(), inflate_chunk - xz_stream.avail_out);
+          if (!hashed) return hashed;
+          stream_ended = r == LZMA_STREAM_END;
+        }
+        break;
+      }
+      default:
+        break;
+    }
+    if (stream_ended && (gzip_stream.avail_in > 0 ||
+                         bzip2_stream.avail_in > 0 ||
+                         xz_stream.avail_in > 0)) {
+      return Error("Trailing data after end of compressed image");
+    }
+    return Success();
+  }
+
+public:
+  // Lowercase hex, as in image IDs.
+  static std::string to_hex(const unsigned char* bytes, const size_t length) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex{};
+    hex.reserve(length * 2);
+    for (size_t i = 0; i < length; i++) {
+      hex += digits[bytes[i] >> 4];
+      hex += digits[bytes[i] & 0x0f];
+    }
+    return hex;
+  }
+
+  explicit ImageVerifier(const Expectation& expected)
+  : expected(Some(expected)) {
+    EVP_DigestInit_ex(digest.get(), EVP_sha512(), nullptr);
+  }
+
+  ImageVerifier()
+  : expected(None<Expectation>()) {
+    EVP_DigestInit_ex(digest.get(), EVP_sha512(), nullptr);
+  }
+
+  ImageVerifier(const ImageVerifier&) = delete;
+  ImageVerifier& operator=(const ImageVerifier&) = delete;
+
+  ~ImageVerifier() {
+    if (compression == Compression::gzip) inflateEnd(&gzip_stream);
+    if (compression == Compression::bzip2) BZ2_bzDecompressEnd(&bzip2_stream);
+    if (compression == Compression::xz) lzma_end(&xz_stream);
+  }
+
+  // Passes the uncompressed tar on as well (to rebuild an image from, say). A failed output fails
+  // the update.
+  void set_output(const Output& output) {
+    this->output = output;
+  }
+
+  // Only sha512 ImageIDs can be verified.
+  Status supported() const {
+    if (!expected) return Success();
+    const std::string& id = expected->image_id.value;
+    if (id.compare(0, image_id_hash_prefix.length(), image_id_hash_prefix) != 0) {
+      return Error("Cannot verify " + id + ", only " + image_id_hash_prefix + " image IDs supported");
+    }
+    return Success();
+  }
+
+  virtual Status update(const void* data, const size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    if (compression != Compression::unknown) return decompress(bytes, size);
+
+    // Hold the first few bytes back until the compression can be determined.
+    sniffed.append(reinterpret_cast<const char*>(bytes), size);
+    if (sniffed.length() < sniff_length) return Success();
+    auto began = begin(sniff(sniffed));
+    if (!began) return began;
+    const std::string head = std::move(sniffed);
+    return decompress(reinterpret_cast<const unsigned char*>(head.data()), head.length());
+  }
+
+  // Completes the stream and returns the image ID of what was seen.
+  Try<ImageID> image_id() {
+    if (compression == Compression::unknown) {
+      auto began = begin(sniff(sniffed));
+      if (!began) return Failure<ImageID>(began.message);
+      auto flushed = decompress(reinterpret_cast<const unsigned char*>(sniffed.data()),
+                                sniffed.length());
+      if (!flushed) return Failure<ImageID>(flushed.message);
+    }
+    if (compression != Compression::none && !stream_ended) {
+      return Failure<ImageID>("Compressed image stream ended early");
+    }
+
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int md_length = 0;
+    if (EVP_DigestFinal_ex(digest.get(), md, &md_length) != 1) {
+      return Failure<ImageID>("Could not finalize image digest");
+    }
+    return Result(ImageID(image_id_hash_prefix + to_hex(md, md_length)));
+  }
+
+  virtual Status finish() {
+    const auto computed = image_id();
+    if (!computed) return Error(computed.failure_reason());
+    if (!expected) return Success();
+    const std::string& actual = computed->value;
+
+    // ImageIDs may be truncated, compare the given portion case-insensitively.
+    const std::string& id = expected->image_id.value;
+    bool matches = id.length() > image_id_hash_prefix.length() && id.length() <= actual.length();
+    for (size_t i = 0; matches && i < id.length(); i++) {
+      matches = std::tolower(static_cast<unsigned char>(id[i])) == actual[i];
+    }
+    if (!matches) return Error("Image ID mismatch, expected " + id + ", got " + actual);
+    return Success();
+  }
+};
+
+
+inline Status feed_file(const Path& path, StreamCheck& check) {
+  std::unique_ptr<FILE, decltype(&fclose)> file{fopen(path.c_str(), "rb"), fclose};
+  if (!file) return Error("Could not open " + path + " to verify");
+  std::unique_ptr<char[]> buffer{new char[64 * 1024]};
+  for (;;) {
+    const size_t read = fread(buffer.get(), 1, 64 * 1024, file.get());
+    if (read > 0) {
+      auto updated = check.update(buffer.get(), read);
+      if (!updated) return updated;
+    }
+    if (read < 64 * 1024) break;
+  }
+  if (ferror(file.get())) return Error("Could not read " + path + " to verify");
+  return Success();
+}
+
+
+// Verify an image already on disk. Used where there is no transfer to hash along with.
+inline Status verify_file(const Path& path, const Expectation& expected) {
+  ImageVerifier verifier{expected};
+  auto supported = verifier.supported();
+  if (!supported) return supported;
+  auto fed = feed_file(path, verifier);
+  if (!fed) return fed;
+  return verifier.finish();
+}
+
+
+inline Try<ImageID> image_id_of_file(const Path& path) {
+  ImageVerifier verifier{};
+  auto fed = feed_file(path, verifier);
+  if (!fed) return Failure<ImageID>(fed.message);
+  return verifier.image_id();
+}
+
+
+} // namespace discovery
+} // namespace appc
@@ -0,0 +1,293 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+#pragma once
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "3rdparty/cdaylward/pathname.h"
+#include "appc/image/image.h"
+#include "appc/util/metrics.h"
+#include "appc/util/profile.h"
+#include "appc/util/trace.h"
+
+
+namespace appc {
+namespace image {
+
+
+#ifdef APPC_METRICS
+// Records one pass over an archive, labelled by phase: its duration, the entries read, the bytes
+// read from the file and the bytes they decompressed to. Must not outlive the archive.
+class PassMetrics {
+private:
+  struct archive* const archive;
+  const util::MetricLabels labels;
+  const util::ScopedTimer timer;
+public:
+  uint64_t entries{0};
+
+  PassMetrics(const char* phase, struct archive* archive)
+  : archive(archive),
+    labels({{"phase", phase}}),
+    timer(util::metrics().histogram("appc_image_pass_seconds",
+                                    "Time spent in one pass over an image.",
+                                    labels)) {}
+
+  ~PassMetrics() {
+    auto& registry = util::metrics();
+    registry.counter("appc_image_entries_total", "Archive entries read.", labels).add(entries);
+    registry.counter("appc_image_bytes_read_total",
+                     "Bytes read from image files.", labels)
+        .add(archive_filter_bytes(archive, -1));
+    registry.counter("appc_image_bytes_decompressed_total",
+                     "Bytes of archive the images decompressed to.", labels)
+        .add(archive_filter_bytes(archive, 0));
+  }
+};
+#endif
+
+
+// libarchive returns null for an error without a message and for an entry without a name.
+static std::string error_string(struct archive* archive) {
+  const char* error = archive_error_string(archive);
+  return error != nullptr ? error : "Unknown archive error";
+}
+
+
+static std::string entry_pathname(struct archive_entry* entry) {
+  const char* pathname = archive_entry_pathname(entry);
+  return pathname != nullptr ? pathname : "";
+}
+
+
+static int copy_data(struct archive* in, struct archive* out, uint64_t& copied) {
+  const void* buff;
+  size_t size;
+  off_t offset;
+
+  for (;;) {
+    APPC_IF_TRACING(const uint64_t traced_at = util::trace_clock();)
+    int r = archive_read_data_block(in, &buff, &size, &offset);
+    APPC_IF_TRACING(util::trace_phase("image.decompress", "", traced_at);)
+    if (r == ARCHIVE_EOF) return ARCHIVE_OK;
+    if (r < ARCHIVE_OK) return r;
+    r = archive_write_data_block(out, buff, size, offset);
+    if (r < ARCHIVE_OK) return r;
+    copied += size;
+  }
+}
+
+
+static Try<std::string> read_data_into_string(struct archive* in) {
+  const void* buff;
+  size_t size;
+  off_t offset;
+
+  std::string result{};
+  for (;;) {
+    int r = archive_read_data_block(in, &buff, &size, &offset);
+    if (r == ARCHIVE_EOF) break;
+    if (r < ARCHIVE_OK) return Failure<std::string>(error_string(in));
+    result.append(static_cast<const char*>(buff), size);
+  }
+  return Result(result);
+}
+
+
+APPC_INLINE Try<FileList> Image::file_list() {
+  APPC_PROFILE_SCOPE("Image::file_list");
+  std::unique_ptr<struct archive, decltype(&archive_read_free)> archive{
+      archive_read_new(), archive_read_free};
+  // TODO restrict this to ACI spec
+  archive_read_support_filter_all(archive.get());
+  archive_read_support_format_all(archive.get());
+
+  if (archive_read_open_filename(archive.get(), filename.c_str(), 10240) != ARCHIVE_OK) {
+    return Failure<FileList>(error_string(archive.get()));
+  }
+  APPC_IF_METRICS(PassMetrics pass{"file_list", archive.get()};)
+  APPC_TRACE_SPAN("image.file_list");
+
+  FileList file_list{};
+  {
+    struct archive_entry* entry;
+    while (archive_read_next_header(archive.get(), &entry) == ARCHIVE_OK) {
+      APPC_IF_METRICS(pass.entries++;)
+      const std::string path = trim_dot_slash(entry_pathname(entry));
+      if (path.length() > rootfs_filename.length() &&
+          path.compare(0, rootfs_filename.length(), rootfs_filename) == 0) {
+        file_list.push_back(path.substr(rootfs_filename.length()));
+      }
+      archive_read_data_skip(archive.get());
+    }
+  }
+
+  return Result(file_list);
+}
+
+
+APPC_INLINE Status Image::validate_structure() {
+  APPC_PROFILE_SCOPE("Image::validate_structure");
+  std::unique_ptr<struct archive, decltype(&archive_read_free)> archive{
+      archive_read_new(), archive_read_free};
+  // TODO restrict
+  archive_read_support_filter_all(archive.get());
+  archive_read_support_format_all(archive.get());
+
+  if (archive_read_open_filename(archive.get(), filename.c_str(), 10240) != ARCHIVE_OK) {
+    return Invalid(error_string(archive.get()));
+  }
+  APPC_IF_METRICS(PassMetrics pass{"validate_structure", archive.get()};)
+  APPC_TRACE_SPAN("image.validate_structure");
+  // TODO requires at least one rootfs entry?
+  {
+    unsigned int manifest_count = 0;
+    struct archive_entry* entry;
+    while (archive_read_next_header(archive.get(), &entry) == ARCHIVE_OK) {
+      APPC_IF_METRICS(pass.entries++;)
+      const std::string path = trim_dot_slash(entry_pathname(entry));
+      const mode_t entry_mode = archive_entry_filetype(entry);
+      // TODO fixup
+      if (path == manifest_filename) {
+        manifest_count++;
+        if (manifest_count > 1) return Invalid("Multiple manifest dentries present.");
+        if (!(entry_mode & AE_IFREG)) return Invalid("manifest is not a regular file");
+      }
+      else if (path == rootfs_filename) {
+        if (!(entry_mode & AE_IFDIR)) return Invalid("rootfs is not a directory");
+      }
+      else if (path.length() <= rootfs_filename.length() ||
+               path.compare(0, rootfs_filename.length(), rootfs_filename) != 0) {
+        return Invalid(path + " is not under rootfs.");
+      }
+      // TODO check for foul beasts like ..
+      archive_read_data_skip(archive.get());
+    }
+  }
+
+  return Valid();
+}
+
+
+APPC_INLINE Try<std::string> Image::manifest() {
+  APPC_PROFILE_SCOPE("Image::manifest");
+  std::unique_ptr<struct archive, decltype(&archive_read_free)> archive{
+      archive_read_new(), archive_read_free};
+  // TODO restrict
+  archive_read_support_filter_all(archive.get());
+  archive_read_support_format_all(archive.get());
+
+  if (archive_read_open_filename(archive.get(), filename.c_str(), 10240) != ARCHIVE_OK) {
+    return Failure<std::string>(error_string(archive.get()));
+  }
+  APPC_IF_METRICS(PassMetrics pass{"manifest", archive.get()};)
+  APPC_TRACE_SPAN("image.manifest");
+
+  {
+    struct archive_entry* entry;
+    while (archive_read_next_header(archive.get(), &entry) == ARCHIVE_OK) {
+      APPC_IF_METRICS(pass.entries++;)
+      const std::string path = trim_dot_slash(entry_pathname(entry));
+      const mode_t entry_mode = archive_entry_filetype(entry);
+      if (path == manifest_filename) {
+        if (!(entry_mode & AE_IFREG)) {
+          return Failure<std::string>("manifest is not a regular file");
+        }
+        return read_data_into_string(archive.get());
+      }
+      archive_read_data_skip(archive.get());
+    }
+  }
+
+  return Failure<std::string>("Archive did not contain a manifest");
+}
+
+
+APPC_INLINE Status Image::extract_rootfs_to(const std::string& base_path) {
+  APPC_PROFILE_SCOPE("Image::extract_rootfs_to");
+  std::unique_ptr<struct archive, decltype(&archive_read_free)> archive{
+      archive_read_new(), archive_read_free};
+  archive_read_support_filter_all(archive.get());
+  archive_read_support_format_all(archive.get());
+
+  std::unique_ptr<struct archive, decltype(&archive_write_free)> writer{
+      archive_write_disk_new(), archive_write_free};
+  const int flags = ARCHIVE_EXTRACT_TIME
+                      | ARCHIVE_EXTRACT_PERM
+                      | ARCHIVE_EXTRACT_ACL
+                      | ARCHIVE_EXTRACT_FFLAGS;
+  archive_write_disk_set_options(writer.get(), flags);
+  archive_write_disk_set_standard_lookup(writer.get());
+
+  if (archive_read_open_filename(archive.get(), filename.c_str(), 10240) != ARCHIVE_OK) {
+    return Error(error_string(archive.get()));
+  }
+  APPC_IF_METRICS(PassMetrics pass{"extract", archive.get()};)
+  APPC_TRACE_SPAN("image.extract");
+
+  uint64_t written = 0;
+  struct archive_entry* entry;
+  for (int r = archive_read_next_header(archive.get(), &entry);
+       r == ARCHIVE_OK;
+       r = archive_read_next_header(archive.get(), &entry)) {
+    if (r == ARCHIVE_EOF) break;
+    if (r < ARCHIVE_OK) return Error(error_string(archive.get()));
+    APPC_IF_METRICS(pass.entries++;)
+    APPC_TRACE_SPAN("image.extract_entry");
+
+    const std::string entry_path { entry_pathname(entry) };
+
+    if (entry_path == "manifest") {
+      archive_read_data_skip(archive.get());
+      continue;
+    }
+
+    std::string write_path { pathname::join(base_path,
+                                            entry_path.substr(rootfs_filename.length())) };
+    archive_entry_set_pathname(entry, write_path.c_str());
+
+    if (archive_write_header(writer.get(), entry) != ARCHIVE_OK) {
+      return Error(error_string(writer.get()));
+    }
+
+    if (archive_entry_size(entry) > 0) {
+      if (copy_data(archive.get(), writer.get(), written)) {
+        return Error(error_string(writer.get()));
+      }
+    }
+
+    if (archive_write_finish_entry(writer.get()) != ARCHIVE_OK) {
+      return Error(error_string(writer.get()));
+    }
+  }
+
+  // Free will call close so this is not necessary above but used here to
+  // report errors when closing.
+  if (archive_write_close(writer.get()) != ARCHIVE_OK) {
+    return Error(error_string(writer.get()));
+  }
+  APPC_IF_METRICS(util::metrics().counter("appc_image_bytes_extracted_total",
+                                          "File data written by extraction.").add(written);)
+
+  return Success();
+}
+
+
+} // namespace image
+} // namespace appc
@@ -0,0 +1,357 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+#pragma once
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <set>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+
+#include "appc/util/option.h"
+#include "appc/util/status.h"
+#include "appc/util/try.h"
+
+
+namespace appc {
+namespace net {
+namespace http {
+
+
+// A small embedded HTTP/1.1 server for serving images (mirrors, peers, test stand-ins). One thread
+// per connection, one request per connection, Connection: close on every response. Not intended to
+// face the internet.
+
+
+using Headers = std::map<std::string, std::string>;
+
+
+struct Request {
+  std::string method;
+  std::string target;
+  // Header names are lower-cased.
+  Headers headers;
+
+  Option<std::string> header(const std::string& name) const {
+    const auto value = headers.find(name);
+    if (value == headers.end()) return None<std::string>();
+    return Some(value->second);
+  }
+};
+
+
+inline std::string reason_phrase(const int status) {
+  switch (status) {
+    case 200: return "OK";
+    case 206: return "Partial Content";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 416: return "Range Not Satisfiable";
+    case 500: return "Internal Server Error";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    default: return "Unknown";
+  }
+}
+
+
+class Connection {
+protected:
+  const int fd;
+  bool head_sent{false};
+
+public:
+  explicit Connection(const int fd)
+  : fd(fd) {}
+
+  virtual ~Connection() {}
+
+  // Returns bytes read, 0 on orderly close, -1 on error.
+  virtual ssize_t read_some(void* buffer, const size_t size) {
+    for (;;) {
+      const ssize_t got = recv(fd, buffer, size, 0);
+      if (got < 0 && errno == EINTR) continue;
+      return got;
+    }
+  }
+
+  virtual Status write(const void* data, const size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    size_t sent = 0;
+    while (sent < size) {
+      const ssize_t wrote = send(fd, bytes + sent, size - sent, MSG_NOSIGNAL);
+      if (wrote < 0 && errno == EINTR) continue;
+      if (wrote <= 0) return Error(std::string{"Could not send: "} + strerror(errno));
+      sent += wrote;
+    }
+    return Success();
+  }
+
+  Status write(const std::string& data) {
+    return write(data.data(), data.length());
+  }
+
+  // Sends count bytes of file_fd from offset without copying through user space where possible.
+  virtual Status send_file(const int file_fd, off_t offset, size_t count) {
+    while (count > 0) {
+      const ssize_t sent = sendfile(fd, file_fd, &offset, count);
+      if (sent < 0 && errno == EINTR) continue;
+      if (sent <= 0) return Error(std::string{"Could not send file: "} + strerror(errno));
+      count -= sent;
+    }
+    return Success();
+  }
+
+  Status send_head(const int status, const Headers& headers = {}) {
+    std::string head = "HTTP/1.1 " + std::to_string(status) + " " + reason_phrase(status) + "\r\n";
+    for (const auto& header : headers) {
+      head += header.first + ": " + header.second + "\r\n";
+    }
+    head += "Connection: close\r\n\r\n";
+    head_sent = true;
+    return write(head);
+  }
+
+  // Whether a response has been started, after which another cannot be sent.
+  bool responded() const {
+    return head_sent;
+  }
+
+  // Makes the close that follows reset the connection, so a client part way through a response
+  // sees an error rather than a body that merely ended early.
+  virtual void abort() {
+    const struct linger linger{1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+  }
+
+  Status send_response(const int status, const std::string& body = "", Headers headers = {}) {
+    headers["Content-Length"] = std::to_string(body.length());
+    const auto sent = send_head(status, headers);
+    if (!sent) return sent;
+    return write(body);
+  }
+};
+
+
+using Handler = std::function<void(const Request&, Connection&)>;
+
+
+inline Try<Request> read_request(Connection& connection) {
+  static const size_t max_head = 16 * 1024;
+  std::string head{};
+  char buffer[4096];
+  size_t end;
+  while ((end = head.find("\r\n\r\n")) == std::string::npos) {
+    if (head.length() > max_head) return Failure<Request>("Request head too large");
+    const ssize_t got = connection.read_some(buffer, sizeof(buffer));
+    if (got <= 0) return Failure<Request>("Connection closed before request was complete");
+    head.append(buffer, got);
+  }
+  head.resize(end + 2);
+
+  Request request{};
+  size_t line_end = head.find("\r\n");
+  const std::string request_line = head.substr(0, line_end);
+  const auto first_space = request_line.find(' ');
+  const auto second_space = request_line.find(' ', first_space + 1);
+  if (first_space == std::string::npos || second_space == std::string::npos) {
+    return Failure<Request>("Malformed request line");
+  }
+  request.method = request_line.substr(0, first_space);
+  request.target = request_line.substr(first_space + 1, second_space - first_space - 1);
+
+  for (size_t pos = line_end + 2; pos < head.length(); pos = line_end + 2) {
+    line_end = head.find("\r\n", pos);
+    const std::string line = head.substr(pos, line_end - pos);
+    const auto colon = line.find(':');
+    if (colon == std::string::npos) continue;
+    std::string name = line.substr(0, colon);
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    const auto value_start = line.find_first_not_of(" \t", colon + 1);
+    request.headers[name] = value_start == std::string::npos ? "" : line.substr(value_start);
+  }
+  return Result(request);
+}
+
+
+class Server {
+public:
+  struct Options {
+    // A connection that sends or accepts nothing for this long is dropped, so an idle client
+    // cannot hold its thread (and stop()) indefinitely.
+    std::chrono::milliseconds timeout;
+    // Connections beyond this many are answered 503 and closed.
+    size_t max_connections;
+
+    Options(const std::chrono::milliseconds timeout = std::chrono::seconds(30),
+            const size_t max_connections = 256)
+    : timeout(timeout),
+      max_connections(max_connections) {}
+  };
+
+protected:
+  const Handler handler;
+  const Options options;
+  int listen_fd{-1};
+  std::thread acceptor{};
+  std::atomic<bool> stopping{false};
+  std::mutex mutex{};
+  std::condition_variable idle{};
+  // The sockets of in-flight connections, shut down by stop().
+  std::set<int> active{};
+
+  // Overridden to wrap accepted sockets (e.g. in TLS).
+  virtual std::unique_ptr<Connection> accept_connection(const int fd) {
+    return std::unique_ptr<Connection>(new Connection(fd));
+  }
+
+  // A handler that throws fails its own request, not the process.
+  void handle(const Request& request, Connection& connection) {
+    std::string error{};
+    try {
+      handler(request, connection);
+      return;
+    } catch (const std::exception& e) {
+      error = e.what();
+    } catch (...) {
+      error = "unknown exception";
+    }
+    if (connection.responded()) {
+      connection.abort();
+    } else {
+      connection.send_response(500, "Handler failed: " + error + "\n");
+    }
+  }
+
+  void serve(const int fd) {
+    {
+      const int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      auto connection = accept_connection(fd);
+      if (connection) {
+        const auto request = read_request(*connection);
+        if (request) {
+          handle(*request, *connection);
+        } else {
+          connection->send_response(400, request.failure_reason() + "\n");
+        }
+      }
+    }
+    std::lock_guard<std::mutex> lock{mutex};
+    // Closed under the lock so that stop() never shuts down a reused descriptor.
+    close(fd);
+    active.erase(fd);
+    if (active.empty()) idle.notify_all();
+  }
+
+  void accept_loop() {
+    while (!stopping) {
+      const int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd < 0) {
+        if (errno == EINTR || errno == ECONNABORTED) continue;
+        break;
+      }
+      struct timeval timeout{};
+      timeout.tv_sec = options.timeout.count() / 1000;
+      timeout.tv_usec = (options.timeout.count() % 1000) * 1000;
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+      {
+        std::lock_guard<std::mutex> lock{mutex};
+        if (active.size() >= options.max_connections || stopping) {
+          Connection(fd).send_response(503);
+          close(fd);
+          continue;
+        }
+        active.insert(fd);
+      }
+      std::thread(&Server::serve, this, fd).detach();
+    }
+  }
+
+public:
+  explicit Server(const Handler& handler, const Options& options = Options())
+  : handler(handler),
+    options(options) {}
+
+  Server(const Server&) = delete;
+  Server& operator=(const Server&) = delete;
+
+  virtual ~Server() {
+    stop();
+  }
+
+  // Binds (port 0 picks a free port), starts accepting and returns the bound port.
+  Try<uint16_t> listen(const std::string& address = "127.0.0.1", const uint16_t port = 0) {
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+      return Failure<uint16_t>("Invalid listen address " + address);
+    }
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) return Failure<uint16_t>(std::string{"socket: "} + strerror(errno));
+    const int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    socklen_t length = sizeof(addr);
+    if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        ::listen(listen_fd, 512) != 0 ||
+        getsockname(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &length) != 0) {
+      const std::string reason = strerror(errno);
+      close(listen_fd);
+      listen_fd = -1;
+      return Failure<uint16_t>("Could not listen on " + address + ":" + std::to_string(port) +
+                               ": " + reason);
+    }
+    acceptor = std::thread(&Server::accept_loop, this);
+    return Result(static_cast<uint16_t>(ntohs(addr.sin_port)));
+  }
+
+  // Stops accepting, shuts down the in-flight connections (their handlers fail on their next read
+  // or write) and waits for their threads to finish.
+  void stop() {
+    if (stopping.exchange(true)) return;
+    if (listen_fd >= 0) shutdown(listen_fd, SHUT_RDWR);
+    if (acceptor.joinable()) acceptor.join();
+    if (listen_fd >= 0) close(listen_fd);
+    std::unique_lock<std::mutex> lock{mutex};
+    for (const int fd : active) shutdown(fd, SHUT_RDWR);
+    idle.wait(lock, [this]() { return active.empty(); });
+  }
+};
+
+
+} // namespace http
+} // namespace net
+} // namespace appc
@@ -0,0 +1,155 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <memory>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include "appc/net/http_server.h"
+#include "appc/util/try.h"
+
+
+namespace appc {
+namespace net {
+namespace http {
+
+
+using TlsContext = std::shared_ptr<SSL_CTX>;
+
+
+inline std::string tls_error() {
+  char buffer[256];
+  ERR_error_string_n(ERR_get_error(), buffer, sizeof(buffer));
+  return buffer;
+}
+
+
+// A server context for a PEM certificate (chain) and private key.
+inline Try<TlsContext> tls_context(const std::string& certificate_path, const std::string& key_path) {
+  TlsContext context{SSL_CTX_new(TLS_server_method()), SSL_CTX_free};
+  if (!context) return Failure<TlsContext>("Could not create TLS context: " + tls_error());
+  if (SSL_CTX_use_certificate_chain_file(context.get(), certificate_path.c_str()) != 1) {
+    return Failure<TlsContext>("Could not load " + certificate_path + ": " + tls_error());
+  }
+  if (SSL_CTX_use_PrivateKey_file(context.get(), key_path.c_str(), SSL_FILETYPE_PEM) != 1 ||
+      SSL_CTX_check_private_key(context.get()) != 1) {
+    return Failure<TlsContext>("Could not load " + key_path + ": " + tls_error());
+  }
+  return Result(context);
+}
+
+
+class TlsConnection : public Connection {
+private:
+  SSL* const ssl;
+
+public:
+  TlsConnection(const int fd, SSL* ssl)
+  : Connection(fd),
+    ssl(ssl) {}
+
+  virtual ~TlsConnection() {
+    SSL_shutdown(ssl);
+    SSL_free(ssl);
+  }
+
+  virtual ssize_t read_some(void* buffer, const size_t size) {
+    const int got = SSL_read(ssl, buffer, static_cast<int>(std::min<size_t>(size, INT_MAX)));
+    if (got > 0) return got;
+    return SSL_get_error(ssl, got) == SSL_ERROR_ZERO_RETURN ? 0 : -1;
+  }
+
+  virtual Status write(const void* data, const size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    size_t sent = 0;
+    while (sent < size) {
+      const int wrote = SSL_write(ssl, bytes + sent,
+                                  static_cast<int>(std::min<size_t>(size - sent, INT_MAX)));
+      if (wrote <= 0) return Error("Could not send: " + tls_error());
+      sent += wrote;
+    }
+    return Success();
+  }
+
+  // Without a close_notify the client cannot take the reset for the end of the response.
+  virtual void abort() {
+    SSL_set_quiet_shutdown(ssl, 1);
+    Connection::abort();
+  }
+
+  // No sendfile through TLS (short of kernel TLS), copy through a buffer.
+  virtual Status send_file(const int file_fd, off_t offset, size_t count) {
+    char buffer[64 * 1024];
+    while (count > 0) {
+      const ssize_t got = pread(file_fd, buffer, std::min(count, sizeof(buffer)), offset);
+      if (got < 0 && errno == EINTR) continue;
+      if (got <= 0) return Error(std::string{"Could not read file: "} + strerror(errno));
+      const auto sent = write(buffer, got);
+      if (!sent) return sent;
+      offset += got;
+      count -= got;
+    }
+    return Success();
+  }
+};
+
+
+// The HTTP server over TLS (e.g. a stand-in for an https:// image host in tests).
+class TlsServer : public Server {
+private:
+  const TlsContext context;
+
+protected:
+  virtual std::unique_ptr<Connection> accept_connection(const int fd) {
+    // OpenSSL writes with write(2), so a client that hangs up would raise SIGPIPE. Blocked in this
+    // connection's thread it is left pending there and discarded when the thread exits.
+    sigset_t pipe;
+    sigemptyset(&pipe);
+    sigaddset(&pipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe, nullptr);
+
+    SSL* ssl = SSL_new(context.get());
+    if (ssl == nullptr) return nullptr;
+    if (SSL_set_fd(ssl, fd) != 1 || SSL_accept(ssl) != 1) {
+      SSL_free(ssl);
+      return nullptr;
+    }
+    return std::unique_ptr<Connection>(new TlsConnection(fd, ssl));
+  }
+
+public:
+  TlsServer(const Handler& handler, const TlsContext& context, const Options& options = Options())
+  : Server(handler, options),
+    context(context) {}
+
+  virtual ~TlsServer() {
+    // Connections call back into this object, stop before it is torn down.
+    stop();
+  }
+};
+
+
+} // namespace http
+} // namespace net
+} // namespace appc
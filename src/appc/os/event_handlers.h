@@ -0,0 +1,71 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+#pragma once
+
+#include <chrono>
+
+#include "appc/os/process.h"
+#include "appc/schema/app.h"
+#include "appc/util/status.h"
+
+
+namespace appc {
+namespace os {
+
+
+// Runs an App's event handlers (pre-start, post-stop) on the process runner: the handler's exec with
+// the App's environment over this process's, from the App's working directory.
+
+
+inline Command event_handler_command(const schema::App& app,
+                                     const schema::EventHandler& handler,
+                                     const std::chrono::milliseconds timeout) {
+  std::vector<std::string> argv{};
+  for (const auto& arg : handler.exec.array) argv.push_back(arg.value);
+  auto environment = EnvironmentBlock::inherit();
+  if (app.environment) {
+    for (const auto& variable : app.environment->array) {
+      environment.set(variable.name, variable.value);
+    }
+  }
+  const std::string working_directory = app.working_directory ? app.working_directory->value : "";
+  return Command(argv, Some(environment), working_directory, timeout);
+}
+
+
+// Runs every handler for the event in order, stopping at the first that does not succeed. An App
+// without handlers for the event succeeds trivially.
+inline Status run_event_handlers(const schema::App& app,
+                                 const std::string& event,
+                                 const OutputHandler& on_stdout = nullptr,
+                                 const OutputHandler& on_stderr = nullptr,
+                                 const std::chrono::milliseconds timeout =
+                                     std::chrono::milliseconds(60000)) {
+  if (!app.event_handlers) return Success();
+  for (const auto& handler : app.event_handlers->array) {
+    if (handler.name.value != event) continue;
+    const auto ran = run(event_handler_command(app, handler, timeout), on_stdout, on_stderr);
+    if (!ran) return Error(event + " handler could not be run: " + ran.failure_reason());
+    if (!ran->success()) return Error(event + " handler " + ran->describe());
+  }
+  return Success();
+}
+
+
+} // namespace os
+} // namespace appc
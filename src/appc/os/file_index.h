@@ -0,0 +1,300 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <mutex>
+#include <string>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "appc/util/status.h"
+
+
+namespace appc {
+namespace os {
+
+
+// An in-memory index of the non-directory entries under a directory tree, built with one scan and
+// kept current with inotify, so that checking whether a file exists costs a hash lookup (and one
+// non-blocking read of pending events) rather than a stat. On filesystems where metadata lives on
+// a server that stat otherwise has to ask, every check is local.
+//
+// The index can only answer for changes made through this kernel: inotify does not see files
+// created by other clients of a network filesystem. When it cannot answer, because it could not be
+// set up, the event queue overflowed, or the path goes through a symlinked directory, contains()
+// says so and the caller should look for itself. After an overflow the tree is rescanned on the
+// first lookup at least rescan_delay later, so an event flood does not turn into a scan flood.
+//
+// Thread-safe.
+class FileIndex {
+public:
+  enum class Presence { present, absent, unknown };
+
+  using Clock = std::chrono::steady_clock;
+
+private:
+  static constexpr uint32_t watch_mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                         IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+  const std::string root;
+  const Clock::duration rescan_delay;
+
+  std::mutex mutex{};
+  int inotify_fd{-1};
+  bool stale{true};
+  Clock::time_point stale_since{};
+  std::unordered_map<int, std::string> directories{};
+  std::unordered_set<std::string> files{};
+  // Symlinks to directories, the index does not follow them.
+  std::unordered_set<std::string> opaque{};
+
+  static std::string strip_trailing_slashes(std::string path) {
+    while (path.length() > 1 && path.back() == '/') path.pop_back();
+    return path;
+  }
+
+  static bool has_prefix(const std::string& path, const std::string& directory) {
+    return path.length() > directory.length() &&
+           path.compare(0, directory.length(), directory) == 0 &&
+           path[directory.length()] == '/';
+  }
+
+  void mark_stale() {
+    if (!stale) stale_since = Clock::now();
+    stale = true;
+  }
+
+  // Requires mutex. Watches before listing, so entries created during the scan are not missed;
+  // applying an event for an entry the scan already saw is harmless.
+  bool watch_tree(const std::string& directory) {
+    const int wd = inotify_add_watch(inotify_fd, directory.c_str(), watch_mask);
+    if (wd < 0) {
+      // Gone already (nothing to index), or out of watches (cannot keep the index current).
+      if (errno != ENOENT && errno != ENOTDIR) mark_stale();
+      return false;
+    }
+    directories[wd] = directory;
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr) return true;
+    for (struct dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+      const std::string name{entry->d_name};
+      if (name == "." || name == "..") continue;
+      const std::string path = directory + "/" + name;
+      unsigned char type = entry->d_type;
+      struct stat entry_stat;
+      if (type == DT_UNKNOWN && fstatat(dirfd(dir), entry->d_name, &entry_stat, AT_SYMLINK_NOFOLLOW) == 0) {
+        type = S_ISDIR(entry_stat.st_mode) ? DT_DIR : S_ISLNK(entry_stat.st_mode) ? DT_LNK : DT_REG;
+      }
+      if (type == DT_DIR) {
+        watch_tree(path);
+        continue;
+      }
+      add_file(path, type == DT_LNK);
+    }
+    closedir(dir);
+    return true;
+  }
+
+  void add_file(const std::string& path, const bool maybe_symlink) {
+    files.insert(path);
+    struct stat target;
+    if (maybe_symlink && stat(path.c_str(), &target) == 0 && S_ISDIR(target.st_mode)) {
+      opaque.insert(path);
+    }
+  }
+
+  // Requires mutex. A directory left the tree (deleted or moved), drop everything beneath it.
+  void forget_tree(const std::string& directory) {
+    for (auto file = files.begin(); file != files.end();) {
+      file = has_prefix(*file, directory) ? files.erase(file) : std::next(file);
+    }
+    for (auto link = opaque.begin(); link != opaque.end();) {
+      link = has_prefix(*link, directory) ? opaque.erase(link) : std::next(link);
+    }
+    for (auto watched = directories.begin(); watched != directories.end();) {
+      if (watched->second == directory || has_prefix(watched->second, directory)) {
+        inotify_rm_watch(inotify_fd, watched->first);
+        watched = directories.erase(watched);
+      } else {
+        watched++;
+      }
+    }
+  }
+
+  // Requires mutex.
+  void apply(const struct inotify_event& event) {
+    if (event.mask & IN_Q_OVERFLOW) {
+      mark_stale();
+      return;
+    }
+    const auto directory = directories.find(event.wd);
+    if (directory == directories.end()) return;
+    if (event.mask & IN_IGNORED) {
+      directories.erase(directory);
+      return;
+    }
+    if (event.mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+      // Subdirectories are handled through their parent, only the root itself matters here.
+      if (directory->second == root) mark_stale();
+      return;
+    }
+    if (event.len == 0) return;
+    const std::string path = directory->second + "/" + event.name;
+    const bool created = event.mask & (IN_CREATE | IN_MOVED_TO);
+    if (event.mask & IN_ISDIR) {
+      if (created) {
+        watch_tree(path);
+      } else {
+        forget_tree(path);
+      }
+    } else if (created) {
+      add_file(path, true);
+    } else {
+      files.erase(path);
+      opaque.erase(path);
+    }
+  }
+
+  // Requires mutex.
+  void drain() {
+    if (inotify_fd < 0) return;
+    alignas(struct inotify_event) char buffer[64 * 1024];
+    while (true) {
+      const ssize_t n = read(inotify_fd, buffer, sizeof(buffer));
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return;
+      for (ssize_t offset = 0; offset < n;) {
+        const auto event = reinterpret_cast<const struct inotify_event*>(buffer + offset);
+        apply(*event);
+        offset += sizeof(struct inotify_event) + event->len;
+      }
+    }
+  }
+
+  // Requires mutex.
+  Status reset() {
+    if (inotify_fd >= 0) close(inotify_fd);
+    directories.clear();
+    files.clear();
+    opaque.clear();
+    stale = false;
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) {
+      mark_stale();
+      return Error(std::string{"Could not initialize inotify: "} + strerror(errno));
+    }
+    if (!watch_tree(root)) {
+      mark_stale();
+      return Error("Could not watch " + root + ": " + strerror(errno));
+    }
+    drain();
+    if (stale) return Error("Could not watch all of " + root);
+    return Success();
+  }
+
+  // Requires mutex.
+  void refresh() {
+    drain();
+    if (stale && inotify_fd >= 0 && Clock::now() - stale_since >= rescan_delay) {
+      reset();
+    }
+  }
+
+  // Requires mutex.
+  Presence lookup(const std::string& path) const {
+    if (stale || !covers(path)) return Presence::unknown;
+    return files.count(path) > 0 ? Presence::present : Presence::absent;
+  }
+
+  // Requires mutex.
+  bool covers(const std::string& path) const {
+    if (!has_prefix(path, root)) return false;
+    if (path.find("//") != std::string::npos ||
+        path.find("/./") != std::string::npos ||
+        path.find("/../") != std::string::npos ||
+        path.back() == '/') {
+      return false;
+    }
+    for (size_t slash = path.find('/', root.length() + 1);
+         slash != std::string::npos && !opaque.empty();
+         slash = path.find('/', slash + 1)) {
+      if (opaque.count(path.substr(0, slash)) > 0) return false;
+    }
+    return true;
+  }
+
+public:
+  explicit FileIndex(const std::string& root,
+                     const Clock::duration rescan_delay = std::chrono::seconds(5))
+  : root(strip_trailing_slashes(root)),
+    rescan_delay(rescan_delay) {}
+
+  FileIndex(const FileIndex&) = delete;
+  FileIndex& operator=(const FileIndex&) = delete;
+
+  ~FileIndex() {
+    if (inotify_fd >= 0) close(inotify_fd);
+  }
+
+  // Scans the tree. On failure the index answers unknown until a later rescan succeeds.
+  Status open() {
+    std::lock_guard<std::mutex> lock{mutex};
+    return reset();
+  }
+
+  Status rescan() {
+    return open();
+  }
+
+  Presence contains(const std::string& path) {
+    std::lock_guard<std::mutex> lock{mutex};
+    refresh();
+    return lookup(path);
+  }
+
+  // contains() for each path, with one drain and under one lock.
+  std::vector<Presence> contains_all(const std::vector<std::string>& paths) {
+    std::lock_guard<std::mutex> lock{mutex};
+    refresh();
+    std::vector<Presence> presence{};
+    presence.reserve(paths.size());
+    for (const auto& path : paths) presence.push_back(lookup(path));
+    return presence;
+  }
+
+  // Files currently indexed.
+  size_t size() {
+    std::lock_guard<std::mutex> lock{mutex};
+    drain();
+    return files.size();
+  }
+};
+
+
+} // namespace os
+} // namespace appc
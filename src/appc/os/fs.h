@@ -0,0 +1,191 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "appc/os/dir.h"
+#include "appc/os/mkdir.h"
+#include "appc/util/executor.h"
+#include "appc/util/status.h"
+
+
+namespace appc {
+namespace os {
+
+
+// Makes a directory's entries (e.g. a file just renamed or linked into it) durable.
+inline Status fsync_dir(const std::string& path) {
+  const int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) return Error("Could not open " + path + ": " + strerror(errno));
+  const int synced = fsync(fd);
+  const int saved_errno = errno;
+  close(fd);
+  if (synced != 0) return Error("Could not sync " + path + ": " + strerror(saved_errno));
+  return Success();
+}
+
+
+namespace detail {
+
+
+inline bool is_directory(const int parent_fd, const struct dirent* entry) {
+  if (entry->d_type != DT_UNKNOWN) return entry->d_type == DT_DIR;
+  struct stat entry_stat;
+  return fstatat(parent_fd, entry->d_name, &entry_stat, AT_SYMLINK_NOFOLLOW) == 0 &&
+         S_ISDIR(entry_stat.st_mode);
+}
+
+
+// The first error met removing a tree. Removal carries on past errors so that one entry that cannot
+// be removed does not leave the rest of the tree behind.
+class FirstError {
+private:
+  std::mutex mutex{};
+  std::string message{};
+public:
+  void add(const std::string& error) {
+    std::lock_guard<std::mutex> lock{mutex};
+    if (message.empty()) message = error;
+  }
+
+  Status status() {
+    std::lock_guard<std::mutex> lock{mutex};
+    return message.empty() ? Success() : Error(message);
+  }
+};
+
+
+// Removes what it can below the directory open at dir_fd (which is consumed), adding what it could
+// not to errors. Symlinks are removed, never followed.
+inline void remove_contents(const int dir_fd, const std::string& path, FirstError& errors) {
+  Dir dir{fdopendir(dir_fd)};
+  if (!dir) {
+    close(dir_fd);
+    errors.add("Could not read " + path + ": " + strerror(errno));
+    return;
+  }
+  const int fd = dirfd(dir.get());
+  for (struct dirent* entry = readdir(dir.get()); entry; entry = readdir(dir.get())) {
+    const std::string name{entry->d_name};
+    if (name == "." || name == "..") continue;
+    if (is_directory(fd, entry)) {
+      const int child = openat(fd, entry->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      if (child < 0) {
+        errors.add("Could not open " + path + "/" + name + ": " + strerror(errno));
+        continue;
+      }
+      remove_contents(child, path + "/" + name, errors);
+      if (unlinkat(fd, entry->d_name, AT_REMOVEDIR) != 0) {
+        errors.add("Could not remove " + path + "/" + name + ": " + strerror(errno));
+      }
+    } else if (unlinkat(fd, entry->d_name, 0) != 0 && errno != ENOENT) {
+      errors.add("Could not remove " + path + "/" + name + ": " + strerror(errno));
+    }
+  }
+}
+
+
+} // namespace detail
+
+
+// Like rm -rf: a missing path is not an error, and an entry that cannot be removed does not stop
+// the rest being removed (the first such error is returned). The top-level subdirectories (an image
+// rootfs's usr, lib, etc.) are removed concurrently, as up to threads tasks on the default executor.
+inline Status remove_tree(const std::string& path,
+                          unsigned threads = std::thread::hardware_concurrency()) {
+  const int root = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (root < 0) {
+    if (errno == ENOENT) return Success();
+    if (errno == ENOTDIR || errno == ELOOP) {
+      if (unlink(path.c_str()) != 0) return Error("Could not remove " + path + ": " + strerror(errno));
+      return Success();
+    }
+    return Error("Could not open " + path + ": " + strerror(errno));
+  }
+  created_directories().forget(path);
+
+  // root stays open for the tasks, so that they work below the directory that was opened even if
+  // path is renamed or replaced meanwhile. The listing gets its own descriptor.
+  detail::FirstError errors{};
+  std::vector<std::string> subdirs{};
+  {
+    const int listing = dup(root);
+    Dir dir{listing < 0 ? nullptr : fdopendir(listing)};
+    if (!dir) {
+      const int saved_errno = errno;
+      if (listing >= 0) close(listing);
+      close(root);
+      return Error("Could not read " + path + ": " + strerror(saved_errno));
+    }
+    const int fd = dirfd(dir.get());
+    for (struct dirent* entry = readdir(dir.get()); entry; entry = readdir(dir.get())) {
+      const std::string name{entry->d_name};
+      if (name == "." || name == "..") continue;
+      if (detail::is_directory(fd, entry)) {
+        subdirs.push_back(name);
+      } else if (unlinkat(fd, entry->d_name, 0) != 0 && errno != ENOENT) {
+        errors.add("Could not remove " + path + "/" + name + ": " + strerror(errno));
+      }
+    }
+  }
+
+  std::atomic<size_t> next{0};
+  // The tasks report through errors rather than failing, which would cancel those not yet started.
+  const auto work = [&]() -> Status {
+    for (size_t i = next++; i < subdirs.size(); i = next++) {
+      const std::string subdir = path + "/" + subdirs[i];
+      const int fd = openat(root, subdirs[i].c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      if (fd < 0) {
+        errors.add("Could not open " + subdir + ": " + strerror(errno));
+        continue;
+      }
+      detail::remove_contents(fd, subdir, errors);
+      if (unlinkat(root, subdirs[i].c_str(), AT_REMOVEDIR) != 0) {
+        errors.add("Could not remove " + subdir + ": " + strerror(errno));
+      }
+    }
+    return Success();
+  };
+  util::TaskGroup group{};
+  const size_t tasks = std::min<size_t>(std::min<size_t>(std::max(threads, 1u), group.concurrency()),
+                                        subdirs.size());
+  for (size_t i = 0; i < tasks; i++) group.run(work);
+  group.wait();
+  close(root);
+
+  if (rmdir(path.c_str()) != 0) {
+    errors.add("Could not remove " + path + ": " + strerror(errno));
+  }
+  return errors.status();
+}
+
+
+} // namespace os
+} // namespace appc
@@ -18,10 +18,15 @@
 #pragma once
 
 #include <cerrno>
-#include <cstdlib>
 #include <cstring>
-#include <iostream>
+#include <fcntl.h>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include "3rdparty/cdaylward/pathname.h"
 #include "appc/util/status.h"
@@ -31,23 +36,138 @@ namespace appc {
 namespace os {
 
 
+// Directories this process has created or found with mkdir(..., true). Most fetches land in a
+// directory an earlier fetch already made, so they skip the walk entirely. Anything that removes
+// directories out from under the cache (remove_tree does) must forget them. Holds at most capacity
+// directories, dropping the least recently used; a dropped one is only walked again.
+class DirectoryCache {
+private:
+  const size_t capacity;
+  std::mutex mutex{};
+  // Most recently used first.
+  std::list<std::string> recent{};
+  // Ordered, so that everything below a directory is one range.
+  std::map<std::string, std::list<std::string>::iterator> known{};
+
+  // Requires mutex.
+  void erase(const std::map<std::string, std::list<std::string>::iterator>::iterator& entry) {
+    recent.erase(entry->second);
+    known.erase(entry);
+  }
+
+public:
+  explicit DirectoryCache(const size_t capacity = 4096)
+  : capacity(capacity) {}
+
+  bool contains(const std::string& path) {
+    std::lock_guard<std::mutex> lock{mutex};
+    const auto entry = known.find(path);
+    if (entry == known.end()) return false;
+    recent.splice(recent.begin(), recent, entry->second);
+    return true;
+  }
+
+  void add(const std::string& path) {
+    std::lock_guard<std::mutex> lock{mutex};
+    const auto entry = known.find(path);
+    if (entry != known.end()) {
+      recent.splice(recent.begin(), recent, entry->second);
+      return;
+    }
+    recent.push_front(path);
+    known.emplace(path, recent.begin());
+    if (known.size() > capacity) erase(known.find(recent.back()));
+  }
+
+  // Forgets path and everything below it.
+  void forget(const std::string& path) {
+    std::lock_guard<std::mutex> lock{mutex};
+    const auto entry = known.find(path);
+    if (entry != known.end()) erase(entry);
+    // Paths below path sort between path + "/" and path + "0", '0' following '/'.
+    const auto end = known.lower_bound(path + "0");
+    for (auto below = known.lower_bound(path + "/"); below != end;) erase(below++);
+  }
+
+  size_t size() {
+    std::lock_guard<std::mutex> lock{mutex};
+    return known.size();
+  }
+};
+
+
+inline DirectoryCache& created_directories() {
+  static DirectoryCache cache{};
+  return cache;
+}
+
+
+// With create_parents, like mkdir -p: missing components are created with mkdirat relative to their
+// parent, and an existing directory (or symlink to one) is not an error.
 inline Status mkdir(const std::string& dir, const mode_t mode, const bool create_parents = false) {
-  if (create_parents && !pathname::is_absolute(dir)) {
+  if (!create_parents) {
+    if (::mkdir(dir.c_str(), mode) != 0) {
+      return Error(std::string{"Could not create "} + dir + ": " + strerror(errno));
+    }
+    return Success();
+  }
+  if (!pathname::is_absolute(dir)) {
     return Error(std::string{"Will not create parents for relative path: "} + dir);
   }
-  // FIXME, use syscall, plumb mode
-  std::string mkdir_command = "mkdir ";
-  if (create_parents) {
-    mkdir_command += "-p ";
+  if (dir.find_first_not_of('/') == std::string::npos) return Success();
+  const std::string path = pathname::trim_trailing_slash(dir);
+  auto& cache = created_directories();
+  if (cache.contains(path)) return Success();
+
+  // Start below the deepest directory already known, unless it has gone away.
+  std::string walked{};
+  size_t start = 1;
+  for (size_t cut = path.rfind('/'); cut != std::string::npos && cut > 0;
+       cut = path.rfind('/', cut - 1)) {
+    if (cache.contains(path.substr(0, cut))) {
+      walked = path.substr(0, cut);
+      start = cut + 1;
+      break;
+    }
   }
-  mkdir_command += "-- " + dir;
-  if (system(mkdir_command.c_str()) != 0) {
-    return Error(std::string{"Could not create "} + dir + ": " + strerror(errno));
+  int parent = open(walked.empty() ? "/" : walked.c_str(), O_DIRECTORY | O_PATH | O_CLOEXEC);
+  if (parent < 0 && !walked.empty()) {
+    cache.forget(walked);
+    walked.clear();
+    start = 1;
+    parent = open("/", O_DIRECTORY | O_PATH | O_CLOEXEC);
   }
+  if (parent < 0) return Error(std::string{"Could not open /: "} + strerror(errno));
+  while (start < path.length()) {
+    size_t end = path.find('/', start);
+    if (end == std::string::npos) end = path.length();
+    const std::string component = path.substr(start, end - start);
+    start = end + 1;
+    if (component.empty() || component == ".") continue;
+    walked += "/" + component;
+    if (mkdirat(parent, component.c_str(), mode) != 0 && errno != EEXIST) {
+      const std::string reason = strerror(errno);
+      close(parent);
+      return Error("Could not create " + walked + ": " + reason);
+    }
+    const int child = openat(parent, component.c_str(), O_DIRECTORY | O_PATH | O_CLOEXEC);
+    close(parent);
+    if (child < 0) return Error("Could not create " + walked + ": " + strerror(errno));
+    parent = child;
+    cache.add(walked);
+  }
+  close(parent);
   return Success();
 }
 
 
+// For a caller that was told dir exists (possibly by the cache) but then failed to create a file in
+// it with ENOENT: something removed it without forgetting it, so forget it and make it again.
+inline Status mkdir_again(const std::string& dir, const mode_t mode) {
+  created_directories().forget(pathname::trim_trailing_slash(dir));
+  return mkdir(dir, mode, true);
+}
+
+
 } // namespace os
 } // namespace appc
-
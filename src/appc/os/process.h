@@ -18,31 +18,349 @@
 #pragma once
 
 #include <cerrno>
+#include <chrono>
+#include <csignal>
 #include <cstdlib>
-#include <iostream>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <poll.h>
+#include <spawn.h>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
+#include "appc/util/option.h"
+#include "appc/util/status.h"
 #include "appc/util/try.h"
 
 
+extern char** environ;
+
+
 namespace appc {
 namespace os {
 
 
-inline Try<std::string> get_process_output(const std::string& cmd, const std::size_t bytes_to_read) {
-  FILE* process = popen(cmd.c_str(), "r");
-  if (!process) return Failure<std::string>(cmd + " failed: " + strerror(errno));
-  std::unique_ptr<char[]> buffer(new char[bytes_to_read]);
-  fread(buffer.get(), sizeof(char), bytes_to_read, process);
-  if (ferror(process)) {
-    pclose(process);
-    return Failure<std::string>(cmd + " could not be read: " + strerror(errno));
+// Environment for a child process, packed into one arena: "NAME=value\0" strings back to back, so
+// building a process's envp is one allocation for the strings and one for the pointers, however
+// many variables there are.
+class EnvironmentBlock {
+private:
+  std::string arena{};
+  // Offsets of live entries; set() retires an entry by dropping its offset.
+  std::vector<size_t> entries{};
+
+  size_t find(const std::string& name) const {
+    for (size_t i = 0; i < entries.size(); i++) {
+      const char* entry = arena.data() + entries[i];
+      if (strncmp(entry, name.data(), name.length()) == 0 && entry[name.length()] == '=') return i;
+    }
+    return entries.size();
+  }
+
+public:
+  EnvironmentBlock() {}
+
+  // A copy of this process's environment.
+  static EnvironmentBlock inherit() {
+    EnvironmentBlock block{};
+    for (char** entry = environ; entry && *entry; entry++) {
+      block.entries.push_back(block.arena.length());
+      block.arena.append(*entry);
+      block.arena.push_back('\0');
+    }
+    return block;
+  }
+
+  EnvironmentBlock& set(const std::string& name, const std::string& value) {
+    const size_t existing = find(name);
+    if (existing < entries.size()) entries.erase(entries.begin() + existing);
+    entries.push_back(arena.length());
+    arena.append(name).append("=").append(value);
+    arena.push_back('\0');
+    return *this;
+  }
+
+  EnvironmentBlock& unset(const std::string& name) {
+    const size_t existing = find(name);
+    if (existing < entries.size()) entries.erase(entries.begin() + existing);
+    return *this;
+  }
+
+  Option<std::string> get(const std::string& name) const {
+    const size_t existing = find(name);
+    if (existing == entries.size()) return None<std::string>();
+    return Some(std::string{arena.data() + entries[existing] + name.length() + 1});
+  }
+
+  size_t size() const {
+    return entries.size();
+  }
+
+  // Null-terminated, valid until the block is next modified.
+  std::vector<char*> envp() const {
+    std::vector<char*> pointers{};
+    pointers.reserve(entries.size() + 1);
+    for (const auto offset : entries) pointers.push_back(const_cast<char*>(arena.data() + offset));
+    pointers.push_back(nullptr);
+    return pointers;
+  }
+};
+
+
+struct Command {
+  // argv[0] without a slash is looked up in PATH.
+  std::vector<std::string> argv;
+  // None inherits this process's environment.
+  Option<EnvironmentBlock> environment;
+  std::string working_directory;
+  // Zero for none. On timeout the child gets SIGTERM, then SIGKILL after the grace period.
+  std::chrono::milliseconds timeout;
+  std::chrono::milliseconds kill_grace;
+
+  explicit Command(const std::vector<std::string>& argv,
+                   const Option<EnvironmentBlock>& environment = None<EnvironmentBlock>(),
+                   const std::string& working_directory = "",
+                   const std::chrono::milliseconds timeout = std::chrono::milliseconds(0),
+                   const std::chrono::milliseconds kill_grace = std::chrono::milliseconds(2000))
+  : argv(argv),
+    environment(environment),
+    working_directory(working_directory),
+    timeout(timeout),
+    kill_grace(kill_grace) {}
+};
+
+
+struct ExitStatus {
+  bool exited;
+  // Exit code if exited, otherwise the terminating signal.
+  int code;
+  bool timed_out;
+
+  bool success() const {
+    return exited && code == 0 && !timed_out;
+  }
+
+  std::string describe() const {
+    if (timed_out) return "timed out";
+    if (exited) return "exited with " + std::to_string(code);
+    return std::string{"killed by "} + strsignal(code);
+  }
+};
+
+
+// Called with each chunk of output as it arrives.
+using OutputHandler = std::function<void(const char* data, const size_t size)>;
+
+
+namespace detail {
+
+
+struct Pipe {
+  int read_fd{-1};
+  int write_fd{-1};
+
+  ~Pipe() {
+    if (read_fd >= 0) close(read_fd);
+    if (write_fd >= 0) close(write_fd);
+  }
+
+  bool open() {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) return false;
+    read_fd = fds[0];
+    write_fd = fds[1];
+    return true;
   }
-  pclose(process);
+};
+
+
+struct FileActions {
+  posix_spawn_file_actions_t actions;
+  FileActions() { posix_spawn_file_actions_init(&actions); }
+  ~FileActions() { posix_spawn_file_actions_destroy(&actions); }
+};
+
+
+struct SpawnAttributes {
+  posix_spawnattr_t attributes;
+  SpawnAttributes() { posix_spawnattr_init(&attributes); }
+  ~SpawnAttributes() { posix_spawnattr_destroy(&attributes); }
+};
+
+
+} // namespace detail
+
+
+// Runs a command with stdin from /dev/null, streaming stdout and stderr to the handlers (either may
+// be empty to discard). glibc's posix_spawn clones with CLONE_VM|CLONE_VFORK, so spawning does not
+// copy the parent's page tables however large the parent is. Failure means the command could not be
+// run at all, or was reaped elsewhere (SIGCHLD ignored) so how it ended is unknown; how it ended
+// is in the ExitStatus.
+inline Try<ExitStatus> run(const Command& command,
+                           const OutputHandler& on_stdout = nullptr,
+                           const OutputHandler& on_stderr = nullptr) {
+  using clock = std::chrono::steady_clock;
+  if (command.argv.empty()) return Failure<ExitStatus>("No command to run");
+
+  detail::Pipe out{}, err{};
+  if (!out.open() || !err.open()) {
+    return Failure<ExitStatus>(std::string{"Could not create pipes: "} + strerror(errno));
+  }
+
+  detail::FileActions files{};
+  posix_spawn_file_actions_addopen(&files.actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_adddup2(&files.actions, out.write_fd, STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&files.actions, err.write_fd, STDERR_FILENO);
+  if (!command.working_directory.empty()) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 29)
+    posix_spawn_file_actions_addchdir_np(&files.actions, command.working_directory.c_str());
+#else
+    return Failure<ExitStatus>("Setting a working directory is not supported on this platform");
+#endif
+  }
+
+  // The child starts with default dispositions and nothing blocked, whatever this process does.
+  detail::SpawnAttributes attributes{};
+  sigset_t signals;
+  sigemptyset(&signals);
+  posix_spawnattr_setsigmask(&attributes.attributes, &signals);
+  sigaddset(&signals, SIGPIPE);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  posix_spawnattr_setsigdefault(&attributes.attributes, &signals);
+  posix_spawnattr_setflags(&attributes.attributes, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+  std::vector<char*> argv{};
+  for (const auto& arg : command.argv) argv.push_back(const_cast<char*>(arg.c_str()));
+  argv.push_back(nullptr);
+  const std::vector<char*> envp = command.environment ? command.environment->envp()
+                                                      : std::vector<char*>{};
 
-  return Result(std::string{buffer.get()});
+  pid_t pid;
+  const bool search = command.argv[0].find('/') == std::string::npos;
+  const int spawned = (search ? posix_spawnp : posix_spawn)(
+      &pid, argv[0], &files.actions, &attributes.attributes, argv.data(),
+      command.environment ? const_cast<char**>(envp.data()) : environ);
+  if (spawned != 0) {
+    return Failure<ExitStatus>("Could not run " + command.argv[0] + ": " + strerror(spawned));
+  }
+  close(out.write_fd);
+  close(err.write_fd);
+  out.write_fd = err.write_fd = -1;
+  fcntl(out.read_fd, F_SETFL, O_NONBLOCK);
+  fcntl(err.read_fd, F_SETFL, O_NONBLOCK);
+
+  bool has_deadline = command.timeout.count() > 0;
+  auto deadline = clock::now() + command.timeout;
+  bool timed_out = false;
+  int status = 0;
+  bool reaped = false;
+  // Reaped by someone else (e.g. SIGCHLD ignored), so how it ended is unknown.
+  bool lost = false;
+
+  struct pollfd fds[2] = {{out.read_fd, POLLIN, 0}, {err.read_fd, POLLIN, 0}};
+  const OutputHandler* handlers[2] = {&on_stdout, &on_stderr};
+  char buffer[64 * 1024];
+  while (fds[0].fd >= 0 || fds[1].fd >= 0 || !reaped) {
+    int wait_ms = 100;
+    if (has_deadline) {
+      const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - clock::now()).count();
+      if (remaining <= 0) {
+        if (!timed_out) {
+          timed_out = true;
+          kill(pid, SIGTERM);
+          deadline = clock::now() + command.kill_grace;
+        } else {
+          kill(pid, SIGKILL);
+          has_deadline = false;
+          // Descendants may hold the pipes open; stop reading them.
+          for (auto& fd : fds) fd.fd = -1;
+        }
+        continue;
+      }
+      wait_ms = std::min<int64_t>(wait_ms, remaining);
+    }
+    if (fds[0].fd >= 0 || fds[1].fd >= 0) {
+      const int ready = poll(fds, 2, wait_ms);
+      if (ready < 0 && errno != EINTR) break;
+      for (int i = 0; i < 2 && ready > 0; i++) {
+        if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+        const ssize_t got = read(fds[i].fd, buffer, sizeof(buffer));
+        if (got > 0) {
+          if (*handlers[i]) (*handlers[i])(buffer, got);
+        } else if (got == 0 || (errno != EINTR && errno != EAGAIN)) {
+          fds[i].fd = -1;
+        }
+      }
+    } else if (!reaped) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(std::min(wait_ms, 5)));
+    }
+    if (!reaped) {
+      const pid_t waited = waitpid(pid, &status, WNOHANG);
+      if (waited == pid || (waited < 0 && errno == ECHILD)) {
+        reaped = true;
+        lost = waited < 0;
+        // Drain what the command left in the pipes. Descendants that outlive the command and keep
+        // the pipes open are not waited for.
+        for (auto& fd : fds) {
+          if (fd.fd < 0) continue;
+          ssize_t got;
+          while ((got = read(fd.fd, buffer, sizeof(buffer))) > 0) {
+            const int i = &fd - fds;
+            if (*handlers[i]) (*handlers[i])(buffer, got);
+          }
+          fd.fd = -1;
+        }
+      }
+    }
+  }
+  if (!reaped) {
+    pid_t waited;
+    while ((waited = waitpid(pid, &status, 0)) < 0 && errno == EINTR) {}
+    lost = waited < 0;
+  }
+  if (lost) return Failure<ExitStatus>(command.argv[0] + ": exit status unavailable");
+
+  if (WIFEXITED(status)) return Result(ExitStatus{true, WEXITSTATUS(status), timed_out});
+  return Result(ExitStatus{false, WTERMSIG(status), timed_out});
+}
+
+
+struct ProcessOutput {
+  ExitStatus status;
+  std::string out;
+  std::string err;
+};
+
+
+// Runs a command and collects its output, keeping at most max_output bytes of each stream (the
+// rest is read and discarded so the command never blocks on a full pipe).
+inline Try<ProcessOutput> capture(const Command& command,
+                                  const size_t max_output = 16 << 20) {
+  std::string out{}, err{};
+  const auto keep = [max_output](std::string& into) {
+    return [&into, max_output](const char* data, const size_t size) {
+      if (into.length() < max_output) into.append(data, std::min(size, max_output - into.length()));
+    };
+  };
+  const auto ran = run(command, keep(out), keep(err));
+  if (!ran) return Failure<ProcessOutput>(ran.failure_reason());
+  return Result(ProcessOutput{*ran, out, err});
+}
+
+
+// The first bytes_to_read bytes of a shell command's standard output.
+inline Try<std::string> get_process_output(const std::string& cmd, const std::size_t bytes_to_read) {
+  const auto output = capture(Command({"/bin/sh", "-c", cmd}), bytes_to_read);
+  if (!output) return Failure<std::string>(cmd + " failed: " + output.failure_reason());
+  return Result(output->out);
 }
 
 
 } // namespace os
 } // namespace appc
-
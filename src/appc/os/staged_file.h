@@ -0,0 +1,295 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "3rdparty/cdaylward/pathname.h"
+#include "appc/os/fs.h"
+#include "appc/os/mkdir.h"
+#include "appc/util/status.h"
+
+
+namespace appc {
+namespace os {
+
+
+// A file written sequentially out of sight and published at its path only once complete.
+//
+// Writes are coalesced in a page-aligned buffer and issued as large writes at buffer-aligned
+// offsets. The file is staged as an anonymous O_TMPFILE in the target directory and linked into
+// place by commit(); where O_TMPFILE is unsupported it is staged under a hidden name and renamed.
+// Either way readers never see a partial file and an abandoned file leaves nothing behind.
+class StagedFile {
+public:
+  struct Options {
+    // Multiple of the page size.
+    size_t buffer_size;
+    // Drop written pages from the page cache as they are flushed (for images that will not be
+    // read back soon, so they do not push out hotter data).
+    bool drop_cache;
+    // Sync the data before publishing and the directory after, so that after a crash the path
+    // holds either the old file or the complete new one.
+    bool durable;
+
+    Options(const size_t buffer_size = 1 << 20,
+            const bool drop_cache = false,
+            const bool durable = false)
+    : buffer_size(buffer_size),
+      drop_cache(drop_cache),
+      durable(durable) {}
+  };
+
+private:
+  struct FreeDeleter {
+    void operator()(char* buffer) const {
+      free(buffer);
+    }
+  };
+
+  const std::string path;
+  const Options options;
+  int fd{-1};
+  // Empty when staged with O_TMPFILE.
+  std::string staging_path{};
+  std::unique_ptr<char, FreeDeleter> buffer{};
+  size_t buffered{0};
+  uint64_t flushed{0};
+  uint64_t preallocated{0};
+
+  Status flush() {
+    size_t written = 0;
+    while (written < buffered) {
+      const ssize_t n = pwrite(fd, buffer.get() + written, buffered - written, flushed + written);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return Error("Could not write " + path + ": " + strerror(errno));
+      written += n;
+    }
+    if (options.drop_cache && buffered > 0) {
+      posix_fadvise(fd, flushed, buffered, POSIX_FADV_DONTNEED);
+    }
+    flushed += buffered;
+    buffered = 0;
+    return Success();
+  }
+
+  // 0 or the errno of the failure.
+  int try_stage(const std::string& dir) {
+#ifdef O_TMPFILE
+    fd = ::open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0644);
+    if (fd >= 0) return 0;
+    // Older kernels and some filesystems (overlay on old kernels, NFS) do not support it.
+    if (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL && errno != ENOENT) return errno;
+#endif
+    std::string staging = pathname::join(dir, "." + pathname::base(path) + ".XXXXXX");
+    fd = mkostemp(&staging[0], O_CLOEXEC);
+    if (fd < 0) return errno;
+    // mkostemp creates 0600, match what O_TMPFILE would have made under the usual umask.
+    fchmod(fd, 0644);
+    staging_path = staging;
+    return 0;
+  }
+
+  Status stage() {
+    const std::string dir = pathname::dir(path);
+    int error = try_stage(dir);
+    if (error == ENOENT && created_directories().contains(pathname::trim_trailing_slash(dir))) {
+      const auto made = mkdir_again(dir, 0755);
+      if (!made) return made;
+      error = try_stage(dir);
+    }
+    if (error != 0) return Error("Could not create file in " + dir + ": " + strerror(error));
+    return Success();
+  }
+
+  Status link_into_place() {
+    if (!staging_path.empty()) {
+      if (rename(staging_path.c_str(), path.c_str()) != 0) {
+        return Error("Could not move " + staging_path + " to " + path + ": " + strerror(errno));
+      }
+      staging_path.clear();
+      return Success();
+    }
+    const std::string proc_path = "/proc/self/fd/" + std::to_string(fd);
+    if (linkat(AT_FDCWD, proc_path.c_str(), AT_FDCWD, path.c_str(), AT_SYMLINK_FOLLOW) == 0) {
+      return Success();
+    }
+    if (errno != EEXIST) return Error("Could not link " + path + ": " + strerror(errno));
+    // linkat does not replace. Link under a hidden name and rename over the old file.
+    for (int attempt = 0; attempt < 100; attempt++) {
+      const std::string temporary = pathname::join(
+          pathname::dir(path),
+          "." + pathname::base(path) + "." + std::to_string(getpid()) + "." + std::to_string(attempt));
+      if (linkat(AT_FDCWD, proc_path.c_str(), AT_FDCWD, temporary.c_str(), AT_SYMLINK_FOLLOW) != 0) {
+        if (errno == EEXIST) continue;
+        return Error("Could not link " + temporary + ": " + strerror(errno));
+      }
+      if (rename(temporary.c_str(), path.c_str()) != 0) {
+        const std::string reason = strerror(errno);
+        unlink(temporary.c_str());
+        return Error("Could not move " + temporary + " to " + path + ": " + reason);
+      }
+      return Success();
+    }
+    return Error("Could not find a free temporary name next to " + path);
+  }
+
+public:
+  explicit StagedFile(const std::string& path, const Options& options = Options())
+  : path(path),
+    options(options) {}
+
+  StagedFile(const StagedFile&) = delete;
+  StagedFile& operator=(const StagedFile&) = delete;
+
+  ~StagedFile() {
+    abort();
+  }
+
+  Status open() {
+    const auto staged = stage();
+    if (!staged) return staged;
+    void* aligned = nullptr;
+    if (posix_memalign(&aligned, sysconf(_SC_PAGESIZE), options.buffer_size) != 0) {
+      abort();
+      return Error("Could not allocate write buffer for " + path);
+    }
+    buffer.reset(static_cast<char*>(aligned));
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return Success();
+  }
+
+  // Reserves space up front (e.g. from Content-Length) so the file is laid out contiguously and a
+  // full disk fails the transfer early. Filesystems without fallocate are left to allocate lazily.
+  Status preallocate(const uint64_t size) {
+    if (size == 0) return Success();
+    // Not posix_fallocate, which emulates by writing every block where unsupported.
+    const int result = fallocate(fd, 0, 0, size) == 0 ? 0 : errno;
+    if (result != 0 && result != EOPNOTSUPP && result != EINVAL) {
+      return Error("Could not allocate " + std::to_string(size) + " bytes for " + path + ": " +
+                   strerror(result));
+    }
+    if (result == 0) preallocated = size;
+    return Success();
+  }
+
+  Status write(const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+      const size_t take = std::min(size, options.buffer_size - buffered);
+      memcpy(buffer.get() + buffered, bytes, take);
+      buffered += take;
+      bytes += take;
+      size -= take;
+      if (buffered == options.buffer_size) {
+        const auto flushed_buffer = flush();
+        if (!flushed_buffer) return flushed_buffer;
+      }
+    }
+    return Success();
+  }
+
+  // Writes at an offset, bypassing the buffer, for files filled out of order (e.g. chunks pulled
+  // from several peers). Not to be mixed with write(); concurrent calls must be serialized.
+  Status write_at(const void* data, const size_t size, const uint64_t offset) {
+    const char* bytes = static_cast<const char*>(data);
+    size_t written = 0;
+    while (written < size) {
+      const ssize_t n = pwrite(fd, bytes + written, size - written, offset + written);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return Error("Could not write " + path + ": " + strerror(errno));
+      written += n;
+    }
+    flushed = std::max(flushed, offset + size);
+    return Success();
+  }
+
+  // Reads back what has been written so far (e.g. to verify it before commit()). Returns the
+  // number of bytes read, 0 at the end, -1 on error.
+  ssize_t read_at(void* data, const size_t size, const uint64_t offset) {
+    if (!flush()) return -1;
+    for (;;) {
+      const ssize_t n = pread(fd, data, size, offset);
+      if (n < 0 && errno == EINTR) continue;
+      return n;
+    }
+  }
+
+  // Flushes and returns the file's descriptor (-1 on error), to read back what has been written
+  // other than by read_at() (e.g. by mapping it). Valid until commit() or abort().
+  int descriptor() {
+    if (!flush()) return -1;
+    return fd;
+  }
+
+  uint64_t size() const {
+    return flushed + buffered;
+  }
+
+  Status commit() {
+    const auto flushed_buffer = flush();
+    if (!flushed_buffer) return flushed_buffer;
+    // A Content-Length that overstated the body would otherwise leave zeros at the end.
+    if (preallocated > flushed && ftruncate(fd, flushed) != 0) {
+      return Error("Could not truncate " + path + ": " + strerror(errno));
+    }
+    if (options.durable && fdatasync(fd) != 0) {
+      return Error("Could not sync " + path + ": " + strerror(errno));
+    }
+    const auto linked = link_into_place();
+    if (!linked) return linked;
+    close(fd);
+    fd = -1;
+    if (options.durable) return fsync_dir(pathname::dir(path));
+    return Success();
+  }
+
+  // Discards the file. Implied by destruction without commit().
+  void abort() {
+    if (fd >= 0) close(fd);
+    fd = -1;
+    if (!staging_path.empty()) unlink(staging_path.c_str());
+    staging_path.clear();
+  }
+};
+
+
+// Atomically replaces (or creates) path with contents.
+inline Status publish_file(const std::string& path,
+                           const std::string& contents,
+                           const bool durable = true) {
+  StagedFile file{path, StagedFile::Options(64 * 1024, false, durable)};
+  const auto opened = file.open();
+  if (!opened) return opened;
+  const auto written = file.write(contents.data(), contents.length());
+  if (!written) return written;
+  return file.commit();
+}
+
+
+} // namespace os
+} // namespace appc
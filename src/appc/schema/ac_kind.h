@@ -40,5 +40,8 @@ struct AcKind : StringType<AcKind> {
 };
 
 
+APPC_EXTERN_TEMPLATE(struct StringType<AcKind>);
+
+
 } // namespace schema
 } // namespace appc
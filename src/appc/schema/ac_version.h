@@ -42,5 +42,8 @@ struct AcVersion : StringType<AcVersion> {
 };
 
 
+APPC_EXTERN_TEMPLATE(struct StringType<AcVersion>);
+
+
 } // namespace schema
 } // namespace appc
@@ -56,5 +56,11 @@ struct Annotations : ArrayType<Annotations, Annotation> {
 };
 
 
+APPC_EXTERN_TEMPLATE(struct StringType<AnnotationName>);
+APPC_EXTERN_TEMPLATE(struct ACName<AnnotationName>);
+APPC_EXTERN_TEMPLATE(struct NameValueType<Annotation>);
+APPC_EXTERN_TEMPLATE(struct ArrayType<Annotations, Annotation>);
+
+
 } // namespace schema
 } // namespace appc
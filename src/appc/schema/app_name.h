@@ -30,5 +30,9 @@ struct AppName : public ACName<AppName> {
 };
 
 
+APPC_EXTERN_TEMPLATE(struct StringType<AppName>);
+APPC_EXTERN_TEMPLATE(struct ACName<AppName>);
+
+
 } // namespace schema
 } // namespace appc
@@ -68,10 +68,10 @@ struct AppRef : Type<AppRef> {
     if (app_ref.app_name) {
       json["app"] = AppName::to_json(from_some(app_ref.app_name));
     }
-    if (app_ref.app_name) {
+    if (app_ref.isolators) {
       json["isolators"] = Isolators::to_json(from_some(app_ref.isolators));
     }
-    if (app_ref.app_name) {
+    if (app_ref.annotations) {
       json["annotations"] = Annotations::to_json(from_some(app_ref.annotations));
     }
     return json;
@@ -94,5 +94,8 @@ struct AppRefs : ArrayType<AppRefs, AppRef> {
 };
 
 
+APPC_EXTERN_TEMPLATE(struct ArrayType<AppRefs, AppRef>);
+
+
 } // namespace schema
 } // namespace appc
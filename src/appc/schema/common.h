@@ -21,6 +21,7 @@
 
 #include "3rdparty/nlohmann/json.h"
 
+#include "appc/util/linkage.h"
 #include "appc/util/option.h"
 #include "appc/util/status.h"
 #include "appc/util/try.h"
@@ -198,7 +199,7 @@ struct ArrayType : Type<T> {
   }
 
   static Json to_json(const ArrayType<T, E>& array) {
-    Json json;
+    Json json = Json::array();
     for (const auto& element : array.array) {
       json.push_back(E::to_json(element));
     }
@@ -25,6 +25,7 @@
 #include "appc/schema/uuid.h"
 #include "appc/schema/volumes.h"
 #include "appc/schema/try_json.h"
+#include "appc/util/linkage.h"
 
 
 namespace appc {
@@ -55,62 +56,18 @@ struct ContainerRuntimeManifest {
       isolators(isolators),
       annotations(annotations) {}
 
-  static Try<ContainerRuntimeManifest> from_json(const Json& json) {
-    const auto ac_version = try_from_json<AcVersion>(json, "acVersion");
-    const auto ac_kind = try_from_json<AcKind>(json, "acKind");
-    const auto uuid = try_from_json<UUID>(json, "uuid");
-    const auto app_refs = try_from_json<AppRefs>(json, "apps");
+  static Try<ContainerRuntimeManifest> from_json(const Json& json);
 
-    const auto volumes = try_option_from_json<Volumes>(json, "volumes");
-    const auto isolators = try_option_from_json<Isolators>(json, "isolators");
-    const auto annotations = try_option_from_json<Annotations>(json, "annotations");
+  static Json to_json(const ContainerRuntimeManifest& crm);
 
-    if (!all_results(ac_version, ac_kind, uuid, app_refs, volumes, isolators, annotations)) {
-      return collect_failure_reasons<ContainerRuntimeManifest>(
-        ac_version, ac_kind, uuid, app_refs, volumes, isolators, annotations);
-    }
-
-    return Result(ContainerRuntimeManifest(
-        from_result(ac_version),
-        from_result(ac_kind),
-        from_result(uuid),
-        from_result(app_refs),
-        from_result(volumes),
-        from_result(isolators),
-        from_result(annotations)));
-  }
-
-  static Json to_json(const ContainerRuntimeManifest& crm) {
-    Json json{};
-    json["acVersion"] = AcVersion::to_json(crm.ac_version);
-    json["acKind"] = AcKind::to_json(crm.ac_kind);
-    json["uuid"] = UUID::to_json(crm.uuid);
-    json["apps"] = AppRefs::to_json(crm.app_refs);
-    if (crm.volumes) {
-      json["volumes"] = Volumes::to_json(from_some(crm.volumes));
-    }
-    if (crm.isolators) {
-      json["isolators"] = Isolators::to_json(from_some(crm.isolators));
-    }
-    if (crm.annotations) {
-      json["annotations"] = Annotations::to_json(from_some(crm.annotations));
-    }
-    return json;
-  }
-
-  Status validate() const {
-    return collect_status({
-      ac_version.validate(),
-      ac_kind.validate(),
-      uuid.validate(),
-      app_refs.validate(),
-      validate_if_some(volumes),
-      validate_if_some(isolators),
-      validate_if_some(annotations),
-    });
-  }
+  Status validate() const;
 };
 
 
 } // namespace schema
 } // namespace appc
+
+
+#ifndef APPC_COMPILED
+#include "appc/schema/container_impl.h"
+#endif
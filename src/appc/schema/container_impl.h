@@ -0,0 +1,97 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+#pragma once
+
+#include "appc/schema/container.h"
+#include "appc/util/metrics.h"
+#include "appc/util/profile.h"
+#include "appc/util/trace.h"
+
+
+namespace appc {
+namespace schema {
+
+
+APPC_INLINE Try<ContainerRuntimeManifest> ContainerRuntimeManifest::from_json(const Json& json) {
+  APPC_PROFILE_SCOPE("ContainerRuntimeManifest::from_json");
+  APPC_TIME_SCOPE("appc_schema_from_json_seconds", "Time spent parsing manifests.",
+                  {{"kind", "ContainerRuntimeManifest"}});
+  APPC_TRACE_SPAN("ContainerRuntimeManifest::from_json");
+  const auto ac_version = try_from_json<AcVersion>(json, "acVersion");
+  const auto ac_kind = try_from_json<AcKind>(json, "acKind");
+  const auto uuid = try_from_json<UUID>(json, "uuid");
+  const auto app_refs = try_from_json<AppRefs>(json, "apps");
+
+  const auto volumes = try_option_from_json<Volumes>(json, "volumes");
+  const auto isolators = try_option_from_json<Isolators>(json, "isolators");
+  const auto annotations = try_option_from_json<Annotations>(json, "annotations");
+
+  if (!all_results(ac_version, ac_kind, uuid, app_refs, volumes, isolators, annotations)) {
+    return collect_failure_reasons<ContainerRuntimeManifest>(
+      ac_version, ac_kind, uuid, app_refs, volumes, isolators, annotations);
+  }
+
+  return Result(ContainerRuntimeManifest(
+      from_result(ac_version),
+      from_result(ac_kind),
+      from_result(uuid),
+      from_result(app_refs),
+      from_result(volumes),
+      from_result(isolators),
+      from_result(annotations)));
+}
+
+
+APPC_INLINE Json ContainerRuntimeManifest::to_json(const ContainerRuntimeManifest& crm) {
+  Json json{};
+  json["acVersion"] = AcVersion::to_json(crm.ac_version);
+  json["acKind"] = AcKind::to_json(crm.ac_kind);
+  json["uuid"] = UUID::to_json(crm.uuid);
+  json["apps"] = AppRefs::to_json(crm.app_refs);
+  if (crm.volumes) {
+    json["volumes"] = Volumes::to_json(from_some(crm.volumes));
+  }
+  if (crm.isolators) {
+    json["isolators"] = Isolators::to_json(from_some(crm.isolators));
+  }
+  if (crm.annotations) {
+    json["annotations"] = Annotations::to_json(from_some(crm.annotations));
+  }
+  return json;
+}
+
+
+APPC_INLINE Status ContainerRuntimeManifest::validate() const {
+  APPC_PROFILE_SCOPE("ContainerRuntimeManifest::validate");
+  APPC_TIME_SCOPE("appc_schema_validate_seconds", "Time spent validating manifests.",
+                  {{"kind", "ContainerRuntimeManifest"}});
+  APPC_TRACE_SPAN("ContainerRuntimeManifest::validate");
+  return collect_status({
+    ac_version.validate(),
+    ac_kind.validate(),
+    uuid.validate(),
+    app_refs.validate(),
+    validate_if_some(volumes),
+    validate_if_some(isolators),
+    validate_if_some(annotations),
+  });
+}
+
+
+} // namespace schema
+} // namespace appc
@@ -50,5 +50,9 @@ struct Environment : ArrayType<Environment, EnvironmentVariable> {
 };
 
 
+APPC_EXTERN_TEMPLATE(struct NameValueType<EnvironmentVariable>);
+APPC_EXTERN_TEMPLATE(struct ArrayType<Environment, EnvironmentVariable>);
+
+
 } // namespace schema
 } // namespace appc
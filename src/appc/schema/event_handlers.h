@@ -67,5 +67,9 @@ struct EventHandlers : ArrayType<EventHandlers, EventHandler> {
 };
 
 
+APPC_EXTERN_TEMPLATE(struct StringType<EventName>);
+APPC_EXTERN_TEMPLATE(struct ACName<EventName>);
+
+
 } // namespace schema
 } // namespace appc
@@ -41,5 +41,9 @@ struct Exec : ArrayType<Exec, ExecArg> {
 };
 
 
+APPC_EXTERN_TEMPLATE(struct StringType<ExecArg>);
+APPC_EXTERN_TEMPLATE(struct ArrayType<Exec, ExecArg>);
+
+
 } // namespace schema
 } // namespace appc
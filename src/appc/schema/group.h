@@ -35,5 +35,8 @@ struct Group : StringType<Group> {
 };
 
 
+APPC_EXTERN_TEMPLATE(struct StringType<Group>);
+
+
 } // namespace schema
 } // namespace appc
@@ -27,6 +27,7 @@
 #include "appc/schema/path.h"
 #include "appc/schema/path_whitelist.h"
 #include "appc/schema/try_json.h"
+#include "appc/util/linkage.h"
 #include "appc/util/try.h"
 #include "appc/util/try_option.h"
 
@@ -62,47 +63,16 @@ struct ImageManifest : Type<ImageManifest> {
     path_whitelist(path_whitelist),
     annotations(annotations) {}
 
-  static Try<ImageManifest> from_json(const Json& json) {
-    const auto ac_kind = try_from_json<AcKind>(json, "acKind");
-    const auto ac_version = try_from_json<AcVersion>(json, "acVersion");
-    const auto name = try_from_json<AppName>(json, "name");
+  static Try<ImageManifest> from_json(const Json& json);
 
-    const auto labels = try_option_from_json<Labels>(json, "labels");
-    const auto app = try_option_from_json<App>(json, "app");
-    const auto dependencies = try_option_from_json<Dependencies>(json, "dependencies");
-    const auto path_whitelist = try_option_from_json<PathWhitelist>(json, "pathWhitelist");
-    const auto annotations = try_option_from_json<Annotations>(json, "annotations");
-
-    if (!all_results(ac_kind, ac_version, name, labels, app,
-                     dependencies, path_whitelist, annotations)) {
-      return collect_failure_reasons<ImageManifest>(ac_kind, ac_version, name, labels, app,
-                                                    dependencies, path_whitelist, annotations);
-    }
-
-    return Result(ImageManifest(from_result(ac_kind),
-                                from_result(ac_version),
-                                from_result(name),
-                                from_result(labels),
-                                from_result(app),
-                                from_result(dependencies),
-                                from_result(path_whitelist),
-                                from_result(annotations)));
-  }
-
-  Status validate() const {
-    return collect_status({
-      ac_kind.validate(),
-      ac_version.validate(),
-      name.validate(),
-      validate_if_some(labels),
-      validate_if_some(app),
-      validate_if_some(dependencies),
-      validate_if_some(path_whitelist),
-      validate_if_some(annotations)
-    });
-  }
+  Status validate() const;
 };
 
 
 } // namespace schema
 } // namespace appc
+
+
+#ifndef APPC_COMPILED
+#include "appc/schema/image_impl.h"
+#endif
@@ -42,5 +42,8 @@ struct ImageID : StringType<ImageID> {
 };
 
 
+APPC_EXTERN_TEMPLATE(struct StringType<ImageID>);
+
+
 } // namespace schema
 } // namespace appc
@@ -0,0 +1,81 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+#pragma once
+
+#include "appc/schema/image.h"
+#include "appc/util/metrics.h"
+#include "appc/util/profile.h"
+#include "appc/util/trace.h"
+
+
+namespace appc {
+namespace schema {
+
+
+APPC_INLINE Try<ImageManifest> ImageManifest::from_json(const Json& json) {
+  APPC_PROFILE_SCOPE("ImageManifest::from_json");
+  APPC_TIME_SCOPE("appc_schema_from_json_seconds", "Time spent parsing manifests.",
+                  {{"kind", "ImageManifest"}});
+  APPC_TRACE_SPAN("ImageManifest::from_json");
+  const auto ac_kind = try_from_json<AcKind>(json, "acKind");
+  const auto ac_version = try_from_json<AcVersion>(json, "acVersion");
+  const auto name = try_from_json<AppName>(json, "name");
+
+  const auto labels = try_option_from_json<Labels>(json, "labels");
+  const auto app = try_option_from_json<App>(json, "app");
+  const auto dependencies = try_option_from_json<Dependencies>(json, "dependencies");
+  const auto path_whitelist = try_option_from_json<PathWhitelist>(json, "pathWhitelist");
+  const auto annotations = try_option_from_json<Annotations>(json, "annotations");
+
+  if (!all_results(ac_kind, ac_version, name, labels, app,
+                   dependencies, path_whitelist, annotations)) {
+    return collect_failure_reasons<ImageManifest>(ac_kind, ac_version, name, labels, app,
+                                                  dependencies, path_whitelist, annotations);
+  }
+
+  return Result(ImageManifest(from_result(ac_kind),
+                              from_result(ac_version),
+                              from_result(name),
+                              from_result(labels),
+                              from_result(app),
+                              from_result(dependencies),
+                              from_result(path_whitelist),
+                              from_result(annotations)));
+}
+
+
+APPC_INLINE Status ImageManifest::validate() const {
+  APPC_PROFILE_SCOPE("ImageManifest::validate");
+  APPC_TIME_SCOPE("appc_schema_validate_seconds", "Time spent validating manifests.",
+                  {{"kind", "ImageManifest"}});
+  APPC_TRACE_SPAN("ImageManifest::validate");
+  return collect_status({
+    ac_kind.validate(),
+    ac_version.validate(),
+    name.validate(),
+    validate_if_some(labels),
+    validate_if_some(app),
+    validate_if_some(dependencies),
+    validate_if_some(path_whitelist),
+    validate_if_some(annotations)
+  });
+}
+
+
+} // namespace schema
+} // namespace appc
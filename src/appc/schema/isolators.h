@@ -47,5 +47,11 @@ struct Isolators : ArrayType<Isolators, Isolator> {
 };
 
 
+APPC_EXTERN_TEMPLATE(struct StringType<IsolatorName>);
+APPC_EXTERN_TEMPLATE(struct ACName<IsolatorName>);
+APPC_EXTERN_TEMPLATE(struct NameValueType<Isolator>);
+APPC_EXTERN_TEMPLATE(struct ArrayType<Isolators, Isolator>);
+
+
 } // namespace schema
 } // namespace appc
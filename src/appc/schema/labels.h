@@ -55,5 +55,11 @@ struct Labels : ArrayType<Labels, Label> {
 };
 
 
+APPC_EXTERN_TEMPLATE(struct StringType<LabelName>);
+APPC_EXTERN_TEMPLATE(struct ACName<LabelName>);
+APPC_EXTERN_TEMPLATE(struct NameValueType<Label>);
+APPC_EXTERN_TEMPLATE(struct ArrayType<Labels, Label>);
+
+
 } // namespace schema
 } // namespace appc
@@ -83,5 +83,11 @@ struct MountPoints : ArrayType<MountPoints, MountPoint> {
 };
 
 
+APPC_EXTERN_TEMPLATE(struct StringType<MountName>);
+APPC_EXTERN_TEMPLATE(struct ACName<MountName>);
+APPC_EXTERN_TEMPLATE(struct StringType<MountPath>);
+APPC_EXTERN_TEMPLATE(struct BooleanType<ReadOnly>);
+
+
 } // namespace schema
 } // namespace appc
@@ -35,5 +35,8 @@ struct Path : StringType<Path> {
 };
 
 
+APPC_EXTERN_TEMPLATE(struct StringType<Path>);
+
+
 } //namespace schema
 } //namespace appc
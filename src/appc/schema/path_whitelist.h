@@ -31,5 +31,8 @@ struct PathWhitelist : ArrayType<PathWhitelist, Path> {
 };
 
 
+APPC_EXTERN_TEMPLATE(struct ArrayType<PathWhitelist, Path>);
+
+
 } // namespace schema
 } // namespace appc
@@ -117,5 +117,12 @@ struct Ports : ArrayType<Ports, Port> {
 };
 
 
+APPC_EXTERN_TEMPLATE(struct StringType<PortName>);
+APPC_EXTERN_TEMPLATE(struct ACName<PortName>);
+APPC_EXTERN_TEMPLATE(struct IntegerType<PortNumber>);
+APPC_EXTERN_TEMPLATE(struct StringType<Protocol>);
+APPC_EXTERN_TEMPLATE(struct BooleanType<SocketActivated>);
+
+
 } // namespace schema
 } // namespace appc
@@ -0,0 +1,96 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+// libappc's copy of the manifests and of the schema types' templates (see appc/util/linkage.h).
+
+#include "appc/schema/ac_kind.h"
+#include "appc/schema/ac_version.h"
+#include "appc/schema/annotations.h"
+#include "appc/schema/app.h"
+#include "appc/schema/app_name.h"
+#include "appc/schema/app_refs.h"
+#include "appc/schema/container_impl.h"
+#include "appc/schema/dependencies.h"
+#include "appc/schema/environment.h"
+#include "appc/schema/event_handlers.h"
+#include "appc/schema/exec.h"
+#include "appc/schema/group.h"
+#include "appc/schema/image_id.h"
+#include "appc/schema/image_impl.h"
+#include "appc/schema/isolators.h"
+#include "appc/schema/labels.h"
+#include "appc/schema/mount_points.h"
+#include "appc/schema/path.h"
+#include "appc/schema/path_whitelist.h"
+#include "appc/schema/ports.h"
+#include "appc/schema/user.h"
+#include "appc/schema/uuid.h"
+#include "appc/schema/volumes.h"
+
+
+namespace appc {
+namespace schema {
+
+
+template struct StringType<AcKind>;
+template struct StringType<AcVersion>;
+template struct StringType<AnnotationName>;
+template struct ACName<AnnotationName>;
+template struct NameValueType<Annotation>;
+template struct ArrayType<Annotations, Annotation>;
+template struct StringType<AppName>;
+template struct ACName<AppName>;
+template struct ArrayType<AppRefs, AppRef>;
+template struct NameValueType<EnvironmentVariable>;
+template struct ArrayType<Environment, EnvironmentVariable>;
+template struct StringType<EventName>;
+template struct ACName<EventName>;
+template struct StringType<ExecArg>;
+template struct ArrayType<Exec, ExecArg>;
+template struct StringType<Group>;
+template struct StringType<ImageID>;
+template struct StringType<IsolatorName>;
+template struct ACName<IsolatorName>;
+template struct NameValueType<Isolator>;
+template struct ArrayType<Isolators, Isolator>;
+template struct StringType<LabelName>;
+template struct ACName<LabelName>;
+template struct NameValueType<Label>;
+template struct ArrayType<Labels, Label>;
+template struct StringType<MountName>;
+template struct ACName<MountName>;
+template struct StringType<MountPath>;
+template struct BooleanType<ReadOnly>;
+template struct StringType<Path>;
+template struct ArrayType<PathWhitelist, Path>;
+template struct StringType<PortName>;
+template struct ACName<PortName>;
+template struct IntegerType<PortNumber>;
+template struct StringType<Protocol>;
+template struct BooleanType<SocketActivated>;
+template struct StringType<User>;
+template struct StringType<UUID>;
+template struct StringType<VolumeKind>;
+template struct StringType<MountPointName>;
+template struct ACName<MountPointName>;
+template struct ArrayType<MountPointNames, MountPointName>;
+template struct StringType<VolumeSource>;
+template struct ArrayType<Volumes, Volume>;
+
+
+} // namespace schema
+} // namespace appc
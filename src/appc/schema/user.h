@@ -35,5 +35,8 @@ struct User : StringType<User> {
 };
 
 
+APPC_EXTERN_TEMPLATE(struct StringType<User>);
+
+
 } // namespace schema
 } // namespace appc
@@ -63,5 +63,8 @@ struct UUID : StringType<UUID> {
 };
 
 
+APPC_EXTERN_TEMPLATE(struct StringType<UUID>);
+
+
 } // namespace schema
 } // namespace appc
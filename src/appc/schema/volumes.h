@@ -132,5 +132,13 @@ struct Volumes : ArrayType<Volumes, Volume> {
 };
 
 
+APPC_EXTERN_TEMPLATE(struct StringType<VolumeKind>);
+APPC_EXTERN_TEMPLATE(struct StringType<MountPointName>);
+APPC_EXTERN_TEMPLATE(struct ACName<MountPointName>);
+APPC_EXTERN_TEMPLATE(struct ArrayType<MountPointNames, MountPointName>);
+APPC_EXTERN_TEMPLATE(struct StringType<VolumeSource>);
+APPC_EXTERN_TEMPLATE(struct ArrayType<Volumes, Volume>);
+
+
 } // namespace schema
 } // namespace appc
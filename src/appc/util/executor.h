@@ -0,0 +1,417 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "appc/util/status.h"
+
+
+namespace appc {
+namespace util {
+
+
+// Runs the library's parallel work (batch validation, extraction, concurrent fetches) on a shared
+// set of threads instead of each feature starting its own. Tasks must not throw.
+
+
+enum class Priority { low = 0, normal = 1, high = 2 };
+
+
+const size_t priority_levels = 3;
+
+
+using Task = std::function<void()>;
+
+
+// Shared by copies: cancelling one cancels them all. The first reason given is kept and reported
+// by status().
+class CancellationToken {
+private:
+  struct State {
+    std::atomic<bool> cancelled{false};
+    std::mutex mutex{};
+    std::string reason{};
+  };
+
+  std::shared_ptr<State> state;
+
+public:
+  CancellationToken()
+  : state(std::make_shared<State>()) {}
+
+  void cancel(const std::string& reason = "Cancelled") {
+    std::lock_guard<std::mutex> lock{state->mutex};
+    if (state->cancelled) return;
+    state->reason = reason;
+    state->cancelled.store(true, std::memory_order_release);
+  }
+
+  // Cancels with the message of a failed status. Returns whether the status was a success.
+  bool cancel_on_error(const Status& status) {
+    if (!status) cancel(status.message);
+    return status;
+  }
+
+  bool cancelled() const {
+    return state->cancelled.load(std::memory_order_acquire);
+  }
+
+  // Success until cancelled, then an Error with the reason.
+  Status status() const {
+    if (!cancelled()) return Success();
+    std::lock_guard<std::mutex> lock{state->mutex};
+    return Error(state->reason);
+  }
+};
+
+
+class Executor {
+public:
+  virtual ~Executor() {}
+
+  virtual void submit(Task task, const Priority priority = Priority::normal) = 0;
+
+  // How many tasks may run at once.
+  virtual size_t concurrency() const = 0;
+
+  // Runs one queued task on the calling thread, if there is one. A thread waiting for work it
+  // submitted calls this to help rather than block, so a pool whose workers all wait on nested work
+  // still makes progress. Executors that cannot hand out queued work return false.
+  virtual bool run_pending() {
+    return false;
+  }
+
+  // For a thread between run_pending() calls: blocks until done() holds or work is queued that
+  // run_pending() could run. Whatever makes done() hold must call notify_waiters() after. Executors
+  // that cannot hand out queued work return false at once, and the caller waits by other means.
+  virtual bool wait_for_work(const std::function<bool()>& /* done */) {
+    return false;
+  }
+
+  virtual void notify_waiters() {}
+};
+
+
+class WorkStealingExecutor;
+
+
+namespace detail {
+
+
+struct CurrentWorker {
+  const WorkStealingExecutor* executor;
+  size_t index;
+};
+
+
+// The executor and worker the calling thread belongs to, if any.
+inline CurrentWorker& current_worker() {
+  static thread_local CurrentWorker current{nullptr, 0};
+  return current;
+}
+
+
+} // namespace detail
+
+
+// A fixed set of threads, each with its own deque per priority. Tasks submitted from a worker go on
+// its own deques and are run newest first (the data they touch is likely still in cache); tasks
+// submitted from other threads go on a shared queue and run in submission order. An idle worker
+// takes from the shared queue, then steals the oldest task from the other workers. Higher
+// priorities always run first: a worker only runs a lower priority task when none of a higher
+// priority is queued anywhere.
+//
+// Destruction runs every task already submitted, then joins the threads.
+class WorkStealingExecutor : public Executor {
+private:
+  struct Worker {
+    std::mutex mutex{};
+    std::deque<Task> queues[priority_levels];
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers{};
+  Worker injected{};
+  std::vector<std::thread> threads{};
+  std::atomic<size_t> queued{0};
+  std::mutex sleep_mutex{};
+  std::condition_variable wake{};
+  bool stopping{false};
+  // Threads in wait_for_work(), woken by every submit.
+  std::condition_variable helpers{};
+  size_t helping{0};
+
+  bool pop_own(const size_t index, const size_t level, Task& task) {
+    Worker& worker = *workers[index];
+    std::lock_guard<std::mutex> lock{worker.mutex};
+    auto& queue = worker.queues[level];
+    if (queue.empty()) return false;
+    task = std::move(queue.back());
+    queue.pop_back();
+    return true;
+  }
+
+  static bool steal(Worker& worker, const size_t level, Task& task) {
+    std::lock_guard<std::mutex> lock{worker.mutex};
+    auto& queue = worker.queues[level];
+    if (queue.empty()) return false;
+    task = std::move(queue.front());
+    queue.pop_front();
+    return true;
+  }
+
+  // The next task for the worker at index (or for any thread, with index == workers.size()).
+  bool take(const size_t index, Task& task) {
+    if (queued.load() == 0) return false;
+    const size_t count = workers.size();
+    for (size_t level = priority_levels; level-- > 0;) {
+      if ((index < count && pop_own(index, level, task)) || steal(injected, level, task)) {
+        queued--;
+        return true;
+      }
+      for (size_t offset = 1; offset <= count; offset++) {
+        const size_t victim = (index + offset) % count;
+        if (victim == index) continue;
+        if (steal(*workers[victim], level, task)) {
+          queued--;
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  void work(const size_t index) {
+    detail::current_worker() = detail::CurrentWorker{this, index};
+    for (;;) {
+      Task task{};
+      if (take(index, task)) {
+        task();
+        continue;
+      }
+      std::unique_lock<std::mutex> lock{sleep_mutex};
+      wake.wait(lock, [this]() { return stopping || queued.load() > 0; });
+      if (stopping && queued.load() == 0) return;
+    }
+  }
+
+public:
+  explicit WorkStealingExecutor(const size_t threads = std::thread::hardware_concurrency()) {
+    const size_t count = std::max<size_t>(threads, 1);
+    for (size_t i = 0; i < count; i++) workers.emplace_back(new Worker());
+    for (size_t i = 0; i < count; i++) {
+      this->threads.emplace_back(&WorkStealingExecutor::work, this, i);
+    }
+  }
+
+  WorkStealingExecutor(const WorkStealingExecutor&) = delete;
+  WorkStealingExecutor& operator=(const WorkStealingExecutor&) = delete;
+
+  virtual ~WorkStealingExecutor() {
+    {
+      std::lock_guard<std::mutex> lock{sleep_mutex};
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto& thread : threads) thread.join();
+  }
+
+  virtual void submit(Task task, const Priority priority = Priority::normal) {
+    const auto& current = detail::current_worker();
+    Worker& worker = current.executor == this ? *workers[current.index] : injected;
+    // Counted first so the count never drops below what is queued.
+    queued++;
+    {
+      std::lock_guard<std::mutex> lock{worker.mutex};
+      worker.queues[static_cast<size_t>(priority)].push_back(std::move(task));
+    }
+    // Taking the lock orders the count above before any sleeper's check of it.
+    {
+      std::lock_guard<std::mutex> lock{sleep_mutex};
+      if (helping > 0) helpers.notify_all();
+    }
+    wake.notify_one();
+  }
+
+  virtual size_t concurrency() const {
+    return threads.size();
+  }
+
+  virtual bool run_pending() {
+    const auto& current = detail::current_worker();
+    Task task{};
+    if (!take(current.executor == this ? current.index : workers.size(), task)) return false;
+    task();
+    return true;
+  }
+
+  virtual bool wait_for_work(const std::function<bool()>& done) {
+    std::unique_lock<std::mutex> lock{sleep_mutex};
+    helping++;
+    helpers.wait(lock, [this, &done]() { return done() || queued.load() > 0; });
+    helping--;
+    return true;
+  }
+
+  virtual void notify_waiters() {
+    std::lock_guard<std::mutex> lock{sleep_mutex};
+    if (helping > 0) helpers.notify_all();
+  }
+};
+
+
+// Runs tasks on the host application's pool, for embedding processes that want to cap the threads
+// libappc uses. submit is called with each task and must run it, on any thread, eventually.
+class HostExecutor : public Executor {
+private:
+  const std::function<void(Task, Priority)> host_submit;
+  const size_t host_concurrency;
+
+public:
+  HostExecutor(const std::function<void(Task, Priority)>& submit,
+               const size_t concurrency)
+  : host_submit(submit),
+    host_concurrency(std::max<size_t>(concurrency, 1)) {}
+
+  virtual void submit(Task task, const Priority priority = Priority::normal) {
+    host_submit(std::move(task), priority);
+  }
+
+  virtual size_t concurrency() const {
+    return host_concurrency;
+  }
+};
+
+
+namespace detail {
+
+
+inline std::mutex& default_executor_mutex() {
+  static std::mutex mutex{};
+  return mutex;
+}
+
+
+inline std::shared_ptr<Executor>& default_executor_slot() {
+  static std::shared_ptr<Executor> executor{};
+  return executor;
+}
+
+
+} // namespace detail
+
+
+// The executor the library runs parallel work on unless given another. Created on first use with a
+// thread per core.
+inline std::shared_ptr<Executor> default_executor() {
+  std::lock_guard<std::mutex> lock{detail::default_executor_mutex()};
+  auto& executor = detail::default_executor_slot();
+  if (!executor) executor = std::make_shared<WorkStealingExecutor>();
+  return executor;
+}
+
+
+// Replaces the default executor (e.g. with a HostExecutor). Work already submitted finishes on the
+// old one, which is destroyed once nothing holds it.
+inline void set_default_executor(const std::shared_ptr<Executor>& executor) {
+  std::lock_guard<std::mutex> lock{detail::default_executor_mutex()};
+  detail::default_executor_slot() = executor;
+}
+
+
+// Tasks that succeed or fail together. The first to fail cancels the group's token, tasks of the
+// group that have not started by then are skipped, and wait() returns the failure. The token can
+// also be cancelled from outside (it is shared with copies). Destruction waits for the group's
+// tasks, so that none outlives what it captured.
+class TaskGroup {
+private:
+  const std::shared_ptr<Executor> executor;
+  CancellationToken token;
+  std::mutex mutex{};
+  std::condition_variable finished{};
+  // Changed under mutex; read without it by wait_for_work()'s check, which holds the executor's.
+  std::atomic<size_t> outstanding{0};
+
+public:
+  explicit TaskGroup(const std::shared_ptr<Executor>& executor = default_executor(),
+                     const CancellationToken& token = CancellationToken())
+  : executor(executor),
+    token(token) {}
+
+  ~TaskGroup() {
+    wait();
+  }
+
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  void run(const std::function<Status()>& task, const Priority priority = Priority::normal) {
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      outstanding++;
+    }
+    executor->submit([this, task]() {
+      if (!token.cancelled()) token.cancel_on_error(task());
+      // The group may be destroyed as soon as the lock is released.
+      std::lock_guard<std::mutex> lock{mutex};
+      if (--outstanding == 0) {
+        finished.notify_all();
+        executor->notify_waiters();
+      }
+    }, priority);
+  }
+
+  // Helps run queued work until every task of the group has finished or been skipped, sleeping
+  // while there is none.
+  Status wait() {
+    const auto done = [this]() { return outstanding.load() == 0; };
+    while (!done()) {
+      if (executor->run_pending()) continue;
+      if (executor->wait_for_work(done)) continue;
+      // The group's tasks are queued on a pool this thread cannot help with.
+      std::unique_lock<std::mutex> lock{mutex};
+      finished.wait(lock, done);
+    }
+    // The last task may still hold the lock it finished under.
+    std::lock_guard<std::mutex> lock{mutex};
+    return token.status();
+  }
+
+  CancellationToken& cancellation() {
+    return token;
+  }
+
+  size_t concurrency() const {
+    return executor->concurrency();
+  }
+};
+
+
+} // namespace util
+} // namespace appc
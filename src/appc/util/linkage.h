@@ -0,0 +1,36 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+
+#pragma once
+
+
+// The library is header-only by default. Linked against libappc instead (which defines
+// APPC_COMPILED for its users), the definitions behind these macros are compiled once into the
+// library rather than into every translation unit, and the headers that wrap libarchive and
+// libcurl stop including them.
+//
+// APPC_INLINE marks a definition kept in an _impl.h header: inline when header-only, an ordinary
+// definition in the library. APPC_EXTERN_TEMPLATE declares a specialization the library
+// instantiates, so that users do not instantiate it again.
+#ifdef APPC_COMPILED
+#define APPC_INLINE
+#define APPC_EXTERN_TEMPLATE(...) extern template __VA_ARGS__
+#else
+#define APPC_INLINE inline
+#define APPC_EXTERN_TEMPLATE(...)
+#endif
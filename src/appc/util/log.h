@@ -0,0 +1,316 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Leveled logging for the library. Records go to a pluggable LogSink; the default sink hands them
+// to a background thread, so a thread that logs never waits on stderr.
+//
+// Log with APPC_LOG, which does not build the message unless its level is enabled:
+//
+//   APPC_LOG(warning, "discovery", "Fetch failed: " + fetched.failure_reason());
+#define APPC_LOG(level, component, message) \
+  do { \
+    if (::appc::util::logger().enabled(::appc::util::LogLevel::level)) { \
+      ::appc::util::logger().log(::appc::util::LogLevel::level, component, message); \
+    } \
+  } while (0)
+
+
+namespace appc {
+namespace util {
+
+
+enum class LogLevel { debug = 0, info = 1, warning = 2, error = 3, off = 4 };
+
+
+inline const char* level_name(const LogLevel level) {
+  switch (level) {
+    case LogLevel::debug: return "DEBUG";
+    case LogLevel::info: return "INFO";
+    case LogLevel::warning: return "WARNING";
+    case LogLevel::error: return "ERROR";
+    case LogLevel::off: break;
+  }
+  return "OFF";
+}
+
+
+struct LogRecord {
+  LogLevel level;
+  std::chrono::system_clock::time_point time;
+  // The part of the library that logged (e.g. "discovery").
+  std::string component;
+  std::string message;
+};
+
+
+// Sinks may be written to by any number of threads at once.
+class LogSink {
+public:
+  virtual ~LogSink() {}
+  virtual void write(const LogRecord& record) = 0;
+  // Returns once everything written so far is out.
+  virtual void flush() {}
+};
+
+
+// Writes "<UTC time> <LEVEL> <component>: <message>" lines to a stream (std::cerr by default),
+// flushing only when asked to.
+class StreamSink : public LogSink {
+private:
+  std::mutex mutex{};
+  std::ostream& out;
+
+public:
+  explicit StreamSink(std::ostream& out = std::cerr)
+  : out(out) {}
+
+  static std::string format(const LogRecord& record) {
+    const std::time_t seconds = std::chrono::system_clock::to_time_t(record.time);
+    const auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(
+        record.time.time_since_epoch()).count() % 1000;
+    std::tm utc{};
+    gmtime_r(&seconds, &utc);
+    char time[32];
+    const size_t length = strftime(time, sizeof(time), "%Y-%m-%dT%H:%M:%S", &utc);
+    snprintf(time + length, sizeof(time) - length, ".%03dZ", static_cast<int>(millis));
+    return std::string(time) + " " + level_name(record.level) + " " + record.component + ": " +
+           record.message + "\n";
+  }
+
+  void write(const LogRecord& record) override {
+    const std::string line = format(record);
+    std::lock_guard<std::mutex> lock{mutex};
+    out << line;
+  }
+
+  void flush() override {
+    std::lock_guard<std::mutex> lock{mutex};
+    out.flush();
+  }
+};
+
+
+// Queues records on a lock-free list and writes them to another sink from a background thread,
+// which flushes that sink whenever it runs out of records. Beyond max_pending queued records,
+// records are dropped (and the number dropped is logged) rather than left to grow without bound.
+class AsyncSink : public LogSink {
+private:
+  // An intrusive multi-producer, single-consumer queue: producers swap themselves in at head, the
+  // writer follows next pointers from tail.
+  struct Node {
+    std::atomic<Node*> next{nullptr};
+    LogRecord record;
+  };
+
+  const std::shared_ptr<LogSink> target;
+  const size_t max_pending;
+  std::atomic<Node*> head;
+  Node* tail;
+  std::atomic<uint64_t> pushed{0};
+  std::atomic<uint64_t> written{0};
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<bool> sleeping{false};
+  std::atomic<bool> stopping{false};
+  std::mutex mutex{};
+  std::condition_variable wake{};
+  std::condition_variable drained{};
+  std::thread writer;
+
+  bool write_pending() {
+    bool any = false;
+    for (Node* next = tail->next.load(std::memory_order_acquire);
+         next != nullptr;
+         next = tail->next.load(std::memory_order_acquire)) {
+      target->write(next->record);
+      delete tail;
+      tail = next;
+      written.fetch_add(1, std::memory_order_release);
+      any = true;
+    }
+    const uint64_t lost = dropped.exchange(0);
+    if (lost > 0) {
+      target->write(LogRecord{LogLevel::warning, std::chrono::system_clock::now(), "log",
+                              std::to_string(lost) + " records dropped"});
+    }
+    return any || lost > 0;
+  }
+
+  void run() {
+    for (;;) {
+      if (write_pending()) {
+        target->flush();
+        std::lock_guard<std::mutex> lock{mutex};
+        drained.notify_all();
+        continue;
+      }
+      if (stopping.load(std::memory_order_acquire)) return;
+      std::unique_lock<std::mutex> lock{mutex};
+      sleeping.store(true);
+      // A producer that saw sleeping still false has pushed already; look again before waiting.
+      if (tail->next.load(std::memory_order_acquire) != nullptr) {
+        sleeping.store(false);
+        continue;
+      }
+      wake.wait_for(lock, std::chrono::milliseconds(100));
+      sleeping.store(false);
+    }
+  }
+
+public:
+  explicit AsyncSink(const std::shared_ptr<LogSink>& target = std::make_shared<StreamSink>(),
+                     const size_t max_pending = 1 << 16)
+  : target(target),
+    max_pending(max_pending),
+    head(new Node()),
+    tail(head.load()),
+    writer([this]() { run(); }) {}
+
+  AsyncSink(const AsyncSink&) = delete;
+  AsyncSink& operator=(const AsyncSink&) = delete;
+
+  // Writes out everything still queued.
+  ~AsyncSink() {
+    stopping.store(true, std::memory_order_release);
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      wake.notify_one();
+    }
+    writer.join();
+    write_pending();
+    target->flush();
+    delete tail;
+  }
+
+  void write(const LogRecord& record) override {
+    const uint64_t done = written.load(std::memory_order_relaxed);
+    if (pushed.load(std::memory_order_relaxed) - done >= max_pending) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    Node* node = new Node();
+    node->record = record;
+    pushed.fetch_add(1, std::memory_order_relaxed);
+    Node* previous = head.exchange(node, std::memory_order_acq_rel);
+    previous->next.store(node, std::memory_order_release);
+    if (sleeping.load() && sleeping.exchange(false)) {
+      std::lock_guard<std::mutex> lock{mutex};
+      wake.notify_one();
+    }
+  }
+
+  void flush() override {
+    const uint64_t target_count = pushed.load();
+    std::unique_lock<std::mutex> lock{mutex};
+    wake.notify_one();
+    while (written.load(std::memory_order_acquire) < target_count) {
+      drained.wait_for(lock, std::chrono::milliseconds(10));
+    }
+  }
+};
+
+
+// Filters records by level and passes the rest to the current sink. Replaced sinks are kept until
+// exit, since another thread may still be writing to one.
+class Logger {
+private:
+  std::atomic<int> threshold;
+  std::atomic<LogSink*> current;
+  std::mutex mutex{};
+  std::vector<std::shared_ptr<LogSink>> sinks{};
+
+public:
+  explicit Logger(const std::shared_ptr<LogSink>& sink = std::make_shared<AsyncSink>(),
+                  const LogLevel level = LogLevel::info)
+  : threshold(static_cast<int>(level)),
+    current(sink.get()),
+    sinks({sink}) {}
+
+  Logger(const Logger&) = delete;
+  Logger& operator=(const Logger&) = delete;
+
+  bool enabled(const LogLevel level) const {
+    return level != LogLevel::off &&
+           static_cast<int>(level) >= threshold.load(std::memory_order_relaxed);
+  }
+
+  void log(const LogLevel level, const std::string& component, const std::string& message) {
+    if (!enabled(level)) return;
+    current.load(std::memory_order_acquire)->write(
+        LogRecord{level, std::chrono::system_clock::now(), component, message});
+  }
+
+  LogLevel level() const {
+    return static_cast<LogLevel>(threshold.load());
+  }
+
+  // LogLevel::off disables logging.
+  void set_level(const LogLevel level) {
+    threshold.store(static_cast<int>(level));
+  }
+
+  // Returns the sink replaced.
+  std::shared_ptr<LogSink> set_sink(const std::shared_ptr<LogSink>& sink) {
+    std::lock_guard<std::mutex> lock{mutex};
+    std::shared_ptr<LogSink> previous{};
+    for (const auto& kept : sinks) {
+      if (kept.get() == current.load()) previous = kept;
+    }
+    if (std::find(sinks.begin(), sinks.end(), sink) == sinks.end()) sinks.push_back(sink);
+    current.store(sink.get(), std::memory_order_release);
+    return previous;
+  }
+
+  void flush() {
+    current.load(std::memory_order_acquire)->flush();
+  }
+};
+
+
+// The logger the library writes to: info and above, to stderr through an AsyncSink. It is never
+// destroyed, so threads and static destructors still running at exit can log; what is queued by
+// then is flushed from an atexit hook.
+inline Logger& logger() {
+  static Logger* const instance = []() {
+    Logger* const created = new Logger();
+    std::atexit([]() { logger().flush(); });
+    return created;
+  }();
+  return *instance;
+}
+
+
+} // namespace util
+} // namespace appc
@@ -0,0 +1,340 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "appc/os/staged_file.h"
+#include "appc/util/shards.h"
+#include "appc/util/status.h"
+
+
+// Counters and histograms for the library's hot paths (image passes, manifest parsing, discovery
+// strategies), exported in the Prometheus text format.
+//
+// The metric types and the registry are always available. The library's own instrumentation is
+// compiled in only when APPC_METRICS is defined (cmake -DAPPC_METRICS=ON); otherwise the macros
+// below expand to nothing and cost nothing.
+#ifdef APPC_METRICS
+#define APPC_IF_METRICS(...) __VA_ARGS__
+// Times the rest of the enclosing scope into a histogram looked up once per call site.
+#define APPC_TIME_SCOPE(name, help, ...) \
+  static ::appc::util::Histogram& appc_scope_histogram_ = \
+      ::appc::util::metrics().histogram(name, help, __VA_ARGS__); \
+  const ::appc::util::ScopedTimer appc_scope_timer_{appc_scope_histogram_}
+#else
+#define APPC_IF_METRICS(...)
+#define APPC_TIME_SCOPE(name, help, ...) do {} while (0)
+#endif
+
+
+namespace appc {
+namespace util {
+
+
+using MetricLabels = std::map<std::string, std::string>;
+
+
+class Counter {
+private:
+  detail::PaddedCount shards[detail::shard_count];
+public:
+  Counter() = default;
+  Counter(const Counter&) = delete;
+  Counter& operator=(const Counter&) = delete;
+
+  void add(const uint64_t n = 1) {
+    shards[detail::thread_shard()].value.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  uint64_t value() const {
+    uint64_t total = 0;
+    for (const auto& shard : shards) total += shard.value.load(std::memory_order_relaxed);
+    return total;
+  }
+};
+
+
+// Counts observations into fixed buckets. Observations are integers (nanoseconds, bytes) and are
+// multiplied by scale on export, so a histogram of nanoseconds exports seconds.
+class Histogram {
+public:
+  const std::vector<uint64_t> bounds;
+  const double scale;
+
+private:
+  // Per shard: a count per bound, one for +Inf, then the sum; padded to whole cache lines.
+  const size_t stride;
+  std::unique_ptr<std::atomic<uint64_t>[]> cells;
+
+public:
+  // bounds are the inclusive upper bounds of the buckets, ascending.
+  explicit Histogram(const std::vector<uint64_t>& bounds, const double scale = 1)
+  : bounds(bounds),
+    scale(scale),
+    stride((bounds.size() + 2 + 7) / 8 * 8),
+    cells(new std::atomic<uint64_t>[stride * detail::shard_count]) {
+    for (size_t i = 0; i < stride * detail::shard_count; i++) cells[i] = 0;
+  }
+
+  Histogram(const Histogram&) = delete;
+  Histogram& operator=(const Histogram&) = delete;
+
+  void observe(const uint64_t value) {
+    const size_t bucket = std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin();
+    std::atomic<uint64_t>* shard = &cells[detail::thread_shard() * stride];
+    shard[bucket].fetch_add(1, std::memory_order_relaxed);
+    shard[bounds.size() + 1].fetch_add(value, std::memory_order_relaxed);
+  }
+
+  // Observations per bucket (not cumulative), the last being those above every bound.
+  std::vector<uint64_t> counts() const {
+    std::vector<uint64_t> totals(bounds.size() + 1, 0);
+    for (size_t shard = 0; shard < detail::shard_count; shard++) {
+      for (size_t bucket = 0; bucket < totals.size(); bucket++) {
+        totals[bucket] += cells[shard * stride + bucket].load(std::memory_order_relaxed);
+      }
+    }
+    return totals;
+  }
+
+  uint64_t count() const {
+    uint64_t total = 0;
+    for (const auto n : counts()) total += n;
+    return total;
+  }
+
+  uint64_t sum() const {
+    uint64_t total = 0;
+    for (size_t shard = 0; shard < detail::shard_count; shard++) {
+      total += cells[shard * stride + bounds.size() + 1].load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+};
+
+
+// 1µs to about 1 minute in powers of 4, in nanoseconds.
+inline std::vector<uint64_t> latency_buckets() {
+  std::vector<uint64_t> bounds{};
+  for (uint64_t bound = 1000; bound <= 64000000000ull; bound *= 4) bounds.push_back(bound);
+  return bounds;
+}
+
+
+// 1KiB to 4GiB in powers of 4.
+inline std::vector<uint64_t> size_buckets() {
+  std::vector<uint64_t> bounds{};
+  for (uint64_t bound = 1024; bound <= (4ull << 30); bound *= 4) bounds.push_back(bound);
+  return bounds;
+}
+
+
+class Stopwatch {
+private:
+  std::chrono::steady_clock::time_point last{std::chrono::steady_clock::now()};
+public:
+  // Nanoseconds since construction or the previous lap.
+  uint64_t lap() {
+    const auto now = std::chrono::steady_clock::now();
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+    last = now;
+    return elapsed;
+  }
+};
+
+
+// Records the time from construction to destruction, in nanoseconds.
+class ScopedTimer {
+private:
+  Histogram& histogram;
+  Stopwatch stopwatch{};
+public:
+  explicit ScopedTimer(Histogram& histogram)
+  : histogram(histogram) {}
+
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+  ~ScopedTimer() {
+    histogram.observe(stopwatch.lap());
+  }
+};
+
+
+// One exported value, as handed to a collect() callback. Histograms are reported as their
+// cumulative name_bucket samples (with an "le" label), name_sum and name_count.
+struct MetricSample {
+  std::string name;
+  MetricLabels labels;
+  double value;
+};
+
+
+// Metrics by name and labels. Lookups take a lock, so callers keep the returned reference (which
+// stays valid for the registry's lifetime) rather than looking a metric up per update.
+class MetricsRegistry {
+private:
+  struct Family {
+    std::string help;
+    bool histogram;
+    std::map<MetricLabels, std::unique_ptr<Counter>> counters;
+    std::map<MetricLabels, std::unique_ptr<Histogram>> histograms;
+  };
+
+  mutable std::mutex mutex{};
+  std::map<std::string, Family> families{};
+
+  Family& family(const std::string& name, const std::string& help, const bool histogram) {
+    auto found = families.find(name);
+    if (found == families.end()) {
+      found = families.emplace(name, Family{help, histogram, {}, {}}).first;
+    }
+    return found->second;
+  }
+
+  static std::string format_value(const double value) {
+    std::ostringstream out{};
+    out.precision(15);
+    out << value;
+    return out.str();
+  }
+
+  static std::string escape(const std::string& value) {
+    std::string escaped{};
+    for (const char c : value) {
+      if (c == '\\' || c == '"') escaped += '\\';
+      if (c == '\n') {
+        escaped += "\\n";
+        continue;
+      }
+      escaped += c;
+    }
+    return escaped;
+  }
+
+  static std::string render_labels(const MetricLabels& labels) {
+    if (labels.empty()) return "";
+    std::string rendered{"{"};
+    for (const auto& label : labels) {
+      if (rendered.length() > 1) rendered += ",";
+      rendered += label.first + "=\"" + escape(label.second) + "\"";
+    }
+    return rendered + "}";
+  }
+
+  static void collect_family(const std::string& name,
+                             const Family& family,
+                             const std::function<void(const MetricSample&)>& visit) {
+    for (const auto& counter : family.counters) {
+      visit(MetricSample{name, counter.first, static_cast<double>(counter.second->value())});
+    }
+    for (const auto& entry : family.histograms) {
+      const Histogram& histogram = *entry.second;
+      const auto counts = histogram.counts();
+      uint64_t cumulative = 0;
+      for (size_t bucket = 0; bucket < counts.size(); bucket++) {
+        cumulative += counts[bucket];
+        MetricLabels labels = entry.first;
+        labels["le"] = bucket < histogram.bounds.size()
+                         ? format_value(histogram.bounds[bucket] * histogram.scale)
+                         : "+Inf";
+        visit(MetricSample{name + "_bucket", labels, static_cast<double>(cumulative)});
+      }
+      visit(MetricSample{name + "_sum", entry.first, histogram.sum() * histogram.scale});
+      visit(MetricSample{name + "_count", entry.first, static_cast<double>(cumulative)});
+    }
+  }
+
+public:
+  MetricsRegistry() = default;
+  MetricsRegistry(const MetricsRegistry&) = delete;
+  MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+  // The first registration of a name sets its help text.
+  Counter& counter(const std::string& name,
+                   const std::string& help,
+                   const MetricLabels& labels = MetricLabels()) {
+    std::lock_guard<std::mutex> lock{mutex};
+    auto& counters = family(name, help, false).counters;
+    auto& counter = counters[labels];
+    if (!counter) counter.reset(new Counter());
+    return *counter;
+  }
+
+  // The first registration of a name and labels sets the buckets.
+  Histogram& histogram(const std::string& name,
+                       const std::string& help,
+                       const MetricLabels& labels = MetricLabels(),
+                       const std::vector<uint64_t>& bounds = latency_buckets(),
+                       const double scale = 1e-9) {
+    std::lock_guard<std::mutex> lock{mutex};
+    auto& histograms = family(name, help, true).histograms;
+    auto& histogram = histograms[labels];
+    if (!histogram) histogram.reset(new Histogram(bounds, scale));
+    return *histogram;
+  }
+
+  // Every current value, e.g. to forward to another metrics system.
+  void collect(const std::function<void(const MetricSample&)>& visit) const {
+    std::lock_guard<std::mutex> lock{mutex};
+    for (const auto& family : families) collect_family(family.first, family.second, visit);
+  }
+
+  // The Prometheus text exposition format.
+  std::string render() const {
+    std::lock_guard<std::mutex> lock{mutex};
+    std::string text{};
+    for (const auto& family : families) {
+      text += "# HELP " + family.first + " " + family.second.help + "\n";
+      text += "# TYPE " + family.first + " " +
+              (family.second.histogram ? "histogram" : "counter") + "\n";
+      collect_family(family.first, family.second, [&text](const MetricSample& sample) {
+        text += sample.name + render_labels(sample.labels) + " " + format_value(sample.value) + "\n";
+      });
+    }
+    return text;
+  }
+
+  // Atomically replaces path with render(), for the node exporter's textfile collector.
+  Status write_text_file(const std::string& path) const {
+    return os::publish_file(path, render(), false);
+  }
+};
+
+
+// The registry the library's instrumentation records into.
+inline MetricsRegistry& metrics() {
+  static MetricsRegistry registry{};
+  return registry;
+}
+
+
+} // namespace util
+} // namespace appc
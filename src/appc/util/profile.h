@@ -0,0 +1,192 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+
+#pragma once
+
+#include <cstdint>
+
+
+// Allocation and syscall counts per library call, for finding allocation churn and chatty I/O.
+//
+// Configure with -DAPPC_PROFILE=ON. That builds libappc-profile.so (src/profile), which
+// interposes malloc and friends and the common I/O calls and keeps per-thread counts, and compiles
+// APPC_PROFILE_SCOPE into the library's entry points (from_json, validate, the Image passes,
+// ImageProvider::get). Run a program with the shim preloaded:
+//
+//   LD_PRELOAD=lib/libappc-profile.so bin/examples/image/extract_image image.aci
+//
+// and a table of calls, allocations, bytes allocated and syscalls per entry point is written to
+// stderr at exit (or to the file named by APPC_PROFILE_OUTPUT). Counts are of the calling
+// thread, so work handed to other threads (concurrent fetches, say) is not included, and an outer
+// scope's counts include its inner scopes'. Only calls made through the dynamic linker are seen
+// as syscalls: libc's calls to itself (fopen's open) are not.
+
+
+extern "C" {
+
+// What the shim counts, per thread.
+struct appc_profile_counters {
+  uint64_t allocations;
+  uint64_t frees;
+  uint64_t bytes_allocated;
+  uint64_t syscalls;
+};
+
+// Provided by the shim: the calling thread's counts so far.
+typedef void (*appc_profile_read_fn)(struct appc_profile_counters*);
+
+}
+
+
+#ifdef APPC_PROFILE
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <map>
+#include <mutex>
+#include <string>
+
+#define APPC_PROFILE_CONCAT_(a, b) a##b
+#define APPC_PROFILE_CONCAT(a, b) APPC_PROFILE_CONCAT_(a, b)
+// Counts the rest of the enclosing scope under name, which must be a string literal.
+#define APPC_PROFILE_SCOPE(name) \
+  const ::appc::util::ProfileScope APPC_PROFILE_CONCAT(appc_profile_scope_, __LINE__){name}
+
+
+namespace appc {
+namespace util {
+
+
+struct ProfileTotals {
+  uint64_t calls;
+  uint64_t allocations;
+  uint64_t bytes_allocated;
+  uint64_t syscalls;
+  uint64_t nanoseconds;
+};
+
+
+class Profile {
+private:
+  std::mutex mutex{};
+  std::map<std::string, ProfileTotals> totals{};
+  const appc_profile_read_fn reader;
+
+  Profile()
+  : reader(reinterpret_cast<appc_profile_read_fn>(dlsym(RTLD_DEFAULT, "appc_profile_read"))) {}
+
+  friend Profile& profile();
+
+public:
+  Profile(const Profile&) = delete;
+  Profile& operator=(const Profile&) = delete;
+
+  ~Profile() {
+    if (totals.empty()) return;
+    const char* path = getenv("APPC_PROFILE_OUTPUT");
+    FILE* out = path != nullptr ? fopen(path, "w") : stderr;
+    if (out == nullptr) return;
+    report(out);
+    if (out != stderr) fclose(out);
+  }
+
+  // Whether the shim is preloaded; without it only calls and time are counted.
+  bool counting() const {
+    return reader != nullptr;
+  }
+
+  appc_profile_counters read() const {
+    appc_profile_counters counters{0, 0, 0, 0};
+    if (reader != nullptr) reader(&counters);
+    return counters;
+  }
+
+  void record(const char* name,
+              const appc_profile_counters& before,
+              const appc_profile_counters& after,
+              const uint64_t nanoseconds) {
+    std::lock_guard<std::mutex> lock{mutex};
+    auto& total = totals[name];
+    total.calls++;
+    total.allocations += after.allocations - before.allocations;
+    total.bytes_allocated += after.bytes_allocated - before.bytes_allocated;
+    total.syscalls += after.syscalls - before.syscalls;
+    total.nanoseconds += nanoseconds;
+  }
+
+  std::map<std::string, ProfileTotals> snapshot() {
+    std::lock_guard<std::mutex> lock{mutex};
+    return totals;
+  }
+
+  void report(FILE* out) {
+    const auto current = snapshot();
+    if (!counting()) fprintf(out, "appc profile: libappc-profile.so not preloaded, "
+                                  "allocations and syscalls not counted\n");
+    fprintf(out, "%-40s %10s %14s %12s %16s %12s %12s\n", "call", "calls", "allocations",
+            "allocs/call", "bytes", "syscalls", "ms");
+    for (const auto& entry : current) {
+      const auto& total = entry.second;
+      fprintf(out, "%-40s %10llu %14llu %12.1f %16llu %12llu %12.3f\n", entry.first.c_str(),
+              static_cast<unsigned long long>(total.calls),
+              static_cast<unsigned long long>(total.allocations),
+              static_cast<double>(total.allocations) / total.calls,
+              static_cast<unsigned long long>(total.bytes_allocated),
+              static_cast<unsigned long long>(total.syscalls),
+              total.nanoseconds / 1e6);
+    }
+  }
+};
+
+
+inline Profile& profile() {
+  static Profile profile{};
+  return profile;
+}
+
+
+class ProfileScope {
+private:
+  const char* const name;
+  const appc_profile_counters before;
+  const std::chrono::steady_clock::time_point started;
+public:
+  explicit ProfileScope(const char* name)
+  : name(name),
+    before(profile().read()),
+    started(std::chrono::steady_clock::now()) {}
+
+  ProfileScope(const ProfileScope&) = delete;
+  ProfileScope& operator=(const ProfileScope&) = delete;
+
+  ~ProfileScope() {
+    const auto after = profile().read();
+    profile().record(name, before, after, std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - started).count());
+  }
+};
+
+
+} // namespace util
+} // namespace appc
+
+#else
+#define APPC_PROFILE_SCOPE(name) do {} while (0)
+#endif
@@ -0,0 +1,54 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace appc {
+namespace util {
+namespace detail {
+
+
+// Per-thread striping for counters that many threads update at once (metrics, snapshot readers):
+// each thread updates one shard, so threads rarely write to the same cache line, and readers sum
+// the shards.
+const size_t shard_count = 16;
+
+
+// The calling thread's shard, chosen on its first call.
+inline size_t thread_shard() {
+  static std::atomic<size_t> next{0};
+  static thread_local const size_t shard = next++ % shard_count;
+  return shard;
+}
+
+
+// A counter alone on its cache line.
+struct PaddedCount {
+  std::atomic<uint64_t> value{0};
+  char padding[64 - sizeof(std::atomic<uint64_t>)];
+};
+
+
+} // namespace detail
+} // namespace util
+} // namespace appc
@@ -0,0 +1,179 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "appc/util/shards.h"
+
+
+namespace appc {
+namespace util {
+
+
+// A value that is replaced whole rather than modified, published RCU-style: readers take the
+// current version without a lock and keep it as long as they like, and writers publish a new
+// version without waiting for readers to be done with the old one. For configuration that is read
+// on every call and changed rarely.
+//
+// A reader holds the version it loaded by its shared_ptr, so a replaced version lives on until
+// the calls begun under it are finished. The only moment readers and writers share is between a
+// reader's load and its taking that reference: readers mark it in their thread's shard of a
+// counter, and a writer, having swapped in the new version, waits to see each shard at zero
+// before dropping its own reference to the old one. The counters come in two generations and the
+// writer moves readers on to the other before it waits, so it waits only for loads already under
+// way, never for a stream of new ones.
+//
+// Each thread also keeps a weak reference to the version it last loaded from a snapshot, with the
+// version() it was loaded at. A load() that finds nothing published since costs one acquire load
+// of version() and the weak reference's lock (a reference count update that every reader of the
+// version contends for). Otherwise it takes the version as above: two atomic loads of the
+// generation and two atomic read-modify-writes on its shard's counter, which the threads sharing
+// the shard contend for. Either way, load once per call, not per access. Being weak, the kept
+// reference never keeps a replaced version alive.
+template<typename T>
+class Snapshot {
+public:
+  using Pointer = std::shared_ptr<const T>;
+
+private:
+  // A thread's last load from one snapshot. Threads keep a few, by snapshot id.
+  struct Kept {
+    uint64_t id;
+    uint64_t version;
+    std::weak_ptr<const T> value;
+  };
+
+  static const size_t kept_slots = 8;
+
+  static Kept* kept() {
+    static thread_local Kept slots[kept_slots]{};
+    return slots;
+  }
+
+  static uint64_t next_id() {
+    static std::atomic<uint64_t> next{1};
+    return next++;
+  }
+
+  // Identifies this snapshot in the threads' kept slots; never reused, unlike its address.
+  const uint64_t id{next_id()};
+  std::atomic<Pointer*> current;
+  std::atomic<uint64_t> published{1};
+  // Which of loading's generations new readers mark.
+  std::atomic<unsigned> generation{0};
+  // Readers between loading current and copying what it points to, by generation and by thread
+  // (as metrics shard).
+  mutable detail::PaddedCount loading[2][detail::shard_count];
+  // Serializes writers.
+  std::mutex mutex{};
+
+  // Requires mutex.
+  Pointer replace(const Pointer& value) {
+    Pointer* previous = current.exchange(new Pointer(value));
+    published++;
+    // A reader that loaded previous marked its shard first, so once each shard has been seen at
+    // zero none can still be copying it. Readers in the other generation confirmed it after this
+    // switch (and load the new version) or before the last one (and that writer waited for them).
+    // Readers that mark the old generation after the switch see it change and move over, so the
+    // old generation drains however many readers keep arriving.
+    const unsigned draining = generation.fetch_xor(1);
+    for (auto& shard : loading[draining]) {
+      while (shard.value.load() != 0) std::this_thread::yield();
+    }
+    const Pointer replaced = *previous;
+    delete previous;
+    return replaced;
+  }
+
+public:
+  explicit Snapshot(const Pointer& value)
+  : current(new Pointer(value)) {}
+
+  // A copy starts at other's current version.
+  Snapshot(const Snapshot& other)
+  : Snapshot(other.load()) {}
+
+  Snapshot& operator=(const Snapshot&) = delete;
+
+  ~Snapshot() {
+    delete current.load();
+  }
+
+  // Without the kept slots.
+  Pointer load_current() const {
+    const size_t thread_shard = detail::thread_shard();
+    for (;;) {
+      const unsigned marked = generation.load();
+      std::atomic<uint64_t>& shard = loading[marked][thread_shard].value;
+      shard.fetch_add(1);
+      // A writer switched generations in between and may not wait for this one.
+      if (generation.load() != marked) {
+        shard.fetch_sub(1, std::memory_order_release);
+        continue;
+      }
+      Pointer value = *current.load();
+      shard.fetch_sub(1, std::memory_order_release);
+      return value;
+    }
+  }
+
+  Pointer load() const {
+    Kept& slot = kept()[id % kept_slots];
+    // What load_current() returns next is at least this version: a writer counts a version after
+    // swapping it in.
+    const uint64_t version = published.load(std::memory_order_acquire);
+    if (slot.id == id && slot.version == version) {
+      // Alive as long as it is current, which it is until version() moves on.
+      Pointer value = slot.value.lock();
+      if (value) return value;
+    }
+    Pointer value = load_current();
+    slot.id = id;
+    slot.version = version;
+    slot.value = value;
+    return value;
+  }
+
+  // Returns the version replaced.
+  Pointer publish(const Pointer& value) {
+    std::lock_guard<std::mutex> lock{mutex};
+    return replace(value);
+  }
+
+  // Publishes update(current value). Concurrent updates are applied one after the other, so none
+  // is lost.
+  template<typename Update>
+  Pointer update(Update update) {
+    std::lock_guard<std::mutex> lock{mutex};
+    return replace(update(**current.load()));
+  }
+
+  // Versions published so far, counting the first. Changes with every publish() and update().
+  uint64_t version() const {
+    return published.load();
+  }
+};
+
+
+} // namespace util
+} // namespace appc
@@ -0,0 +1,353 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "appc/os/staged_file.h"
+#include "appc/util/status.h"
+
+
+// Trace spans for following one request (a pod start, say) through the library: resolve, fetch,
+// transfer, decompress, extract, manifest parse and validate. Spans are recorded into per-thread
+// ring buffers and exported as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+//
+// The tracer is always available. The library's own spans are compiled in only when APPC_TRACING
+// is defined (cmake -DAPPC_TRACING=ON); otherwise the macros below expand to nothing and their
+// arguments are not evaluated.
+#ifdef APPC_TRACING
+#define APPC_IF_TRACING(...) __VA_ARGS__
+#define APPC_TRACE_CONCAT_(a, b) a##b
+#define APPC_TRACE_CONCAT(a, b) APPC_TRACE_CONCAT_(a, b)
+// A span from here to the end of the enclosing scope. name must be a string literal.
+#define APPC_TRACE_SPAN(name) \
+  const ::appc::util::TraceSpan APPC_TRACE_CONCAT(appc_trace_span_, __LINE__){name}
+// As above, with a detail shown alongside (e.g. the image name). Its first
+// detail::trace_detail_length bytes are copied into the span when it ends.
+#define APPC_TRACE_SPAN_DETAIL(name, detail) \
+  const std::string& APPC_TRACE_CONCAT(appc_trace_detail_, __LINE__) = detail; \
+  const ::appc::util::TraceSpan APPC_TRACE_CONCAT(appc_trace_span_, __LINE__){ \
+      name, APPC_TRACE_CONCAT(appc_trace_detail_, __LINE__).c_str()}
+#else
+#define APPC_IF_TRACING(...)
+#define APPC_TRACE_SPAN(name) do {} while (0)
+#define APPC_TRACE_SPAN_DETAIL(name, detail) do {} while (0)
+#endif
+
+
+namespace appc {
+namespace util {
+
+
+struct TraceEvent {
+  const char* name;
+  // Empty if none, cut to detail::trace_detail_length bytes.
+  std::string detail;
+  uint64_t thread;
+  // As recorded, in trace_clock() ticks; as returned by Tracer::events(), in nanoseconds on the
+  // steady clock.
+  uint64_t start;
+  uint64_t duration;
+};
+
+
+inline uint64_t steady_nanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// The span clock: the time stamp counter where there is one (a fraction of the cost of reading
+// the steady clock), converted to nanoseconds only on export.
+inline uint64_t trace_clock() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return steady_nanoseconds();
+#endif
+}
+
+
+namespace detail {
+
+
+// Per thread: a ring fills in about this many spans and then overwrites its oldest.
+const size_t trace_ring_capacity = 16384;
+
+// The most of a span's detail kept in its slot (enough for an image name or URI).
+const size_t trace_detail_length = 64;
+
+
+// A single writer's events, overwritten oldest first. Each slot is a seqlock so that a reader
+// copying a slot while its writer reuses it can tell, and skip it; the writer never waits. Details
+// are copied into the slot, so the caller's string need not outlive the span and nothing is
+// allocated or locked to record one.
+class TraceRing {
+private:
+  static const size_t detail_words = trace_detail_length / sizeof(uint64_t);
+
+  struct Slot {
+    std::atomic<uint64_t> sequence{0};
+    std::atomic<const char*> name{nullptr};
+    std::atomic<uint64_t> detail[detail_words]{};
+    std::atomic<uint64_t> thread{0};
+    std::atomic<uint64_t> start{0};
+    std::atomic<uint64_t> duration{0};
+  };
+
+  std::unique_ptr<Slot[]> slots;
+  std::atomic<uint64_t> head{0};
+
+public:
+  const size_t capacity;
+  // Whether a live thread writes to this ring (otherwise it may be handed to a new thread).
+  std::atomic<bool> owned{true};
+
+  explicit TraceRing(const size_t capacity)
+  : slots(new Slot[capacity]),
+    capacity(capacity) {}
+
+  void push(const char* name,
+            const char* detail,
+            const uint64_t thread,
+            const uint64_t start,
+            const uint64_t duration) {
+    const uint64_t index = head.load(std::memory_order_relaxed);
+    Slot& slot = slots[index % capacity];
+    slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name.store(name, std::memory_order_relaxed);
+    // Zero padded, and ended by the slot when it fills it.
+    const size_t length = strnlen(detail, trace_detail_length);
+    for (size_t word = 0; word < detail_words; word++) {
+      uint64_t bytes = 0;
+      const size_t offset = word * sizeof(uint64_t);
+      if (offset < length) memcpy(&bytes, detail + offset, std::min(sizeof(bytes), length - offset));
+      slot.detail[word].store(bytes, std::memory_order_relaxed);
+    }
+    slot.thread.store(thread, std::memory_order_relaxed);
+    slot.start.store(start, std::memory_order_relaxed);
+    slot.duration.store(duration, std::memory_order_relaxed);
+    slot.sequence.store(2 * index + 2, std::memory_order_release);
+    head.store(index + 1, std::memory_order_release);
+  }
+
+  void append_to(std::vector<TraceEvent>& events, const uint64_t since) const {
+    const uint64_t end = head.load(std::memory_order_acquire);
+    const uint64_t begin = end > capacity ? end - capacity : 0;
+    for (uint64_t index = begin; index < end; index++) {
+      const Slot& slot = slots[index % capacity];
+      const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+      char detail[trace_detail_length];
+      for (size_t word = 0; word < detail_words; word++) {
+        const uint64_t bytes = slot.detail[word].load(std::memory_order_relaxed);
+        memcpy(detail + word * sizeof(uint64_t), &bytes, sizeof(bytes));
+      }
+      TraceEvent event{slot.name.load(std::memory_order_relaxed),
+                       std::string(detail, strnlen(detail, trace_detail_length)),
+                       slot.thread.load(std::memory_order_relaxed),
+                       slot.start.load(std::memory_order_relaxed),
+                       slot.duration.load(std::memory_order_relaxed)};
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence != 2 * index + 2 || slot.sequence.load(std::memory_order_relaxed) != sequence) {
+        continue;
+      }
+      if (event.start >= since) events.push_back(std::move(event));
+    }
+  }
+};
+
+
+} // namespace detail
+
+
+class Tracer;
+inline Tracer& tracer();
+
+
+// Hands each thread a ring on its first span. A thread's ring outlives it, so a dump still shows
+// the work of threads that have finished, until the ring is handed to a later thread.
+//
+// There is one tracer, tracer(): rings are leased per thread, not per tracer.
+class Tracer {
+private:
+  friend Tracer& tracer();
+
+  struct Lease {
+    std::shared_ptr<detail::TraceRing> ring;
+    uint64_t thread;
+
+    ~Lease() {
+      if (ring) ring->owned.store(false, std::memory_order_release);
+    }
+  };
+
+  std::mutex mutex{};
+  std::vector<std::shared_ptr<detail::TraceRing>> rings{};
+  std::atomic<uint64_t> next_thread{1};
+  std::atomic<uint64_t> since{0};
+  // Both clocks at construction; with both read again on export, the ratio of the intervals
+  // converts ticks to nanoseconds.
+  const uint64_t origin_ticks{trace_clock()};
+  const uint64_t origin_nanoseconds{steady_nanoseconds()};
+
+  std::shared_ptr<detail::TraceRing> lease_ring() {
+    std::lock_guard<std::mutex> lock{mutex};
+    for (const auto& ring : rings) {
+      bool owned = false;
+      if (ring->owned.compare_exchange_strong(owned, true)) return ring;
+    }
+    rings.push_back(std::make_shared<detail::TraceRing>(detail::trace_ring_capacity));
+    return rings.back();
+  }
+
+  Lease& lease() {
+    static thread_local Lease lease{};
+    if (!lease.ring) {
+      lease.ring = lease_ring();
+      lease.thread = next_thread++;
+    }
+    return lease;
+  }
+
+  static std::string escape(const std::string& text) {
+    std::string escaped{};
+    for (const char c : text) {
+      if (c == '"' || c == '\\') {
+        escaped += '\\';
+        escaped += c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        escaped += ' ';
+      } else {
+        escaped += c;
+      }
+    }
+    return escaped;
+  }
+
+  Tracer() = default;
+
+public:
+  Tracer(const Tracer&) = delete;
+  Tracer& operator=(const Tracer&) = delete;
+
+  void record(const char* name, const char* detail, const uint64_t start, const uint64_t duration) {
+    Lease& current = lease();
+    current.ring->push(name, detail, current.thread, start, duration);
+  }
+
+  // Leaves out everything recorded so far from later dumps, e.g. before the pod start of interest.
+  void clear() {
+    since.store(trace_clock(), std::memory_order_relaxed);
+  }
+
+  // The retained spans of every thread, unordered, timed in nanoseconds.
+  std::vector<TraceEvent> events() {
+    std::vector<TraceEvent> events{};
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      for (const auto& ring : rings) ring->append_to(events, since.load(std::memory_order_relaxed));
+    }
+    const uint64_t ticks = trace_clock() - origin_ticks;
+    const uint64_t nanoseconds = steady_nanoseconds() - origin_nanoseconds;
+    const double scale = ticks == 0 ? 1 : static_cast<double>(nanoseconds) / ticks;
+    for (auto& event : events) {
+      const int64_t since_origin = static_cast<int64_t>(event.start - origin_ticks);
+      event.start = origin_nanoseconds + static_cast<int64_t>(since_origin * scale);
+      event.duration = static_cast<uint64_t>(event.duration * scale);
+    }
+    return events;
+  }
+
+  std::string render_chrome_trace() {
+    const auto pid = std::to_string(getpid());
+    std::ostringstream json{};
+    json.precision(3);
+    json << std::fixed << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (const auto& event : events()) {
+      json << (first ? "" : ",") << "\n{\"name\":\"" << escape(event.name)
+           << "\",\"cat\":\"appc\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << event.thread
+           << ",\"ts\":" << event.start / 1e3 << ",\"dur\":" << event.duration / 1e3;
+      if (!event.detail.empty()) {
+        json << ",\"args\":{\"detail\":\"" << escape(event.detail) << "\"}";
+      }
+      json << "}";
+      first = false;
+    }
+    json << "\n]}\n";
+    return json.str();
+  }
+
+  Status write_chrome_trace(const std::string& path) {
+    return os::publish_file(path, render_chrome_trace(), false);
+  }
+};
+
+
+inline Tracer& tracer() {
+  static Tracer tracer{};
+  return tracer;
+}
+
+
+class TraceSpan {
+private:
+  const char* const name;
+  const char* const detail;
+  const uint64_t start;
+public:
+  explicit TraceSpan(const char* name, const char* detail = "")
+  : name(name),
+    detail(detail),
+    start(trace_clock()) {}
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+  ~TraceSpan() {
+    tracer().record(name, detail, start, trace_clock() - start);
+  }
+};
+
+
+// For consecutive phases without a scope each: records a span from start to now and returns now,
+// the start of the next phase.
+inline uint64_t trace_phase(const char* name, const char* detail, const uint64_t start) {
+  const uint64_t now = trace_clock();
+  tracer().record(name, detail, start, now - start);
+  return now;
+}
+
+
+} // namespace util
+} // namespace appc
@@ -0,0 +1,64 @@
+#include <csignal>
+#include <iostream>
+#include <memory>
+
+#include "appc/discovery/mirror.h"
+#include "appc/net/http_server.h"
+#include "appc/net/tls_server.h"
+
+
+using namespace appc::discovery;
+using namespace appc::net;
+
+
+int main(int args, char** argv) {
+  if (args != 3 && args != 4 && args != 6) {
+    std::cerr << "Usage: " << argv[0]
+              << " <port> <cache directory> [<upstream prefix> [<certificate> <key>]]" << std::endl;
+    std::cerr << "  e.g. " << argv[0]
+              << " 8443 /var/cache/aci https:// /etc/aci/mirror.pem /etc/aci/mirror.key" << std::endl;
+    std::cerr << "Without a certificate the mirror speaks plain HTTP." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const uint16_t port = std::stoi(argv[1]);
+  const std::string cache_dir{argv[2]};
+  const URI upstream{args > 3 ? argv[3] : https_prefix};
+
+  // The main thread waits for SIGINT/SIGTERM below, the serving threads must not take them.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  mirror::MirrorCache cache{cache_dir, upstream};
+
+  // Clients fetch through the simple strategy, which only fetches https:// URIs.
+  std::unique_ptr<http::Server> server{};
+  if (args == 6) {
+    const auto context = http::tls_context(argv[4], argv[5]);
+    if (!context) {
+      std::cerr << context.failure_reason() << std::endl;
+      return EXIT_FAILURE;
+    }
+    server.reset(new http::TlsServer(mirror::handler(cache), from_result(context)));
+  } else {
+    server.reset(new http::Server(mirror::handler(cache)));
+  }
+
+  const auto listening = server->listen("0.0.0.0", port);
+  if (!listening) {
+    std::cerr << listening.failure_reason() << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cerr << "Mirroring " << upstream << " on port " << from_result(listening)
+            << (args == 6 ? " (TLS)" : "")
+            << ", caching in " << cache_dir << std::endl;
+
+  int signal_number;
+  sigwait(&signals, &signal_number);
+  server->stop();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,70 @@
+#include <csignal>
+#include <iostream>
+
+#include "appc/discovery/provider.h"
+#include "appc/discovery/strategy/peer.h"
+#include "appc/net/http_server.h"
+
+
+using namespace appc::discovery;
+using namespace appc::net;
+
+
+// Shares an image store with peers and, given peers, first pulls an image from them into it. Run
+// several on localhost with different ports and stores to try peer sharing out, e.g.
+//
+//   aci_peer 7071 /tmp/store-a
+//   aci_peer 7072 /tmp/store-b http://127.0.0.1:7071/ example.com/worker 1.0.0
+
+
+int main(int args, char** argv) {
+  if (args != 3 && args != 6) {
+    std::cerr << "Usage: " << argv[0] << " <port> <store directory> [<peer> <name> <version>]"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const uint16_t port = std::stoi(argv[1]);
+  const std::string store_dir{argv[2]};
+
+  if (args == 6) {
+    const auto strategy = strategy::peer::StrategyBuilder()
+                            .with_storage_base_uri(file_prefix + store_dir)
+                            .with_peers({argv[3]})
+                            .build();
+    if (!strategy) {
+      std::cerr << strategy.failure_reason() << std::endl;
+      return EXIT_FAILURE;
+    }
+    ImageProvider provider{{from_result(strategy)}};
+    const auto fetched = provider.get(argv[4], {{"version", argv[5]}, {"os", "linux"}, {"arch", "amd64"}});
+    if (!fetched) {
+      std::cerr << fetched.failure_reason() << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  // The main thread waits for SIGINT/SIGTERM below, the serving threads must not take them.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  strategy::peer::Store store{store_dir};
+  http::Server server{strategy::peer::handler(store)};
+
+  const auto listening = server.listen("0.0.0.0", port);
+  if (!listening) {
+    std::cerr << listening.failure_reason() << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cerr << "Sharing " << store_dir << " with peers on port " << from_result(listening)
+            << std::endl;
+
+  int signal_number;
+  sigwait(&signals, &signal_number);
+  server.stop();
+
+  return EXIT_SUCCESS;
+}
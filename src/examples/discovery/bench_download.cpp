@@ -0,0 +1,107 @@
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+
+#include "appc/discovery/curl.h"
+#include "appc/discovery/https.h"
+#include "appc/net/http_server.h"
+
+
+using namespace appc::discovery;
+using namespace appc::net;
+using bench_clock = std::chrono::steady_clock;
+
+
+// Compares the staged, coalescing download path against writing curl's chunks straight to the
+// final path with stdio, over a loopback server paced to a 10 Gbit/s link.
+
+
+static size_t stdio_writer(void* buffer, size_t size, size_t nmemb, void* stream) {
+  return fwrite(buffer, size, nmemb, static_cast<FILE*>(stream));
+}
+
+
+static Status stdio_get(const URI& uri, const Path& path) {
+  char error_buffer[CURL_ERROR_SIZE];
+  const auto curl = https::new_handle(uri, error_buffer);
+  if (!curl) return Error(curl.failure_reason());
+  FILE* file = fopen(path.c_str(), "wb");
+  if (!file) return Error("Could not open " + path);
+  curl_easy_setopt(curl->get(), CURLOPT_WRITEFUNCTION, stdio_writer);
+  curl_easy_setopt(curl->get(), CURLOPT_WRITEDATA, file);
+  const CURLcode result = curl_easy_perform(curl->get());
+  fclose(file);
+  if (result != CURLE_OK) return Error(error_buffer);
+  return Success();
+}
+
+
+template<typename Get>
+static void run(const std::string& label,
+                const Path& path,
+                const size_t size,
+                const int rounds,
+                Get get) {
+  double best = 0;
+  double total = 0;
+  for (int round = 0; round < rounds; round++) {
+    unlink(path.c_str());
+    const auto started = bench_clock::now();
+    const Status fetched = get();
+    const double seconds = std::chrono::duration<double>(bench_clock::now() - started).count();
+    if (!fetched) {
+      std::cerr << label << ": " << fetched.message << std::endl;
+      return;
+    }
+    const double rate = size / seconds / 1e6;
+    best = std::max(best, rate);
+    total += rate;
+  }
+  std::cout << label << ": mean " << total / rounds << " MB/s, best " << best << " MB/s"
+            << std::endl;
+}
+
+
+int main(int args, char** argv) {
+  if (args < 2) {
+    std::cerr << "Usage: " << argv[0] << " <output directory> [MiB] [rounds] [Gbit/s]" << std::endl;
+    return EXIT_FAILURE;
+  }
+  const std::string out_dir{argv[1]};
+  const size_t size = (args > 2 ? std::stoul(argv[2]) : 512) << 20;
+  const int rounds = args > 3 ? std::stoi(argv[3]) : 5;
+  const double gbits = args > 4 ? std::stod(argv[4]) : 10;
+  const double bytes_per_second = gbits * 1e9 / 8;
+
+  const std::string body(size, 'x');
+  http::Server server{[&](const http::Request&, http::Connection& connection) {
+    connection.send_head(200, {{"Content-Length", std::to_string(size)}});
+    const size_t chunk = 1 << 20;
+    const auto started = bench_clock::now();
+    for (size_t sent = 0; sent < size; sent += chunk) {
+      if (!connection.write(body.data() + sent, std::min(chunk, size - sent))) return;
+      const auto due = started + std::chrono::duration_cast<bench_clock::duration>(
+          std::chrono::duration<double>((sent + chunk) / bytes_per_second));
+      std::this_thread::sleep_until(due);
+    }
+  }};
+  const auto port = server.listen();
+  if (!port) {
+    std::cerr << port.failure_reason() << std::endl;
+    return EXIT_FAILURE;
+  }
+  const URI uri = "http://127.0.0.1:" + std::to_string(*port) + "/image.aci";
+  const Path path = out_dir + "/bench-download.aci";
+
+  std::cout << size / (1 << 20) << " MiB at " << gbits << " Gbit/s (link limit "
+            << bytes_per_second / 1e6 << " MB/s), " << rounds << " rounds" << std::endl;
+  run("stdio, in place", path, size, rounds, [&]() { return stdio_get(uri, path); });
+  run("staged", path, size, rounds, [&]() { return https::get(uri, path); });
+  run("staged, drop cache", path, size, rounds, [&]() {
+    return https::get(uri, path, {}, appc::os::StagedFile::Options(1 << 20, true));
+  });
+  unlink(path.c_str());
+
+  return EXIT_SUCCESS;
+}
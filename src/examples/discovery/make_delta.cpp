@@ -0,0 +1,42 @@
+#include <iostream>
+
+#include <sys/stat.h>
+
+#include "appc/discovery/delta.h"
+#include "appc/discovery/verify.h"
+
+
+using namespace appc::discovery;
+
+
+static long long file_size(const std::string& path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 ? info.st_size : -1;
+}
+
+
+int main(int args, char** argv) {
+  if (args < 4) {
+    std::cerr << "Usage: " << argv[0] << " <previous ACI> <new ACI> <output delta>" << std::endl;
+    std::cerr << "  e.g. " << argv[0] << " worker-1.0.0-linux-amd64.aci "
+              << "worker-1.1.0-linux-amd64.aci "
+              << "worker-1.1.0-linux-amd64.aci.from-1.0.0.delta" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const std::string base_path{argv[1]};
+  const std::string target_path{argv[2]};
+  const std::string delta_path{argv[3]};
+
+  // Neither image is held in memory: the base is decompressed to a scratch file and mapped.
+  const auto created = delta::create_file(base_path, target_path, delta_path);
+  if (!created) {
+    std::cerr << "Could not create " << delta_path << ": " << created.message << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cerr << target_path << ": " << file_size(target_path) << " bytes, delta "
+            << file_size(delta_path) << " bytes" << std::endl;
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,353 @@
+#include <algorithm>
+#include <archive.h>
+#include <archive_entry.h>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "3rdparty/nlohmann/json.h"
+
+#include "appc/image/image.h"
+#include "appc/os/fs.h"
+
+
+using namespace appc::image;
+using Json = nlohmann::json;
+using bench_clock = std::chrono::steady_clock;
+
+
+// Generates synthetic ACIs and times Image's passes over them: file_list, validate_structure,
+// manifest and extract_rootfs_to. Each measurement runs in a child process so that its peak RSS
+// and syscall counts are its own. Results can be written as a JSON baseline.
+
+
+struct Options {
+  std::string dir{"/dev/shm"};
+  size_t files{2000};
+  size_t size{16 * 1024};
+  // fixed, uniform (0 to twice size) or exponential (mean size: mostly small files, a few large).
+  std::string distribution{"exponential"};
+  int depth{3};
+  std::vector<std::string> compressions{"none", "gzip"};
+  // first or last.
+  std::string manifest{"first"};
+  int rounds{5};
+  uint32_t seed{1};
+  std::string json{};
+};
+
+
+static std::vector<std::string> split(const std::string& list) {
+  std::vector<std::string> parts{};
+  std::stringstream stream{list};
+  for (std::string part; std::getline(stream, part, ',');) parts.push_back(part);
+  return parts;
+}
+
+
+static bool parse_options(int args, char** argv, Options& options) {
+  for (int i = 1; i < args; i++) {
+    const std::string arg{argv[i]};
+    const auto equals = arg.find('=');
+    const std::string key = arg.substr(0, equals);
+    const std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+    if (key == "--dir") options.dir = value;
+    else if (key == "--files") options.files = std::stoul(value);
+    else if (key == "--size") options.size = std::stoul(value);
+    else if (key == "--distribution") options.distribution = value;
+    else if (key == "--depth") options.depth = std::max(0, std::stoi(value));
+    else if (key == "--compression") options.compressions = split(value);
+    else if (key == "--manifest") options.manifest = value;
+    else if (key == "--rounds") options.rounds = std::max(1, std::stoi(value));
+    else if (key == "--seed") options.seed = std::stoul(value);
+    else if (key == "--json") options.json = value;
+    else return false;
+  }
+  return options.distribution == "fixed" || options.distribution == "uniform" ||
+         options.distribution == "exponential";
+}
+
+
+static int add_filter(struct archive* archive, const std::string& compression) {
+  if (compression == "none") return archive_write_add_filter_none(archive);
+  if (compression == "gzip") return archive_write_add_filter_gzip(archive);
+  if (compression == "bzip2") return archive_write_add_filter_bzip2(archive);
+  if (compression == "xz") return archive_write_add_filter_xz(archive);
+#ifdef ARCHIVE_FILTER_ZSTD
+  if (compression == "zstd") return archive_write_add_filter_zstd(archive);
+#endif
+  return ARCHIVE_FATAL;
+}
+
+
+// zstd needs libarchive 3.3.3 or later.
+static bool supported(const std::string& compression) {
+  std::unique_ptr<struct archive, decltype(&archive_write_free)> archive{
+      archive_write_new(), archive_write_free};
+  return add_filter(archive.get(), compression) == ARCHIVE_OK;
+}
+
+
+// About half compressible: random 4KiB blocks alternate with runs of repeated text.
+static std::string file_contents(const size_t size, std::mt19937_64& random) {
+  static const std::string text{"lib/x86_64-linux-gnu/libc.so.6 GLIBC_2.17 "};
+  std::string contents(size, '\0');
+  for (size_t offset = 0; offset < size; offset += 4096) {
+    const size_t length = std::min<size_t>(4096, size - offset);
+    if ((offset / 4096) % 2 == 0) {
+      for (size_t i = 0; i < length; i++) contents[offset + i] = static_cast<char>(random());
+    } else {
+      for (size_t i = 0; i < length; i++) contents[offset + i] = text[i % text.length()];
+    }
+  }
+  return contents;
+}
+
+
+static std::string directory_for(size_t file, const int depth) {
+  std::string path{"rootfs"};
+  for (int level = 0; level < depth; level++) {
+    path += "/d" + std::to_string(file % 4);
+    file /= 4;
+  }
+  return path;
+}
+
+
+struct Generated {
+  std::string path;
+  uint64_t file_bytes;
+  uint64_t entries;
+  uint64_t image_bytes;
+};
+
+
+static Try<Generated> generate(const Options& options, const std::string& compression) {
+  const std::string path = options.dir + "/bench-image-" + compression + ".aci";
+  std::unique_ptr<struct archive, decltype(&archive_write_free)> archive{
+      archive_write_new(), archive_write_free};
+  archive_write_set_format_pax_restricted(archive.get());
+  add_filter(archive.get(), compression);
+  if (archive_write_open_filename(archive.get(), path.c_str()) != ARCHIVE_OK) {
+    return Failure<Generated>(archive_error_string(archive.get()));
+  }
+
+  Generated generated{path, 0, 0, 0};
+  const auto write_entry = [&](const std::string& name, const mode_t type, const std::string& data) {
+    std::unique_ptr<struct archive_entry, decltype(&archive_entry_free)> entry{
+        archive_entry_new(), archive_entry_free};
+    archive_entry_set_pathname(entry.get(), name.c_str());
+    archive_entry_set_filetype(entry.get(), type);
+    archive_entry_set_perm(entry.get(), type == AE_IFDIR ? 0755 : 0644);
+    archive_entry_set_size(entry.get(), data.length());
+    archive_write_header(archive.get(), entry.get());
+    if (!data.empty()) archive_write_data(archive.get(), data.data(), data.length());
+    generated.entries++;
+  };
+  const std::string manifest{
+      "{\"acKind\":\"ImageManifest\",\"acVersion\":\"0.5.1\",\"name\":\"example.com/bench\"}"};
+
+  if (options.manifest == "first") write_entry("manifest", AE_IFREG, manifest);
+  std::set<std::string> directories{"rootfs"};
+  for (size_t file = 0; file < std::min<size_t>(options.files, 1 << options.depth * 2); file++) {
+    const std::string directory = directory_for(file, options.depth);
+    for (size_t slash = directory.find('/'); ; slash = directory.find('/', slash + 1)) {
+      directories.insert(directory.substr(0, slash));
+      if (slash == std::string::npos) break;
+    }
+  }
+  for (const auto& directory : directories) write_entry(directory, AE_IFDIR, "");
+
+  std::mt19937_64 random{options.seed};
+  std::exponential_distribution<double> exponential{1.0 / options.size};
+  std::uniform_int_distribution<size_t> uniform{0, 2 * options.size};
+  for (size_t file = 0; file < options.files; file++) {
+    const size_t size = options.distribution == "fixed" ? options.size
+                      : options.distribution == "uniform" ? uniform(random)
+                      : static_cast<size_t>(exponential(random));
+    write_entry(directory_for(file, options.depth) + "/f" + std::to_string(file), AE_IFREG,
+                file_contents(size, random));
+    generated.file_bytes += size;
+  }
+  if (options.manifest != "first") write_entry("manifest", AE_IFREG, manifest);
+
+  if (archive_write_close(archive.get()) != ARCHIVE_OK) {
+    return Failure<Generated>(archive_error_string(archive.get()));
+  }
+  struct stat info{};
+  stat(path.c_str(), &info);
+  generated.image_bytes = info.st_size;
+  return Result(generated);
+}
+
+
+struct Syscalls {
+  uint64_t reads;
+  uint64_t writes;
+};
+
+
+// Read and write syscalls (including the pread/pwrite/readv/writev families) made so far.
+static Syscalls syscalls() {
+  std::ifstream io{"/proc/self/io"};
+  Syscalls counts{0, 0};
+  for (std::string key; io >> key;) {
+    uint64_t value = 0;
+    io >> value;
+    if (key == "syscr:") counts.reads = value;
+    if (key == "syscw:") counts.writes = value;
+  }
+  return counts;
+}
+
+
+struct Measurement {
+  bool ok;
+  double seconds;
+  uint64_t reads;
+  uint64_t writes;
+  long peak_rss_kib;
+};
+
+
+// Runs one pass in a child process.
+static Measurement measure(const std::string& operation, const Generated& generated,
+                           const std::string& scratch) {
+  int pipe_fds[2];
+  if (pipe(pipe_fds) != 0) return Measurement{false, 0, 0, 0, 0};
+  const pid_t child = fork();
+  if (child == 0) {
+    close(pipe_fds[0]);
+    Image image{generated.path};
+    const Syscalls before = syscalls();
+    const auto started = bench_clock::now();
+    bool ok = false;
+    if (operation == "file_list") ok = static_cast<bool>(image.file_list());
+    else if (operation == "validate_structure") ok = static_cast<bool>(image.validate_structure());
+    else if (operation == "manifest") ok = static_cast<bool>(image.manifest());
+    else if (operation == "extract_rootfs_to") ok = static_cast<bool>(image.extract_rootfs_to(scratch));
+    Measurement measured{ok,
+                         std::chrono::duration<double>(bench_clock::now() - started).count(),
+                         0, 0, 0};
+    const Syscalls after = syscalls();
+    measured.reads = after.reads - before.reads;
+    measured.writes = after.writes - before.writes;
+    if (write(pipe_fds[1], &measured, sizeof(measured)) != sizeof(measured)) _exit(1);
+    if (operation == "extract_rootfs_to") appc::os::remove_tree(scratch);
+    _exit(0);
+  }
+  close(pipe_fds[1]);
+  Measurement measured{false, 0, 0, 0, 0};
+  if (read(pipe_fds[0], &measured, sizeof(measured)) != sizeof(measured)) measured.ok = false;
+  close(pipe_fds[0]);
+  int status = 0;
+  struct rusage usage{};
+  wait4(child, &status, 0, &usage);
+  measured.peak_rss_kib = usage.ru_maxrss;
+  return measured;
+}
+
+
+int main(int args, char** argv) {
+  Options options{};
+  if (!parse_options(args, argv, options)) {
+    std::cerr << "Usage: " << argv[0] << " [--dir=PATH] [--files=N] [--size=BYTES]"
+              << " [--distribution=fixed|uniform|exponential] [--depth=N]"
+              << " [--compression=none,gzip,bzip2,xz,zstd] [--manifest=first|last]"
+              << " [--rounds=N] [--seed=N] [--json=PATH]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const std::vector<std::string> operations{"file_list", "validate_structure", "manifest",
+                                            "extract_rootfs_to"};
+  Json results = Json::array();
+  bool failed = false;
+  for (const auto& compression : options.compressions) {
+    if (!supported(compression)) {
+      std::cout << compression << ": not supported by this libarchive, skipped" << std::endl;
+      continue;
+    }
+    const auto generated = generate(options, compression);
+    if (!generated) {
+      std::cerr << compression << ": " << generated.failure_reason() << std::endl;
+      failed = true;
+      continue;
+    }
+    std::cout << compression << ": " << generated->entries << " entries, "
+              << generated->file_bytes / 1e6 << " MB of files in a "
+              << generated->image_bytes / 1e6 << " MB image" << std::endl;
+    const std::string scratch = options.dir + "/bench-image-rootfs";
+    for (const auto& operation : operations) {
+      double best = 0;
+      double total = 0;
+      Measurement worst{true, 0, 0, 0, 0};
+      for (int round = 0; round < options.rounds; round++) {
+        const auto measured = measure(operation, *generated, scratch);
+        if (!measured.ok) {
+          std::cerr << compression << " " << operation << " failed" << std::endl;
+          failed = true;
+          break;
+        }
+        best = round == 0 ? measured.seconds : std::min(best, measured.seconds);
+        total += measured.seconds;
+        worst.reads = std::max(worst.reads, measured.reads);
+        worst.writes = std::max(worst.writes, measured.writes);
+        worst.peak_rss_kib = std::max(worst.peak_rss_kib, measured.peak_rss_kib);
+      }
+      const double mean = total / options.rounds;
+      const double mb_per_second = generated->file_bytes / best / 1e6;
+      const double entries_per_second = generated->entries / best;
+      printf("  %-20s best %9.3f ms  mean %9.3f ms  %9.1f MB/s  %11.0f entries/s  "
+             "rss %7ld KiB  syscalls %llu r / %llu w\n",
+             operation.c_str(), best * 1e3, mean * 1e3, mb_per_second, entries_per_second,
+             worst.peak_rss_kib, static_cast<unsigned long long>(worst.reads),
+             static_cast<unsigned long long>(worst.writes));
+      fflush(stdout);
+
+      Json result = Json::object();
+      result["compression"] = compression;
+      result["operation"] = operation;
+      result["best_ms"] = best * 1e3;
+      result["mean_ms"] = mean * 1e3;
+      result["mb_per_second"] = mb_per_second;
+      result["entries_per_second"] = entries_per_second;
+      result["peak_rss_kib"] = static_cast<int64_t>(worst.peak_rss_kib);
+      result["read_syscalls"] = static_cast<int64_t>(worst.reads);
+      result["write_syscalls"] = static_cast<int64_t>(worst.writes);
+      results.push_back(result);
+    }
+    unlink(generated->path.c_str());
+  }
+
+  if (!options.json.empty()) {
+    Json config = Json::object();
+    config["files"] = static_cast<int64_t>(options.files);
+    config["size"] = static_cast<int64_t>(options.size);
+    config["distribution"] = options.distribution;
+    config["depth"] = options.depth;
+    config["manifest"] = options.manifest;
+    config["rounds"] = options.rounds;
+    config["seed"] = static_cast<int64_t>(options.seed);
+    Json baseline = Json::object();
+    baseline["benchmark"] = "bench-image";
+    baseline["config"] = config;
+    baseline["results"] = results;
+    std::ofstream out{options.json};
+    out << baseline.dump(2) << std::endl;
+    if (!out) {
+      std::cerr << "Could not write " << options.json << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
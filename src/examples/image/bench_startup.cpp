@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <archive.h>
+#include <archive_entry.h>
+#include <cstring>
+#include <ctime>
+#include <elf.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "3rdparty/nlohmann/json.h"
+
+
+using Json = nlohmann::json;
+
+
+// Compares builds of first_parse (header-only, and linked statically and dynamically against
+// libappc): the size of each binary and its code, and the time from exec to the end of its first
+// manifest parse. Binaries are run in turn each round so that drift affects them alike. With
+// --drop-caches (root only) the page cache is dropped before every run, for a cold start.
+
+
+struct Options {
+  std::string dir{"/dev/shm"};
+  int rounds{20};
+  bool drop_caches{false};
+  std::string library{};
+  std::string json{};
+  std::vector<std::string> binaries{};
+};
+
+
+static bool parse_options(int args, char** argv, Options& options) {
+  for (int i = 1; i < args; i++) {
+    const std::string arg{argv[i]};
+    const auto equals = arg.find('=');
+    const std::string key = arg.substr(0, equals);
+    const std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+    if (key == "--dir") options.dir = value;
+    else if (key == "--rounds") options.rounds = std::max(1, std::stoi(value));
+    else if (key == "--drop-caches") options.drop_caches = true;
+    else if (key == "--library") options.library = value;
+    else if (key == "--json") options.json = value;
+    else if (arg.compare(0, 2, "--") == 0) return false;
+    else options.binaries.push_back(arg);
+  }
+  return !options.binaries.empty();
+}
+
+
+static bool write_image(const std::string& path) {
+  std::unique_ptr<struct archive, decltype(&archive_write_free)> archive{
+      archive_write_new(), archive_write_free};
+  archive_write_set_format_pax_restricted(archive.get());
+  archive_write_add_filter_gzip(archive.get());
+  if (archive_write_open_filename(archive.get(), path.c_str()) != ARCHIVE_OK) return false;
+  const auto write_entry = [&](const std::string& name, const mode_t type, const std::string& data) {
+    std::unique_ptr<struct archive_entry, decltype(&archive_entry_free)> entry{
+        archive_entry_new(), archive_entry_free};
+    archive_entry_set_pathname(entry.get(), name.c_str());
+    archive_entry_set_filetype(entry.get(), type);
+    archive_entry_set_perm(entry.get(), type == AE_IFDIR ? 0755 : 0644);
+    archive_entry_set_size(entry.get(), data.length());
+    archive_write_header(archive.get(), entry.get());
+    if (!data.empty()) archive_write_data(archive.get(), data.data(), data.length());
+  };
+  write_entry("manifest", AE_IFREG, R"json({
+    "acKind": "ImageManifest",
+    "acVersion": "0.5.1",
+    "name": "example.com/startup",
+    "labels": [
+      {"name": "version", "value": "1.0.0"},
+      {"name": "os", "value": "linux"},
+      {"name": "arch", "value": "amd64"}
+    ],
+    "app": {
+      "exec": ["/bin/worker", "--serve"],
+      "user": "100",
+      "group": "300",
+      "environment": [{"name": "PATH", "value": "/bin"}]
+    },
+    "annotations": [{"name": "authors", "value": "someone@example.com"}]
+  })json");
+  write_entry("rootfs", AE_IFDIR, "");
+  write_entry("rootfs/bin", AE_IFDIR, "");
+  write_entry("rootfs/bin/worker", AE_IFREG, std::string(64 * 1024, 'x'));
+  return archive_write_close(archive.get()) == ARCHIVE_OK;
+}
+
+
+struct Sizes {
+  uint64_t file;
+  uint64_t code;
+};
+
+
+// The file and its executable sections.
+static Sizes sizes(const std::string& path) {
+  Sizes result{0, 0};
+  std::ifstream in{path, std::ios::binary};
+  const std::string contents{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+  result.file = contents.size();
+  if (contents.size() < sizeof(Elf64_Ehdr) || contents.compare(0, SELFMAG, ELFMAG) != 0 ||
+      contents[EI_CLASS] != ELFCLASS64) {
+    return result;
+  }
+  Elf64_Ehdr header;
+  memcpy(&header, contents.data(), sizeof(header));
+  for (unsigned i = 0; i < header.e_shnum; i++) {
+    const uint64_t offset = header.e_shoff + i * static_cast<uint64_t>(header.e_shentsize);
+    if (offset + sizeof(Elf64_Shdr) > contents.size()) break;
+    Elf64_Shdr section;
+    memcpy(&section, contents.data() + offset, sizeof(section));
+    if (section.sh_flags & SHF_EXECINSTR) result.code += section.sh_size;
+  }
+  return result;
+}
+
+
+static int64_t monotonic_nanoseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000LL + now.tv_nsec;
+}
+
+
+// Nanoseconds from fork to the end of the first parse, -1 on failure.
+static int64_t run(const std::string& binary, const std::string& image) {
+  int pipe_fds[2];
+  if (pipe(pipe_fds) != 0) return -1;
+  const int64_t started = monotonic_nanoseconds();
+  const pid_t child = fork();
+  if (child == 0) {
+    close(pipe_fds[0]);
+    dup2(pipe_fds[1], STDOUT_FILENO);
+    execl(binary.c_str(), binary.c_str(), image.c_str(), static_cast<char*>(nullptr));
+    _exit(127);
+  }
+  close(pipe_fds[1]);
+  std::string output{};
+  char buffer[64];
+  for (ssize_t n; (n = read(pipe_fds[0], buffer, sizeof(buffer))) > 0;) output.append(buffer, n);
+  close(pipe_fds[0]);
+  int status = 0;
+  waitpid(child, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || output.empty()) return -1;
+  return std::stoll(output) - started;
+}
+
+
+static bool drop_caches() {
+  sync();
+  std::ofstream out{"/proc/sys/vm/drop_caches"};
+  out << "3" << std::endl;
+  return static_cast<bool>(out);
+}
+
+
+static double median(std::vector<int64_t> values) {
+  std::sort(values.begin(), values.end());
+  const size_t middle = values.size() / 2;
+  return values.size() % 2 ? values[middle] : (values[middle - 1] + values[middle]) / 2.0;
+}
+
+
+int main(int args, char** argv) {
+  Options options{};
+  if (!parse_options(args, argv, options)) {
+    std::cerr << "Usage: " << argv[0] << " [--dir=PATH] [--rounds=N] [--drop-caches]"
+              << " [--library=libappc.so] [--json=PATH] <first_parse binary>..." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const std::string image = options.dir + "/bench-startup.aci";
+  if (!write_image(image)) {
+    std::cerr << "Could not write " << image << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  bool cold = options.drop_caches;
+  std::vector<std::vector<int64_t>> times(options.binaries.size());
+  for (int round = 0; round < options.rounds; round++) {
+    for (size_t i = 0; i < options.binaries.size(); i++) {
+      if (cold && !drop_caches()) {
+        std::cerr << "Could not drop the page cache (needs root), timing warm starts" << std::endl;
+        cold = false;
+      }
+      const int64_t nanoseconds = run(options.binaries[i], image);
+      if (nanoseconds < 0) {
+        std::cerr << options.binaries[i] << " failed" << std::endl;
+        unlink(image.c_str());
+        return EXIT_FAILURE;
+      }
+      times[i].push_back(nanoseconds);
+    }
+  }
+  unlink(image.c_str());
+
+  std::cout << options.rounds << (cold ? " cold" : " warm") << " starts each" << std::endl;
+  Json results = Json::array();
+  for (size_t i = 0; i < options.binaries.size(); i++) {
+    const Sizes size = sizes(options.binaries[i]);
+    const double best = *std::min_element(times[i].begin(), times[i].end()) / 1e6;
+    const double middle = median(times[i]) / 1e6;
+    printf("  %-40s file %9llu B  code %9llu B  first parse: median %7.3f ms  best %7.3f ms\n",
+           options.binaries[i].c_str(), static_cast<unsigned long long>(size.file),
+           static_cast<unsigned long long>(size.code), middle, best);
+    Json result = Json::object();
+    result["binary"] = options.binaries[i];
+    result["file_bytes"] = static_cast<int64_t>(size.file);
+    result["code_bytes"] = static_cast<int64_t>(size.code);
+    result["median_ms"] = middle;
+    result["best_ms"] = best;
+    results.push_back(result);
+  }
+  if (!options.library.empty()) {
+    const Sizes size = sizes(options.library);
+    printf("  %-40s file %9llu B  code %9llu B  (loaded by the shared build)\n",
+           options.library.c_str(), static_cast<unsigned long long>(size.file),
+           static_cast<unsigned long long>(size.code));
+  }
+
+  if (!options.json.empty()) {
+    Json report = Json::object();
+    report["benchmark"] = "bench-startup";
+    report["rounds"] = options.rounds;
+    report["cold"] = cold;
+    report["results"] = results;
+    std::ofstream out{options.json};
+    out << report.dump(2) << std::endl;
+    if (!out) {
+      std::cerr << "Could not write " << options.json << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,56 @@
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <string>
+
+#include "3rdparty/nlohmann/json.h"
+
+#include "appc/image/image.h"
+#include "appc/schema/image.h"
+
+
+using namespace appc;
+using Json = nlohmann::json;
+
+
+// What an agent does first: read an image's manifest, parse it and validate it. Prints the
+// CLOCK_MONOTONIC time in nanoseconds once done, for bench_startup. Built header-only
+// (first_parse) and against libappc (first_parse_static, first_parse_shared).
+
+
+int main(int args, char** argv) {
+  if (args < 2) {
+    std::cerr << "Usage: " << argv[0] << " <App Container Image>" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  image::Image image{argv[1]};
+  const auto manifest = image.manifest();
+  if (!manifest) {
+    std::cerr << "Could not get manifest: " << manifest.failure_reason() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  Json json;
+  try {
+    json = Json::parse(from_result(manifest));
+  } catch (const std::invalid_argument& err) {
+    std::cerr << err.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  const auto parsed = schema::ImageManifest::from_json(json);
+  if (!parsed) {
+    std::cerr << parsed.failure_reason() << std::endl;
+    return EXIT_FAILURE;
+  }
+  const auto valid = parsed->validate();
+  if (!valid) {
+    std::cerr << valid.message << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  printf("%lld\n", static_cast<long long>(now.tv_sec) * 1000000000LL + now.tv_nsec);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,88 @@
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+#include "appc/os/fs.h"
+#include "appc/os/mkdir.h"
+
+
+using bench_clock = std::chrono::steady_clock;
+
+
+// Times directory creation for a bulk fetch (one mkdir -p per image, as the fetchers do) and the
+// removal of an image-sized tree, shelling out versus the native appc::os calls.
+
+
+template<typename Body>
+static double time_seconds(Body body) {
+  const auto started = bench_clock::now();
+  body();
+  return std::chrono::duration<double>(bench_clock::now() - started).count();
+}
+
+
+static std::string image_dir(const std::string& root, const int image) {
+  return root + "/example" + std::to_string(image % 50) + ".com/images/" + std::to_string(image);
+}
+
+
+static void make_tree(const std::string& root, const int dirs, const int files_per_dir) {
+  for (int d = 0; d < dirs; d++) {
+    const std::string dir = root + "/d" + std::to_string(d % 16) + "/sub" + std::to_string(d);
+    appc::os::mkdir(dir, 0755, true);
+    for (int f = 0; f < files_per_dir; f++) {
+      std::ofstream{dir + "/f" + std::to_string(f)} << "x";
+    }
+  }
+}
+
+
+static void report(const std::string& label, const double seconds, const int operations) {
+  std::cout << label << ": " << seconds * 1e3 << " ms, "
+            << seconds * 1e6 / operations << " us/op" << std::endl;
+}
+
+
+int main(int args, char** argv) {
+  if (args < 2) {
+    std::cerr << "Usage: " << argv[0] << " <scratch directory> [images] [tree dirs]" << std::endl;
+    return EXIT_FAILURE;
+  }
+  const std::string scratch{argv[1]};
+  const int images = args > 2 ? std::stoi(argv[2]) : 2000;
+  const int tree_dirs = args > 3 ? std::stoi(argv[3]) : 2000;
+
+  const std::string shell_root = scratch + "/bench-shell";
+  const std::string native_root = scratch + "/bench-native";
+  appc::os::remove_tree(shell_root);
+  appc::os::remove_tree(native_root);
+
+  std::cout << images << " images, one mkdir -p each" << std::endl;
+  report("system(\"mkdir -p\")", time_seconds([&]() {
+    for (int i = 0; i < images; i++) {
+      const std::string command = "mkdir -p -- '" + image_dir(shell_root, i) + "'";
+      if (system(command.c_str()) != 0) std::cerr << "failed: " << command << std::endl;
+    }
+  }), images);
+  report("os::mkdir, new directories", time_seconds([&]() {
+    for (int i = 0; i < images; i++) appc::os::mkdir(image_dir(native_root, i), 0755, true);
+  }), images);
+  report("os::mkdir, existing directories", time_seconds([&]() {
+    for (int i = 0; i < images; i++) appc::os::mkdir(image_dir(native_root, i), 0755, true);
+  }), images);
+
+  make_tree(shell_root, tree_dirs, 8);
+  make_tree(native_root, tree_dirs, 8);
+  const int entries = tree_dirs * 9;
+  std::cout << "Removing trees of " << entries << " entries" << std::endl;
+  report("system(\"rm -rf\")", time_seconds([&]() {
+    system(("rm -rf -- '" + shell_root + "'").c_str());
+  }), entries);
+  report("os::remove_tree", time_seconds([&]() {
+    const auto removed = appc::os::remove_tree(native_root);
+    if (!removed) std::cerr << removed.message << std::endl;
+  }), entries);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,216 @@
+// Copyright 2015 Charles D. Aylward
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A (possibly updated) copy of of this software is available at
+// https://github.com/cdaylward/libappc
+
+
+// libappc-profile.so: counts allocations and syscalls per thread for APPC_PROFILE_SCOPE (see
+// appc/util/profile.h). Meant to be preloaded, so that it sees the calls of the library, libarchive
+// and libcurl alike.
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "appc/util/profile.h"
+
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* pointer);
+}
+
+
+namespace {
+
+
+// Initial-exec so that reaching it never allocates (malloc may be called before the thread's
+// dynamic TLS exists).
+__thread appc_profile_counters counters __attribute__((tls_model("initial-exec"))) = {0, 0, 0, 0};
+
+
+inline void allocated(const size_t size) {
+  counters.allocations++;
+  counters.bytes_allocated += size;
+}
+
+
+template<typename Function>
+Function next(const char* name) {
+  return reinterpret_cast<Function>(dlsym(RTLD_NEXT, name));
+}
+
+
+} // namespace
+
+
+extern "C" {
+
+
+void appc_profile_read(struct appc_profile_counters* out) {
+  *out = counters;
+}
+
+
+void* malloc(size_t size) noexcept {
+  allocated(size);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) noexcept {
+  allocated(count * size);
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) noexcept {
+  if (pointer != nullptr) counters.frees++;
+  if (size > 0) allocated(size);
+  return __libc_realloc(pointer, size);
+}
+
+void free(void* pointer) noexcept {
+  if (pointer != nullptr) counters.frees++;
+  __libc_free(pointer);
+}
+
+void* memalign(size_t alignment, size_t size) noexcept {
+  allocated(size);
+  return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) noexcept {
+  allocated(size);
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** pointer, size_t alignment, size_t size) noexcept {
+  if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) return EINVAL;
+  allocated(size);
+  *pointer = __libc_memalign(alignment, size);
+  return *pointer != nullptr ? 0 : ENOMEM;
+}
+
+
+// Counts the call and forwards it to the next definition (libc's).
+#define APPC_PROFILE_SYSCALL(result, name, parameters, arguments, ...) \
+  result name parameters __VA_ARGS__ { \
+    counters.syscalls++; \
+    static const auto forward = next<result (*) parameters>(#name); \
+    return forward arguments; \
+  }
+
+// open and openat take a mode only with O_CREAT or O_TMPFILE.
+#define APPC_PROFILE_OPEN(name, parameters, arguments) \
+  int name parameters { \
+    mode_t mode = 0; \
+    if ((flags & O_CREAT) != 0 || (flags & O_TMPFILE) == O_TMPFILE) { \
+      va_list rest; \
+      va_start(rest, flags); \
+      mode = va_arg(rest, mode_t); \
+      va_end(rest); \
+    } \
+    counters.syscalls++; \
+    static const auto forward = next<int (*)(...)>(#name); \
+    return forward arguments; \
+  }
+
+APPC_PROFILE_OPEN(open, (const char* path, int flags, ...), (path, flags, mode))
+APPC_PROFILE_OPEN(open64, (const char* path, int flags, ...), (path, flags, mode))
+APPC_PROFILE_OPEN(openat, (int dir, const char* path, int flags, ...), (dir, path, flags, mode))
+APPC_PROFILE_OPEN(openat64, (int dir, const char* path, int flags, ...), (dir, path, flags, mode))
+
+APPC_PROFILE_SYSCALL(int, close, (int fd), (fd))
+APPC_PROFILE_SYSCALL(ssize_t, read, (int fd, void* buffer, size_t size), (fd, buffer, size))
+APPC_PROFILE_SYSCALL(ssize_t, write, (int fd, const void* buffer, size_t size), (fd, buffer, size))
+APPC_PROFILE_SYSCALL(ssize_t, pread, (int fd, void* buffer, size_t size, off_t offset),
+                     (fd, buffer, size, offset))
+APPC_PROFILE_SYSCALL(ssize_t, pread64, (int fd, void* buffer, size_t size, off64_t offset),
+                     (fd, buffer, size, offset))
+APPC_PROFILE_SYSCALL(ssize_t, pwrite, (int fd, const void* buffer, size_t size, off_t offset),
+                     (fd, buffer, size, offset))
+APPC_PROFILE_SYSCALL(ssize_t, pwrite64, (int fd, const void* buffer, size_t size, off64_t offset),
+                     (fd, buffer, size, offset))
+APPC_PROFILE_SYSCALL(ssize_t, readv, (int fd, const struct iovec* vector, int count),
+                     (fd, vector, count))
+APPC_PROFILE_SYSCALL(ssize_t, writev, (int fd, const struct iovec* vector, int count),
+                     (fd, vector, count))
+APPC_PROFILE_SYSCALL(off_t, lseek, (int fd, off_t offset, int whence), (fd, offset, whence),
+                     noexcept)
+APPC_PROFILE_SYSCALL(off64_t, lseek64, (int fd, off64_t offset, int whence), (fd, offset, whence),
+                     noexcept)
+APPC_PROFILE_SYSCALL(int, stat, (const char* path, struct stat* buffer), (path, buffer), noexcept)
+APPC_PROFILE_SYSCALL(int, stat64, (const char* path, struct stat64* buffer), (path, buffer),
+                     noexcept)
+APPC_PROFILE_SYSCALL(int, lstat, (const char* path, struct stat* buffer), (path, buffer), noexcept)
+APPC_PROFILE_SYSCALL(int, lstat64, (const char* path, struct stat64* buffer), (path, buffer),
+                     noexcept)
+APPC_PROFILE_SYSCALL(int, fstat, (int fd, struct stat* buffer), (fd, buffer), noexcept)
+APPC_PROFILE_SYSCALL(int, fstat64, (int fd, struct stat64* buffer), (fd, buffer), noexcept)
+APPC_PROFILE_SYSCALL(int, fstatat, (int dir, const char* path, struct stat* buffer, int flags),
+                     (dir, path, buffer, flags), noexcept)
+APPC_PROFILE_SYSCALL(int, fstatat64, (int dir, const char* path, struct stat64* buffer, int flags),
+                     (dir, path, buffer, flags), noexcept)
+APPC_PROFILE_SYSCALL(int, access, (const char* path, int mode), (path, mode), noexcept)
+APPC_PROFILE_SYSCALL(int, mkdir, (const char* path, mode_t mode), (path, mode), noexcept)
+APPC_PROFILE_SYSCALL(int, rmdir, (const char* path), (path), noexcept)
+APPC_PROFILE_SYSCALL(int, unlink, (const char* path), (path), noexcept)
+APPC_PROFILE_SYSCALL(int, rename, (const char* from, const char* to), (from, to), noexcept)
+APPC_PROFILE_SYSCALL(int, symlink, (const char* target, const char* path), (target, path),
+                     noexcept)
+APPC_PROFILE_SYSCALL(int, link, (const char* target, const char* path), (target, path), noexcept)
+APPC_PROFILE_SYSCALL(int, linkat,
+                     (int from_dir, const char* from, int to_dir, const char* to, int flags),
+                     (from_dir, from, to_dir, to, flags), noexcept)
+APPC_PROFILE_SYSCALL(int, chmod, (const char* path, mode_t mode), (path, mode), noexcept)
+APPC_PROFILE_SYSCALL(int, fchmod, (int fd, mode_t mode), (fd, mode), noexcept)
+APPC_PROFILE_SYSCALL(int, fchown, (int fd, uid_t owner, gid_t group), (fd, owner, group),
+                     noexcept)
+APPC_PROFILE_SYSCALL(int, lchown, (const char* path, uid_t owner, gid_t group),
+                     (path, owner, group), noexcept)
+APPC_PROFILE_SYSCALL(int, futimens, (int fd, const struct timespec times[2]), (fd, times),
+                     noexcept)
+APPC_PROFILE_SYSCALL(int, utimensat,
+                     (int dir, const char* path, const struct timespec times[2], int flags),
+                     (dir, path, times, flags), noexcept)
+APPC_PROFILE_SYSCALL(int, ftruncate, (int fd, off_t size), (fd, size), noexcept)
+APPC_PROFILE_SYSCALL(int, fallocate, (int fd, int mode, off_t offset, off_t size),
+                     (fd, mode, offset, size))
+APPC_PROFILE_SYSCALL(int, posix_fadvise, (int fd, off_t offset, off_t size, int advice),
+                     (fd, offset, size, advice), noexcept)
+APPC_PROFILE_SYSCALL(int, fsync, (int fd), (fd))
+APPC_PROFILE_SYSCALL(int, fdatasync, (int fd), (fd))
+APPC_PROFILE_SYSCALL(int, socket, (int domain, int type, int protocol), (domain, type, protocol),
+                     noexcept)
+APPC_PROFILE_SYSCALL(int, connect, (int fd, const struct sockaddr* address, socklen_t size),
+                     (fd, address, size))
+APPC_PROFILE_SYSCALL(ssize_t, send, (int fd, const void* buffer, size_t size, int flags),
+                     (fd, buffer, size, flags))
+APPC_PROFILE_SYSCALL(ssize_t, recv, (int fd, void* buffer, size_t size, int flags),
+                     (fd, buffer, size, flags))
+APPC_PROFILE_SYSCALL(int, poll, (struct pollfd* fds, nfds_t count, int timeout),
+                     (fds, count, timeout))
+
+
+} // extern "C"
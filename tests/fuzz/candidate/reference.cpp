@@ -0,0 +1,59 @@
+#include "fuzz.h"
+
+#include "appc/image/image.h"
+
+
+// A candidate that is the reference itself: the smallest example of the hooks, and a check that a
+// differential build agrees with itself over the corpus. A real candidate defines only the hooks
+// for what it reimplements.
+
+
+namespace appc {
+namespace fuzz {
+namespace candidate {
+
+
+Try<schema::ImageManifest> image_manifest_from_json(const Json& json) {
+  return schema::ImageManifest::from_json(json);
+}
+
+
+Status image_manifest_validate(const schema::ImageManifest& manifest) {
+  return manifest.validate();
+}
+
+
+Try<schema::ContainerRuntimeManifest> container_runtime_manifest_from_json(const Json& json) {
+  return schema::ContainerRuntimeManifest::from_json(json);
+}
+
+
+Status container_runtime_manifest_validate(const schema::ContainerRuntimeManifest& manifest) {
+  return manifest.validate();
+}
+
+
+Try<std::vector<std::string>> image_file_list(const std::string& filename) {
+  return image::Image{filename}.file_list();
+}
+
+
+Status image_validate_structure(const std::string& filename) {
+  return image::Image{filename}.validate_structure();
+}
+
+
+Try<std::string> image_manifest(const std::string& filename) {
+  return image::Image{filename}.manifest();
+}
+
+
+// The schema types are covered by the manifests' hooks.
+Option<Status> validate(const std::string&, const Json&) {
+  return None<Status>();
+}
+
+
+} // namespace candidate
+} // namespace fuzz
+} // namespace appc
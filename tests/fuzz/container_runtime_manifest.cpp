@@ -0,0 +1,39 @@
+#include "fuzz.h"
+
+
+using namespace appc;
+using namespace appc::fuzz;
+
+
+// A container runtime manifest: ContainerRuntimeManifest::from_json and, on what it accepts,
+// validate() and a round trip through to_json.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  const auto json = parse_json(data, size);
+  if (!json) return 0;
+
+  const auto manifest = schema::ContainerRuntimeManifest::from_json(*json);
+  const auto render_manifest = [](const schema::ContainerRuntimeManifest& m) { return render(m); };
+  if (candidate::container_runtime_manifest_from_json) {
+    compare("ContainerRuntimeManifest::from_json",
+            outcome_of(manifest, render_manifest),
+            outcome_of(candidate::container_runtime_manifest_from_json(*json), render_manifest));
+  }
+  if (!manifest) return 0;
+
+  const auto valid = manifest->validate();
+  if (candidate::container_runtime_manifest_validate) {
+    compare("ContainerRuntimeManifest::validate",
+            outcome_of(valid),
+            outcome_of(candidate::container_runtime_manifest_validate(*manifest)));
+  }
+
+  // What to_json writes must read back as the same manifest.
+  const auto reparsed = schema::ContainerRuntimeManifest::from_json(
+      schema::ContainerRuntimeManifest::to_json(*manifest));
+  if (!reparsed || render(*reparsed) != render(*manifest)) {
+    fprintf(stderr, "ContainerRuntimeManifest does not survive to_json: %s\n",
+            reparsed ? render(*reparsed).c_str() : reparsed.failure_reason().c_str());
+    abort();
+  }
+  return 0;
+}
@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include "3rdparty/nlohmann/json.h"
+
+
+using Json = nlohmann::json;
+using bench_clock = std::chrono::steady_clock;
+
+
+// Stands in for libFuzzer's main where there is no libFuzzer (GCC builds, or plain test runs):
+// runs a fuzz target once over every input in the given files and directories, which is how the
+// checked-in corpus is replayed as a test. With --rounds, it then times the target over the whole
+// corpus, which makes the corpus a throughput workload for the code under the target.
+//
+//   fuzz-image-manifest-replay tests/fuzz/corpus/image_manifest
+//   fuzz-image-manifest-replay --rounds=200 --json=out.json tests/fuzz/corpus/image_manifest
+
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+
+struct Options {
+  int rounds{0};
+  std::string json{};
+  std::vector<std::string> paths{};
+};
+
+
+static bool parse_options(int args, char** argv, Options& options) {
+  for (int i = 1; i < args; i++) {
+    const std::string arg{argv[i]};
+    if (arg.compare(0, 2, "--") != 0) {
+      options.paths.push_back(arg);
+      continue;
+    }
+    const auto equals = arg.find('=');
+    const std::string key = arg.substr(0, equals);
+    const std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+    if (key == "--rounds") options.rounds = std::max(0, std::stoi(value));
+    else if (key == "--json") options.json = value;
+    else return false;
+  }
+  return !options.paths.empty();
+}
+
+
+// Files directly under path (sorted, so runs are repeatable), or path itself.
+static bool collect(const std::string& path, std::vector<std::string>& files) {
+  struct stat status;
+  if (stat(path.c_str(), &status) != 0) return false;
+  if (!S_ISDIR(status.st_mode)) {
+    files.push_back(path);
+    return true;
+  }
+  DIR* dir = opendir(path.c_str());
+  if (dir == nullptr) return false;
+  std::vector<std::string> found{};
+  for (struct dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+    const std::string name{entry->d_name};
+    if (name[0] == '.') continue;
+    const std::string file = path + "/" + name;
+    if (stat(file.c_str(), &status) == 0 && S_ISREG(status.st_mode)) found.push_back(file);
+  }
+  closedir(dir);
+  std::sort(found.begin(), found.end());
+  files.insert(files.end(), found.begin(), found.end());
+  return true;
+}
+
+
+int main(int args, char** argv) {
+  Options options{};
+  if (!parse_options(args, argv, options)) {
+    std::cerr << "Usage: " << argv[0] << " [--rounds=N] [--json=PATH] <file or directory>..."
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::vector<std::string> files{};
+  for (const auto& path : options.paths) {
+    if (!collect(path, files)) {
+      std::cerr << "Could not read " << path << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  std::vector<std::string> inputs{};
+  size_t bytes = 0;
+  for (const auto& file : files) {
+    std::ifstream in{file, std::ios::binary};
+    std::stringstream contents{};
+    contents << in.rdbuf();
+    if (!in) {
+      std::cerr << "Could not read " << file << std::endl;
+      return EXIT_FAILURE;
+    }
+    inputs.push_back(contents.str());
+    bytes += inputs.back().size();
+  }
+
+  // A crash, or a difference from the reference in a differential build, aborts here, after the
+  // name of the input.
+  for (size_t i = 0; i < inputs.size(); i++) {
+    std::cerr << "Running: " << files[i] << std::endl;
+    LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(inputs[i].data()), inputs[i].size());
+  }
+  std::cout << "Replayed " << inputs.size() << " inputs (" << bytes << " bytes)" << std::endl;
+  if (options.rounds == 0) return EXIT_SUCCESS;
+
+  double best = 0;
+  double total = 0;
+  for (int round = 0; round < options.rounds; round++) {
+    const auto started = bench_clock::now();
+    for (const auto& input : inputs) {
+      LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(input.data()), input.size());
+    }
+    const double seconds = std::chrono::duration<double>(bench_clock::now() - started).count();
+    best = round == 0 ? seconds : std::min(best, seconds);
+    total += seconds;
+  }
+  const double mean = total / options.rounds;
+  printf("%d rounds: best %9.3f ms  mean %9.3f ms  %11.0f inputs/s  %9.1f MB/s\n",
+         options.rounds, best * 1e3, mean * 1e3, inputs.size() / best, bytes / best / 1e6);
+
+  if (!options.json.empty()) {
+    Json result = Json::object();
+    result["benchmark"] = std::string{argv[0]}.substr(std::string{argv[0]}.rfind('/') + 1);
+    result["inputs"] = static_cast<int64_t>(inputs.size());
+    result["bytes"] = static_cast<int64_t>(bytes);
+    result["rounds"] = options.rounds;
+    result["best_seconds"] = best;
+    result["mean_seconds"] = mean;
+    result["inputs_per_second"] = inputs.size() / best;
+    result["bytes_per_second"] = bytes / best;
+    std::ofstream out{options.json};
+    out << result.dump(2) << std::endl;
+    if (!out) {
+      std::cerr << "Could not write " << options.json << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "appc/schema/container.h"
+#include "appc/schema/image.h"
+#include "appc/util/option.h"
+#include "appc/util/status.h"
+#include "appc/util/try.h"
+
+
+// Shared by the fuzz targets. Each target renders what the library made of an input as an
+// Outcome: whether it was accepted and what it was accepted as. Reasons for rejecting are kept for
+// the report but not compared, so a reimplementation may word its errors differently.
+//
+// Differential mode: link in a candidate that defines any of the hooks in appc::fuzz::candidate
+// (cmake -DAPPC_FUZZ_CANDIDATE=<sources>). Every input is then run through the reference and the
+// candidate, and a difference aborts with both outcomes, which the fuzzer reports and minimizes
+// like any other crash. Hooks the candidate leaves undefined are not compared.
+
+
+namespace appc {
+namespace fuzz {
+
+
+using Json = schema::Json;
+
+
+namespace candidate {
+
+
+// Each stands in for the library call of the same name (the image ones for Image's methods, on an
+// Image of filename).
+Try<schema::ImageManifest> image_manifest_from_json(const Json& json) __attribute__((weak));
+Status image_manifest_validate(const schema::ImageManifest& manifest) __attribute__((weak));
+Try<schema::ContainerRuntimeManifest>
+    container_runtime_manifest_from_json(const Json& json) __attribute__((weak));
+Status container_runtime_manifest_validate(
+    const schema::ContainerRuntimeManifest& manifest) __attribute__((weak));
+Try<std::vector<std::string>> image_file_list(const std::string& filename) __attribute__((weak));
+Status image_validate_structure(const std::string& filename) __attribute__((weak));
+Try<std::string> image_manifest(const std::string& filename) __attribute__((weak));
+
+// Parses json as the named schema type (AcKind, Labels, ...) and validates it, or returns None for
+// types the candidate does not reimplement.
+Option<Status> validate(const std::string& type, const Json& json) __attribute__((weak));
+
+
+} // namespace candidate
+
+
+struct Outcome {
+  bool accepted;
+  // What the input was accepted as, or why it was rejected.
+  std::string detail;
+};
+
+
+inline Outcome outcome_of(const Status& status) {
+  return Outcome{status.successful, status.message};
+}
+
+
+template<typename T, typename Render>
+Outcome outcome_of(const Try<T>& result, Render render) {
+  if (!result) return Outcome{false, result.failure_reason()};
+  return Outcome{true, render(*result)};
+}
+
+
+inline void compare(const std::string& call, const Outcome& reference, const Outcome& candidate) {
+  if (reference.accepted == candidate.accepted &&
+      (!reference.accepted || reference.detail == candidate.detail)) {
+    return;
+  }
+  fprintf(stderr, "%s: the candidate differs from the reference\n"
+                  "  reference: %s %s\n"
+                  "  candidate: %s %s\n",
+          call.c_str(),
+          reference.accepted ? "accepted" : "rejected", reference.detail.c_str(),
+          candidate.accepted ? "accepted" : "rejected", candidate.detail.c_str());
+  abort();
+}
+
+
+inline Try<Json> parse_json(const uint8_t* data, const size_t size) {
+  try {
+    return Result(Json::parse(std::string(reinterpret_cast<const char*>(data), size)));
+  }
+  catch (const std::exception& err) {
+    return Failure<Json>(err.what());
+  }
+}
+
+
+template<typename T>
+int64_t count(const Option<T>& array) {
+  return array ? array->array.size() : 0;
+}
+
+
+// ImageManifest has no to_json, so this covers what can be rendered: everything but the app's
+// event handlers, mount points and ports, and the dependencies' labels, which are counted.
+inline std::string render(const schema::ImageManifest& manifest) {
+  using namespace schema;
+  Json json = Json::object();
+  json["acKind"] = AcKind::to_json(manifest.ac_kind);
+  json["acVersion"] = AcVersion::to_json(manifest.ac_version);
+  json["name"] = AppName::to_json(manifest.name);
+  json["labels"] = to_json_if_some(manifest.labels);
+  json["pathWhitelist"] = to_json_if_some(manifest.path_whitelist);
+  json["annotations"] = to_json_if_some(manifest.annotations);
+  if (manifest.app) {
+    const App& app = *manifest.app;
+    Json app_json = Json::object();
+    app_json["exec"] = Exec::to_json(app.exec);
+    app_json["user"] = User::to_json(app.user);
+    app_json["group"] = Group::to_json(app.group);
+    app_json["workingDirectory"] = to_json_if_some(app.working_directory);
+    app_json["environment"] = to_json_if_some(app.environment);
+    app_json["isolators"] = to_json_if_some(app.isolators);
+    app_json["eventHandlers"] = count(app.event_handlers);
+    app_json["mountPoints"] = count(app.mount_points);
+    app_json["ports"] = count(app.ports);
+    json["app"] = app_json;
+  }
+  if (manifest.dependencies) {
+    Json dependencies = Json::array();
+    for (const auto& dependency : manifest.dependencies->array) {
+      Json dependency_json = Json::object();
+      dependency_json["app"] = AppName::to_json(dependency.app_name);
+      dependency_json["imageID"] = to_json_if_some(dependency.image_id);
+      dependency_json["labels"] = count(dependency.labels);
+      dependencies.push_back(dependency_json);
+    }
+    json["dependencies"] = dependencies;
+  }
+  return json.dump();
+}
+
+
+inline std::string render(const schema::ContainerRuntimeManifest& manifest) {
+  return schema::ContainerRuntimeManifest::to_json(manifest).dump();
+}
+
+
+} // namespace fuzz
+} // namespace appc
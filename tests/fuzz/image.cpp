@@ -0,0 +1,71 @@
+#include <cstring>
+#include <unistd.h>
+
+#include "fuzz.h"
+
+#include "appc/image/image.h"
+
+
+using namespace appc;
+using namespace appc::fuzz;
+
+
+// Image only reads from a path, so each input is written over the same scratch file. It is
+// unlinked as soon as it is made and reached through /proc/self/fd, so nothing is left behind
+// however the run ends (a fuzzer's usually ends in a crash or a kill).
+static std::string scratch_image() {
+  const char* tmpdir = getenv("TMPDIR");
+  std::string path = std::string{tmpdir != nullptr ? tmpdir : "/tmp"} + "/appc-fuzz-image.XXXXXX";
+  const int fd = mkstemp(&path[0]);
+  if (fd < 0) {
+    perror("mkstemp");
+    abort();
+  }
+  unlink(path.c_str());
+  return "/proc/self/fd/" + std::to_string(fd);
+}
+
+
+static const std::string scratch = scratch_image();
+
+
+static std::string render_list(const image::FileList& files) {
+  std::string rendered{};
+  for (const auto& file : files) rendered += file + '\n';
+  return rendered;
+}
+
+
+// An image: its entries as listed by file_list(), read by manifest() and checked by
+// validate_structure(). Not extraction, which is left to the tests of the file system code.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  FILE* file = fopen(scratch.c_str(), "wb");
+  if (file == nullptr || fwrite(data, 1, size, file) != size || fclose(file) != 0) {
+    perror(scratch.c_str());
+    abort();
+  }
+  image::Image image{scratch};
+
+  const auto files = image.file_list();
+  if (candidate::image_file_list) {
+    compare("Image::file_list",
+            outcome_of(files, render_list),
+            outcome_of(candidate::image_file_list(scratch), render_list));
+  }
+
+  const auto manifest = image.manifest();
+  if (candidate::image_manifest) {
+    const auto same = [](const std::string& contents) { return contents; };
+    compare("Image::manifest",
+            outcome_of(manifest, same),
+            outcome_of(candidate::image_manifest(scratch), same));
+  }
+
+  const auto structure = image.validate_structure();
+  if (candidate::image_validate_structure) {
+    compare("Image::validate_structure",
+            outcome_of(structure),
+            outcome_of(candidate::image_validate_structure(scratch)));
+  }
+  return 0;
+}
@@ -0,0 +1,29 @@
+#include "fuzz.h"
+
+
+using namespace appc;
+using namespace appc::fuzz;
+
+
+// An image manifest: ImageManifest::from_json and, on what it accepts, validate().
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  const auto json = parse_json(data, size);
+  if (!json) return 0;
+
+  const auto manifest = schema::ImageManifest::from_json(*json);
+  const auto render_manifest = [](const schema::ImageManifest& m) { return render(m); };
+  if (candidate::image_manifest_from_json) {
+    compare("ImageManifest::from_json",
+            outcome_of(manifest, render_manifest),
+            outcome_of(candidate::image_manifest_from_json(*json), render_manifest));
+  }
+  if (!manifest) return 0;
+
+  const auto valid = manifest->validate();
+  if (candidate::image_manifest_validate) {
+    compare("ImageManifest::validate",
+            outcome_of(valid),
+            outcome_of(candidate::image_manifest_validate(*manifest)));
+  }
+  return 0;
+}
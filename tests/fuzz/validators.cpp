@@ -0,0 +1,98 @@
+#include <cstring>
+#include <map>
+
+#include "fuzz.h"
+
+#include "appc/schema/annotations.h"
+#include "appc/schema/app.h"
+#include "appc/schema/app_refs.h"
+#include "appc/schema/dependencies.h"
+#include "appc/schema/environment.h"
+#include "appc/schema/event_handlers.h"
+#include "appc/schema/isolators.h"
+#include "appc/schema/labels.h"
+#include "appc/schema/mount_points.h"
+#include "appc/schema/path_whitelist.h"
+#include "appc/schema/ports.h"
+#include "appc/schema/uuid.h"
+#include "appc/schema/volumes.h"
+
+
+using namespace appc;
+using namespace appc::fuzz;
+using namespace appc::schema;
+
+
+template<typename T>
+static Status validate(const Json& json) {
+  const auto value = T::from_json(json);
+  if (!value) return Invalid(value.failure_reason());
+  return value->validate();
+}
+
+
+static const std::map<std::string, Status (*)(const Json&)> validators{
+  {"AcKind", validate<AcKind>},
+  {"AcVersion", validate<AcVersion>},
+  {"Annotation", validate<Annotation>},
+  {"AnnotationName", validate<AnnotationName>},
+  {"Annotations", validate<Annotations>},
+  {"App", validate<App>},
+  {"AppName", validate<AppName>},
+  {"AppRef", validate<AppRef>},
+  {"AppRefs", validate<AppRefs>},
+  {"Dependencies", validate<Dependencies>},
+  {"Dependency", validate<Dependency>},
+  {"Environment", validate<Environment>},
+  {"EnvironmentVariable", validate<EnvironmentVariable>},
+  {"EventHandler", validate<EventHandler>},
+  {"EventHandlers", validate<EventHandlers>},
+  {"EventName", validate<EventName>},
+  {"Exec", validate<Exec>},
+  {"Group", validate<Group>},
+  {"ImageID", validate<ImageID>},
+  {"Isolator", validate<Isolator>},
+  {"IsolatorName", validate<IsolatorName>},
+  {"Isolators", validate<Isolators>},
+  {"Label", validate<Label>},
+  {"LabelName", validate<LabelName>},
+  {"Labels", validate<Labels>},
+  {"MountName", validate<MountName>},
+  {"MountPath", validate<MountPath>},
+  {"MountPoint", validate<MountPoint>},
+  {"MountPointNames", validate<MountPointNames>},
+  {"MountPoints", validate<MountPoints>},
+  {"Path", validate<Path>},
+  {"PathWhitelist", validate<PathWhitelist>},
+  {"Port", validate<Port>},
+  {"PortName", validate<PortName>},
+  {"PortNumber", validate<PortNumber>},
+  {"Ports", validate<Ports>},
+  {"Protocol", validate<Protocol>},
+  {"User", validate<User>},
+  {"UUID", validate<UUID>},
+  {"Volume", validate<Volume>},
+  {"VolumeKind", validate<VolumeKind>},
+  {"VolumeSource", validate<VolumeSource>},
+  {"Volumes", validate<Volumes>},
+};
+
+
+// One schema type's from_json and validate(). The first line of the input names the type, the
+// rest is its JSON, so that corpus files stay readable and keep their meaning as types are added.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  const auto newline = static_cast<const uint8_t*>(memchr(data, '\n', size));
+  if (newline == nullptr) return 0;
+  const std::string type(reinterpret_cast<const char*>(data), newline - data);
+  const auto validator = validators.find(type);
+  if (validator == validators.end()) return 0;
+  const auto json = parse_json(newline + 1, size - (newline + 1 - data));
+  if (!json) return 0;
+
+  const auto valid = validator->second(*json);
+  if (candidate::validate) {
+    const auto candidate_valid = candidate::validate(type, *json);
+    if (candidate_valid) compare(type + "::validate", outcome_of(valid), outcome_of(*candidate_valid));
+  }
+  return 0;
+}
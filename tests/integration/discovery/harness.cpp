@@ -0,0 +1,342 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "appc/discovery/provider.h"
+#include "appc/discovery/strategy/local.h"
+#include "appc/discovery/strategy/simple.h"
+#include "appc/net/tls_server.h"
+#include "appc/os/fs.h"
+
+#include "stand_in.h"
+#include "../../temp_dir.h"
+
+
+// Drives ImageProvider (local, then simple) against an in-process HTTPS stand-in and reports resolve
+// and fetch latency percentiles and throughput:
+//
+//   cold: every image is missing locally and is downloaded (and verified against its image ID)
+//   warm: every image is found by the local strategy
+//
+// Exits non-zero if an image could not be provided without injected errors, or if anything other
+// than a complete, verified image was left in the store.
+
+
+using namespace appc::discovery;
+using namespace appc::net;
+using bench_clock = std::chrono::steady_clock;
+
+
+struct Options {
+  size_t images{32};
+  size_t size{4 << 20};
+  int warm_rounds{3};
+  int clients{4};
+  double latency_ms{2};
+  double bandwidth_mbps{0};
+  double error_rate{0};
+  uint32_t seed{1};
+  bool indexed{false};
+  bool batch{false};
+  bool verbose{false};
+};
+
+
+static bool parse_options(int args, char** argv, Options& options) {
+  for (int i = 1; i < args; i++) {
+    const std::string arg{argv[i]};
+    const auto equals = arg.find('=');
+    const std::string key = arg.substr(0, equals);
+    const std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+    if (key == "--images") options.images = std::stoul(value);
+    else if (key == "--size") options.size = std::stoul(value);
+    else if (key == "--warm-rounds") options.warm_rounds = std::stoi(value);
+    else if (key == "--clients") options.clients = std::max(1, std::stoi(value));
+    else if (key == "--latency-ms") options.latency_ms = std::stod(value);
+    else if (key == "--bandwidth-mbps") options.bandwidth_mbps = std::stod(value);
+    else if (key == "--error-rate") options.error_rate = std::stod(value);
+    else if (key == "--seed") options.seed = std::stoul(value);
+    else if (key == "--indexed") options.indexed = true;
+    else if (key == "--batch") options.batch = true;
+    else if (key == "--verbose") options.verbose = true;
+    else return false;
+  }
+  return true;
+}
+
+
+class Samples {
+private:
+  std::mutex mutex{};
+  std::vector<double> seconds{};
+public:
+  void add(const double sample) {
+    std::lock_guard<std::mutex> lock{mutex};
+    seconds.push_back(sample);
+  }
+
+  void report(const std::string& label) {
+    std::lock_guard<std::mutex> lock{mutex};
+    if (seconds.empty()) return;
+    std::sort(seconds.begin(), seconds.end());
+    const auto at = [this](const double quantile) {
+      return seconds[std::min(seconds.size() - 1, static_cast<size_t>(quantile * seconds.size()))] * 1e3;
+    };
+    std::cout << std::left << std::setw(16) << label << std::right << std::fixed << std::setprecision(3)
+              << " n=" << std::setw(5) << seconds.size()
+              << "  p50 " << std::setw(9) << at(0.5)
+              << "  p90 " << std::setw(9) << at(0.9)
+              << "  p99 " << std::setw(9) << at(0.99)
+              << "  max " << std::setw(9) << seconds.back() * 1e3 << " ms" << std::endl;
+  }
+};
+
+
+template<typename Function>
+static auto timed(Samples& samples, Function function) -> decltype(function()) {
+  const auto started = bench_clock::now();
+  auto result = function();
+  samples.add(std::chrono::duration<double>(bench_clock::now() - started).count());
+  return result;
+}
+
+
+class TimedResolver : public Resolver {
+private:
+  const std::shared_ptr<Resolver> resolver;
+  Samples& samples;
+public:
+  TimedResolver(const std::shared_ptr<Resolver>& resolver, Samples& samples)
+  : resolver(resolver),
+    samples(samples) {}
+
+  virtual Try<URI> resolve(const Name& name, const Labels& labels) {
+    return timed(samples, [&]() { return resolver->resolve(name, labels); });
+  }
+
+  // A batch is one sample.
+  virtual std::vector<Try<URI>> resolve_all(const std::vector<ImageReference>& references) {
+    return timed(samples, [&]() { return resolver->resolve_all(references); });
+  }
+};
+
+
+class TimedFetcher : public Fetcher {
+private:
+  const std::shared_ptr<Fetcher> fetcher;
+  Samples& samples;
+public:
+  TimedFetcher(const std::shared_ptr<Fetcher>& fetcher, Samples& samples)
+  : fetcher(fetcher),
+    samples(samples) {}
+
+  virtual Try<URI> fetch(const URI& uri) {
+    return timed(samples, [&]() { return fetcher->fetch(uri); });
+  }
+
+  virtual Try<URI> fetch(const URI& uri, const Expectation& expected) {
+    return timed(samples, [&]() { return fetcher->fetch(uri, expected); });
+  }
+
+  virtual std::vector<Try<URI>> fetch_all(const std::vector<URI>& uris) {
+    return timed(samples, [&]() { return fetcher->fetch_all(uris); });
+  }
+};
+
+
+struct StrategySamples {
+  Samples resolve{};
+  Samples fetch{};
+};
+
+
+static Strategy timed_strategy(const Strategy& strategy, StrategySamples& samples) {
+  return Strategy(new TimedResolver(strategy.get_resolver(), samples.resolve),
+                  new TimedFetcher(strategy.get_fetcher(), samples.fetch),
+                  strategy.get_name());
+}
+
+
+struct Image {
+  Name name;
+  std::string path;
+  std::string body;
+  std::string id;
+};
+
+
+static const Labels labels{{"version", "1.0.0"}, {"os", "linux"}, {"arch", "amd64"}};
+
+
+// All images in one ImageProvider::get_all, returns the number provided. Batches are not verified
+// against image IDs while fetching; the store is checked afterward.
+static size_t run_batch(const std::vector<Image>& images,
+                        const std::vector<Strategy>& strategies,
+                        Samples& samples) {
+  std::vector<ImageReference> references{};
+  for (const auto& image : images) references.push_back(ImageReference{image.name, labels});
+  ImageProvider provider{strategies};
+  const auto fetched = timed(samples, [&]() { return provider.get_all(references); });
+  return std::count_if(fetched.begin(), fetched.end(), [](const Try<URI>& uri) {
+    return static_cast<bool>(uri);
+  });
+}
+
+
+// Each client gets every clients-th image, returns the number provided.
+static size_t run_phase(const std::vector<Image>& images,
+                        const std::vector<Strategy>& strategies,
+                        const int clients,
+                        Samples& samples) {
+  std::atomic<size_t> provided{0};
+  std::vector<std::thread> threads{};
+  for (int client = 0; client < clients; client++) {
+    threads.emplace_back([&, client]() {
+      ImageProvider provider{strategies};
+      for (size_t i = client; i < images.size(); i += clients) {
+        const auto fetched = timed(samples, [&]() {
+          return provider.get(images[i].name, labels, Expectation(ImageID(images[i].id)));
+        });
+        if (fetched) provided++;
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  return provided;
+}
+
+
+static std::string read_all(const std::string& path) {
+  std::ifstream file{path, std::ios::binary};
+  return std::string{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+}
+
+
+int main(int args, char** argv) {
+  Options options{};
+  if (!parse_options(args, argv, options)) {
+    std::cerr << "Usage: " << argv[0] << " [--images=N] [--size=BYTES] [--warm-rounds=N] [--clients=N]"
+              << " [--latency-ms=MS] [--bandwidth-mbps=MB/s] [--error-rate=P] [--seed=N] [--indexed]"
+              << " [--batch]"
+              << " [--verbose]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::vector<Image> images{};
+  stand_in::ImageHost host{stand_in::Faults(), options.seed};
+  for (size_t i = 0; i < options.images; i++) {
+    Image image{};
+    image.name = "example.com/app-" + std::to_string(i);
+    image.path = "example.com/app-" + std::to_string(i) + "-1.0.0-linux-amd64.aci";
+    image.body.resize(options.size);
+    uint32_t state = options.seed * 7919 + i;
+    for (auto& byte : image.body) {
+      state = state * 1103515245 + 12345;
+      byte = static_cast<char>(state >> 16);
+    }
+    ImageVerifier verifier{};
+    verifier.update(image.body.data(), image.body.length());
+    image.id = verifier.image_id()->value;
+    host.add("/" + image.path, image.body);
+    images.push_back(image);
+  }
+
+  const auto context = http::tls_context(APPC_TEST_FIXTURES "/tls/server.pem",
+                                         APPC_TEST_FIXTURES "/tls/server.key");
+  if (!context) {
+    std::cerr << context.failure_reason() << std::endl;
+    return EXIT_FAILURE;
+  }
+  http::TlsServer server{host.handler(), *context};
+  const auto port = server.listen();
+  if (!port) {
+    std::cerr << port.failure_reason() << std::endl;
+    return EXIT_FAILURE;
+  }
+  setenv("APPC_CA_FILE", APPC_TEST_FIXTURES "/tls/server.pem", 1);
+
+  // The simple fetcher stores https://<host>/<path> at <store>/<host>/<path>, so the local
+  // strategy looks under the stand-in's host.
+  const TempDir store_dir{"appc-harness"};
+  const std::string& store = store_dir.path;
+  const std::string host_port = "127.0.0.1:" + std::to_string(*port);
+  const URI local_uri = file_prefix + pathname::join(store, host_port);
+
+  StrategySamples local_samples{};
+  StrategySamples simple_samples{};
+  appc::os::mkdir(pathname::join(store, host_port), 0755, true);
+  const auto local = strategy::local::StrategyBuilder().with_storage_base_uri(local_uri)
+                                                         .with_index(options.indexed)
+                                                         .build();
+  if (!local) {
+    std::cerr << local.failure_reason() << std::endl;
+    return EXIT_FAILURE;
+  }
+  const Strategy simple{new strategy::simple::Resolver(https_prefix + host_port + "/"),
+                        new strategy::simple::Fetcher(store)};
+  const std::vector<Strategy> strategies{timed_strategy(from_result(local), local_samples),
+                                         timed_strategy(simple, simple_samples)};
+
+  stand_in::Faults faults{};
+  faults.latency = std::chrono::microseconds(static_cast<int64_t>(options.latency_ms * 1000));
+  faults.bandwidth = options.bandwidth_mbps * 1e6;
+  faults.error_rate = options.error_rate;
+  host.set_faults(faults);
+
+  // The provider narrates every attempt at info.
+  if (!options.verbose) appc::util::logger().set_level(appc::util::LogLevel::off);
+
+  Samples cold{};
+  const auto cold_started = bench_clock::now();
+  const size_t provided = options.batch ? run_batch(images, strategies, cold)
+                                        : run_phase(images, strategies, options.clients, cold);
+  const double cold_seconds = std::chrono::duration<double>(bench_clock::now() - cold_started).count();
+
+  Samples warm{};
+  size_t warm_provided = 0;
+  for (int round = 0; round < options.warm_rounds; round++) {
+    warm_provided += options.batch ? run_batch(images, strategies, warm)
+                                   : run_phase(images, strategies, options.clients, warm);
+  }
+  appc::util::logger().flush();
+
+  std::cout << options.images << " images of " << options.size << " bytes, " << options.clients
+            << " clients, " << options.latency_ms << " ms to first byte, "
+            << (options.bandwidth_mbps > 0 ? std::to_string(static_cast<int>(options.bandwidth_mbps)) + " MB/s"
+                                           : std::string{"unlimited"})
+            << " per connection, error rate " << options.error_rate
+            << (options.indexed ? ", indexed local store" : "")
+            << (options.batch ? ", batched" : "") << std::endl;
+  cold.report(options.batch ? "get_all (cold)" : "get (cold)");
+  warm.report(options.batch ? "get_all (warm)" : "get (warm)");
+  local_samples.resolve.report("local resolve");
+  local_samples.fetch.report("local fetch");
+  simple_samples.resolve.report("simple resolve");
+  simple_samples.fetch.report("simple fetch");
+  std::cout << "cold: " << provided << "/" << images.size() << " provided, "
+            << std::setprecision(1) << provided * options.size / cold_seconds / 1e6 << " MB/s, "
+            << host.counters.requests << " requests, " << host.counters.injected_errors
+            << " injected errors" << std::endl;
+
+  bool ok = true;
+  if (options.error_rate == 0 && (provided != images.size() ||
+                                  warm_provided != images.size() * options.warm_rounds)) {
+    std::cerr << "Not every image was provided" << std::endl;
+    ok = false;
+  }
+  // Whatever failed, nothing partial may have been published.
+  for (const auto& image : images) {
+    const std::string stored = read_all(pathname::join(store, host_port + "/" + image.path));
+    if (!stored.empty() && stored != image.body) {
+      std::cerr << "Stored " << image.path << " is not the image" << std::endl;
+      ok = false;
+    }
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "appc/net/http_server.h"
+
+
+// An image host for tests and benchmarks: serves files from memory with configurable time to first
+// byte, per-connection bandwidth and injected failures, and supports ETag (If-None-Match) and
+// single byte ranges, as a CDN or object store in front of real images would.
+namespace stand_in {
+
+
+using namespace appc::net;
+
+
+struct Faults {
+  // Before the response head.
+  std::chrono::microseconds latency{0};
+  // Bytes per second per connection, 0 for unlimited.
+  double bandwidth{0};
+  // Probability that a request fails: half of failures are a 503, half are cut off halfway
+  // through the body.
+  double error_rate{0};
+};
+
+
+struct Counters {
+  std::atomic<uint64_t> requests{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> not_modified{0};
+  std::atomic<uint64_t> partial{0};
+  std::atomic<uint64_t> injected_errors{0};
+};
+
+
+inline std::string etag_of(const std::string& body) {
+  // FNV-1a, plenty to tell versions of a file apart.
+  uint64_t hash = 14695981039346656037ull;
+  for (const unsigned char byte : body) {
+    hash = (hash ^ byte) * 1099511628211ull;
+  }
+  char etag[40];
+  snprintf(etag, sizeof(etag), "\"%016llx\"", static_cast<unsigned long long>(hash));
+  return etag;
+}
+
+
+struct ByteRange {
+  bool satisfiable;
+  uint64_t first;
+  uint64_t last;
+};
+
+
+// Parses a single "bytes=first-last", "bytes=first-" or "bytes=-suffix" range. Anything else
+// (including multiple ranges) is ignored, and the whole file is served.
+inline bool parse_range(const std::string& header, const uint64_t size, ByteRange& range) {
+  const std::string unit{"bytes="};
+  if (header.compare(0, unit.length(), unit) != 0) return false;
+  const std::string spec = header.substr(unit.length());
+  const auto dash = spec.find('-');
+  if (dash == std::string::npos || spec.find(',') != std::string::npos) return false;
+  const std::string first = spec.substr(0, dash);
+  const std::string last = spec.substr(dash + 1);
+  if (first.find_first_not_of("0123456789") != std::string::npos ||
+      last.find_first_not_of("0123456789") != std::string::npos ||
+      (first.empty() && last.empty())) {
+    return false;
+  }
+  if (first.empty()) {
+    const uint64_t suffix = std::stoull(last);
+    range = ByteRange{suffix > 0 && size > 0, size - std::min(suffix, size), size - 1};
+    return true;
+  }
+  range.first = std::stoull(first);
+  range.last = last.empty() ? size - 1 : std::min<uint64_t>(std::stoull(last), size - 1);
+  range.satisfiable = range.first < size && range.first <= range.last;
+  return true;
+}
+
+
+class ImageHost {
+private:
+  enum class Fault { none, unavailable, truncate };
+
+  std::map<std::string, std::string> files{};
+  std::mutex mutex{};
+  Faults faults;
+  std::mt19937 random;
+
+  Fault next_fault() {
+    std::lock_guard<std::mutex> lock{mutex};
+    if (std::uniform_real_distribution<double>{0, 1}(random) >= faults.error_rate) {
+      return Fault::none;
+    }
+    return random() % 2 == 0 ? Fault::unavailable : Fault::truncate;
+  }
+
+  Faults current_faults() {
+    std::lock_guard<std::mutex> lock{mutex};
+    return faults;
+  }
+
+  void serve(const http::Request& request, http::Connection& connection) {
+    counters.requests++;
+    if (request.method != "GET" && request.method != "HEAD") {
+      connection.send_response(405);
+      return;
+    }
+    const auto file = files.find(request.target.substr(0, request.target.find('?')));
+    if (file == files.end()) {
+      connection.send_response(404);
+      return;
+    }
+    const Faults faults = current_faults();
+    if (faults.latency.count() > 0) std::this_thread::sleep_for(faults.latency);
+    const Fault fault = next_fault();
+    if (fault == Fault::unavailable) {
+      counters.injected_errors++;
+      connection.send_response(503);
+      return;
+    }
+
+    const std::string& body = file->second;
+    const std::string etag = etag_of(body);
+    const auto if_none_match = request.header("if-none-match");
+    if (if_none_match && (*if_none_match == etag || *if_none_match == "*")) {
+      counters.not_modified++;
+      connection.send_head(304, {{"ETag", etag}});
+      return;
+    }
+
+    http::Headers headers{{"ETag", etag},
+                          {"Accept-Ranges", "bytes"},
+                          {"Content-Type", "application/octet-stream"}};
+    uint64_t first = 0;
+    uint64_t length = body.length();
+    int status = 200;
+    ByteRange range{};
+    const auto range_header = request.header("range");
+    if (range_header && parse_range(*range_header, body.length(), range)) {
+      if (!range.satisfiable) {
+        connection.send_response(416, "", {{"Content-Range", "bytes */" + std::to_string(body.length())}});
+        return;
+      }
+      counters.partial++;
+      status = 206;
+      first = range.first;
+      length = range.last - range.first + 1;
+      headers["Content-Range"] = "bytes " + std::to_string(range.first) + "-" +
+                                 std::to_string(range.last) + "/" + std::to_string(body.length());
+    }
+    headers["Content-Length"] = std::to_string(length);
+    if (!connection.send_head(status, headers) || request.method == "HEAD") return;
+
+    if (fault == Fault::truncate) {
+      counters.injected_errors++;
+      length /= 2;
+    }
+    const size_t chunk = 64 * 1024;
+    const auto started = std::chrono::steady_clock::now();
+    for (uint64_t sent = 0; sent < length; sent += chunk) {
+      const size_t size = std::min<uint64_t>(chunk, length - sent);
+      if (!connection.write(body.data() + first + sent, size)) return;
+      counters.bytes += size;
+      if (faults.bandwidth > 0) {
+        std::this_thread::sleep_until(started + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>((sent + size) / faults.bandwidth)));
+      }
+    }
+  }
+
+public:
+  Counters counters{};
+
+  explicit ImageHost(const Faults& faults = Faults(), const uint32_t seed = 1)
+  : faults(faults),
+    random(seed) {}
+
+  ImageHost(const ImageHost&) = delete;
+  ImageHost& operator=(const ImageHost&) = delete;
+
+  // Before serving; path is the request target, e.g. "/example.com/worker-1.0.0-linux-amd64.aci".
+  void add(const std::string& path, const std::string& body) {
+    files[path] = body;
+  }
+
+  void set_faults(const Faults& faults) {
+    std::lock_guard<std::mutex> lock{mutex};
+    this->faults = faults;
+  }
+
+  // The host must outlive servers using the handler.
+  http::Handler handler() {
+    return [this](const http::Request& request, http::Connection& connection) {
+      serve(request, connection);
+    };
+  }
+};
+
+
+} // namespace stand_in
@@ -0,0 +1,314 @@
+#include <algorithm>
+#include <archive.h>
+#include <archive_entry.h>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "3rdparty/nlohmann/json.h"
+
+#include "appc/image/image.h"
+#include "appc/os/fs.h"
+#include "appc/schema/image.h"
+
+
+using namespace appc;
+using Json = nlohmann::json;
+using bench_clock = std::chrono::steady_clock;
+
+
+#ifndef APPC_PERF_BUILD_TYPE
+#define APPC_PERF_BUILD_TYPE "default"
+#endif
+
+const std::string build_type{APPC_PERF_BUILD_TYPE};
+const int exit_skipped = 77;
+
+
+// Times fixed-seed workloads and fails if any is significantly slower than the checked-in
+// baseline. Times are kept relative to a calibration workload measured in the same run, so the
+// baseline carries over between machines of different speeds. A workload regresses when its
+// median exceeds the baseline by more than the tolerance, or by more than three times the
+// run's own spread (median absolute deviation), whichever is larger, but never by more than
+// twice the tolerance. A workload over its limit
+// is measured twice more and judged by its best measurement, so that one noisy stretch (another
+// tenant on the host, say) does not fail the check; --update records the middle of three.
+//
+// The calibration does not cancel out optimization: an unoptimized build slows some workloads far
+// more than others. The baseline records the build type it was measured in (CMAKE_BUILD_TYPE,
+// "default" when unset), and in a build of any other type the check is skipped (exit status 77,
+// which ctest reports as skipped) rather than compared.
+//
+//   perf-check --baseline=tests/perf/baseline.json            compare
+//   perf-check --baseline=tests/perf/baseline.json --update   rewrite the baseline
+
+
+struct Options {
+  std::string baseline{};
+  // tmpfs, so that extraction is not timing the disk.
+  std::string dir{"/dev/shm"};
+  int samples{11};
+  bool update{false};
+};
+
+
+static bool parse_options(int args, char** argv, Options& options) {
+  for (int i = 1; i < args; i++) {
+    const std::string arg{argv[i]};
+    const auto equals = arg.find('=');
+    const std::string key = arg.substr(0, equals);
+    const std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+    if (key == "--baseline") options.baseline = value;
+    else if (key == "--dir") options.dir = value;
+    else if (key == "--samples") options.samples = std::max(3, std::stoi(value));
+    else if (key == "--update") options.update = true;
+    else return false;
+  }
+  return !options.baseline.empty();
+}
+
+
+const std::string manifest_json = R"json({
+  "acKind": "ImageManifest",
+  "acVersion": "0.5.1",
+  "name": "example.com/reduce-worker",
+  "labels": [
+    {"name": "version", "value": "1.0.0"},
+    {"name": "arch", "value": "amd64"},
+    {"name": "os", "value": "linux"}
+  ],
+  "app": {
+    "exec": ["/usr/bin/reduce-worker", "--quiet"],
+    "user": "100",
+    "group": "300",
+    "eventHandlers": [
+      {"exec": ["/usr/bin/data-downloader"], "name": "pre-start"},
+      {"exec": ["/usr/bin/deregister-worker", "--verbose"], "name": "post-stop"}
+    ],
+    "environment": [{"name": "REDUCE_WORKER_DEBUG", "value": "true"}],
+    "mountPoints": [
+      {"name": "work", "path": "/var/lib/work", "readOnly": false}
+    ],
+    "ports": [
+      {"name": "health", "port": 4000, "protocol": "tcp", "socketActivated": true}
+    ]
+  },
+  "dependencies": [
+    {
+      "app": "example.com/reduce-worker-base",
+      "imageID": "sha512-9efe5f4bb52ab9f2f5fa4ff4ef0e5a4e2f1e7e3f3bd3c5a4f1e2d3c4b5a69788",
+      "labels": [{"name": "os", "value": "linux"}, {"name": "env", "value": "canary"}]
+    }
+  ],
+  "pathWhitelist": ["/etc/ca/example.com/crt", "/usr/bin/map-reduce-worker", "/opt/libs/reduce-toolkit.so"],
+  "annotations": [
+    {"name": "authors", "value": "Carly Container <carly@example.com>"},
+    {"name": "created", "value": "2014-10-27T19:32:27.000Z"},
+    {"name": "documentation", "value": "https://example.com/docs"},
+    {"name": "homepage", "value": "https://example.com"}
+  ]
+})json";
+
+
+// Stands in for the machine's speed: sorting and hashing strings, roughly the mix of work the
+// other workloads do.
+static void calibration() {
+  std::mt19937 random{7};
+  std::vector<std::string> strings{};
+  for (int i = 0; i < 20000; i++) strings.push_back(std::to_string(random()));
+  std::sort(strings.begin(), strings.end());
+  size_t hash = 0;
+  for (const auto& s : strings) hash ^= std::hash<std::string>()(s);
+  if (hash == 42) std::cout << "";
+}
+
+
+static std::string write_image(const std::string& path) {
+  std::unique_ptr<struct archive, decltype(&archive_write_free)> archive{
+      archive_write_new(), archive_write_free};
+  archive_write_set_format_pax_restricted(archive.get());
+  archive_write_add_filter_gzip(archive.get());
+  if (archive_write_open_filename(archive.get(), path.c_str()) != ARCHIVE_OK) {
+    return archive_error_string(archive.get());
+  }
+  const auto write_entry = [&](const std::string& name, const mode_t type, const std::string& data) {
+    std::unique_ptr<struct archive_entry, decltype(&archive_entry_free)> entry{
+        archive_entry_new(), archive_entry_free};
+    archive_entry_set_pathname(entry.get(), name.c_str());
+    archive_entry_set_filetype(entry.get(), type);
+    archive_entry_set_perm(entry.get(), type == AE_IFDIR ? 0755 : 0644);
+    archive_entry_set_size(entry.get(), data.length());
+    archive_write_header(archive.get(), entry.get());
+    if (!data.empty()) archive_write_data(archive.get(), data.data(), data.length());
+  };
+  write_entry("manifest", AE_IFREG, manifest_json);
+  write_entry("rootfs", AE_IFDIR, "");
+  std::mt19937_64 random{1};
+  for (int d = 0; d < 8; d++) {
+    const std::string dir = "rootfs/d" + std::to_string(d);
+    write_entry(dir, AE_IFDIR, "");
+    for (int f = 0; f < 32; f++) {
+      std::string contents(std::exponential_distribution<double>(1.0 / 8192)(random), '\0');
+      for (size_t i = 0; i < contents.size(); i++) {
+        contents[i] = i % 2 == 0 ? static_cast<char>(random()) : 'a' + i % 26;
+      }
+      write_entry(dir + "/f" + std::to_string(f), AE_IFREG, contents);
+    }
+  }
+  if (archive_write_close(archive.get()) != ARCHIVE_OK) return archive_error_string(archive.get());
+  return "";
+}
+
+
+struct Timing {
+  // Median workload time over median calibration time.
+  double median;
+  // The workload's median absolute deviation, relative to its median.
+  double spread;
+};
+
+
+static double median_of(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  const size_t middle = values.size() / 2;
+  return values.size() % 2 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+}
+
+
+// Samples are interleaved with calibration samples so that both see the same machine state.
+static Timing time_relative(const std::function<void()>& workload,
+                            const std::function<void()>& reset,
+                            const int samples) {
+  std::vector<double> references{};
+  std::vector<double> times{};
+  workload();
+  reset();
+  for (int sample = 0; sample < samples; sample++) {
+    auto started = bench_clock::now();
+    calibration();
+    references.push_back(std::chrono::duration<double>(bench_clock::now() - started).count());
+    started = bench_clock::now();
+    workload();
+    times.push_back(std::chrono::duration<double>(bench_clock::now() - started).count());
+    reset();
+  }
+  const double median = median_of(times);
+  std::vector<double> deviations{};
+  for (const auto time : times) deviations.push_back(std::fabs(time - median));
+  return Timing{median / median_of(references), median_of(deviations) / median};
+}
+
+
+int main(int args, char** argv) {
+  Options options{};
+  if (!parse_options(args, argv, options)) {
+    std::cerr << "Usage: " << argv[0] << " --baseline=PATH [--update] [--samples=N] [--dir=PATH]"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const Json json = Json::parse(manifest_json);
+  const auto manifest = schema::ImageManifest::from_json(json);
+  if (!manifest || !manifest->validate()) {
+    std::cerr << "The workload manifest does not parse and validate" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  Json baseline = Json::object();
+  if (!options.update) {
+    std::ifstream file{options.baseline};
+    std::stringstream contents{};
+    contents << file.rdbuf();
+    if (!file) {
+      std::cerr << "Could not read " << options.baseline << std::endl;
+      return EXIT_FAILURE;
+    }
+    baseline = Json::parse(contents.str());
+    const auto build = baseline.find("build");
+    const std::string recorded = build != baseline.end() ? build->get<std::string>() : "default";
+    if (recorded != build_type) {
+      std::cout << "Skipped: " << options.baseline << " was recorded in a " << recorded
+                << " build, this is a " << build_type << " build" << std::endl;
+      return exit_skipped;
+    }
+  }
+
+  const std::string image_path = options.dir + "/perf-check-" + std::to_string(getpid()) + ".aci";
+  const std::string rootfs = options.dir + "/perf-check-" + std::to_string(getpid()) + "-rootfs";
+  const std::string written = write_image(image_path);
+  if (!written.empty()) {
+    std::cerr << "Could not write " << image_path << ": " << written << std::endl;
+    return EXIT_FAILURE;
+  }
+  image::Image image{image_path};
+  bool extracted = true;
+
+  const std::vector<std::pair<std::string, std::function<void()>>> workloads{
+    {"ImageManifest::from_json", [&json]() {
+      for (int i = 0; i < 200; i++) schema::ImageManifest::from_json(json);
+    }},
+    {"ImageManifest::validate", [&manifest]() {
+      for (int i = 0; i < 200; i++) manifest->validate();
+    }},
+    {"Image::extract_rootfs_to", [&image, &rootfs, &extracted]() {
+      extracted = image.extract_rootfs_to(rootfs) && extracted;
+    }},
+  };
+  const auto remove_rootfs = [&rootfs]() { os::remove_tree(rootfs); };
+
+  const double tolerance = options.update ? 0.4 : baseline["tolerance"].get<double>();
+
+  Json updated = Json::object();
+  updated["build"] = build_type;
+  updated["tolerance"] = tolerance;
+  Json relative = Json::object();
+  bool regressed = false;
+  for (const auto& workload : workloads) {
+    if (options.update) {
+      std::vector<double> medians{};
+      for (int run = 0; run < 3; run++) {
+        medians.push_back(time_relative(workload.second, remove_rootfs, options.samples).median);
+      }
+      relative[workload.first] = median_of(medians);
+      printf("%-26s %8.3f\n", workload.first.c_str(), median_of(medians));
+      continue;
+    }
+    const double expected = baseline["relative"][workload.first].get<double>();
+    Timing timing{0, 0};
+    double limit = 0;
+    for (int run = 0; run < 3; run++) {
+      const auto measured = time_relative(workload.second, remove_rootfs, options.samples);
+      if (run == 0 || measured.median < timing.median) timing = measured;
+      limit = expected * (1 + std::max(tolerance, std::min(3 * timing.spread, 2 * tolerance)));
+      if (timing.median <= limit) break;
+    }
+    const bool slow = timing.median > limit;
+    regressed = regressed || slow;
+    printf("%-26s %8.3f (baseline %8.3f, limit %8.3f, spread %4.1f%%) %s\n",
+           workload.first.c_str(), timing.median, expected, limit, timing.spread * 100,
+           slow ? "REGRESSED" : timing.median < expected / 2 ? "faster, consider --update" : "ok");
+  }
+  unlink(image_path.c_str());
+  if (!extracted) {
+    std::cerr << "Extraction failed" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (options.update) {
+    updated["relative"] = relative;
+    std::ofstream out{options.baseline};
+    out << updated.dump(2) << std::endl;
+    if (!out) {
+      std::cerr << "Could not write " << options.baseline << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  return regressed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdexcept>
+#include <stdlib.h>
+#include <string>
+
+#include "appc/os/fs.h"
+
+
+// A fresh directory under /tmp, removed with everything in it when this goes out of scope.
+struct TempDir {
+  std::string path;
+
+  explicit TempDir(const std::string& prefix = "appc-test") {
+    std::string name = "/tmp/" + prefix + "-XXXXXX";
+    if (mkdtemp(&name[0]) == nullptr) throw std::runtime_error("Could not create " + name);
+    path = name;
+  }
+
+  TempDir(const TempDir&) = delete;
+  TempDir& operator=(const TempDir&) = delete;
+
+  ~TempDir() {
+    appc::os::remove_tree(path);
+  }
+};
@@ -0,0 +1,26 @@
+#include "gtest/gtest.h"
+
+#include "appc/util/log.h"
+
+#include "test_verify.h"
+#include "test_signature.h"
+#include "test_delta.h"
+#include "test_mirror.h"
+#include "test_mirrors.h"
+#include "test_plan.h"
+#include "test_local.h"
+#include "test_stand_in.h"
+#include "test_batch.h"
+#include "test_label_aliases.h"
+#include "test_peer.h"
+
+
+// Discovery logs every resolve and fetch at info; keep the test output to what went wrong.
+class QuietLogs : public ::testing::Environment {
+public:
+  void SetUp() override {
+    appc::util::logger().set_level(appc::util::LogLevel::warning);
+  }
+};
+
+static ::testing::Environment* const quiet_logs = ::testing::AddGlobalTestEnvironment(new QuietLogs);
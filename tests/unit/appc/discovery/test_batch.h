@@ -0,0 +1,81 @@
+#pragma once
+
+#include "appc/discovery/provider.h"
+#include "appc/discovery/strategy/local.h"
+#include "appc/discovery/strategy/simple.h"
+#include "../../../temp_dir.h"
+
+
+inline ImageReference reference(const Name& name, const std::string& version) {
+  return ImageReference{name, {{"version", version}, {"os", "linux"}, {"arch", "amd64"}}};
+}
+
+
+TEST(Batch, resolve_all_matches_resolve_in_order) {
+  strategy::local::Resolver resolver{"file:///images"};
+  const std::vector<ImageReference> references{reference("example.com/a", "1.0.0"),
+                                                ImageReference{"example.com/b", {{"version", "1"}}},
+                                                reference("example.com/c", "2.0.0")};
+  const auto uris = resolver.resolve_all(references);
+  ASSERT_EQ(3, uris.size());
+  ASSERT_EQ("file:///images/example.com/a-1.0.0-linux-amd64.aci", *uris[0]);
+  ASSERT_FALSE(uris[1]);
+  ASSERT_EQ("os label required", uris[1].failure_reason());
+  ASSERT_EQ("file:///images/example.com/c-2.0.0-linux-amd64.aci", *uris[2]);
+  for (size_t i = 0; i < references.size(); i++) {
+    const auto single = resolver.resolve(references[i].name, references[i].labels);
+    ASSERT_EQ(static_cast<bool>(single), static_cast<bool>(uris[i]));
+    if (single) {
+      ASSERT_EQ(*single, *uris[i]);
+    }
+  }
+}
+
+TEST(Batch, get_all_answers_locally_before_fetching_the_rest) {
+  TlsStandIn stand_in{};
+  TempDir store{};
+  const std::string host = stand_in.base.substr(https_prefix.length(),
+                                                stand_in.base.length() - https_prefix.length() - 1);
+  const Path local_root = pathname::join(store.path, host);
+  appc::os::mkdir(pathname::join(local_root, "example.com"), 0755, true);
+
+  std::vector<ImageReference> references{};
+  std::vector<std::string> images{};
+  for (int i = 0; i < 12; i++) {
+    references.push_back(reference("example.com/app-" + std::to_string(i), "1.0.0"));
+    images.push_back(pseudo_random_bytes(64 * 1024 + i, 100 + i));
+    const std::string aci_name = "example.com/app-" + std::to_string(i) + "-1.0.0-linux-amd64.aci";
+    // Every third image is already stored, the last is nowhere.
+    if (i % 3 == 0) {
+      write_file(pathname::join(local_root, aci_name), images.back());
+    } else if (i != 11) {
+      stand_in.host.add("/" + aci_name, images.back());
+    }
+  }
+
+  const auto local = strategy::local::StrategyBuilder()
+                       .with_storage_base_uri(file_prefix + local_root)
+                       .with_index()
+                       .build();
+  ASSERT_TRUE(local);
+  ImageProvider provider{{from_result(local),
+                          Strategy(new strategy::simple::Resolver(stand_in.base),
+                                   new strategy::simple::Fetcher(store.path))}};
+  const auto provided = provider.get_all(references);
+  ASSERT_EQ(references.size(), provided.size());
+  for (size_t i = 0; i < references.size(); i++) {
+    if (i == 11) {
+      ASSERT_FALSE(provided[i]);
+      continue;
+    }
+    ASSERT_TRUE(provided[i]) << provided[i].failure_reason();
+    ASSERT_TRUE(images[i] == read_file(uri_file_path(*provided[i]))) << i;
+  }
+  // Only what the store did not have was requested.
+  ASSERT_EQ(8, stand_in.host.counters.requests);
+
+  // Now everything but the missing image is local.
+  const auto again = provider.get_all(references);
+  ASSERT_EQ(9, stand_in.host.counters.requests);
+  for (size_t i = 0; i < 11; i++) ASSERT_EQ(*provided[i], *again[i]);
+}
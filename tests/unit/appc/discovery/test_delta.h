@@ -0,0 +1,246 @@
+#pragma once
+
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+#include "appc/discovery/delta.h"
+#include "appc/discovery/provider.h"
+#include "appc/discovery/strategy/delta.h"
+#include "appc/os/fs.h"
+#include "../../../temp_dir.h"
+
+using namespace appc::discovery;
+
+
+inline void write_file(const std::string& path, const std::string& contents) {
+  std::ofstream file{path, std::ios::binary};
+  file.write(contents.data(), contents.length());
+}
+
+
+inline std::string read_file(const std::string& path) {
+  std::ifstream file{path, std::ios::binary};
+  std::stringstream contents{};
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+
+inline std::string pseudo_random_bytes(const size_t length, uint32_t seed) {
+  std::string bytes(length, '\0');
+  for (auto& byte : bytes) {
+    seed = seed * 1103515245 + 12345;
+    byte = static_cast<char>(seed >> 16);
+  }
+  return bytes;
+}
+
+
+inline ImageID image_id_of(const std::string& contents) {
+  ImageVerifier verifier{};
+  verifier.update(contents.data(), contents.length());
+  return *verifier.image_id();
+}
+
+
+struct DeltaFixture {
+  std::string base;
+  std::string target;
+
+  DeltaFixture()
+  : base(pseudo_random_bytes(64 * 1024, 1)) {
+    target = base.substr(0, 10000) + "inserted" + base.substr(10000, 30000) +
+             pseudo_random_bytes(500, 2) + base.substr(40500) + "appended";
+  }
+};
+
+
+TEST(Delta, compare_versions) {
+  ASSERT_EQ(-1, strategy::delta::compare_versions("1.0.0", "1.1.0"));
+  ASSERT_EQ(-1, strategy::delta::compare_versions("1.9.0", "1.10.0"));
+  ASSERT_EQ(1, strategy::delta::compare_versions("2.0", "1.10.0"));
+  ASSERT_EQ(0, strategy::delta::compare_versions("1.2.3", "1.2.3"));
+  ASSERT_EQ(-1, strategy::delta::compare_versions("1.2", "1.2.1"));
+}
+
+TEST(Delta, create_then_apply_rebuilds_target) {
+  TempDir dir{};
+  DeltaFixture fixture{};
+  const std::string patch = *delta::create(fixture.base, fixture.target, 256);
+  ASSERT_LT(patch.length(), fixture.target.length() / 10);
+
+  write_file(dir.path + "/base.aci", fixture.base);
+  write_file(dir.path + "/patch.delta", patch);
+  auto applied = delta::apply(dir.path + "/base.aci", dir.path + "/patch.delta",
+                              dir.path + "/target.aci");
+  ASSERT_TRUE(applied) << applied.message;
+  ASSERT_EQ(fixture.target, read_file(dir.path + "/target.aci"));
+}
+
+// The delta is taken between the tars, so compressing both images costs it nothing, and the
+// rebuilt image is the target's tar.
+TEST(Delta, compressed_images_diff_as_tars) {
+  TempDir dir{};
+  DeltaFixture fixture{};
+  const std::string patch = *delta::create(gzip(fixture.base), gzip(fixture.target), 256);
+  ASSERT_LT(patch.length(), fixture.target.length() / 10);
+
+  write_file(dir.path + "/base.aci", gzip(fixture.base));
+  write_file(dir.path + "/patch.delta", patch);
+  auto applied = delta::apply(dir.path + "/base.aci", dir.path + "/patch.delta",
+                              dir.path + "/target.aci",
+                              Some(Expectation(image_id_of(gzip(fixture.target)))));
+  ASSERT_TRUE(applied) << applied.message;
+  ASSERT_EQ(fixture.target, read_file(dir.path + "/target.aci"));
+  ASSERT_EQ(0, unlink((dir.path + "/target.aci").c_str()));
+
+  // An uncompressed base serves as well as the compressed one the delta was made from.
+  write_file(dir.path + "/base.aci", fixture.base);
+  ASSERT_TRUE(delta::apply(dir.path + "/base.aci", dir.path + "/patch.delta",
+                           dir.path + "/target.aci"));
+  ASSERT_EQ(fixture.target, read_file(dir.path + "/target.aci"));
+}
+
+// Streaming the target through the encoder, in whatever pieces, makes the same delta.
+TEST(Delta, create_file_streams_the_same_delta) {
+  TempDir dir{};
+  DeltaFixture fixture{};
+  write_file(dir.path + "/base.aci", gzip(fixture.base));
+  write_file(dir.path + "/target.aci", gzip(fixture.target));
+  auto created = delta::create_file(dir.path + "/base.aci", dir.path + "/target.aci",
+                                    dir.path + "/patch.delta", 256);
+  ASSERT_TRUE(created) << created.message;
+  const std::string patch = *delta::create(gzip(fixture.base), gzip(fixture.target), 256);
+  ASSERT_EQ(patch, read_file(dir.path + "/patch.delta"));
+
+  std::string ops{};
+  delta::Encoder encoder{reinterpret_cast<const unsigned char*>(fixture.base.data()),
+                         fixture.base.length(), 256, [&ops](const std::string& more) {
+                           ops += more;
+                           return Success();
+                         }};
+  for (const char byte : fixture.target) ASSERT_TRUE(encoder.update(&byte, 1));
+  ASSERT_TRUE(encoder.finish());
+  ASSERT_EQ(patch.substr(patch.length() - ops.length()), ops);
+
+  ASSERT_TRUE(delta::apply(dir.path + "/base.aci", dir.path + "/patch.delta",
+                           dir.path + "/rebuilt.aci"));
+  ASSERT_EQ(fixture.target, read_file(dir.path + "/rebuilt.aci"));
+}
+
+TEST(Delta, apply_rejects_unexpected_target) {
+  TempDir dir{};
+  DeltaFixture fixture{};
+  write_file(dir.path + "/base.aci", fixture.base);
+  write_file(dir.path + "/patch.delta",
+             *delta::create(fixture.base, fixture.target, 256));
+  auto applied = delta::apply(dir.path + "/base.aci", dir.path + "/patch.delta",
+                              dir.path + "/target.aci",
+                              Some(Expectation(image_id_of(fixture.base))));
+  ASSERT_FALSE(applied);
+  ASSERT_NE(0, access((dir.path + "/target.aci").c_str(), F_OK));
+}
+
+TEST(Delta, apply_rejects_oversized_target_before_writing) {
+  TempDir dir{};
+  DeltaFixture fixture{};
+  write_file(dir.path + "/base.aci", fixture.base);
+  write_file(dir.path + "/patch.delta",
+             *delta::create(fixture.base, fixture.target, 256));
+  const auto capped = delta::apply(dir.path + "/base.aci", dir.path + "/patch.delta",
+                                   dir.path + "/target.aci",
+                                   Some(Expectation(image_id_of(fixture.target), 1024)));
+  ASSERT_FALSE(capped);
+  ASSERT_NE(std::string::npos, capped.message.find("more than the 1024 allowed")) << capped.message;
+  ASSERT_FALSE(delta::apply(dir.path + "/base.aci", dir.path + "/patch.delta",
+                            dir.path + "/target.aci", None<Expectation>(), 4096));
+  ASSERT_NE(0, access((dir.path + "/target.aci").c_str(), F_OK));
+  ASSERT_TRUE(delta::apply(dir.path + "/base.aci", dir.path + "/patch.delta",
+                           dir.path + "/target.aci",
+                           Some(Expectation(image_id_of(fixture.target), fixture.target.length()))));
+}
+
+TEST(Delta, apply_rejects_wrong_base) {
+  TempDir dir{};
+  DeltaFixture fixture{};
+  write_file(dir.path + "/base.aci", fixture.base + "x");
+  write_file(dir.path + "/patch.delta",
+             *delta::create(fixture.base, fixture.target, 256));
+  ASSERT_FALSE(delta::apply(dir.path + "/base.aci", dir.path + "/patch.delta",
+                            dir.path + "/target.aci"));
+}
+
+TEST(Delta, strategy_rebuilds_from_previous_local_version) {
+  TempDir store{};
+  TempDir remote{};
+  DeltaFixture fixture{};
+  ASSERT_EQ(0, mkdir((store.path + "/example.com").c_str(), 0755));
+  ASSERT_EQ(0, mkdir((remote.path + "/example.com").c_str(), 0755));
+  write_file(store.path + "/example.com/worker-1.0.0-linux-amd64.aci", fixture.base);
+  write_file(store.path + "/example.com/worker-0.9.0-linux-amd64.aci", "older");
+  write_file(remote.path + "/example.com/worker-1.1.0-linux-amd64.aci.from-1.0.0.delta",
+             *delta::create(fixture.base, fixture.target, 256));
+
+  auto strategy = strategy::delta::StrategyBuilder()
+                    .with_storage_base_uri(file_prefix + store.path)
+                    .with_remote_prefix(file_prefix + remote.path + "/")
+                    .build();
+  ASSERT_TRUE(strategy) << strategy.failure_reason();
+  ImageProvider provider{{from_result(strategy)}};
+
+  const Labels labels{{"version", "1.1.0"}, {"os", "linux"}, {"arch", "amd64"}};
+  auto fetched = provider.get("example.com/worker", labels,
+                              Expectation(image_id_of(fixture.target)));
+  ASSERT_TRUE(fetched) << fetched.failure_reason();
+  ASSERT_EQ(file_prefix + store.path + "/example.com/worker-1.1.0-linux-amd64.aci", *fetched);
+  ASSERT_EQ(fixture.target, read_file(uri_file_path(*fetched)));
+}
+
+TEST(Delta, strategy_serves_concurrent_fetches_of_one_image) {
+  TempDir store{};
+  TempDir remote{};
+  DeltaFixture fixture{};
+  ASSERT_EQ(0, mkdir((store.path + "/example.com").c_str(), 0755));
+  ASSERT_EQ(0, mkdir((remote.path + "/example.com").c_str(), 0755));
+  // Dashes in both the name and the versions.
+  write_file(store.path + "/example.com/reduce-worker-1.0.0-rc1-linux-amd64.aci", fixture.base);
+  write_file(remote.path +
+                 "/example.com/reduce-worker-1.0.0-rc2-linux-amd64.aci.from-1.0.0-rc1.delta",
+             *delta::create(fixture.base, fixture.target, 256));
+
+  auto strategy = strategy::delta::StrategyBuilder()
+                    .with_storage_base_uri(file_prefix + store.path)
+                    .with_remote_prefix(file_prefix + remote.path + "/")
+                    .build();
+  ASSERT_TRUE(strategy) << strategy.failure_reason();
+  const ImageProvider provider{{from_result(strategy)}};
+  const Labels labels{{"version", "1.0.0-rc2"}, {"os", "linux"}, {"arch", "amd64"}};
+
+  // Each resolve is followed by its own fetch, in any interleaving.
+  std::atomic<int> provided{0};
+  std::vector<std::thread> threads{};
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([&provider, &labels, &provided]() {
+      if (provider.get("example.com/reduce-worker", labels)) provided++;
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  ASSERT_EQ(8, provided);
+  ASSERT_EQ(fixture.target,
+            read_file(store.path + "/example.com/reduce-worker-1.0.0-rc2-linux-amd64.aci"));
+
+  // Resolving without fetching leaves nothing behind to go stale.
+  ASSERT_TRUE(strategy->get_resolver()->resolve_all({ImageReference{"example.com/reduce-worker",
+                                                                    labels}}).front());
+}
+
+TEST(Delta, strategy_fails_without_previous_version) {
+  TempDir store{};
+  auto strategy = strategy::delta::StrategyBuilder()
+                    .with_storage_base_uri(file_prefix + store.path)
+                    .build();
+  const Labels labels{{"version", "1.1.0"}, {"os", "linux"}, {"arch", "amd64"}};
+  ASSERT_FALSE(strategy->get_resolver()->resolve("example.com/worker", labels));
+}
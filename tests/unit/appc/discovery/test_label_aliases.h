@@ -0,0 +1,83 @@
+#pragma once
+
+#include "appc/discovery/label_aliases.h"
+#include "../../../temp_dir.h"
+
+
+TEST(LabelAliases, expands_in_order) {
+  const auto aliases = LabelAliases::defaults();
+  const Labels labels{{"version", "1.0.0"}, {"os", "linux"}, {"arch", "amd64"}};
+  const auto candidates = aliases.candidates(labels);
+  ASSERT_EQ(2, candidates.size());
+  ASSERT_EQ(labels, candidates[0]);
+  ASSERT_EQ("x86_64", candidates[1].at("arch"));
+  ASSERT_EQ("1.0.0", candidates[1].at("version"));
+
+  // The requested spelling comes first, values are normalized.
+  ASSERT_EQ("x86_64", aliases.candidates({{"arch", "x86_64"}})[0].at("arch"));
+  ASSERT_EQ("amd64", aliases.candidates({{"arch", "x86_64"}})[1].at("arch"));
+  ASSERT_EQ("amd64", aliases.candidates({{"arch", "AMD64"}})[0].at("arch"));
+  ASSERT_EQ(1, aliases.candidates({{"arch", "s390x"}}).size());
+  ASSERT_EQ(1, LabelAliases().candidates(labels).size());
+}
+
+TEST(LabelAliases, combines_labels) {
+  const auto aliases = LabelAliases().with("arch", {"aarch64", "arm64"})
+                                     .with("os", {"linux", "gnu-linux"});
+  const auto candidates = aliases.candidates({{"arch", "arm64"}, {"os", "linux"}});
+  ASSERT_EQ(4, candidates.size());
+  ASSERT_EQ((Labels{{"arch", "arm64"}, {"os", "linux"}}), candidates[0]);
+  ASSERT_EQ((Labels{{"arch", "arm64"}, {"os", "gnu-linux"}}), candidates[1]);
+  ASSERT_EQ((Labels{{"arch", "aarch64"}, {"os", "linux"}}), candidates[2]);
+  ASSERT_EQ((Labels{{"arch", "aarch64"}, {"os", "gnu-linux"}}), candidates[3]);
+}
+
+TEST(LabelAliases, provider_searches_local_aliases_before_remote) {
+  TlsStandIn stand_in{};
+  TempDir store{};
+  const std::string host = stand_in.base.substr(https_prefix.length(),
+                                                stand_in.base.length() - https_prefix.length() - 1);
+  const Path local_root = pathname::join(store.path, host);
+  appc::os::mkdir(pathname::join(local_root, "example.com"), 0755, true);
+  const std::string local_image = pseudo_random_bytes(4096, 1);
+  const std::string remote_image = pseudo_random_bytes(4096, 2);
+  write_file(pathname::join(local_root, "example.com/worker-1.0.0-linux-x86_64.aci"), local_image);
+  stand_in.host.add("/example.com/worker-1.0.0-linux-amd64.aci", remote_image);
+  stand_in.host.add("/example.com/reduce-1.0.0-linux-x86_64.aci", remote_image);
+
+  const auto local = strategy::local::StrategyBuilder()
+                       .with_storage_base_uri(file_prefix + local_root)
+                       .with_index()
+                       .build();
+  ASSERT_TRUE(local);
+  const std::vector<Strategy> strategies{from_result(local),
+                                         Strategy(new strategy::simple::Resolver(stand_in.base),
+                                                  new strategy::simple::Fetcher(store.path))};
+  const Labels labels{{"version", "1.0.0"}, {"os", "linux"}, {"arch", "amd64"}};
+
+  ASSERT_FALSE(ImageProvider(strategies).get("example.com/reduce", labels));
+  ImageProvider provider{strategies, LabelAliases::defaults()};
+  stand_in.host.counters.requests = 0;
+
+  // The local x86_64 image wins over the remote amd64 one.
+  const auto worker = provider.get("example.com/worker", labels, Expectation(image_id_of(local_image)));
+  ASSERT_TRUE(worker) << worker.failure_reason();
+  ASSERT_EQ(local_image, read_file(uri_file_path(*worker)));
+  ASSERT_EQ(0, stand_in.host.counters.requests);
+
+  // Remotely, candidates are tried in order until one is found.
+  const auto reduce = provider.get("example.com/reduce", labels);
+  ASSERT_TRUE(reduce) << reduce.failure_reason();
+  ASSERT_EQ(remote_image, read_file(uri_file_path(*reduce)));
+  ASSERT_EQ(2, stand_in.host.counters.requests);
+
+  // Batches too, one candidate per reference at a time.
+  ASSERT_EQ(0, unlink(uri_file_path(*reduce).c_str()));
+  stand_in.host.counters.requests = 0;
+  const auto both = provider.get_all({{"example.com/worker", labels}, {"example.com/reduce", labels}});
+  ASSERT_TRUE(both[0]);
+  ASSERT_EQ(local_image, read_file(uri_file_path(*both[0])));
+  ASSERT_TRUE(both[1]);
+  ASSERT_EQ(remote_image, read_file(uri_file_path(*both[1])));
+  ASSERT_EQ(2, stand_in.host.counters.requests);
+}
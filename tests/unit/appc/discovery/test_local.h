@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#include "appc/discovery/strategy/local.h"
+#include "../../../temp_dir.h"
+
+
+TEST(LocalStrategy, indexed_fetcher_sees_new_images) {
+  TempDir store{};
+  const auto strategy = strategy::local::StrategyBuilder()
+                          .with_storage_base_uri(file_prefix + store.path)
+                          .with_index()
+                          .build();
+  ASSERT_TRUE(strategy);
+  ImageProvider provider{{from_result(strategy)}};
+  const Labels labels{{"version", "1.0.0"}, {"os", "linux"}, {"arch", "amd64"}};
+  ASSERT_FALSE(provider.get("example.com/worker", labels));
+
+  appc::os::mkdir(pathname::join(store.path, "example.com"), 0755, true);
+  write_file(pathname::join(store.path, "example.com/worker-1.0.0-linux-amd64.aci"), "image");
+  const auto fetched = provider.get("example.com/worker", labels);
+  ASSERT_TRUE(fetched) << fetched.failure_reason();
+  ASSERT_EQ(pathname::join(store.path, "example.com/worker-1.0.0-linux-amd64.aci"),
+            uri_file_path(*fetched));
+}
+
+TEST(LocalStrategy, provider_is_shared_across_threads) {
+  TempDir store{};
+  appc::os::mkdir(pathname::join(store.path, "example.com"), 0755, true);
+  const Labels labels{{"version", "1.0.0"}, {"os", "linux"}, {"arch", "amd64"}};
+  std::vector<ImageReference> references{};
+  for (int i = 0; i < 8; i++) {
+    const std::string name = "example.com/app-" + std::to_string(i);
+    write_file(pathname::join(store.path, name + "-1.0.0-linux-amd64.aci"), "image");
+    references.push_back(ImageReference{name, labels});
+  }
+  const auto strategy = strategy::local::StrategyBuilder()
+                          .with_storage_base_uri(file_prefix + store.path)
+                          .with_index()
+                          .build();
+  ASSERT_TRUE(strategy);
+  const ImageProvider provider{{from_result(strategy)}};
+
+  std::atomic<int> provided{0};
+  std::vector<std::thread> threads{};
+  for (int t = 0; t < 128; t++) {
+    threads.emplace_back([&provider, &references, &provided]() {
+      for (int round = 0; round < 10; round++) {
+        for (const auto& uri : provider.get_all(references)) {
+          if (uri) provided++;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  ASSERT_EQ(128 * 10 * 8, provided);
+}
+
+TEST(LocalStrategy, provider_reconfigured_while_in_use) {
+  TempDir first{};
+  TempDir second{};
+  const Labels labels{{"version", "1.0.0"}, {"os", "linux"}, {"arch", "amd64"}};
+  std::vector<ImageReference> references{};
+  for (const auto& store : {first.path, second.path}) {
+    appc::os::mkdir(pathname::join(store, "example.com"), 0755, true);
+    write_file(pathname::join(store, "example.com/app-1.0.0-linux-amd64.aci"), "image");
+  }
+  references.push_back(ImageReference{"example.com/app", labels});
+  const auto store_strategy = [](const Path& store) {
+    return from_result(strategy::local::StrategyBuilder()
+                         .with_storage_base_uri(file_prefix + store)
+                         .build());
+  };
+  ImageProvider provider{{store_strategy(first.path)}};
+
+  // Calls under way while the stores are swapped still find the image.
+  std::atomic<bool> stop{false};
+  std::atomic<int> failed{0};
+  std::vector<std::thread> threads{};
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([&]() {
+      while (!stop) {
+        const auto fetched = provider.get_all(references).front();
+        if (!fetched) failed++;
+      }
+    });
+  }
+  for (int round = 0; round < 200; round++) {
+    provider.configure({store_strategy(round % 2 == 0 ? second.path : first.path)});
+  }
+  stop = true;
+  for (auto& thread : threads) thread.join();
+  ASSERT_EQ(0, failed);
+
+  provider.configure({store_strategy(second.path)});
+  ASSERT_EQ(1u, provider.get_configuration()->strategies.size());
+  const auto fetched = provider.get("example.com/app", labels);
+  ASSERT_TRUE(fetched) << fetched.failure_reason();
+  ASSERT_EQ(pathname::join(second.path, "example.com/app-1.0.0-linux-amd64.aci"),
+            uri_file_path(*fetched));
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#include "appc/discovery/mirror.h"
+#include "appc/net/http_server.h"
+#include "appc/net/tls_server.h"
+#include "../../../temp_dir.h"
+
+
+using namespace appc::net;
+
+
+// Serves files from a directory in small, slow pieces so that mirror clients overlap the fill.
+struct SlowUpstream {
+  const std::string root;
+  std::atomic<int> requests{0};
+  http::Server server;
+  uint16_t port{0};
+
+  explicit SlowUpstream(const std::string& root)
+  : root(root),
+    server([this](const http::Request& request, http::Connection& connection) {
+      requests++;
+      const std::string contents = read_file(pathname::join(this->root, request.target));
+      if (contents.empty()) {
+        connection.send_response(404);
+        return;
+      }
+      connection.send_head(200, {{"Content-Length", std::to_string(contents.length())}});
+      for (size_t offset = 0; offset < contents.length(); offset += 16 * 1024) {
+        connection.write(contents.substr(offset, 16 * 1024));
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      }
+    }) {
+    port = *server.listen();
+  }
+
+  URI prefix() const {
+    return "http://127.0.0.1:" + std::to_string(port) + "/";
+  }
+};
+
+
+TEST(Mirror, parse_aci_name_inverts_render) {
+  const auto parsed = parse_aci_name("example.com/my-worker-1.0.0-linux-amd64.aci");
+  ASSERT_TRUE(parsed);
+  ASSERT_EQ("example.com/my-worker", parsed->name);
+  ASSERT_EQ("1.0.0", parsed->labels.at("version"));
+  ASSERT_EQ("linux", parsed->labels.at("os"));
+  ASSERT_EQ("amd64", parsed->labels.at("arch"));
+  ASSERT_EQ("example.com/my-worker-1.0.0-linux-amd64.aci",
+            *render_aci_name(parsed->name, parsed->labels));
+
+  ASSERT_FALSE(parse_aci_name("example.com/worker-1.0.0-linux-amd64.aci.partial"));
+  ASSERT_FALSE(parse_aci_name("worker-linux-amd64.aci"));
+}
+
+TEST(Mirror, rejects_paths_outside_cache) {
+  ASSERT_FALSE(mirror::MirrorCache::image_for_path("/../worker-1.0.0-linux-amd64.aci"));
+  ASSERT_FALSE(mirror::MirrorCache::image_for_path("/"));
+  ASSERT_TRUE(mirror::MirrorCache::image_for_path("/example.com/worker-1.0.0-linux-amd64.aci"));
+}
+
+TEST(Mirror, concurrent_misses_fetch_upstream_once) {
+  TempDir upstream_dir{};
+  TempDir cache_dir{};
+  const std::string image = pseudo_random_bytes(512 * 1024, 7);
+  appc::os::mkdir(pathname::join(upstream_dir.path, "example.com"), 0755, true);
+  write_file(pathname::join(upstream_dir.path, "example.com/worker-1.0.0-linux-amd64.aci"), image);
+
+  SlowUpstream upstream{upstream_dir.path};
+  mirror::MirrorCache cache{cache_dir.path, upstream.prefix()};
+  http::Server server{mirror::handler(cache)};
+  const auto port = server.listen();
+  ASSERT_TRUE(port);
+  const URI uri = "http://127.0.0.1:" + std::to_string(*port) +
+                  "/example.com/worker-1.0.0-linux-amd64.aci";
+
+  const int clients = 8;
+  std::vector<std::string> bodies(clients);
+  std::vector<std::thread> threads{};
+  for (int i = 0; i < clients; i++) {
+    threads.emplace_back([&bodies, &uri, i]() {
+      const auto body = https::get_string(uri);
+      bodies[i] = body ? *body : body.failure_reason();
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  for (const auto& body : bodies) {
+    ASSERT_TRUE(image == body) << body.substr(0, 200);
+  }
+  ASSERT_EQ(1, upstream.requests);
+  ASSERT_EQ(image, read_file(pathname::join(cache_dir.path, "example.com/worker-1.0.0-linux-amd64.aci")));
+
+  // Now a hit.
+  const auto cached = https::get_string(uri);
+  ASSERT_TRUE(cached);
+  ASSERT_EQ(image, *cached);
+  ASSERT_EQ(1, upstream.requests);
+}
+
+TEST(Mirror, upstream_miss_is_bad_gateway) {
+  TempDir upstream_dir{};
+  TempDir cache_dir{};
+  SlowUpstream upstream{upstream_dir.path};
+  mirror::MirrorCache cache{cache_dir.path, upstream.prefix()};
+  http::Server server{mirror::handler(cache)};
+  const auto port = server.listen();
+  ASSERT_TRUE(port);
+  const URI base = "http://127.0.0.1:" + std::to_string(*port);
+
+  const auto missing = https::get_string(base + "/example.com/worker-9.9.9-linux-amd64.aci");
+  ASSERT_FALSE(missing);
+  ASSERT_NE(std::string::npos, missing.failure_reason().find("502"));
+  ASSERT_FALSE(https::get_string(base + "/not-an-image"));
+
+  // Failures are not cached.
+  ASSERT_FALSE(https::get_string(base + "/example.com/worker-9.9.9-linux-amd64.aci"));
+  ASSERT_EQ(2, upstream.requests);
+}
+
+TEST(Mirror, upstream_failure_mid_stream_fails_clients) {
+  TempDir cache_dir{};
+  const std::string image = pseudo_random_bytes(256 * 1024, 8);
+  // Promises the whole image, sends half and hangs up.
+  http::Server upstream{[&image](const http::Request&, http::Connection& connection) {
+    connection.send_head(200, {{"Content-Length", std::to_string(image.length())}});
+    for (size_t offset = 0; offset < image.length() / 2; offset += 16 * 1024) {
+      connection.write(image.substr(offset, 16 * 1024));
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+  }};
+  const auto upstream_port = upstream.listen();
+  ASSERT_TRUE(upstream_port);
+  mirror::MirrorCache cache{cache_dir.path, "http://127.0.0.1:" + std::to_string(*upstream_port) + "/"};
+  http::Server server{mirror::handler(cache)};
+  const auto port = server.listen();
+  ASSERT_TRUE(port);
+
+  const auto body = https::get_string("http://127.0.0.1:" + std::to_string(*port) +
+                                      "/example.com/worker-1.0.0-linux-amd64.aci");
+  ASSERT_FALSE(body) << body->length();
+  ASSERT_EQ("", read_file(pathname::join(cache_dir.path, "example.com/worker-1.0.0-linux-amd64.aci")));
+}
+
+TEST(Mirror, serves_the_simple_strategy_over_tls) {
+  TempDir upstream_dir{};
+  TempDir cache_dir{};
+  TempDir store{};
+  const std::string image = pseudo_random_bytes(128 * 1024, 9);
+  appc::os::mkdir(pathname::join(upstream_dir.path, "example.com"), 0755, true);
+  write_file(pathname::join(upstream_dir.path, "example.com/worker-1.0.0-linux-amd64.aci"), image);
+
+  SlowUpstream upstream{upstream_dir.path};
+  mirror::MirrorCache cache{cache_dir.path, upstream.prefix()};
+  setenv("APPC_CA_FILE", APPC_TEST_FIXTURES "/tls/server.pem", 1);
+  const auto context = http::tls_context(APPC_TEST_FIXTURES "/tls/server.pem",
+                                         APPC_TEST_FIXTURES "/tls/server.key");
+  ASSERT_TRUE(context) << context.failure_reason();
+  http::TlsServer server{mirror::handler(cache), *context};
+  const auto port = server.listen();
+  ASSERT_TRUE(port);
+
+  ImageProvider provider{{Strategy(
+    new strategy::simple::Resolver("https://127.0.0.1:" + std::to_string(*port) + "/"),
+    new strategy::simple::Fetcher(store.path))}};
+  const auto fetched = provider.get("example.com/worker",
+                                    {{"version", "1.0.0"}, {"os", "linux"}, {"arch", "amd64"}});
+  ASSERT_TRUE(fetched) << fetched.failure_reason();
+  ASSERT_TRUE(image == read_file(uri_file_path(*fetched)));
+}
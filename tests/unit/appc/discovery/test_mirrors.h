@@ -0,0 +1,209 @@
+#pragma once
+
+#include "appc/discovery/strategy/mirrors.h"
+#include "../../../temp_dir.h"
+
+
+using strategy::mirrors::Ranking;
+
+
+TEST(Mirrors, ranks_by_expected_transfer_time) {
+  int64_t now = 1000;
+  Ranking ranking{{"https://a/", "https://b/", "https://c/"}, "", 0.5, 600, [&now]() { return now; }};
+  ASSERT_EQ((std::vector<URI>{"https://a/", "https://b/", "https://c/"}), ranking.ranked());
+
+  // b: quick to answer but slow, c: slower to answer, much faster.
+  ranking.record_success("https://b/", 0.01, 16 << 20, 8.0);
+  ranking.record_success("https://c/", 0.2, 16 << 20, 1.0);
+  ASSERT_EQ((std::vector<URI>{"https://c/", "https://b/", "https://a/"}), ranking.ranked());
+
+  // Estimates are moving averages: one bad sample does not swap them...
+  ranking.record_success("https://c/", 0.2, 16 << 20, 160.0);
+  ASSERT_NEAR(0.5 * (16 << 20) + 0.5 * (16 << 20) / 160.0,
+              ranking.estimate("https://c/").throughput, 1);
+  ASSERT_EQ("https://c/", ranking.ranked().front());
+  // ...several do.
+  for (int i = 0; i < 3; i++) ranking.record_success("https://c/", 0.2, 16 << 20, 160.0);
+  ASSERT_EQ("https://b/", ranking.ranked().front());
+}
+
+TEST(Mirrors, failures_demote_until_success) {
+  int64_t now = 1000;
+  Ranking ranking{{"https://a/", "https://b/"}, "", 0.3, 600, [&now]() { return now; }};
+  ranking.record_success("https://a/", 0.01, 1 << 20, 0.1);
+  ranking.record_success("https://b/", 0.5, 1 << 20, 10.0);
+  ASSERT_EQ("https://a/", ranking.ranked().front());
+
+  ranking.record_failure("https://a/");
+  ASSERT_EQ((std::vector<URI>{"https://b/", "https://a/"}), ranking.ranked());
+  ranking.record_success("https://a/", 0.01, 1 << 20, 0.1);
+  ASSERT_EQ("https://a/", ranking.ranked().front());
+}
+
+TEST(Mirrors, probes_stalest_mirror_each_interval) {
+  int64_t now = 1000;
+  Ranking ranking{{"https://a/", "https://b/", "https://c/"}, "", 0.3, 600, [&now]() { return now; }};
+  ranking.record_success("https://a/", 0.01, 1 << 20, 0.1);
+  ASSERT_EQ("https://a/", ranking.ranked().front());
+
+  now += 600;
+  ASSERT_EQ("https://b/", ranking.ranked().front());
+  // Once per interval.
+  ASSERT_EQ("https://a/", ranking.ranked().front());
+  ranking.record_success("https://b/", 0.5, 1 << 20, 10.0);
+
+  now += 600;
+  ASSERT_EQ("https://c/", ranking.ranked().front());
+  ASSERT_EQ("https://a/", ranking.ranked().front());
+}
+
+TEST(Mirrors, estimates_survive_restart) {
+  TempDir dir{};
+  const Path state = pathname::join(dir.path, "mirrors");
+  {
+    Ranking ranking{{"https://a/", "https://b/"}, state};
+    ASSERT_TRUE(ranking.load());
+    ranking.record_success("https://b/", 0.25, 1 << 20, 0.5);
+    ranking.record_failure("https://a/");
+  }
+  Ranking restarted{{"https://a/", "https://b/", "https://new/"}, state};
+  ASSERT_TRUE(restarted.load());
+  ASSERT_EQ(1, restarted.estimate("https://b/").samples);
+  ASSERT_DOUBLE_EQ(0.25, restarted.estimate("https://b/").latency);
+  ASSERT_DOUBLE_EQ((1 << 20) / 0.5, restarted.estimate("https://b/").throughput);
+  ASSERT_EQ(1, restarted.estimate("https://a/").failures);
+  ASSERT_EQ((std::vector<URI>{"https://b/", "https://new/", "https://a/"}), restarted.ranked());
+
+  write_file(state, "something else\n");
+  ASSERT_FALSE(restarted.load());
+}
+
+TEST(Mirrors, estimates_are_written_at_most_every_save_interval) {
+  TempDir dir{};
+  const Path state = pathname::join(dir.path, "mirrors");
+  int64_t now = 1000;
+  const auto saved_failures = [&state]() {
+    Ranking saved{{"https://a/"}, state};
+    saved.load();
+    return saved.estimate("https://a/").failures;
+  };
+  {
+    Ranking ranking{{"https://a/"}, state, 0.3, 600, [&now]() { return now; }, 10};
+    ASSERT_TRUE(ranking.record_failure("https://a/"));
+    ASSERT_EQ(1u, saved_failures());
+    ASSERT_TRUE(ranking.record_failure("https://a/"));
+    ASSERT_EQ(1u, saved_failures());
+    now += 10;
+    ASSERT_TRUE(ranking.record_failure("https://a/"));
+    ASSERT_EQ(3u, saved_failures());
+    ASSERT_TRUE(ranking.record_failure("https://a/"));
+    ASSERT_TRUE(ranking.save());
+    ASSERT_EQ(4u, saved_failures());
+    ASSERT_TRUE(ranking.record_failure("https://a/"));
+  }
+  // The rest on destruction.
+  ASSERT_EQ(5u, saved_failures());
+}
+
+TEST(Mirrors, falls_back_to_next_mirror) {
+  TempDir upstream{};
+  TempDir store{};
+  const std::string image = pseudo_random_bytes(4096, 3);
+  appc::os::mkdir(pathname::join(upstream.path, "example.com"), 0755, true);
+  write_file(pathname::join(upstream.path, "example.com/worker-1.0.0-linux-amd64.aci"), image);
+
+  const URI dead = file_prefix + pathname::join(store.path, "nothing-here") + "/";
+  const URI live = file_prefix + upstream.path + "/";
+  {
+    const auto strategy = strategy::mirrors::StrategyBuilder()
+                            .with_storage_base_uri(file_prefix + store.path)
+                            .with_mirrors({dead, live})
+                            .with_state_path(pathname::join(store.path, "mirrors"))
+                            .build();
+    ASSERT_TRUE(strategy);
+    ImageProvider provider{{from_result(strategy)}};
+
+    const Labels labels{{"version", "1.0.0"}, {"os", "linux"}, {"arch", "amd64"}};
+    const auto fetched = provider.get("example.com/worker", labels);
+    ASSERT_TRUE(fetched) << fetched.failure_reason();
+    ASSERT_EQ(image, read_file(uri_file_path(*fetched)));
+  }
+
+  // Written out when the strategy went away. The dead mirror is now ranked last.
+  Ranking saved{{dead, live}, pathname::join(store.path, "mirrors")};
+  ASSERT_TRUE(saved.load());
+  ASSERT_EQ(1, saved.estimate(dead).failures);
+  ASSERT_EQ(1, saved.estimate(live).samples);
+  ASSERT_EQ(live, saved.ranked().front());
+}
+
+TEST(Mirrors, mirrors_replaced_in_place) {
+  TempDir upstream{};
+  TempDir store{};
+  const std::string image = pseudo_random_bytes(4096, 4);
+  appc::os::mkdir(pathname::join(upstream.path, "example.com"), 0755, true);
+  write_file(pathname::join(upstream.path, "example.com/worker-1.0.0-linux-amd64.aci"), image);
+
+  const URI dead = file_prefix + pathname::join(store.path, "nothing-here") + "/";
+  const URI live = file_prefix + upstream.path + "/";
+  const auto ranking = std::make_shared<Ranking>(std::vector<URI>{dead});
+  const auto strategy = strategy::mirrors::StrategyBuilder()
+                          .with_storage_base_uri(file_prefix + store.path)
+                          .with_ranking(ranking)
+                          .build();
+  ASSERT_TRUE(strategy);
+  ImageProvider provider{{from_result(strategy)}};
+  const Labels labels{{"version", "1.0.0"}, {"os", "linux"}, {"arch", "amd64"}};
+  ASSERT_FALSE(provider.get("example.com/worker", labels));
+  ASSERT_EQ(1, ranking->estimate(dead).failures);
+
+  ASSERT_FALSE(ranking->set_mirrors({}));
+  ASSERT_TRUE(ranking->set_mirrors({live}));
+  ASSERT_EQ((std::vector<URI>{live}), *ranking->get_mirrors());
+  const auto fetched = provider.get("example.com/worker", labels);
+  ASSERT_TRUE(fetched) << fetched.failure_reason();
+  ASSERT_EQ(image, read_file(uri_file_path(*fetched)));
+
+  // The dead mirror's estimates went with it.
+  ASSERT_TRUE(ranking->set_mirrors({dead, live}));
+  ASSERT_EQ(0, ranking->estimate(dead).failures);
+  ASSERT_EQ(1, ranking->estimate(live).samples);
+}
+
+TEST(Mirrors, only_transfer_failures_demote) {
+  TempDir upstream{};
+  TempDir store{};
+  const std::string image = pseudo_random_bytes(4096, 5);
+  appc::os::mkdir(pathname::join(upstream.path, "example.com"), 0755, true);
+  write_file(pathname::join(upstream.path, "example.com/worker-1.0.0-linux-amd64.aci"), image);
+
+  const URI live = file_prefix + upstream.path + "/";
+  const auto ranking = std::make_shared<Ranking>(std::vector<URI>{live});
+  const Labels labels{{"version", "1.0.0"}, {"os", "linux"}, {"arch", "amd64"}};
+
+  // Not the image that was asked for.
+  const auto strategy = strategy::mirrors::StrategyBuilder()
+                          .with_storage_base_uri(file_prefix + store.path)
+                          .with_ranking(ranking)
+                          .build();
+  ASSERT_TRUE(strategy);
+  ImageProvider provider{{from_result(strategy)}};
+  ASSERT_FALSE(provider.get("example.com/worker", labels,
+                            Expectation(image_id_of(pseudo_random_bytes(4096, 6)))));
+  ASSERT_EQ(0, ranking->estimate(live).failures);
+
+  // Nowhere to store it.
+  const Path blocked = pathname::join(store.path, "blocked");
+  write_file(blocked, "");
+  const auto unstorable = strategy::mirrors::StrategyBuilder()
+                            .with_storage_base_uri(file_prefix + blocked)
+                            .with_ranking(ranking)
+                            .build();
+  ASSERT_TRUE(unstorable);
+  ImageProvider nowhere{{from_result(unstorable)}};
+  ASSERT_FALSE(nowhere.get("example.com/worker", labels));
+  ASSERT_EQ(0, ranking->estimate(live).failures);
+
+  ASSERT_TRUE(provider.get("example.com/worker", labels, Expectation(image_id_of(image))));
+  ASSERT_EQ(1, ranking->estimate(live).samples);
+}
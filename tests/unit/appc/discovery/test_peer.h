@@ -0,0 +1,271 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <thread>
+
+#include "appc/discovery/strategy/peer.h"
+#include "../../../temp_dir.h"
+
+
+using strategy::peer::HashList;
+
+
+// A node sharing its store with peers on localhost, answering image requests after a short delay
+// so that transfers overlap. A lying node advertises one image and serves another.
+struct PeerNode {
+  TempDir dir{};
+  TempDir decoy_dir{};
+  strategy::peer::Store store;
+  strategy::peer::Store decoy;
+  const bool lying;
+  std::atomic<int> chunks_served{0};
+  http::Server server;
+  uint16_t port{0};
+
+  explicit PeerNode(const bool lying = false)
+  : store(dir.path, 64 * 1024),
+    decoy(decoy_dir.path, 64 * 1024),
+    lying(lying),
+    server([this](const http::Request& request, http::Connection& connection) {
+      if (request.target.compare(0, 8, "/images/") == 0) {
+        chunks_served++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        if (this->lying) {
+          strategy::peer::handler(decoy)(request, connection);
+          return;
+        }
+      }
+      strategy::peer::handler(store)(request, connection);
+    }) {
+    port = *server.listen();
+  }
+
+  void hold(const std::string& name, const std::string& image) {
+    appc::os::mkdir(pathname::dir(pathname::join(dir.path, name)), 0755, true);
+    appc::os::mkdir(pathname::dir(pathname::join(decoy_dir.path, name)), 0755, true);
+    write_file(pathname::join(dir.path, name), image);
+    std::string corrupt{image};
+    for (size_t i = 0; i < corrupt.length(); i += 4096) corrupt[i] ^= 0x5a;
+    write_file(pathname::join(decoy_dir.path, name), corrupt);
+  }
+
+  URI uri() const {
+    return "http://127.0.0.1:" + std::to_string(port) + "/";
+  }
+};
+
+
+const std::string peer_image_name{"example.com/worker-1.0.0-linux-amd64.aci"};
+
+
+inline URI peer_prefix_uri() {
+  return strategy::peer::peer_prefix + peer_image_name;
+}
+
+
+inline Try<Strategy> peer_strategy(const Path& store, const std::vector<PeerNode*>& nodes) {
+  std::vector<URI> peers{};
+  for (const auto node : nodes) peers.push_back(node->uri());
+  return strategy::peer::StrategyBuilder()
+           .with_storage_base_uri(file_prefix + store)
+           .with_peers(peers)
+           .build();
+}
+
+
+TEST(Peer, advertises_held_images) {
+  PeerNode node{};
+  const std::string image = pseudo_random_bytes(200 * 1024, 11);
+  node.hold(peer_image_name, image);
+  node.hold("example.com/other-2.0.0-linux-amd64.aci", "");
+
+  const auto listing = https::get_string(node.uri() + "images");
+  ASSERT_TRUE(listing) << listing.failure_reason();
+  ASSERT_EQ(image_id_of("").value + " 0 example.com/other-2.0.0-linux-amd64.aci\n" +
+            image_id_of(image).value + " 204800 " + peer_image_name + "\n",
+            *listing);
+
+  const auto body = https::get_string(node.uri() + "hashes/" + peer_image_name);
+  ASSERT_TRUE(body);
+  const auto hashes = HashList::parse(*body);
+  ASSERT_TRUE(hashes) << hashes.failure_reason();
+  ASSERT_EQ(image_id_of(image).value, hashes->image_id);
+  ASSERT_EQ(4u, hashes->chunks.size());
+  ASSERT_EQ(8192u, hashes->chunk_length(3));
+  ASSERT_EQ(strategy::peer::chunk_digest(image.data() + 3 * 65536, 8192), hashes->chunks[3]);
+  ASSERT_TRUE(*hashes == *HashList::parse(hashes->render()));
+  ASSERT_FALSE(HashList::parse(hashes->render() + "chunk 00\n"));
+
+  ASSERT_FALSE(https::get_string(node.uri() + "hashes/../" + peer_image_name));
+  ASSERT_FALSE(https::get_string(node.uri() + "hashes/example.com/missing-1.0.0-linux-amd64.aci"));
+}
+
+TEST(Peer, pulls_chunks_from_every_holder) {
+  const std::string image = pseudo_random_bytes(1 << 20, 12);
+  PeerNode a{};
+  PeerNode b{};
+  PeerNode c{};
+  PeerNode empty{};
+  for (auto node : {&a, &b, &c}) node->hold(peer_image_name, image);
+
+  TempDir store{};
+  const auto strategy = peer_strategy(store.path, {&empty, &a, &b, &c});
+  ASSERT_TRUE(strategy) << strategy.failure_reason();
+  ImageProvider provider{{from_result(strategy)}};
+  const Labels labels{{"version", "1.0.0"}, {"os", "linux"}, {"arch", "amd64"}};
+  const auto fetched = provider.get("example.com/worker", labels);
+  ASSERT_TRUE(fetched) << fetched.failure_reason();
+  ASSERT_EQ(pathname::join(store.path, peer_image_name), uri_file_path(*fetched));
+  ASSERT_TRUE(image == read_file(uri_file_path(*fetched)));
+
+  // 16 chunks, each pulled once, spread over the holders.
+  ASSERT_EQ(16, a.chunks_served + b.chunks_served + c.chunks_served);
+  ASSERT_LT(0, a.chunks_served);
+  ASSERT_LT(0, b.chunks_served);
+  ASSERT_LT(0, c.chunks_served);
+  ASSERT_EQ(0, empty.chunks_served);
+}
+
+TEST(Peer, drops_peers_sending_corrupt_chunks) {
+  const std::string image = pseudo_random_bytes(1 << 20, 13);
+  PeerNode honest{};
+  PeerNode liar{true};
+  honest.hold(peer_image_name, image);
+  liar.hold(peer_image_name, image);
+
+  TempDir store{};
+  const auto strategy = peer_strategy(store.path, {&liar, &honest});
+  ASSERT_TRUE(strategy);
+  const auto fetched = (*strategy).get_fetcher()->fetch(peer_prefix_uri());
+  ASSERT_TRUE(fetched) << fetched.failure_reason();
+  ASSERT_TRUE(image == read_file(uri_file_path(*fetched)));
+  // Each of its two connections gave up after one bad chunk.
+  ASSERT_GE(2, liar.chunks_served);
+
+  // With only liars nothing is stored.
+  TempDir other_store{};
+  const auto liars_only = peer_strategy(other_store.path, {&liar});
+  ASSERT_TRUE(liars_only);
+  const auto failed = (*liars_only).get_fetcher()->fetch(peer_prefix_uri());
+  ASSERT_FALSE(failed);
+  ASSERT_NE(std::string::npos, failed.failure_reason().find("corrupt chunk"));
+  ASSERT_EQ("", read_file(pathname::join(other_store.path, peer_image_name)));
+}
+
+TEST(Peer, expectation_selects_holders_of_the_image) {
+  const std::string image = pseudo_random_bytes(300 * 1024, 14);
+  const std::string rebuilt = pseudo_random_bytes(300 * 1024, 15);
+  PeerNode stale{};
+  PeerNode current{};
+  stale.hold(peer_image_name, rebuilt);
+  current.hold(peer_image_name, image);
+
+  TempDir store{};
+  const auto strategy = peer_strategy(store.path, {&stale, &current});
+  ASSERT_TRUE(strategy);
+  const auto fetcher = (*strategy).get_fetcher();
+  const auto fetched = fetcher->fetch(peer_prefix_uri(), Expectation(image_id_of(image)));
+  ASSERT_TRUE(fetched) << fetched.failure_reason();
+  ASSERT_TRUE(image == read_file(uri_file_path(*fetched)));
+  ASSERT_EQ(0, stale.chunks_served);
+
+  const auto missing = fetcher->fetch(peer_prefix_uri(),
+                                      Expectation(image_id_of(pseudo_random_bytes(10, 16))));
+  ASSERT_FALSE(missing);
+  ASSERT_NE(std::string::npos, missing.failure_reason().find("No peer holds"));
+}
+
+TEST(Peer, out_of_range_byte_ranges_are_refused) {
+  PeerNode node{};
+  node.hold(peer_image_name, pseudo_random_bytes(100 * 1024, 19));
+  const URI uri = node.uri() + "images/" + peer_image_name;
+  long status = 0;
+  ASSERT_FALSE(get_with_headers(uri, {"Range: bytes=0-99999999999999999999999"}, status));
+  ASSERT_FALSE(get_with_headers(uri, {"Range: bytes=99999999999999999999999-"}, status));
+  // Still serving.
+  const auto head = get_with_headers(uri, {"Range: bytes=0-9"}, status);
+  ASSERT_TRUE(head) << head.failure_reason();
+  ASSERT_EQ(206, status);
+  ASSERT_EQ(10u, head->length());
+}
+
+TEST(Peer, range_reads_take_only_the_asked_bytes) {
+  // Ignores the range, or answers it with the rest of the resource.
+  http::Server server{[](const http::Request& request, http::Connection& connection) {
+    connection.send_response(request.target == "/whole" ? 200 : 206, "0123456789");
+  }};
+  const auto port = server.listen();
+  ASSERT_TRUE(port);
+  const URI base = "http://127.0.0.1:" + std::to_string(*port);
+  std::string data{};
+  const auto whole = https::RangeReader{base + "/whole"}.read(2, 3, data);
+  ASSERT_FALSE(whole);
+  ASSERT_NE(std::string::npos, whole.message.find("206")) << whole.message;
+  ASSERT_FALSE(https::RangeReader{base + "/long"}.read(2, 3, data));
+  ASSERT_TRUE(https::RangeReader{base + "/long"}.read(0, 10, data));
+  ASSERT_EQ("0123456789", data);
+  ASSERT_FALSE(https::RangeReader{base + "/short"}.read(0, 11, data));
+}
+
+TEST(Peer, hash_lists_are_bounded) {
+  const auto listing = [](const std::string& size, const std::string& chunk_size, const int chunks) {
+    std::string text = "appc-peer-hashes 1\nid sha512-00\nsize " + size + "\nchunk-size " +
+                       chunk_size + "\n";
+    for (int i = 0; i < chunks; i++) text += "chunk 00\n";
+    return text;
+  };
+  ASSERT_TRUE(HashList::parse(listing("8193", "4096", 3)));
+  ASSERT_FALSE(HashList::parse(listing("8193", "4096", 4)));
+  // (size + chunk_size - 1) would wrap to a single chunk.
+  ASSERT_FALSE(HashList::parse(listing("18446744073709551615", "4096", 1),
+                               std::numeric_limits<uint64_t>::max()));
+  ASSERT_FALSE(HashList::parse(listing("18446744073709551615", "4096", 1)));
+  ASSERT_FALSE(HashList::parse(listing("8193", "4096", 3), 8192));
+  ASSERT_FALSE(HashList::parse(listing("8193", "0", 0)));
+  ASSERT_FALSE(HashList::parse(listing("8193", "1", 8193)));
+  ASSERT_FALSE(HashList::parse(listing("8193", "1099511627776", 1)));
+
+  // An Expectation bounds what the peers may claim.
+  const std::string image = pseudo_random_bytes(300 * 1024, 17);
+  PeerNode node{};
+  node.hold(peer_image_name, image);
+  TempDir store{};
+  const auto strategy = peer_strategy(store.path, {&node});
+  ASSERT_TRUE(strategy);
+  const auto fetched = (*strategy).get_fetcher()->fetch(peer_prefix_uri(),
+                                                        Expectation(image_id_of(image), 100 * 1024));
+  ASSERT_FALSE(fetched);
+  ASSERT_NE(std::string::npos, fetched.failure_reason().find("more than the limit"));
+  ASSERT_EQ(0, node.chunks_served);
+}
+
+TEST(Peer, corrupt_chunk_drops_peer_on_every_connection) {
+  const std::string image = pseudo_random_bytes(64 * 1024, 18);
+  HashList hashes{image_id_of(image).value, image.length(), 16 * 1024, {}};
+  for (size_t chunk = 0; chunk < 4; chunk++) {
+    hashes.chunks.push_back(strategy::peer::chunk_digest(image.data() + chunk * 16 * 1024, 16 * 1024));
+  }
+  TempDir dir{};
+  appc::os::StagedFile file{pathname::join(dir.path, "image.aci")};
+  ASSERT_TRUE(file.open());
+  strategy::peer::Swarm swarm{hashes, file};
+
+  size_t first = 0;
+  size_t second = 0;
+  ASSERT_TRUE(swarm.next("liar", first));
+  ASSERT_TRUE(swarm.next("liar", second));
+  ASSERT_FALSE(swarm.deliver(first, std::string(16 * 1024, 'x'), "liar"));
+  // The liar's other connection stops once its chunk is in.
+  ASSERT_TRUE(swarm.deliver(second, image.substr(second * 16 * 1024, 16 * 1024), "liar"));
+  size_t chunk = 0;
+  ASSERT_FALSE(swarm.next("liar", chunk));
+
+  while (swarm.next("honest", chunk)) {
+    ASSERT_TRUE(swarm.deliver(chunk, image.substr(chunk * 16 * 1024, 16 * 1024), "honest"));
+  }
+  ASSERT_TRUE(swarm.result());
+  ASSERT_TRUE(file.commit());
+  ASSERT_TRUE(image == read_file(pathname::join(dir.path, "image.aci")));
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <memory>
+#include <set>
+
+#include "appc/discovery/plan.h"
+#include "appc/discovery/provider.h"
+
+
+// A strategy that has a fixed set of names and takes a fixed time (on a fake clock) per attempt.
+class ScriptedResolver : public Resolver {
+private:
+  double& clock;
+  const double cost;
+  const std::set<Name> names;
+public:
+  int attempts{0};
+
+  ScriptedResolver(double& clock, const double cost, const std::set<Name>& names)
+  : clock(clock),
+    cost(cost),
+    names(names) {}
+
+  virtual Try<URI> resolve(const Name& name, const Labels&) {
+    attempts++;
+    clock += cost;
+    if (names.count(name) == 0) return Failure<URI>("No " + name);
+    return Result(file_prefix + "/images/" + name);
+  }
+};
+
+
+class PassThroughFetcher : public Fetcher {
+public:
+  virtual Try<URI> fetch(const URI& uri) {
+    return Result(uri);
+  }
+};
+
+
+struct PlanFixture {
+  double clock{0};
+  ScriptedResolver* local;
+  ScriptedResolver* remote;
+  std::vector<Strategy> strategies{};
+  std::shared_ptr<AdaptivePlan> plan{};
+
+  explicit PlanFixture(const AdaptivePlan::Order order = AdaptivePlan::Order::adaptive)
+  : local(new ScriptedResolver(clock, 0.5, {"example.com/cached", "example.com/local-only"})),
+    remote(new ScriptedResolver(clock, 1.0, {"example.com/cached", "example.com/a",
+                                             "example.com/b", "other.org/a"})),
+    plan(std::make_shared<AdaptivePlan>(order, 0.2, [this]() { return clock; })) {
+    strategies.push_back(Strategy(local, new PassThroughFetcher(), "local"));
+    strategies.push_back(Strategy(remote, new PassThroughFetcher(), "remote"));
+  }
+
+  std::vector<size_t> order(const Name& name) const {
+    return plan->order(name, strategies);
+  }
+};
+
+
+TEST(Plan, fixed_order_never_changes) {
+  PlanFixture fixture{AdaptivePlan::Order::fixed};
+  const ImageProvider provider{fixture.strategies, LabelAliases(), fixture.plan};
+  for (int i = 0; i < 5; i++) ASSERT_TRUE(provider.get("example.com/a", {}));
+  ASSERT_EQ((std::vector<size_t>{0, 1}), fixture.order("example.com/a"));
+  ASSERT_EQ(5, fixture.local->attempts);
+
+  const auto stats = fixture.plan->stats().at("example.com");
+  ASSERT_EQ(5, stats.at("local").attempts);
+  ASSERT_EQ(0, stats.at("local").hits);
+  ASSERT_EQ(5, stats.at("remote").hits);
+  ASSERT_DOUBLE_EQ(1.0, stats.at("remote").mean_seconds);
+}
+
+TEST(Plan, learns_to_skip_strategies_that_miss) {
+  PlanFixture fixture{};
+  const ImageProvider provider{fixture.strategies, LabelAliases(), fixture.plan};
+  ASSERT_EQ((std::vector<size_t>{0, 1}), fixture.order("example.com/a"));
+
+  ASSERT_TRUE(provider.get("example.com/a", {}));
+  // local: 0.5s / (1/3), remote: 1s / (2/3): a tie keeps the given order.
+  ASSERT_EQ((std::vector<size_t>{0, 1}), fixture.order("example.com/b"));
+  ASSERT_TRUE(provider.get("example.com/b", {}));
+  ASSERT_EQ((std::vector<size_t>{1, 0}), fixture.order("example.com/b"));
+
+  for (int i = 0; i < 10; i++) ASSERT_TRUE(provider.get("example.com/b", {}));
+  ASSERT_EQ(2, fixture.local->attempts);
+
+  // Names only the skipped strategy has are still found, after the others miss.
+  ASSERT_TRUE(provider.get("example.com/local-only", {}));
+  ASSERT_EQ(3, fixture.local->attempts);
+
+  // Other prefixes have their own history.
+  ASSERT_EQ((std::vector<size_t>{0, 1}), fixture.order("other.org/a"));
+}
+
+TEST(Plan, is_deterministic) {
+  std::vector<std::vector<size_t>> orders[2];
+  for (auto& run : orders) {
+    PlanFixture fixture{};
+    const ImageProvider provider{fixture.strategies, LabelAliases(), fixture.plan};
+    for (const auto& name : {"example.com/a", "example.com/cached", "example.com/b",
+                             "example.com/cached", "other.org/a", "example.com/cached"}) {
+      provider.get(name, {});
+      run.push_back(fixture.order(name));
+    }
+  }
+  ASSERT_EQ(orders[0], orders[1]);
+}
+
+// Batches follow the plan too: once local has been learned to miss example.com, a batch of its
+// names goes to remote first, and local only sees what remote did not have.
+TEST(Plan, orders_batches) {
+  PlanFixture fixture{};
+  const ImageProvider provider{fixture.strategies, LabelAliases(), fixture.plan};
+  ASSERT_TRUE(provider.get("example.com/a", {}));
+  ASSERT_TRUE(provider.get("example.com/b", {}));
+  ASSERT_EQ((std::vector<size_t>{1, 0}), fixture.order("example.com/a"));
+  const int local_attempts = fixture.local->attempts;
+
+  const auto results = provider.get_all({ImageReference{"example.com/a", {}},
+                                         ImageReference{"example.com/local-only", {}},
+                                         ImageReference{"other.org/a", {}}});
+  ASSERT_TRUE(results[0]);
+  ASSERT_TRUE(results[1]);
+  ASSERT_TRUE(results[2]);
+  // local-only after remote missed it, and other.org/a, which has no history, local first.
+  ASSERT_EQ(local_attempts + 2, fixture.local->attempts);
+  const auto remote = fixture.plan->stats().at("example.com").at("remote");
+  ASSERT_EQ(4, remote.attempts);
+  ASSERT_EQ(3, remote.hits);
+}
+
+// What has been learned is kept by strategy name, across a change of strategies.
+TEST(Plan, survives_reconfiguration) {
+  PlanFixture fixture{};
+  ImageProvider provider{fixture.strategies, LabelAliases(), fixture.plan};
+  ASSERT_TRUE(provider.get("example.com/a", {}));
+  ASSERT_TRUE(provider.get("example.com/b", {}));
+
+  const std::vector<Strategy> reordered{fixture.strategies[1], fixture.strategies[0]};
+  provider.configure(reordered, LabelAliases(), fixture.plan);
+  ASSERT_EQ((std::vector<size_t>{0, 1}), fixture.plan->order("example.com/a", reordered));
+  const int local_attempts = fixture.local->attempts;
+  ASSERT_TRUE(provider.get("example.com/a", {}));
+  ASSERT_EQ(local_attempts, fixture.local->attempts);
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+#include "appc/discovery/signature.h"
+#include "../../../temp_dir.h"
+
+using namespace appc::discovery;
+
+
+const std::string fixtures{APPC_TEST_FIXTURES "/discovery"};
+const std::string signed_aci{fixtures + "/signed-1.0.0-linux-amd64.aci"};
+
+
+inline std::string read_fixture(const std::string& path) {
+  std::ifstream file{path, std::ios::binary};
+  std::stringstream contents{};
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+
+inline std::shared_future<Try<signature::Bytes>> ready_signature(const std::string& path) {
+  std::promise<Try<signature::Bytes>> promise{};
+  promise.set_value(Result(read_fixture(path)));
+  return promise.get_future().share();
+}
+
+
+inline Status verify_streamed(const signature::Keyring& keyring,
+                              std::shared_future<Try<signature::Bytes>> pending,
+                              const std::string& data) {
+  signature::SignatureVerifier verifier{keyring, pending};
+  for (size_t pos = 0; pos < data.length(); pos += 64) {
+    auto updated = verifier.update(data.data() + pos, std::min<size_t>(64, data.length() - pos));
+    if (!updated) return updated;
+  }
+  return verifier.finish();
+}
+
+
+TEST(Keyring, loads_binary_directory) {
+  auto keyring = signature::Keyring::from_path(fixtures + "/keyring");
+  ASSERT_TRUE(keyring) << keyring.failure_reason();
+  ASSERT_EQ(1u, keyring->size());
+}
+
+TEST(Keyring, loads_armored_file) {
+  auto keyring = signature::Keyring::from_path(fixtures + "/trusted.gpg.asc");
+  ASSERT_TRUE(keyring) << keyring.failure_reason();
+  ASSERT_EQ(1u, keyring->size());
+}
+
+TEST(SignatureVerifier, binary_signature_verifies) {
+  auto keyring = signature::Keyring::from_path(fixtures + "/keyring");
+  auto verified = verify_streamed(*keyring, ready_signature(signed_aci + ".sig"),
+                                  read_fixture(signed_aci));
+  ASSERT_TRUE(verified) << verified.message;
+}
+
+TEST(SignatureVerifier, armored_sha512_signature_verifies) {
+  auto keyring = signature::Keyring::from_path(fixtures + "/keyring");
+  auto verified = verify_streamed(*keyring, ready_signature(signed_aci + ".asc"),
+                                  read_fixture(signed_aci));
+  ASSERT_TRUE(verified) << verified.message;
+}
+
+TEST(SignatureVerifier, signature_arriving_after_data) {
+  auto keyring = signature::Keyring::from_path(fixtures + "/keyring");
+  std::promise<Try<signature::Bytes>> promise{};
+  signature::SignatureVerifier verifier{*keyring, promise.get_future().share()};
+  const auto data = read_fixture(signed_aci);
+  ASSERT_TRUE(verifier.update(data.data(), 100));
+  ASSERT_EQ(5u, verifier.hashing());
+  promise.set_value(Result(read_fixture(signed_aci + ".sig")));
+  ASSERT_TRUE(verifier.update(data.data() + 100, data.length() - 100));
+  ASSERT_EQ(1u, verifier.hashing());
+  ASSERT_TRUE(verifier.finish());
+}
+
+TEST(SignatureVerifier, signature_in_time_hashes_with_its_algorithm_only) {
+  auto keyring = signature::Keyring::from_path(fixtures + "/keyring");
+  std::promise<Try<signature::Bytes>> promise{};
+  signature::SignatureVerifier verifier{*keyring, promise.get_future().share()};
+  promise.set_value(Result(read_fixture(signed_aci + ".sig")));
+  const auto data = read_fixture(signed_aci);
+  ASSERT_TRUE(verifier.update(data.data(), data.length()));
+  ASSERT_EQ(1u, verifier.hashing());
+  ASSERT_TRUE(verifier.finish());
+}
+
+TEST(SignatureVerifier, updates_do_not_wait_for_the_signature) {
+  auto keyring = signature::Keyring::from_path(fixtures + "/keyring");
+  std::promise<Try<signature::Bytes>> promise{};
+  signature::SignatureVerifier verifier{*keyring, promise.get_future().share()};
+  const auto data = read_fixture(signed_aci);
+  const auto started = std::chrono::steady_clock::now();
+  ASSERT_TRUE(verifier.update(data.data(), data.length()));
+  ASSERT_GT(std::chrono::milliseconds(250), std::chrono::steady_clock::now() - started);
+  promise.set_value(Result(read_fixture(signed_aci + ".sig")));
+  ASSERT_TRUE(verifier.finish());
+}
+
+TEST(SignatureVerifier, untrusted_key_fails) {
+  auto keyring = signature::Keyring::from_path(fixtures + "/keyring");
+  ASSERT_FALSE(verify_streamed(*keyring, ready_signature(fixtures + "/untrusted.aci.sig"),
+                               read_fixture(signed_aci)));
+}
+
+TEST(SignatureVerifier, tampered_data_fails) {
+  auto keyring = signature::Keyring::from_path(fixtures + "/keyring");
+  auto data = read_fixture(signed_aci);
+  data[data.length() / 2] ^= 0x01;
+  ASSERT_FALSE(verify_streamed(*keyring, ready_signature(signed_aci + ".sig"), data));
+}
+
+TEST(SignatureVerifier, get_signed_fetches_and_verifies) {
+  auto keyring = signature::Keyring::from_path(fixtures + "/keyring");
+  TempDir dir{};
+  const std::string written{dir.path + "/signed.aci"};
+  auto fetched = signature::get_signed(file_prefix + signed_aci, written, *keyring);
+  ASSERT_TRUE(fetched) << fetched.message;
+  ASSERT_EQ(0, access(written.c_str(), F_OK));
+}
+
+TEST(SignatureVerifier, get_signed_missing_signature_fails) {
+  auto keyring = signature::Keyring::from_path(fixtures + "/keyring");
+  TempDir dir{};
+  const std::string written{dir.path + "/trusted.aci"};
+  ASSERT_FALSE(signature::get_signed(file_prefix + fixtures + "/trusted.gpg.asc", written, *keyring));
+  ASSERT_NE(0, access(written.c_str(), F_OK));
+}
+
+TEST(SignatureVerifier, signatures_are_fetched_with_a_size_cap) {
+  const URI sig_uri = file_prefix + signed_aci + ".sig";
+  ASSERT_TRUE(https::get_string(sig_uri, signature::max_signature_size));
+  const auto capped = https::get_string(sig_uri, 100);
+  ASSERT_FALSE(capped);
+  ASSERT_NE(std::string::npos, capped.failure_reason().find("exceeds 100 bytes"));
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cstdlib>
+
+#include "appc/discovery/curl.h"
+#include "appc/net/tls_server.h"
+#include "../../../integration/discovery/stand_in.h"
+#include "../../../temp_dir.h"
+
+
+struct TlsStandIn {
+  stand_in::ImageHost host;
+  std::unique_ptr<http::TlsServer> server{};
+  URI base{};
+
+  explicit TlsStandIn(const stand_in::Faults& faults = stand_in::Faults())
+  : host(faults) {
+    setenv("APPC_CA_FILE", APPC_TEST_FIXTURES "/tls/server.pem", 1);
+    const auto context = http::tls_context(APPC_TEST_FIXTURES "/tls/server.pem",
+                                           APPC_TEST_FIXTURES "/tls/server.key");
+    if (!context) throw std::runtime_error(context.failure_reason());
+    server.reset(new http::TlsServer(host.handler(), *context));
+    base = "https://127.0.0.1:" + std::to_string(*server->listen()) + "/";
+  }
+};
+
+
+inline Try<std::string> get_with_headers(const URI& uri, const std::vector<std::string>& headers, long& status) {
+  char error_buffer[CURL_ERROR_SIZE];
+  const auto curl = https::new_handle(uri, error_buffer);
+  if (!curl) return Failure<std::string>(curl.failure_reason());
+  curl_slist* list = nullptr;
+  for (const auto& header : headers) list = curl_slist_append(list, header.c_str());
+  std::string body{};
+  curl_easy_setopt(curl->get(), CURLOPT_HTTPHEADER, list);
+  curl_easy_setopt(curl->get(), CURLOPT_WRITEFUNCTION, https::string_writer);
+  curl_easy_setopt(curl->get(), CURLOPT_WRITEDATA, &body);
+  const CURLcode result = curl_easy_perform(curl->get());
+  curl_slist_free_all(list);
+  if (result != CURLE_OK) return Failure<std::string>(error_buffer);
+  curl_easy_getinfo(curl->get(), CURLINFO_RESPONSE_CODE, &status);
+  return Result(body);
+}
+
+
+TEST(StandIn, serves_over_tls) {
+  TlsStandIn stand_in{};
+  const std::string image = pseudo_random_bytes(300 * 1024, 5);
+  stand_in.host.add("/example.com/worker-1.0.0-linux-amd64.aci", image);
+  const auto body = https::get_string(stand_in.base + "example.com/worker-1.0.0-linux-amd64.aci");
+  ASSERT_TRUE(body) << body.failure_reason();
+  ASSERT_TRUE(image == *body);
+  ASSERT_FALSE(https::get_string(stand_in.base + "example.com/missing.aci"));
+}
+
+TEST(StandIn, ranges_and_etags) {
+  TlsStandIn stand_in{};
+  const std::string image = pseudo_random_bytes(100 * 1024, 6);
+  stand_in.host.add("/image.aci", image);
+  const URI uri = stand_in.base + "image.aci";
+  long status = 0;
+
+  const auto middle = get_with_headers(uri, {"Range: bytes=1000-1999"}, status);
+  ASSERT_TRUE(middle) << middle.failure_reason();
+  ASSERT_EQ(206, status);
+  ASSERT_TRUE(image.substr(1000, 1000) == *middle);
+  const auto suffix = get_with_headers(uri, {"Range: bytes=-10"}, status);
+  ASSERT_TRUE(suffix);
+  ASSERT_EQ(206, status);
+  ASSERT_TRUE(image.substr(image.length() - 10) == *suffix);
+  ASSERT_FALSE(get_with_headers(uri, {"Range: bytes=200000-"}, status));
+
+  const auto unchanged = get_with_headers(uri, {"If-None-Match: " + stand_in::etag_of(image)}, status);
+  ASSERT_TRUE(unchanged);
+  ASSERT_EQ(304, status);
+  ASSERT_TRUE(unchanged->empty());
+  const auto changed = get_with_headers(uri, {"If-None-Match: \"something-else\""}, status);
+  ASSERT_TRUE(changed);
+  ASSERT_EQ(200, status);
+  ASSERT_EQ(image.length(), changed->length());
+}
+
+TEST(StandIn, injected_failures_leave_nothing_behind) {
+  stand_in::Faults faults{};
+  faults.error_rate = 1;
+  TlsStandIn stand_in{faults};
+  stand_in.host.add("/image.aci", pseudo_random_bytes(256 * 1024, 7));
+  TempDir store{};
+  for (int i = 0; i < 6; i++) {
+    ASSERT_FALSE(https::get(stand_in.base + "image.aci", pathname::join(store.path, "image.aci")));
+  }
+  ASSERT_EQ(6, stand_in.host.counters.injected_errors);
+  ASSERT_EQ("", read_file(pathname::join(store.path, "image.aci")));
+}
+
+TEST(HttpServer, handler_exceptions_fail_only_their_request) {
+  http::Server server{[](const http::Request& request, http::Connection& connection) {
+    if (request.target == "/before") throw std::out_of_range("before");
+    if (request.target == "/after") {
+      connection.send_head(200, {{"Content-Length", "100"}});
+      connection.write("partial");
+      throw std::runtime_error("after");
+    }
+    connection.send_response(200, "fine");
+  }};
+  const auto port = server.listen();
+  ASSERT_TRUE(port);
+  const URI base = "http://127.0.0.1:" + std::to_string(*port);
+
+  long status = 0;
+  const auto before = get_with_headers(base + "/before", {}, status);
+  ASSERT_FALSE(before);
+  ASSERT_NE(std::string::npos, before.failure_reason().find("500"));
+  ASSERT_FALSE(https::get_string(base + "/after"));
+  const auto fine = https::get_string(base + "/fine");
+  ASSERT_TRUE(fine) << fine.failure_reason();
+  ASSERT_EQ("fine", *fine);
+}
+
+inline int connect_to(const uint16_t port) {
+  const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  struct sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+TEST(HttpServer, idle_connections_time_out_and_do_not_block_stop) {
+  const auto handler = [](const http::Request&, http::Connection& connection) {
+    connection.send_response(200, "fine");
+  };
+  {
+    http::Server server{handler, http::Server::Options(std::chrono::milliseconds(200))};
+    const auto port = server.listen();
+    ASSERT_TRUE(port);
+    const int idle = connect_to(*port);
+    ASSERT_LE(0, idle);
+    // Sent nothing: dropped (with a 400) once the timeout passes.
+    char buffer[256];
+    ASSERT_LT(0, recv(idle, buffer, sizeof(buffer), 0));
+    close(idle);
+  }
+
+  http::Server server{handler};
+  const auto port = server.listen();
+  ASSERT_TRUE(port);
+  const int idle = connect_to(*port);
+  ASSERT_LE(0, idle);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  const auto started = std::chrono::steady_clock::now();
+  server.stop();
+  ASSERT_GT(std::chrono::seconds(5), std::chrono::steady_clock::now() - started);
+  close(idle);
+}
+
+TEST(HttpServer, connections_beyond_the_limit_are_refused) {
+  http::Server server{[](const http::Request&, http::Connection& connection) {
+                        connection.send_response(200, "fine");
+                      },
+                      http::Server::Options(std::chrono::seconds(30), 1)};
+  const auto port = server.listen();
+  ASSERT_TRUE(port);
+  const int idle = connect_to(*port);
+  ASSERT_LE(0, idle);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  const auto refused = https::get_string("http://127.0.0.1:" + std::to_string(*port) + "/");
+  ASSERT_FALSE(refused);
+  ASSERT_NE(std::string::npos, refused.failure_reason().find("503"));
+  close(idle);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ASSERT_TRUE(https::get_string("http://127.0.0.1:" + std::to_string(*port) + "/"));
+}
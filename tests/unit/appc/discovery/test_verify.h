@@ -0,0 +1,130 @@
+#pragma once
+
+#include <fstream>
+#include <sstream>
+#include <zlib.h>
+
+#include "appc/discovery/verify.h"
+
+using namespace appc::discovery;
+
+
+const std::string sha512_abc{
+  "sha512-ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+  "2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f"};
+
+// The tar inside tests/fixtures/discovery/signed-1.0.0-linux-amd64.aci, which the bzip2- and xz-
+// fixtures hold recompressed.
+const std::string fixture_image_id{
+  "sha512-51f910d10cf82c85bee46865e56687d352c7419463c28377fff2f5b42a71f75d"
+  "992ec33f0029d8d43da4fb8deab1c3f852eeb778452c8999fb29d9dda47b5ea8"};
+
+
+inline std::string gzip(const std::string& data) {
+  z_stream stream{};
+  deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+  std::string out(deflateBound(&stream, data.length()) + 32, '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.length();
+  stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+  stream.avail_out = out.length();
+  deflate(&stream, Z_FINISH);
+  out.resize(stream.total_out);
+  deflateEnd(&stream);
+  return out;
+}
+
+
+inline std::string discovery_fixture(const std::string& name) {
+  std::ifstream in{APPC_TEST_FIXTURES "/discovery/" + name, std::ios::binary};
+  std::stringstream contents{};
+  contents << in.rdbuf();
+  return contents.str();
+}
+
+
+// Fed a few bytes at a time, so that decompression resumes across updates.
+inline Status verify_in_pieces(ImageVerifier& verifier, const std::string& compressed) {
+  for (size_t offset = 0; offset < compressed.length(); offset += 7) {
+    const auto updated = verifier.update(compressed.data() + offset,
+                                         std::min<size_t>(7, compressed.length() - offset));
+    if (!updated) return updated;
+  }
+  return verifier.finish();
+}
+
+
+TEST(ImageVerifier, uncompressed_matches) {
+  ImageVerifier verifier{Expectation(ImageID(sha512_abc))};
+  ASSERT_TRUE(verifier.supported());
+  ASSERT_TRUE(verifier.update("abc", 3));
+  ASSERT_TRUE(verifier.finish());
+}
+
+TEST(ImageVerifier, truncated_id_matches) {
+  ImageVerifier verifier{Expectation(ImageID(sha512_abc.substr(0, 39)))};
+  ASSERT_TRUE(verifier.update("abc", 3));
+  ASSERT_TRUE(verifier.finish());
+}
+
+TEST(ImageVerifier, uncompressed_mismatch) {
+  ImageVerifier verifier{Expectation(ImageID(sha512_abc))};
+  ASSERT_TRUE(verifier.update("abd", 3));
+  ASSERT_FALSE(verifier.finish());
+}
+
+TEST(ImageVerifier, gzip_hashes_decompressed_stream) {
+  const std::string compressed = gzip("abc");
+  ImageVerifier verifier{Expectation(ImageID(sha512_abc))};
+  for (const char byte : compressed) {
+    ASSERT_TRUE(verifier.update(&byte, 1));
+  }
+  ASSERT_TRUE(verifier.finish());
+}
+
+TEST(ImageVerifier, gzip_truncated_fails) {
+  const std::string compressed = gzip(std::string(4096, 'x'));
+  ImageVerifier verifier{Expectation(ImageID(sha512_abc))};
+  ASSERT_TRUE(verifier.update(compressed.data(), compressed.length() / 2));
+  ASSERT_FALSE(verifier.finish());
+}
+
+TEST(ImageVerifier, corrupt_gzip_fails_early) {
+  std::string compressed = gzip(std::string(4096, 'x'));
+  for (size_t i = 10; i < compressed.length(); i++) compressed[i] = ~compressed[i];
+  ImageVerifier verifier{Expectation(ImageID(sha512_abc))};
+  ASSERT_FALSE(verifier.update(compressed.data(), compressed.length()));
+}
+
+TEST(ImageVerifier, bzip2_hashes_decompressed_stream) {
+  const std::string compressed = discovery_fixture("bzip2-1.0.0-linux-amd64.aci");
+  ASSERT_EQ("BZh", compressed.substr(0, 3));
+  ImageVerifier verifier{Expectation(ImageID(fixture_image_id))};
+  ASSERT_TRUE(verify_in_pieces(verifier, compressed));
+
+  ImageVerifier truncated{Expectation(ImageID(fixture_image_id))};
+  ASSERT_FALSE(verify_in_pieces(truncated, compressed.substr(0, compressed.length() - 16)));
+}
+
+TEST(ImageVerifier, xz_hashes_decompressed_stream) {
+  const std::string compressed = discovery_fixture("xz-1.0.0-linux-amd64.aci");
+  ASSERT_EQ("\xFD" "7zXZ", compressed.substr(0, 5));
+  ImageVerifier verifier{Expectation(ImageID(fixture_image_id))};
+  ASSERT_TRUE(verify_in_pieces(verifier, compressed));
+
+  ImageVerifier truncated{Expectation(ImageID(fixture_image_id))};
+  ASSERT_FALSE(verify_in_pieces(truncated, compressed.substr(0, compressed.length() - 16)));
+}
+
+TEST(ImageVerifier, size_exceeded_fails_early) {
+  ImageVerifier verifier{Expectation(ImageID(sha512_abc), 1024)};
+  const std::string chunk(512, 'x');
+  ASSERT_TRUE(verifier.update(chunk.data(), chunk.length()));
+  ASSERT_TRUE(verifier.update(chunk.data(), chunk.length()));
+  ASSERT_FALSE(verifier.update(chunk.data(), 1));
+}
+
+TEST(ImageVerifier, unsupported_hash) {
+  ImageVerifier verifier{Expectation(ImageID("sha256-abcdef"))};
+  ASSERT_FALSE(verifier.supported());
+}
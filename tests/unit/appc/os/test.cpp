@@ -0,0 +1,6 @@
+#include "gtest/gtest.h"
+
+#include "test_staged_file.h"
+#include "test_fs.h"
+#include "test_process.h"
+#include "test_file_index.h"
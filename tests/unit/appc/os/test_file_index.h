@@ -0,0 +1,106 @@
+#pragma once
+
+#include <chrono>
+#include <fstream>
+
+#include "appc/os/file_index.h"
+#include "appc/os/mkdir.h"
+#include "../../../temp_dir.h"
+
+
+using appc::os::FileIndex;
+
+
+inline void touch(const std::string& path) {
+  std::ofstream{path};
+}
+
+
+TEST(FileIndex, scans_existing_tree) {
+  TempDir dir{};
+  ASSERT_TRUE(appc::os::mkdir(dir.path + "/example.com/nested", 0755, true));
+  touch(dir.path + "/top.aci");
+  touch(dir.path + "/example.com/worker.aci");
+  touch(dir.path + "/example.com/nested/deep.aci");
+
+  FileIndex index{dir.path + "/"};
+  ASSERT_TRUE(index.open());
+  ASSERT_EQ(3, index.size());
+  ASSERT_EQ(FileIndex::Presence::present, index.contains(dir.path + "/example.com/worker.aci"));
+  ASSERT_EQ(FileIndex::Presence::present, index.contains(dir.path + "/example.com/nested/deep.aci"));
+  ASSERT_EQ(FileIndex::Presence::absent, index.contains(dir.path + "/example.com/other.aci"));
+  // Directories are not files.
+  ASSERT_EQ(FileIndex::Presence::absent, index.contains(dir.path + "/example.com"));
+  // Not the index's to answer.
+  ASSERT_EQ(FileIndex::Presence::unknown, index.contains("/etc/passwd"));
+  ASSERT_EQ(FileIndex::Presence::unknown, index.contains(dir.path + "/example.com/../top.aci"));
+  ASSERT_EQ(FileIndex::Presence::unknown, index.contains(dir.path + "//top.aci"));
+}
+
+TEST(FileIndex, follows_changes) {
+  TempDir dir{};
+  FileIndex index{dir.path};
+  ASSERT_TRUE(index.open());
+  const std::string image = dir.path + "/example.com/worker.aci";
+  ASSERT_EQ(FileIndex::Presence::absent, index.contains(image));
+
+  // A new directory is watched, and anything created in it before the watch is picked up.
+  ASSERT_TRUE(appc::os::mkdir(dir.path + "/example.com", 0755, true));
+  touch(image);
+  ASSERT_EQ(FileIndex::Presence::present, index.contains(image));
+
+  // Renames, including the hidden-name-then-rename pattern of staged writes.
+  touch(dir.path + "/example.com/.staging");
+  ASSERT_EQ(0, rename((dir.path + "/example.com/.staging").c_str(),
+                      (dir.path + "/example.com/next.aci").c_str()));
+  ASSERT_EQ(FileIndex::Presence::present, index.contains(dir.path + "/example.com/next.aci"));
+  ASSERT_EQ(FileIndex::Presence::absent, index.contains(dir.path + "/example.com/.staging"));
+
+  ASSERT_EQ(0, unlink(image.c_str()));
+  ASSERT_EQ(FileIndex::Presence::absent, index.contains(image));
+
+  // Moving a directory moves everything beneath it.
+  ASSERT_EQ(0, rename((dir.path + "/example.com").c_str(), (dir.path + "/example.org").c_str()));
+  ASSERT_EQ(FileIndex::Presence::absent, index.contains(dir.path + "/example.com/next.aci"));
+  ASSERT_EQ(FileIndex::Presence::present, index.contains(dir.path + "/example.org/next.aci"));
+  touch(dir.path + "/example.org/later.aci");
+  ASSERT_EQ(FileIndex::Presence::present, index.contains(dir.path + "/example.org/later.aci"));
+  ASSERT_EQ(2, index.size());
+}
+
+TEST(FileIndex, does_not_answer_through_symlinked_directories) {
+  TempDir dir{};
+  TempDir elsewhere{};
+  touch(elsewhere.path + "/worker.aci");
+  ASSERT_EQ(0, symlink(elsewhere.path.c_str(), (dir.path + "/example.com").c_str()));
+  FileIndex index{dir.path};
+  ASSERT_TRUE(index.open());
+  ASSERT_EQ(FileIndex::Presence::unknown, index.contains(dir.path + "/example.com/worker.aci"));
+}
+
+TEST(FileIndex, missing_root_is_unknown_until_created) {
+  TempDir dir{};
+  const std::string root = dir.path + "/images";
+  FileIndex index{root, std::chrono::seconds(0)};
+  ASSERT_FALSE(index.open());
+  ASSERT_EQ(FileIndex::Presence::unknown, index.contains(root + "/worker.aci"));
+  ASSERT_TRUE(appc::os::mkdir(root, 0755, false));
+  touch(root + "/worker.aci");
+  ASSERT_EQ(FileIndex::Presence::present, index.contains(root + "/worker.aci"));
+}
+
+TEST(FileIndex, overflow_falls_back_until_rescan) {
+  std::ifstream limit_file{"/proc/sys/fs/inotify/max_queued_events"};
+  size_t limit = 0;
+  limit_file >> limit;
+  if (limit == 0 || limit > 100000) return;
+
+  TempDir dir{};
+  FileIndex index{dir.path, std::chrono::hours(1)};
+  ASSERT_TRUE(index.open());
+  for (size_t i = 0; i <= limit; i++) touch(dir.path + "/" + std::to_string(i));
+  ASSERT_EQ(FileIndex::Presence::unknown, index.contains(dir.path + "/0"));
+  ASSERT_TRUE(index.rescan());
+  ASSERT_EQ(FileIndex::Presence::present, index.contains(dir.path + "/0"));
+  ASSERT_EQ(limit + 1, index.size());
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <fcntl.h>
+#include <fstream>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "appc/os/fs.h"
+#include "appc/os/mkdir.h"
+#include "../../../temp_dir.h"
+
+
+inline bool is_dir(const std::string& path) {
+  struct stat path_stat;
+  return stat(path.c_str(), &path_stat) == 0 && S_ISDIR(path_stat.st_mode);
+}
+
+
+inline bool exists(const std::string& path) {
+  struct stat path_stat;
+  return lstat(path.c_str(), &path_stat) == 0;
+}
+
+
+TEST(Filesystem, mkdir_creates_parents) {
+  TempDir dir{};
+  const std::string nested = dir.path + "/a b/c/d";
+  ASSERT_TRUE(appc::os::mkdir(nested, 0755, true));
+  ASSERT_TRUE(is_dir(nested));
+  ASSERT_TRUE(created_directories().contains(nested));
+  // Existing directories, trailing slashes and repeated slashes are fine.
+  ASSERT_TRUE(appc::os::mkdir(nested + "/", 0755, true));
+  ASSERT_TRUE(appc::os::mkdir(dir.path + "/a b//c/e", 0755, true));
+  ASSERT_TRUE(is_dir(dir.path + "/a b/c/e"));
+}
+
+TEST(Filesystem, directory_cache_is_bounded_and_forgets_subtrees) {
+  DirectoryCache cache{3};
+  cache.add("/a");
+  cache.add("/a/b");
+  cache.add("/a/b/c");
+  ASSERT_TRUE(cache.contains("/a"));
+  // The least recently used goes first.
+  cache.add("/ab");
+  ASSERT_EQ(3u, cache.size());
+  ASSERT_FALSE(cache.contains("/a/b"));
+  ASSERT_TRUE(cache.contains("/a"));
+  ASSERT_TRUE(cache.contains("/a/b/c"));
+
+  cache.forget("/a");
+  ASSERT_FALSE(cache.contains("/a"));
+  ASSERT_FALSE(cache.contains("/a/b/c"));
+  // Only a prefix of the name, not a parent.
+  ASSERT_TRUE(cache.contains("/ab"));
+  ASSERT_EQ(1u, cache.size());
+}
+
+TEST(Filesystem, mkdir_without_parents) {
+  TempDir dir{};
+  ASSERT_FALSE(appc::os::mkdir(dir.path + "/x/y", 0755));
+  ASSERT_TRUE(appc::os::mkdir(dir.path + "/x", 0755));
+  ASSERT_FALSE(appc::os::mkdir(dir.path + "/x", 0755));
+  ASSERT_FALSE(appc::os::mkdir("relative/path", 0755, true));
+}
+
+TEST(Filesystem, mkdir_fails_on_file_in_the_way) {
+  TempDir dir{};
+  std::ofstream{dir.path + "/file"} << "x";
+  ASSERT_FALSE(appc::os::mkdir(dir.path + "/file/below", 0755, true));
+}
+
+TEST(Filesystem, mkdir_recovers_when_cached_directory_is_gone) {
+  TempDir dir{};
+  const std::string nested = dir.path + "/a/b";
+  ASSERT_TRUE(appc::os::mkdir(nested, 0755, true));
+  ASSERT_EQ(0, rmdir(nested.c_str()));
+  ASSERT_EQ(0, rmdir((dir.path + "/a").c_str()));
+  // The cache still believes in /a, but the walk falls back to the root.
+  ASSERT_TRUE(appc::os::mkdir(nested + "/c", 0755, true));
+  ASSERT_TRUE(is_dir(nested + "/c"));
+}
+
+TEST(Filesystem, remove_tree_removes_everything) {
+  TempDir dir{};
+  TempDir outside{};
+  std::ofstream{outside.path + "/keep"} << "x";
+  const std::string root = dir.path + "/rootfs";
+  for (const auto& sub : {"/usr/bin", "/usr/lib/x", "/etc", "/var/empty"}) {
+    ASSERT_TRUE(appc::os::mkdir(root + sub, 0755, true));
+  }
+  std::ofstream{root + "/usr/bin/sh"} << "#!";
+  std::ofstream{root + "/etc/hosts"} << "127.0.0.1 localhost";
+  std::ofstream{root + "/top"} << "x";
+  ASSERT_EQ(0, symlink(outside.path.c_str(), (root + "/usr/lib/x/outside").c_str()));
+  ASSERT_EQ(0, symlink(outside.path.c_str(), (root + "/link").c_str()));
+
+  ASSERT_TRUE(remove_tree(root, 4));
+  ASSERT_FALSE(exists(root));
+  ASSERT_FALSE(created_directories().contains(root + "/usr/bin"));
+  // Symlinks were removed, not followed.
+  ASSERT_TRUE(exists(outside.path + "/keep"));
+
+  ASSERT_TRUE(remove_tree(root));
+}
+
+// Makes a file impossible to unlink, or possible again: immutable where the filesystem allows it,
+// otherwise by taking write permission from its directory (which root ignores).
+inline bool pin(const std::string& path, const bool pinned) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  int flags = 0;
+  if (fd >= 0 && ioctl(fd, FS_IOC_GETFLAGS, &flags) == 0) {
+    flags = pinned ? (flags | FS_IMMUTABLE_FL) : (flags & ~FS_IMMUTABLE_FL);
+    const bool set = ioctl(fd, FS_IOC_SETFLAGS, &flags) == 0;
+    close(fd);
+    if (set) return true;
+  } else if (fd >= 0) {
+    close(fd);
+  }
+  if (geteuid() == 0) return false;
+  return chmod(pathname::dir(path).c_str(), pinned ? 0555 : 0755) == 0;
+}
+
+
+TEST(Filesystem, remove_tree_carries_on_past_errors) {
+  TempDir dir{};
+  const std::string root = dir.path + "/rootfs";
+  for (const auto& sub : {"/usr/bin", "/usr/lib", "/etc", "/var/empty", "/opt/a", "/srv"}) {
+    ASSERT_TRUE(appc::os::mkdir(root + sub, 0755, true));
+  }
+  for (int i = 0; i < 20; i++) {
+    std::ofstream{root + "/usr/lib/lib" + std::to_string(i)} << "x";
+    std::ofstream{root + "/top" + std::to_string(i)} << "x";
+  }
+  std::ofstream{root + "/etc/hosts"} << "127.0.0.1 localhost";
+  const std::string stuck = root + "/usr/lib/stuck";
+  const std::string stuck_top = root + "/stuck";
+  std::ofstream{stuck} << "x";
+  std::ofstream{stuck_top} << "x";
+  if (!pin(stuck, true) || !pin(stuck_top, true)) {
+    GTEST_SKIP() << "Cannot make a file unremovable here";
+  }
+
+  const auto removed = remove_tree(root, 1);
+  pin(stuck, false);
+  pin(stuck_top, false);
+  ASSERT_FALSE(removed);
+  ASSERT_NE(std::string::npos, removed.message.find("stuck")) << removed.message;
+  // Everything else went.
+  ASSERT_EQ(2, count_entries(root));
+  ASSERT_EQ(1, count_entries(root + "/usr"));
+  ASSERT_EQ(1, count_entries(root + "/usr/lib"));
+  ASSERT_TRUE(exists(stuck));
+
+  ASSERT_TRUE(remove_tree(root));
+  ASSERT_FALSE(exists(root));
+}
+
+TEST(Filesystem, fsync_dir) {
+  TempDir dir{};
+  ASSERT_TRUE(fsync_dir(dir.path));
+  ASSERT_FALSE(fsync_dir(dir.path + "/missing"));
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <chrono>
+
+#include "appc/os/event_handlers.h"
+#include "appc/os/process.h"
+
+
+TEST(Process, captures_output_and_exit_code) {
+  const auto output = capture(Command({"sh", "-c", "echo out; echo err >&2; exit 3"}));
+  ASSERT_TRUE(output) << output.failure_reason();
+  ASSERT_EQ("out\n", output->out);
+  ASSERT_EQ("err\n", output->err);
+  ASSERT_TRUE(output->status.exited);
+  ASSERT_EQ(3, output->status.code);
+  ASSERT_FALSE(output->status.success());
+}
+
+TEST(Process, streams_output_larger_than_a_pipe) {
+  size_t streamed = 0;
+  size_t chunks = 0;
+  const auto ran = run(Command({"head", "-c", "4000000", "/dev/zero"}),
+                       [&](const char*, const size_t size) { streamed += size; chunks++; });
+  ASSERT_TRUE(ran);
+  ASSERT_TRUE(ran->success());
+  ASSERT_EQ(4000000, streamed);
+  ASSERT_LT(1, chunks);
+}
+
+TEST(Process, limits_captured_output) {
+  const auto output = capture(Command({"head", "-c", "100000", "/dev/zero"}), 10);
+  ASSERT_TRUE(output);
+  ASSERT_TRUE(output->status.success());
+  ASSERT_EQ(10, output->out.length());
+}
+
+TEST(Process, times_out) {
+  const auto started = std::chrono::steady_clock::now();
+  const auto ran = run(Command({"sleep", "10"}, None<EnvironmentBlock>(), "",
+                               std::chrono::milliseconds(100)));
+  ASSERT_TRUE(ran);
+  ASSERT_TRUE(ran->timed_out);
+  ASSERT_FALSE(ran->success());
+  ASSERT_EQ("timed out", ran->describe());
+  ASSERT_GT(std::chrono::seconds(5), std::chrono::steady_clock::now() - started);
+}
+
+TEST(Process, escalates_to_sigkill) {
+  const auto ran = run(Command({"sh", "-c", "trap '' TERM; sleep 10"}, None<EnvironmentBlock>(), "",
+                               std::chrono::milliseconds(100), std::chrono::milliseconds(100)));
+  ASSERT_TRUE(ran);
+  ASSERT_TRUE(ran->timed_out);
+  ASSERT_FALSE(ran->exited);
+  ASSERT_EQ(SIGKILL, ran->code);
+}
+
+TEST(Process, reports_signals) {
+  const auto ran = run(Command({"sh", "-c", "kill -KILL $$"}));
+  ASSERT_TRUE(ran);
+  ASSERT_FALSE(ran->exited);
+  ASSERT_EQ(SIGKILL, ran->code);
+}
+
+TEST(Process, fails_for_missing_command) {
+  ASSERT_FALSE(run(Command({"/nonexistent/command"})));
+  ASSERT_FALSE(run(Command({"appc-no-such-command"})));
+  ASSERT_FALSE(run(Command({})));
+}
+
+TEST(Process, fails_when_the_exit_status_is_lost) {
+  // With SIGCHLD ignored the kernel reaps children itself.
+  struct sigaction ignore{}, previous{};
+  ignore.sa_handler = SIG_IGN;
+  sigaction(SIGCHLD, &ignore, &previous);
+  const auto ran = run(Command({"true"}));
+  sigaction(SIGCHLD, &previous, nullptr);
+  ASSERT_FALSE(ran);
+  ASSERT_NE(std::string::npos, ran.failure_reason().find("exit status unavailable"));
+  ASSERT_TRUE(run(Command({"true"})));
+}
+
+TEST(Process, environment_block) {
+  EnvironmentBlock environment{};
+  environment.set("A", "1").set("B", "2").set("A", "3").unset("B");
+  ASSERT_EQ(1, environment.size());
+  ASSERT_EQ("3", *environment.get("A"));
+  ASSERT_FALSE(environment.get("B"));
+  environment.set("PATH", "/usr/bin:/bin");
+
+  const auto output = capture(Command({"sh", "-c", "echo $A-$B"}, Some(environment)));
+  ASSERT_TRUE(output);
+  ASSERT_EQ("3-\n", output->out);
+
+  ASSERT_TRUE(EnvironmentBlock::inherit().get("PATH"));
+}
+
+TEST(Process, working_directory) {
+  const auto output = capture(Command({"pwd"}, None<EnvironmentBlock>(), "/"));
+  ASSERT_TRUE(output);
+  ASSERT_EQ("/\n", output->out);
+}
+
+TEST(Process, get_process_output) {
+  const auto output = get_process_output("printf 'abcdef'", 4);
+  ASSERT_TRUE(output);
+  ASSERT_EQ("abcd", *output);
+}
+
+TEST(Process, runs_event_handlers) {
+  const auto app = appc::schema::App::from_json(appc::schema::Json::parse(R"json({
+    "exec": ["/bin/true"],
+    "user": "0",
+    "group": "0",
+    "workingDirectory": "/",
+    "environment": [{"name": "GREETING", "value": "hello"}],
+    "eventHandlers": [
+      {"name": "pre-start", "exec": ["sh", "-c", "echo $GREETING from $(pwd)"]},
+      {"name": "post-stop", "exec": ["sh", "-c", "exit 1"]}
+    ]
+  })json"));
+  ASSERT_TRUE(app) << app.failure_reason();
+
+  std::string out{};
+  ASSERT_TRUE(run_event_handlers(*app, "pre-start",
+                                 [&out](const char* data, const size_t size) {
+                                   out.append(data, size);
+                                 }));
+  ASSERT_EQ("hello from /\n", out);
+  const auto stopped = run_event_handlers(*app, "post-stop");
+  ASSERT_FALSE(stopped);
+  ASSERT_EQ("post-stop handler exited with 1", stopped.message);
+  ASSERT_TRUE(run_event_handlers(*app, "no-such-event"));
+}
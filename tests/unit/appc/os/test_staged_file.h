@@ -0,0 +1,109 @@
+#pragma once
+
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+
+#include "appc/os/dir.h"
+#include "appc/os/fs.h"
+#include "appc/os/staged_file.h"
+#include "../../../temp_dir.h"
+
+using namespace appc::os;
+
+
+inline std::string read_file(const std::string& path) {
+  std::ifstream file{path, std::ios::binary};
+  std::stringstream contents{};
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+
+inline size_t count_entries(const std::string& path) {
+  size_t entries = 0;
+  const auto dir = open_dir(path);
+  for (struct dirent* entry = readdir(dir.get()); entry; entry = readdir(dir.get())) {
+    const std::string name{entry->d_name};
+    if (name != "." && name != "..") entries++;
+  }
+  return entries;
+}
+
+
+TEST(StagedFile, invisible_until_committed) {
+  TempDir dir{};
+  const std::string path = dir.path + "/image.aci";
+  StagedFile file{path, StagedFile::Options(4096)};
+  ASSERT_TRUE(file.open());
+  std::string contents{};
+  for (int i = 0; i < 1000; i++) contents += "chunk " + std::to_string(i) + "\n";
+  ASSERT_TRUE(file.write(contents.data(), 5000));
+  ASSERT_TRUE(file.write(contents.data() + 5000, contents.length() - 5000));
+  ASSERT_EQ(contents.length(), file.size());
+
+  struct stat path_stat;
+  ASSERT_NE(0, stat(path.c_str(), &path_stat));
+
+  ASSERT_TRUE(file.commit());
+  ASSERT_EQ(contents, read_file(path));
+  ASSERT_EQ(1, count_entries(dir.path));
+}
+
+TEST(StagedFile, remakes_a_cached_directory_removed_behind_its_back) {
+  TempDir dir{};
+  const std::string image_dir = dir.path + "/example.com";
+  ASSERT_TRUE(appc::os::mkdir(image_dir, 0755, true));
+  // Removed without forgetting it, the cache still says it exists.
+  ASSERT_EQ(0, rmdir(image_dir.c_str()));
+  ASSERT_TRUE(appc::os::mkdir(image_dir, 0755, true));
+
+  StagedFile file{image_dir + "/image.aci"};
+  const auto opened = file.open();
+  ASSERT_TRUE(opened) << opened.message;
+  ASSERT_TRUE(file.write("image", 5));
+  ASSERT_TRUE(file.commit());
+  ASSERT_EQ("image", read_file(image_dir + "/image.aci"));
+}
+
+TEST(StagedFile, abandoned_file_leaves_nothing) {
+  TempDir dir{};
+  {
+    StagedFile file{dir.path + "/image.aci"};
+    ASSERT_TRUE(file.open());
+    ASSERT_TRUE(file.write("partial", 7));
+  }
+  ASSERT_EQ(0, count_entries(dir.path));
+}
+
+TEST(StagedFile, commit_replaces_existing_file) {
+  TempDir dir{};
+  const std::string path = dir.path + "/image.aci";
+  std::ofstream{path} << "old contents that are longer";
+  StagedFile file{path};
+  ASSERT_TRUE(file.open());
+  ASSERT_TRUE(file.write("new", 3));
+  ASSERT_TRUE(file.commit());
+  ASSERT_EQ("new", read_file(path));
+  ASSERT_EQ(1, count_entries(dir.path));
+}
+
+TEST(StagedFile, overstated_preallocation_is_trimmed) {
+  TempDir dir{};
+  const std::string path = dir.path + "/image.aci";
+  StagedFile file{path};
+  ASSERT_TRUE(file.open());
+  ASSERT_TRUE(file.preallocate(1 << 20));
+  ASSERT_TRUE(file.write("short", 5));
+  ASSERT_TRUE(file.commit());
+  ASSERT_EQ("short", read_file(path));
+}
+
+TEST(StagedFile, publish_file_replaces_atomically) {
+  TempDir dir{};
+  const std::string path = dir.path + "/state";
+  ASSERT_TRUE(publish_file(path, "first"));
+  ASSERT_TRUE(publish_file(path, "second", false));
+  ASSERT_EQ("second", read_file(path));
+  ASSERT_EQ(1, count_entries(dir.path));
+}
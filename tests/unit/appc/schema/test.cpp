@@ -5,6 +5,7 @@
 #include "test_ac_version.h"
 #include "test_annotations.h"
 #include "test_app.h"
+#include "test_app_refs.h"
 #include "test_common.h"
 #include "test_image.h"
 #include "test_labels.h"
@@ -33,3 +33,10 @@ TEST(ACName, rfc1123_plus_slash) {
   ASSERT_FALSE(TestName::from_json("/aa-00.bb/11.cc-22")->validate());
   ASSERT_FALSE(TestName::from_json("aa-00.bb/11.cc-22/")->validate());
 }
+
+TEST(ACName, too_long) {
+  ASSERT_TRUE(TestName::from_json(std::string(512, 'a'))->validate());
+  const auto too_long = TestName::from_json(std::string(513, 'a'))->validate();
+  ASSERT_FALSE(too_long);
+  ASSERT_EQ("ACName must not be longer than 512", too_long.message);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "gtest/gtest.h"
+
+#include "appc/schema/app_refs.h"
+
+using namespace appc::schema;
+
+
+const std::string some_image_id =
+    "sha512-0000000000000000000000000000000000000000000000000000000000000000";
+
+
+TEST(AppRef, marshals_only_what_is_set) {
+  const Json app_only = { {"imageID", some_image_id}, {"app", "reduce-worker"} };
+  const auto app_ref = AppRef::from_json(app_only);
+  ASSERT_TRUE(app_ref);
+  ASSERT_EQ(app_only, AppRef::to_json(*app_ref));
+
+  const Json annotations_only = {
+    {"imageID", some_image_id},
+    {"annotations", { { {"name", "created"}, {"value", "today"} } } }
+  };
+  const auto annotated = AppRef::from_json(annotations_only);
+  ASSERT_TRUE(annotated);
+  ASSERT_EQ(annotations_only, AppRef::to_json(*annotated));
+}
+
+TEST(AppRef, marshal_to_unmarshal) {
+  const Json json = {
+    {"imageID", some_image_id},
+    {"app", "reduce-worker"},
+    {"isolators", { { {"name", "cpu/shares"}, {"value", "20"} } } },
+    {"annotations", { { {"name", "created"}, {"value", "today"} } } }
+  };
+  const auto app_ref = AppRef::from_json(json);
+  ASSERT_TRUE(app_ref);
+  ASSERT_TRUE(app_ref->validate());
+  ASSERT_EQ(json, AppRef::to_json(*app_ref));
+}
@@ -75,3 +75,23 @@ TEST(StringType, marshal_to_unmarshal) {
   ASSERT_EQ(expected_json, json);
 }
 
+
+TEST(Json, unterminated_input_is_an_error) {
+  ASSERT_ANY_THROW(Json::parse("[["));
+  ASSERT_ANY_THROW(Json::parse("{\"a\": [{"));
+  ASSERT_ANY_THROW(Json::parse("[1, "));
+}
+
+
+struct SomeArrayType : ArrayType<SomeArrayType, SomeStringType> {
+  explicit SomeArrayType(const std::vector<SomeStringType>& array)
+  : ArrayType<SomeArrayType, SomeStringType>(array) {}
+};
+
+TEST(ArrayType, empty_marshal_to_unmarshal) {
+  const Json json = SomeArrayType::to_json(SomeArrayType({}));
+  ASSERT_EQ(Json::value_t::array, json.type());
+  const Try<SomeArrayType> a_try = SomeArrayType::from_json(json);
+  ASSERT_TRUE(a_try);
+  ASSERT_TRUE(a_try->array.empty());
+}
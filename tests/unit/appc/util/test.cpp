@@ -4,3 +4,9 @@
 #include "test_try.h"
 #include "test_try_option.h"
 
+#include "test_executor.h"
+#include "test_metrics.h"
+#include "test_trace.h"
+#include "test_log.h"
+#include "test_profile.h"
+#include "test_snapshot.h"
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "appc/util/executor.h"
+
+
+using namespace appc::util;
+
+
+// Holds a single-threaded executor's only worker until released, so that work queues up behind it.
+struct Gate {
+  std::mutex mutex{};
+  std::condition_variable opened{};
+  bool open{false};
+
+  Task task() {
+    return [this]() {
+      std::unique_lock<std::mutex> lock{mutex};
+      opened.wait(lock, [this]() { return open; });
+    };
+  }
+
+  void release() {
+    std::lock_guard<std::mutex> lock{mutex};
+    open = true;
+    opened.notify_all();
+  }
+};
+
+
+TEST(Executor, group_runs_every_task) {
+  const auto executor = std::make_shared<WorkStealingExecutor>(4);
+  std::atomic<int> ran{0};
+  TaskGroup group{executor};
+  for (int i = 0; i < 1000; i++) {
+    group.run([&ran]() {
+      ran++;
+      return Success();
+    });
+  }
+  ASSERT_TRUE(group.wait());
+  ASSERT_EQ(1000, ran);
+}
+
+TEST(Executor, higher_priorities_run_first) {
+  const auto executor = std::make_shared<WorkStealingExecutor>(1);
+  Gate gate{};
+  executor->submit(gate.task());
+  Gate done{};
+  std::vector<std::string> order{};
+  const auto record = [&order](const std::string& name) -> Task {
+    return [&order, name]() { order.push_back(name); };
+  };
+  executor->submit(record("low"), Priority::low);
+  executor->submit(record("normal"), Priority::normal);
+  executor->submit(record("high"), Priority::high);
+  executor->submit(record("high again"), Priority::high);
+  executor->submit([&done]() { done.release(); }, Priority::low);
+  gate.release();
+  done.task()();
+  ASSERT_EQ((std::vector<std::string>{"high", "high again", "normal", "low"}), order);
+}
+
+TEST(Executor, first_failure_cancels_the_rest) {
+  // One thread, and the waiting thread cannot help (HostExecutor), so tasks run in order.
+  const auto pool = std::make_shared<WorkStealingExecutor>(1);
+  const auto executor = std::make_shared<HostExecutor>([pool](Task task, Priority priority) {
+    pool->submit(task, priority);
+  }, 1);
+  Gate gate{};
+  executor->submit(gate.task());
+  std::atomic<int> ran{0};
+  TaskGroup group{executor};
+  group.run([&ran]() {
+    ran++;
+    return Error("disk full");
+  });
+  for (int i = 0; i < 10; i++) {
+    group.run([&ran]() {
+      ran++;
+      return Success();
+    }, Priority::low);
+  }
+  gate.release();
+  const auto waited = group.wait();
+  ASSERT_FALSE(waited);
+  ASSERT_EQ("disk full", waited.message);
+  ASSERT_EQ(1, ran);
+  ASSERT_TRUE(group.cancellation().cancelled());
+
+  CancellationToken token{};
+  CancellationToken copy{token};
+  ASSERT_TRUE(token.status());
+  copy.cancel("stopped");
+  copy.cancel("again");
+  ASSERT_FALSE(token.status());
+  ASSERT_EQ("stopped", token.status().message);
+  TaskGroup cancelled{executor, token};
+  cancelled.run([&ran]() {
+    ran++;
+    return Success();
+  });
+  ASSERT_EQ("stopped", cancelled.wait().message);
+  ASSERT_EQ(1, ran);
+}
+
+TEST(Executor, idle_workers_steal_nested_work) {
+  const auto executor = std::make_shared<WorkStealingExecutor>(4);
+  std::mutex mutex{};
+  std::set<std::thread::id> threads{};
+  TaskGroup outer{executor};
+  outer.run([&]() {
+    // Submitted from a worker, so queued on its own deque; the others must steal it.
+    TaskGroup inner{executor};
+    for (int i = 0; i < 64; i++) {
+      inner.run([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::lock_guard<std::mutex> lock{mutex};
+        threads.insert(std::this_thread::get_id());
+        return Success();
+      });
+    }
+    return inner.wait();
+  });
+  ASSERT_TRUE(outer.wait());
+  ASSERT_LT(1u, threads.size());
+}
+
+TEST(Executor, waiting_thread_runs_work_queued_while_it_waits) {
+  // The only worker is held by a task that needs the second, queued only once the main thread is
+  // already waiting: the main thread must wake up to run it.
+  const auto executor = std::make_shared<WorkStealingExecutor>(1);
+  std::atomic<bool> second_ran{false};
+  TaskGroup group{executor};
+  group.run([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    group.run([&]() {
+      second_ran = true;
+      return Success();
+    });
+    while (!second_ran) std::this_thread::yield();
+    return Success();
+  });
+  ASSERT_TRUE(group.wait());
+  ASSERT_TRUE(second_ran);
+}
+
+TEST(Executor, destroying_a_group_waits_for_its_tasks) {
+  const auto executor = std::make_shared<WorkStealingExecutor>(2);
+  std::atomic<int> ran{0};
+  {
+    TaskGroup group{executor};
+    for (int i = 0; i < 8; i++) {
+      group.run([&ran]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        ran++;
+        return Success();
+      });
+    }
+  }
+  ASSERT_EQ(8, ran);
+}
+
+TEST(Executor, host_pool_can_replace_the_default) {
+  std::atomic<int> submitted{0};
+  std::vector<std::thread> host_threads{};
+  std::mutex mutex{};
+  const auto host = std::make_shared<HostExecutor>([&](Task task, Priority) {
+    submitted++;
+    std::lock_guard<std::mutex> lock{mutex};
+    host_threads.emplace_back(task);
+  }, 2);
+  set_default_executor(host);
+
+  std::atomic<int> ran{0};
+  {
+    TaskGroup group{};
+    ASSERT_EQ(2u, group.concurrency());
+    for (int i = 0; i < 8; i++) {
+      group.run([&ran]() {
+        ran++;
+        return Success();
+      });
+    }
+    ASSERT_TRUE(group.wait());
+  }
+  set_default_executor(nullptr);
+  for (auto& thread : host_threads) thread.join();
+  ASSERT_EQ(8, submitted);
+  ASSERT_EQ(8, ran);
+  ASSERT_NE(host, default_executor());
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "appc/util/log.h"
+
+
+using namespace appc::util;
+
+
+// Keeps what it is given; optionally holds writers until released.
+struct CaptureSink : public LogSink {
+  std::mutex mutex{};
+  std::condition_variable opened{};
+  bool open{true};
+  std::vector<LogRecord> records{};
+
+  void write(const LogRecord& record) override {
+    std::unique_lock<std::mutex> lock{mutex};
+    opened.wait(lock, [this]() { return open; });
+    records.push_back(record);
+  }
+
+  void release() {
+    std::lock_guard<std::mutex> lock{mutex};
+    open = true;
+    opened.notify_all();
+  }
+};
+
+
+TEST(Log, level_filters_before_formatting) {
+  const auto capture = std::make_shared<CaptureSink>();
+  Logger logger{capture, LogLevel::warning};
+  int formatted = 0;
+  const auto message = [&formatted](const std::string& text) {
+    formatted++;
+    return text;
+  };
+  if (logger.enabled(LogLevel::info)) logger.log(LogLevel::info, "test", message("hidden"));
+  if (logger.enabled(LogLevel::error)) logger.log(LogLevel::error, "test", message("shown"));
+  ASSERT_EQ(1, formatted);
+  ASSERT_EQ(1u, capture->records.size());
+  ASSERT_EQ("shown", capture->records[0].message);
+  ASSERT_EQ(LogLevel::error, capture->records[0].level);
+
+  logger.set_level(LogLevel::off);
+  ASSERT_FALSE(logger.enabled(LogLevel::error));
+}
+
+TEST(Log, macro_goes_to_the_library_logger) {
+  const auto capture = std::make_shared<CaptureSink>();
+  const auto previous = logger().set_sink(capture);
+  const auto level = logger().level();
+  logger().set_level(LogLevel::info);
+  int formatted = 0;
+  APPC_LOG(debug, "test", std::to_string(++formatted));
+  APPC_LOG(info, "test", "formatted " + std::to_string(++formatted));
+  logger().set_sink(previous);
+  logger().set_level(level);
+
+  ASSERT_EQ(1, formatted);
+  ASSERT_EQ(1u, capture->records.size());
+  ASSERT_EQ("test", capture->records[0].component);
+  ASSERT_EQ("formatted 1", capture->records[0].message);
+}
+
+struct LogsOnExit {
+  ~LogsOnExit() {
+    APPC_LOG(warning, "test", "logged from a static destructor");
+  }
+};
+
+
+TEST(Log, library_logger_is_flushed_at_exit) {
+  // Forking while other tests' threads may hold locks could hang the child; run it afresh.
+  ::testing::FLAGS_gtest_death_test_style = "threadsafe";
+  EXPECT_EXIT(
+      {
+        logger().set_sink(std::make_shared<AsyncSink>());
+        logger().set_level(LogLevel::info);
+        static LogsOnExit logs_on_exit{};
+        APPC_LOG(info, "test", "queued at exit");
+        std::exit(0);
+      },
+      ::testing::ExitedWithCode(0), "queued at exit(.|\n)*logged from a static destructor");
+}
+
+TEST(Log, stream_sink_formats_lines) {
+  std::ostringstream out{};
+  StreamSink sink{out};
+  sink.write(LogRecord{LogLevel::warning,
+                       std::chrono::system_clock::from_time_t(86400),
+                       "discovery",
+                       "Fetch failed: nope"});
+  ASSERT_EQ("1970-01-02T00:00:00.000Z WARNING discovery: Fetch failed: nope\n", out.str());
+}
+
+TEST(Log, async_sink_keeps_each_threads_order) {
+  const auto capture = std::make_shared<CaptureSink>();
+  {
+    AsyncSink sink{capture};
+    std::vector<std::thread> threads{};
+    for (int t = 0; t < 8; t++) {
+      threads.emplace_back([&sink, t]() {
+        for (int i = 0; i < 1000; i++) {
+          sink.write(LogRecord{LogLevel::info, std::chrono::system_clock::now(),
+                               std::to_string(t), std::to_string(i)});
+        }
+      });
+    }
+    for (auto& thread : threads) thread.join();
+    sink.flush();
+    ASSERT_EQ(8000u, capture->records.size());
+  }
+  std::map<std::string, int> next{};
+  for (const auto& record : capture->records) {
+    ASSERT_EQ(std::to_string(next[record.component]++), record.message);
+  }
+}
+
+TEST(Log, async_sink_drops_beyond_its_limit) {
+  const auto capture = std::make_shared<CaptureSink>();
+  capture->open = false;
+  {
+    AsyncSink sink{capture, 10};
+    for (int i = 0; i < 100; i++) {
+      sink.write(LogRecord{LogLevel::info, std::chrono::system_clock::now(), "test",
+                           std::to_string(i)});
+    }
+    capture->release();
+    sink.flush();
+  }
+  // The writer may have taken one record off the queue before it blocked.
+  ASSERT_LE(11u, capture->records.size());
+  ASSERT_GE(12u, capture->records.size());
+  ASSERT_EQ(LogLevel::warning, capture->records.back().level);
+  ASSERT_NE(std::string::npos, capture->records.back().message.find("records dropped"));
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "appc/util/metrics.h"
+#include "../../../temp_dir.h"
+
+
+using namespace appc::util;
+
+
+TEST(Metrics, counter_sums_every_thread) {
+  Counter counter{};
+  std::vector<std::thread> threads{};
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([&counter]() {
+      for (int i = 0; i < 100000; i++) counter.add();
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  counter.add(5);
+  ASSERT_EQ(800005u, counter.value());
+}
+
+TEST(Metrics, histogram_bounds_are_inclusive) {
+  Histogram histogram{{10, 100}};
+  for (const uint64_t value : {0, 10, 11, 100, 101, 5000}) histogram.observe(value);
+  ASSERT_EQ((std::vector<uint64_t>{2, 2, 2}), histogram.counts());
+  ASSERT_EQ(6u, histogram.count());
+  ASSERT_EQ(5222u, histogram.sum());
+}
+
+TEST(Metrics, same_name_and_labels_is_same_metric) {
+  MetricsRegistry registry{};
+  auto& a = registry.counter("requests_total", "Requests.", {{"method", "GET"}});
+  auto& b = registry.counter("requests_total", "Requests.", {{"method", "GET"}});
+  auto& c = registry.counter("requests_total", "Requests.", {{"method", "PUT"}});
+  ASSERT_EQ(&a, &b);
+  ASSERT_NE(&a, &c);
+}
+
+TEST(Metrics, renders_prometheus_text) {
+  MetricsRegistry registry{};
+  registry.counter("appc_things_total", "Things.", {{"kind", "a \"quoted\" one"}}).add(3);
+  auto& seconds = registry.histogram("appc_wait_seconds", "Waits.", {}, {1000000, 1000000000});
+  seconds.observe(500000);
+  seconds.observe(2000000);
+  seconds.observe(5000000000);
+
+  ASSERT_EQ("# HELP appc_things_total Things.\n"
+            "# TYPE appc_things_total counter\n"
+            "appc_things_total{kind=\"a \\\"quoted\\\" one\"} 3\n"
+            "# HELP appc_wait_seconds Waits.\n"
+            "# TYPE appc_wait_seconds histogram\n"
+            "appc_wait_seconds_bucket{le=\"0.001\"} 1\n"
+            "appc_wait_seconds_bucket{le=\"1\"} 2\n"
+            "appc_wait_seconds_bucket{le=\"+Inf\"} 3\n"
+            "appc_wait_seconds_sum 5.0025\n"
+            "appc_wait_seconds_count 3\n",
+            registry.render());
+}
+
+TEST(Metrics, exports_to_file_and_callback) {
+  MetricsRegistry registry{};
+  registry.counter("appc_things_total", "Things.").add(7);
+
+  double exported = 0;
+  registry.collect([&exported](const MetricSample& sample) {
+    if (sample.name == "appc_things_total") exported = sample.value;
+  });
+  ASSERT_EQ(7, exported);
+
+  TempDir dir{};
+  const std::string path = dir.path + "/appc.prom";
+  ASSERT_TRUE(registry.write_text_file(path));
+  std::ifstream file{path};
+  std::stringstream contents{};
+  contents << file.rdbuf();
+  ASSERT_EQ(registry.render(), contents.str());
+}
+
+#ifndef APPC_METRICS
+TEST(Metrics, instrumentation_compiles_out) {
+  APPC_TIME_SCOPE("appc_test_disabled_seconds", "Never recorded.", {});
+  APPC_IF_METRICS(metrics().counter("appc_test_disabled_total", "Never recorded.").add();)
+  ASSERT_EQ(std::string::npos, metrics().render().find("appc_test_disabled"));
+}
+#endif
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "appc/util/profile.h"
+
+
+#ifdef APPC_PROFILE
+
+using namespace appc::util;
+
+
+static void profiled_allocation() {
+  APPC_PROFILE_SCOPE("test.profiled_allocation");
+  std::vector<int> allocated(1024);
+}
+
+
+TEST(Profile, scope_counts_calls_and_allocations) {
+  profiled_allocation();
+  profiled_allocation();
+  const auto totals = profile().snapshot().at("test.profiled_allocation");
+  ASSERT_EQ(2u, totals.calls);
+  // Run with libappc-profile.so preloaded (as ctest does) to count allocations.
+  if (!profile().counting()) return;
+  ASSERT_EQ(2u, totals.allocations);
+  ASSERT_EQ(2 * 1024 * sizeof(int), totals.bytes_allocated);
+}
+
+#endif
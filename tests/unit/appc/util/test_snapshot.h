@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "appc/util/snapshot.h"
+
+
+using namespace appc::util;
+
+
+TEST(Snapshot, publish_replaces_for_later_loads) {
+  Snapshot<int> snapshot{std::make_shared<const int>(1)};
+  ASSERT_EQ(1, *snapshot.load());
+  ASSERT_EQ(1u, snapshot.version());
+  const auto replaced = snapshot.publish(std::make_shared<const int>(2));
+  ASSERT_EQ(1, *replaced);
+  ASSERT_EQ(2, *snapshot.load());
+  ASSERT_EQ(2u, snapshot.version());
+  snapshot.update([](const int value) { return std::make_shared<const int>(value * 10); });
+  ASSERT_EQ(20, *snapshot.load());
+  ASSERT_EQ(3u, snapshot.version());
+}
+
+
+TEST(Snapshot, loaded_version_outlives_replacement) {
+  Snapshot<std::vector<int>> snapshot{std::make_shared<const std::vector<int>>(3, 7)};
+  const auto held = snapshot.load();
+  snapshot.publish(std::make_shared<const std::vector<int>>(1, 8));
+  ASSERT_EQ((std::vector<int>{7, 7, 7}), *held);
+  ASSERT_EQ((std::vector<int>{8}), *snapshot.load());
+}
+
+
+TEST(Snapshot, copy_starts_at_current_version) {
+  Snapshot<int> snapshot{std::make_shared<const int>(1)};
+  snapshot.publish(std::make_shared<const int>(2));
+  Snapshot<int> copy{snapshot};
+  snapshot.publish(std::make_shared<const int>(3));
+  ASSERT_EQ(2, *copy.load());
+  ASSERT_EQ(3, *snapshot.load());
+}
+
+
+TEST(Snapshot, replaced_version_is_freed_once_released) {
+  Snapshot<int> snapshot{std::make_shared<const int>(1)};
+  const std::weak_ptr<const int> first{snapshot.load()};
+  ASSERT_FALSE(first.expired());
+  snapshot.publish(std::make_shared<const int>(2));
+  // Not even the loading thread keeps it.
+  ASSERT_TRUE(first.expired());
+  ASSERT_EQ(2, *snapshot.load());
+}
+
+
+// More snapshots than a thread keeps slots for, loaded and replaced in turn.
+TEST(Snapshot, loads_see_publishes_whatever_the_thread_kept) {
+  std::vector<std::unique_ptr<Snapshot<int>>> snapshots{};
+  for (int i = 0; i < 20; i++) {
+    snapshots.emplace_back(new Snapshot<int>(std::make_shared<const int>(i)));
+  }
+  for (int round = 1; round <= 3; round++) {
+    for (int i = 0; i < 20; i++) ASSERT_EQ(100 * (round - 1) + i, *snapshots[i]->load());
+    for (int i = 0; i < 20; i++) ASSERT_EQ(100 * (round - 1) + i, *snapshots[i]->load());
+    for (int i = 0; i < 20; i++) snapshots[i]->publish(std::make_shared<const int>(100 * round + i));
+  }
+  // A snapshot made where a destroyed one was starts from its own value.
+  snapshots[0].reset(new Snapshot<int>(std::make_shared<const int>(-1)));
+  ASSERT_EQ(-1, *snapshots[0]->load());
+}
+
+
+// Readers never see a torn or freed version, and concurrent updates are not lost.
+TEST(Snapshot, readers_and_writers_concurrently) {
+  struct Pair {
+    int first;
+    int second;
+  };
+  Snapshot<Pair> snapshot{std::make_shared<const Pair>(Pair{0, 0})};
+  std::atomic<bool> stop{false};
+  std::atomic<int> torn{0};
+  std::vector<std::thread> readers{};
+  for (int i = 0; i < 4; i++) {
+    readers.emplace_back([&]() {
+      int last = 0;
+      while (!stop.load()) {
+        const auto pair = snapshot.load();
+        if (pair->first != pair->second || pair->first < last) torn++;
+        last = pair->first;
+      }
+    });
+  }
+  std::vector<std::thread> writers{};
+  for (int i = 0; i < 2; i++) {
+    writers.emplace_back([&]() {
+      for (int n = 0; n < 2000; n++) {
+        snapshot.update([](const Pair& pair) {
+          return std::make_shared<const Pair>(Pair{pair.first + 1, pair.second + 1});
+        });
+      }
+    });
+  }
+  for (auto& writer : writers) writer.join();
+  stop = true;
+  for (auto& reader : readers) reader.join();
+  ASSERT_EQ(0, torn.load());
+  ASSERT_EQ(4000, snapshot.load()->first);
+  ASSERT_EQ(4001u, snapshot.version());
+}
+
+
+// Readers that never stop loading, several to a shard, do not hold a writer up.
+TEST(Snapshot, readers_do_not_starve_writers) {
+  Snapshot<int> snapshot{std::make_shared<const int>(0)};
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> readers{};
+  for (size_t i = 0; i < 2 * detail::shard_count; i++) {
+    readers.emplace_back([&]() {
+      while (!stop.load()) snapshot.load();
+    });
+  }
+  auto writer = std::async(std::launch::async, [&]() {
+    for (int n = 1; n <= 10; n++) snapshot.publish(std::make_shared<const int>(n));
+  });
+  const auto finished = writer.wait_for(std::chrono::seconds(20));
+  stop = true;
+  for (auto& reader : readers) reader.join();
+  writer.wait();
+  ASSERT_EQ(std::future_status::ready, finished);
+  ASSERT_EQ(10, *snapshot.load());
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "3rdparty/nlohmann/json.h"
+#include "appc/util/trace.h"
+
+
+using namespace appc::util;
+
+
+static std::vector<TraceEvent> events_named(const char* name) {
+  std::vector<TraceEvent> named{};
+  for (const auto& event : tracer().events()) {
+    if (std::string(event.name) == name) named.push_back(event);
+  }
+  return named;
+}
+
+
+TEST(Trace, records_spans_of_every_thread) {
+  tracer().clear();
+  std::vector<std::thread> threads{};
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([]() {
+      for (int i = 0; i < 10; i++) {
+        const TraceSpan span{"test.every_thread"};
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  const auto events = events_named("test.every_thread");
+  ASSERT_EQ(40u, events.size());
+  std::map<uint64_t, int> per_thread{};
+  for (const auto& event : events) per_thread[event.thread]++;
+  ASSERT_EQ(4u, per_thread.size());
+  for (const auto& count : per_thread) ASSERT_EQ(10, count.second);
+}
+
+TEST(Trace, ring_keeps_the_latest_spans) {
+  tracer().clear();
+  std::thread writer{[]() {
+    for (uint64_t i = 0; i < 3 * detail::trace_ring_capacity; i++) {
+      tracer().record("test.wraps", "", trace_clock(), i);
+    }
+  }};
+  writer.join();
+
+  const auto events = events_named("test.wraps");
+  ASSERT_EQ(detail::trace_ring_capacity, events.size());
+  // Durations were recorded as the index of each span (scaled alike on export): the last third.
+  std::set<uint64_t> kept{};
+  for (const auto& event : events) kept.insert(event.duration);
+  ASSERT_GT(*kept.begin(), *kept.rbegin() / 2);
+}
+
+TEST(Trace, clear_hides_earlier_spans) {
+  { const TraceSpan span{"test.cleared"}; }
+  ASSERT_FALSE(events_named("test.cleared").empty());
+  tracer().clear();
+  ASSERT_TRUE(events_named("test.cleared").empty());
+}
+
+TEST(Trace, renders_chrome_trace_json) {
+  tracer().clear();
+  {
+    const TraceSpan span{"test.render", "example.com/\"quoted\""};
+  }
+  const auto trace = nlohmann::json::parse(tracer().render_chrome_trace());
+  bool found = false;
+  for (const auto& event : trace["traceEvents"]) {
+    if (event["name"].get<std::string>() != "test.render") continue;
+    found = true;
+    ASSERT_EQ("X", event["ph"].get<std::string>());
+    ASSERT_EQ("example.com/\"quoted\"", event["args"]["detail"].get<std::string>());
+    ASSERT_LE(0, event["dur"].get<double>());
+    ASSERT_LT(0, event["ts"].get<double>());
+  }
+  ASSERT_TRUE(found);
+}
+
+TEST(Trace, details_are_copied_and_bounded) {
+  tracer().clear();
+  std::thread writer{[]() {
+    std::string detail = "https://example.com/worker-1.0.0-linux-amd64.aci";
+    tracer().record("test.detail", detail.c_str(), trace_clock(), 0);
+    detail.assign(200, 'x');
+    tracer().record("test.detail", detail.c_str(), trace_clock(), 0);
+    // Overwritten after the span: the span kept its own copy.
+    detail.assign(200, 'y');
+  }};
+  writer.join();
+
+  std::set<std::string> details{};
+  for (const auto& event : events_named("test.detail")) details.insert(event.detail);
+  ASSERT_EQ(2u, details.size());
+  ASSERT_EQ(1u, details.count("https://example.com/worker-1.0.0-linux-amd64.aci"));
+  ASSERT_EQ(1u, details.count(std::string(detail::trace_detail_length, 'x')));
+}
+
+#ifndef APPC_TRACING
+TEST(Trace, spans_compile_out) {
+  tracer().clear();
+  APPC_TRACE_SPAN("test.disabled");
+  APPC_TRACE_SPAN_DETAIL("test.disabled", std::string("never copied"));
+  APPC_IF_TRACING(tracer().record("test.disabled", "", trace_clock(), 0);)
+  ASSERT_TRUE(events_named("test.disabled").empty());
+}
+#endif